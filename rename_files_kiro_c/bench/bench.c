@@ -0,0 +1,584 @@
+/**
+ * Benchmark Harness for the File Renaming Utility
+ *
+ * Builds the utility's own source with its main() compiled out and times the
+ * pattern matcher (directly and through the renamer.h batch API), the
+ * validator, the file reader and a full directory run
+ * over a corpus made by gen_corpus. Accepts the utility's options (--jobs,
+ * --mmap, --io-uring, ...), which apply to the file reader and the full run.
+ * Note: the full run renames files, so regenerate the corpus before each run.
+ */
+
+#define RENAME_FILES_NO_MAIN
+#include "../rename_files.c"
+
+#include <sys/resource.h>
+#include <time.h>
+
+// Constants
+#define BENCH_LOAD_LIMIT (256LL * 1024 * 1024)  // Bytes of content kept in memory for the matcher
+#define BENCH_REFERENCE_LIMIT (256 * 1024)      // Largest buffer checked against the reference matcher
+#define BENCH_VALIDATE_BATCH 256                // validate_rj_pattern calls per timed sample
+#define BENCH_SCAN_BATCH 256                    // Buffers per renamer_scan_buffers call
+
+// One .txt file of the corpus
+typedef struct {
+    int dir;                    // Index into BenchCorpus.dirs
+    char *name;
+    long long size;
+    char *content;              // NUL-terminated content, or NULL if not loaded
+} BenchFile;
+
+// Files and directories found under the corpus root
+typedef struct {
+    char **dirs;
+    int *dir_fds;
+    size_t dir_count;
+    size_t dir_capacity;
+    BenchFile *files;
+    size_t file_count;
+    size_t file_capacity;
+    long long total_bytes;
+} BenchCorpus;
+
+// Timings of one benchmark
+typedef struct {
+    const char *name;
+    size_t items;               // Files (or calls) processed
+    long long bytes;            // Bytes processed (0 if not meaningful)
+    double seconds;             // Total wall time
+    double *samples;            // Per-item latencies in seconds (may be NULL)
+    size_t sample_count;
+} BenchResult;
+
+/**
+ * Returns a monotonic timestamp in seconds
+ * @return Seconds since an arbitrary point
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the peak resident set size of the process so far
+ * @return Peak RSS in megabytes
+ */
+static double peak_rss_mb(void) {
+    struct rusage usage;
+    
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)usage.ru_maxrss / 1024.0;  // ru_maxrss is in KB on Linux
+}
+
+/**
+ * Orders doubles ascending for qsort
+ * @param a First value
+ * @param b Second value
+ * @return Negative, zero or positive as for qsort
+ */
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    
+    return (x > y) - (x < y);
+}
+
+/**
+ * Returns a percentile of sorted samples
+ * @param samples Sorted samples
+ * @param count Number of samples
+ * @param percentile Percentile in [0, 100]
+ * @return The sample at that percentile (0 if there are none)
+ */
+static double percentile(const double *samples, size_t count, double percentile) {
+    if (count == 0) {
+        return 0.0;
+    }
+    
+    size_t index = (size_t)(percentile / 100.0 * (double)(count - 1) + 0.5);
+    return samples[index];
+}
+
+/**
+ * Prints one result row and frees its samples
+ * @param result The result to report
+ */
+static void report(BenchResult *result) {
+    double seconds = result->seconds > 0 ? result->seconds : 1e-9;
+    
+    printf("%-20s %10zu %12.0f", result->name, result->items, (double)result->items / seconds);
+    
+    if (result->bytes > 0) {
+        printf(" %10.1f", (double)result->bytes / 1048576.0 / seconds);
+    } else {
+        printf(" %10s", "-");
+    }
+    
+    if (result->sample_count > 0) {
+        qsort(result->samples, result->sample_count, sizeof(double), compare_doubles);
+        printf(" %10.2f %10.2f",
+               percentile(result->samples, result->sample_count, 50) * 1e6,
+               percentile(result->samples, result->sample_count, 99) * 1e6);
+    } else {
+        printf(" %10s %10s", "-", "-");
+    }
+    
+    printf(" %10.1f\n", peak_rss_mb());
+    fflush(stdout);
+    
+    free(result->samples);
+    result->samples = NULL;
+}
+
+/**
+ * Recursively collects the .txt files under a directory
+ * @param corpus The corpus to fill
+ * @param path The directory to walk
+ * @return 0 on success, -1 on error
+ */
+static int collect_files(BenchCorpus *corpus, const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "Error: Cannot open directory '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    if (corpus->dir_count == corpus->dir_capacity) {
+        corpus->dir_capacity = corpus->dir_capacity ? corpus->dir_capacity * 2 : 64;
+        corpus->dirs = (char**)realloc(corpus->dirs, corpus->dir_capacity * sizeof(char*));
+        corpus->dir_fds = (int*)realloc(corpus->dir_fds, corpus->dir_capacity * sizeof(int));
+        if (corpus->dirs == NULL || corpus->dir_fds == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            closedir(dir);
+            return -1;
+        }
+    }
+    
+    int dir_index = (int)corpus->dir_count++;
+    corpus->dirs[dir_index] = strdup(path);
+    corpus->dir_fds[dir_index] = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    
+    struct dirent *entry;
+    int result = 0;
+    
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        
+        char child[4096];
+        struct stat st;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (lstat(child, &st) != 0) {
+            continue;
+        }
+        
+        if (S_ISDIR(st.st_mode)) {
+            result = collect_files(corpus, child);
+        } else if (S_ISREG(st.st_mode) && is_txt_file(entry->d_name)) {
+            if (corpus->file_count == corpus->file_capacity) {
+                corpus->file_capacity = corpus->file_capacity ? corpus->file_capacity * 2 : 1024;
+                corpus->files = (BenchFile*)realloc(corpus->files, corpus->file_capacity * sizeof(BenchFile));
+                if (corpus->files == NULL) {
+                    fprintf(stderr, "Error: Memory allocation failed\n");
+                    result = -1;
+                    break;
+                }
+            }
+            
+            BenchFile *file = &corpus->files[corpus->file_count++];
+            file->dir = dir_index;
+            file->name = strdup(entry->d_name);
+            file->size = (long long)st.st_size;
+            file->content = NULL;
+            corpus->total_bytes += file->size;
+        }
+    }
+    
+    closedir(dir);
+    return result;
+}
+
+/**
+ * Loads file contents into memory (NUL-terminated) up to BENCH_LOAD_LIMIT bytes
+ * @param corpus The corpus
+ * @return Number of bytes loaded
+ */
+static long long load_contents(BenchCorpus *corpus) {
+    long long loaded = 0;
+    
+    for (size_t i = 0; i < corpus->file_count && loaded < BENCH_LOAD_LIMIT; i++) {
+        BenchFile *file = &corpus->files[i];
+        int fd = openat(corpus->dir_fds[file->dir], file->name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        
+        file->content = (char*)malloc((size_t)file->size + 1);
+        if (file->content != NULL) {
+            ssize_t got = read(fd, file->content, (size_t)file->size);
+            file->content[got > 0 ? got : 0] = '\0';
+            loaded += file->size;
+        }
+        close(fd);
+    }
+    
+    return loaded;
+}
+
+// The built-in format compiled into a DFA, checked alongside the dedicated kernels
+static PatternSet g_dfa_reference;
+
+/**
+ * Runs the general DFA matcher on the built-in RJ format
+ * @param data The bytes to search
+ * @param length Number of bytes in data
+ * @return Pointer to the start of the first match, or NULL if there is none
+ */
+static const char *find_rj_pattern_dfa(const char *data, size_t length) {
+    size_t match_length = 0;
+    return find_pattern_dfa(&g_dfa_reference, data, length, &match_length);
+}
+
+/**
+ * Checks every available scanning kernel against extract_rj_pattern_reference
+ * @param corpus The corpus (contents loaded)
+ * @return Number of mismatches found
+ */
+static size_t check_kernels(const BenchCorpus *corpus) {
+    const char *(*kernels[4])(const char *data, size_t length);
+    const char *kernel_names[4];
+    size_t kernel_count = 0;
+    size_t mismatches = 0;
+    size_t checked = 0;
+    
+    kernels[kernel_count] = find_rj_pattern_scalar;
+    kernel_names[kernel_count++] = "scalar";
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("sse2")) {
+        kernels[kernel_count] = find_rj_pattern_sse2;
+        kernel_names[kernel_count++] = "sse2";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[kernel_count] = find_rj_pattern_avx2;
+        kernel_names[kernel_count++] = "avx2";
+    }
+#endif
+    if (pattern_set_add(&g_dfa_reference, DEFAULT_PATTERN_SPEC) == 0 &&
+        pattern_set_compile(&g_dfa_reference) == 0) {
+        kernels[kernel_count] = find_rj_pattern_dfa;
+        kernel_names[kernel_count++] = "dfa";
+    }
+
+    for (size_t i = 0; i < corpus->file_count; i++) {
+        const BenchFile *file = &corpus->files[i];
+        if (file->content == NULL || file->size > BENCH_REFERENCE_LIMIT) {
+            continue;
+        }
+        
+        char expected[RJ_PATTERN_LENGTH];
+        int found = extract_rj_pattern_reference(file->content, expected, sizeof(expected)) == 0;
+        size_t length = strlen(file->content);
+        checked++;
+        
+        for (size_t k = 0; k < kernel_count; k++) {
+            const char *match = kernels[k](file->content, length);
+            if ((match != NULL) != found ||
+                (match != NULL && memcmp(match, expected, RJ_PATTERN_LENGTH - 1) != 0)) {
+                fprintf(stderr, "Error: %s kernel disagrees with the reference on '%s/%s'\n",
+                        kernel_names[k], corpus->dirs[file->dir], file->name);
+                mismatches++;
+            }
+        }
+    }
+    
+    printf("Kernel check: %zu files, %zu kernels, %zu mismatches\n", checked, kernel_count, mismatches);
+    pattern_set_free(&g_dfa_reference);
+    return mismatches;
+}
+
+/**
+ * Times extract_rj_pattern on every loaded file
+ * @param corpus The corpus (contents loaded)
+ */
+static void bench_extract(const BenchCorpus *corpus) {
+    BenchResult result = { "extract_rj_pattern", 0, 0, 0.0, NULL, 0 };
+    char pattern[PATTERN_MAX_LENGTH];
+    
+    result.samples = (double*)malloc((corpus->file_count + 1) * sizeof(double));
+    double start = now_seconds();
+    
+    for (size_t i = 0; i < corpus->file_count; i++) {
+        const BenchFile *file = &corpus->files[i];
+        if (file->content == NULL) {
+            continue;
+        }
+        
+        double t0 = now_seconds();
+        extract_rj_pattern(file->content, pattern, sizeof(pattern));
+        double t1 = now_seconds();
+        
+        if (result.samples != NULL) {
+            result.samples[result.sample_count++] = t1 - t0;
+        }
+        result.items++;
+        result.bytes += file->size;
+    }
+    
+    result.seconds = now_seconds() - start;
+    report(&result);
+}
+
+/**
+ * Times the library's batch entry point, renamer_scan_buffers, on the loaded
+ * files in batches of BENCH_SCAN_BATCH. Latencies are per batch, divided by
+ * the batch size.
+ * @param corpus The corpus (contents loaded)
+ */
+static void bench_scan_batch(const BenchCorpus *corpus) {
+    BenchResult result = { "renamer_scan_buffers", 0, 0, 0.0, NULL, 0 };
+    RenamerBuffer buffers[BENCH_SCAN_BATCH];
+    RenamerMatch matches[BENCH_SCAN_BATCH];
+    RenamerConfig config;
+    
+    renamer_config_init(&config);
+    config.max_scan_bytes = g_options.max_scan_bytes;
+    RenamerContext *ctx = renamer_create(&config);
+    if (ctx == NULL) {
+        return;
+    }
+    
+    result.samples = (double*)malloc((corpus->file_count / BENCH_SCAN_BATCH + 1) * sizeof(double));
+    double start = now_seconds();
+    size_t i = 0;
+    
+    while (i < corpus->file_count) {
+        size_t count = 0;
+        for (; i < corpus->file_count && count < BENCH_SCAN_BATCH; i++) {
+            const BenchFile *file = &corpus->files[i];
+            if (file->content == NULL) {
+                continue;
+            }
+            buffers[count].data = file->content;
+            buffers[count].length = (size_t)file->size;
+            result.bytes += file->size;
+            count++;
+        }
+        if (count == 0) {
+            break;
+        }
+        
+        double t0 = now_seconds();
+        renamer_scan_buffers(ctx, buffers, count, matches);
+        double t1 = now_seconds();
+        
+        if (result.samples != NULL) {
+            result.samples[result.sample_count++] = (t1 - t0) / (double)count;
+        }
+        result.items += count;
+    }
+    
+    result.seconds = now_seconds() - start;
+    report(&result);
+    renamer_destroy(ctx);
+}
+
+/**
+ * Times validate_rj_pattern on every "RJ-" occurrence in the loaded files,
+ * in batches (a single call is too short to time on its own)
+ * @param corpus The corpus (contents loaded)
+ */
+static void bench_validate(const BenchCorpus *corpus) {
+    BenchResult result = { "validate_rj_pattern", 0, 0, 0.0, NULL, 0 };
+    const char **candidates = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    
+    for (size_t i = 0; i < corpus->file_count; i++) {
+        const char *p = corpus->files[i].content;
+        while (p != NULL && (p = strstr(p, "RJ-")) != NULL) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 4096;
+                const char **grown = (const char**)realloc(candidates, capacity * sizeof(char*));
+                if (grown == NULL) {
+                    free(candidates);
+                    return;
+                }
+                candidates = grown;
+            }
+            candidates[count++] = p++;
+        }
+    }
+    
+    result.samples = (double*)malloc((count / BENCH_VALIDATE_BATCH + 1) * sizeof(double));
+    volatile int valid = 0;
+    double start = now_seconds();
+    
+    for (size_t first = 0; first < count; first += BENCH_VALIDATE_BATCH) {
+        size_t last = first + BENCH_VALIDATE_BATCH < count ? first + BENCH_VALIDATE_BATCH : count;
+        
+        double t0 = now_seconds();
+        for (size_t i = first; i < last; i++) {
+            valid += validate_rj_pattern(candidates[i]);
+        }
+        double t1 = now_seconds();
+        
+        if (result.samples != NULL) {
+            result.samples[result.sample_count++] = (t1 - t0) / (double)(last - first);
+        }
+    }
+    
+    result.seconds = now_seconds() - start;
+    result.items = count;
+    report(&result);
+    free(candidates);
+}
+
+/**
+ * Times read_file_content on every file of the corpus
+ * @param corpus The corpus
+ */
+static void bench_read(const BenchCorpus *corpus) {
+    BenchResult result = { "read_file_content", 0, 0, 0.0, NULL, 0 };
+    char pattern[PATTERN_MAX_LENGTH];
+    
+    result.samples = (double*)malloc((corpus->file_count + 1) * sizeof(double));
+    double start = now_seconds();
+    
+    for (size_t i = 0; i < corpus->file_count; i++) {
+        const BenchFile *file = &corpus->files[i];
+        DirRef dir = { corpus->dirs[file->dir], corpus->dir_fds[file->dir], NULL };
+        
+        double t0 = now_seconds();
+        read_file_content(&dir, file->name, pattern, sizeof(pattern));
+        double t1 = now_seconds();
+        
+        if (result.samples != NULL) {
+            result.samples[result.sample_count++] = t1 - t0;
+        }
+        result.items++;
+        result.bytes += file->size;
+    }
+    
+    result.seconds = now_seconds() - start;
+    report(&result);
+}
+
+/**
+ * Times a full process_directory run over the corpus, with the per-file
+ * output discarded. With --cache the cache is loaded and saved inside the
+ * timed region, as in a real run. There is no per-file latency for this benchmark.
+ * @param corpus The corpus
+ * @param root The corpus root directory
+ * @return 0 on success, -1 if the run reported errors
+ */
+static int bench_process_directory(const BenchCorpus *corpus, const char *root) {
+    BenchResult result = { "process_directory", 0, 0, 0.0, NULL, 0 };
+    Statistics stats = {0, 0, 0, 0, 0};
+    
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (saved_stdout < 0 || null_fd < 0) {
+        fprintf(stderr, "Error: Cannot redirect output: %s\n", strerror(errno));
+        return -1;
+    }
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    
+    double start = now_seconds();
+    if (g_options.cache_path != NULL) {
+        cache_open(g_options.cache_path);
+    }
+    int process_result = process_directory(root, &stats);
+    if (g_options.cache_path != NULL) {
+        if (process_result == 0 && cache_save(g_options.cache_path) != 0) {
+            process_result = -1;
+        }
+        cache_close();
+    }
+    result.seconds = now_seconds() - start;
+    
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    
+    result.items = (size_t)stats.total_files;
+    result.bytes = corpus->total_bytes;
+    report(&result);
+    printf("Full run: %d renamed, %d skipped, %d errors\n",
+           stats.renamed_files, stats.skipped_files, stats.error_files);
+    
+    return (process_result == 0 && stats.error_files == 0) ? 0 : -1;
+}
+
+/**
+ * Main entry point for the benchmark harness
+ * @param argc Argument count
+ * @param argv Argument values (the utility's options and the corpus directory)
+ * @return 0 on success, non-zero if a check failed or an error occurred
+ */
+int main(int argc, char *argv[]) {
+    BenchCorpus corpus;
+    const char *root = NULL;
+    
+    select_pattern_scanner();
+    if (validate_arguments(argc, argv, &root) != 0) {
+        return 1;
+    }
+    if (g_options.use_mmap) {
+        install_mmap_fault_handler();
+    }
+    
+    memset(&corpus, 0, sizeof(corpus));
+    if (collect_files(&corpus, root) != 0) {
+        return 1;
+    }
+    
+    long long loaded = load_contents(&corpus);
+    printf("Corpus: %zu files, %zu directories, %.1f MB (%.1f MB loaded for the matcher)\n",
+           corpus.file_count, corpus.dir_count, (double)corpus.total_bytes / 1048576.0,
+           (double)loaded / 1048576.0);
+    printf("Scanner: %s, jobs: %d\n\n",
+           !g_patterns.builtin ? "dfa" :
+#ifdef HAVE_X86_SIMD
+           g_pattern_scanner == find_rj_pattern_avx2 ? "avx2" :
+           g_pattern_scanner == find_rj_pattern_sse2 ? "sse2" :
+#endif
+           "scalar", g_options.jobs);
+    
+    size_t mismatches = check_kernels(&corpus);
+    
+    printf("\n%-20s %10s %12s %10s %10s %10s %10s\n",
+           "benchmark", "items", "items/s", "MB/s", "p50 us", "p99 us", "peak MB");
+    bench_validate(&corpus);
+    bench_extract(&corpus);
+    bench_scan_batch(&corpus);
+    
+    // The in-memory copies would only inflate the peak RSS of the file benchmarks
+    for (size_t i = 0; i < corpus.file_count; i++) {
+        free(corpus.files[i].content);
+        corpus.files[i].content = NULL;
+    }
+    
+    bench_read(&corpus);
+    int run_result = bench_process_directory(&corpus, root);
+    
+    for (size_t i = 0; i < corpus.file_count; i++) {
+        free(corpus.files[i].name);
+    }
+    for (size_t i = 0; i < corpus.dir_count; i++) {
+        if (corpus.dir_fds[i] >= 0) {
+            close(corpus.dir_fds[i]);
+        }
+        free(corpus.dirs[i]);
+    }
+    free(corpus.files);
+    free(corpus.dirs);
+    free(corpus.dir_fds);
+    
+    return (mismatches == 0 && run_result == 0) ? 0 : 1;
+}
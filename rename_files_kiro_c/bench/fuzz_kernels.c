@@ -0,0 +1,356 @@
+/**
+ * Differential Fuzz Test for the pattern scanning kernels
+ *
+ * Builds the utility's own source with its main() compiled out and feeds
+ * seeded random buffers to every scanning kernel the CPU supports (scalar,
+ * SSE2, AVX2 and the general DFA) and to the UTF-16 path through each
+ * narrower, checking every answer against extract_rj_pattern_reference.
+ * Buffers are dense in "RJ-" candidates, place IDs across the 16- and 32-byte
+ * block edges and cut them off at the buffer end, and contain NUL bytes.
+ * Each buffer ends right at a guard page, so a kernel that reads past its
+ * length faults instead of passing by luck.
+ * Usage: fuzz_kernels [--seed N] [--iterations N]
+ */
+
+#define RENAME_FILES_NO_MAIN
+#include "../rename_files.c"
+
+#include <sys/mman.h>
+
+// Constants
+#define FUZZ_DEFAULT_ITERATIONS 200000
+#define FUZZ_SHORT_LENGTH 200           // Most buffers: a few 16/32-byte blocks plus a tail
+#define FUZZ_LONG_LENGTH 10000          // Some buffers: long enough to cross UTF-16 windows
+#define FUZZ_MAX_KERNELS 4
+#define FUZZ_REPORT_LIMIT 10            // Mismatches printed in full; the rest are only counted
+
+// One scanning kernel under test
+typedef struct {
+    const char *name;
+    const char *(*scan)(const char *data, size_t length);
+} FuzzKernel;
+
+// Fuzzer state
+typedef struct {
+    unsigned long long rng;
+    char *region;                       // Pages followed by a PROT_NONE guard page
+    size_t region_size;                 // Bytes before the guard page
+    char *reference;                    // NUL-terminated copy for the reference matcher
+    FuzzKernel kernels[FUZZ_MAX_KERNELS];
+    size_t kernel_count;
+    PatternSet dfa;                     // The built-in format as a DFA
+    size_t mismatches;
+} FuzzState;
+
+/**
+ * Returns the next value of a xorshift64* generator
+ * @param state The fuzzer state
+ * @return A pseudo-random 64-bit value
+ */
+static unsigned long long fuzz_next(FuzzState *state) {
+    state->rng ^= state->rng >> 12;
+    state->rng ^= state->rng << 25;
+    state->rng ^= state->rng >> 27;
+    return state->rng * 2685821657736338717ULL;
+}
+
+/**
+ * Returns a pseudo-random value below bound
+ * @param state The fuzzer state
+ * @param bound Exclusive upper limit (must be non-zero)
+ * @return A value in [0, bound)
+ */
+static size_t fuzz_below(FuzzState *state, size_t bound) {
+    return (size_t)(fuzz_next(state) % bound);
+}
+
+// The built-in format compiled into a DFA, set up by main
+static PatternSet *g_fuzz_dfa;
+
+/**
+ * Runs the general DFA matcher on the built-in RJ format
+ * @param data The bytes to search
+ * @param length Number of bytes in data
+ * @return Pointer to the start of the first match, or NULL if there is none
+ */
+static const char *find_rj_pattern_dfa(const char *data, size_t length) {
+    size_t match_length = 0;
+    return find_pattern_dfa(g_fuzz_dfa, data, length, &match_length);
+}
+
+/**
+ * Finds the first valid ID with extract_rj_pattern_reference. The reference
+ * stops at a NUL byte, so it is run on each NUL-separated piece in turn;
+ * an ID never contains a NUL, so this is the answer for the whole buffer.
+ * @param state The fuzzer state
+ * @param data The bytes to search
+ * @param length Number of bytes in data
+ * @return Offset of the first valid ID, or -1 if there is none
+ */
+static long reference_offset(FuzzState *state, const char *data, size_t length) {
+    char found[RJ_PATTERN_LENGTH];
+    
+    memcpy(state->reference, data, length);
+    state->reference[length] = '\0';
+    
+    for (size_t start = 0; start < length; start += strlen(state->reference + start) + 1) {
+        const char *piece = state->reference + start;
+        if (extract_rj_pattern_reference(piece, found, sizeof(found)) == 0) {
+            // An earlier copy of the same text would have been found first
+            return (long)(strstr(piece, found) - state->reference);
+        }
+    }
+    
+    return -1;
+}
+
+/**
+ * Writes a random valid ID
+ * @param state The fuzzer state
+ * @param output Receives RJ_PATTERN_LENGTH - 1 bytes (no terminator)
+ */
+static void random_id(FuzzState *state, char *output) {
+    char id[RJ_PATTERN_LENGTH];
+    
+    snprintf(id, sizeof(id), "RJ-%04u-%05u", (unsigned)fuzz_below(state, 10000),
+             (unsigned)fuzz_below(state, 100000));
+    memcpy(output, id, RJ_PATTERN_LENGTH - 1);
+}
+
+/**
+ * Fills a buffer with candidate-dense noise and plants IDs in it: across
+ * 16-byte block edges (which covers 32-byte ones), cut off by the buffer
+ * end, or anywhere. Some planted IDs get one character changed so they
+ * become near misses.
+ * @param state The fuzzer state
+ * @param data Receives length bytes
+ * @param length Buffer length
+ */
+static void fill_buffer(FuzzState *state, char *data, size_t length) {
+    static const char dense[] = "RRRJJJ---0123456789";
+    const size_t id_length = RJ_PATTERN_LENGTH - 1;
+    size_t noise = fuzz_below(state, 4);
+    
+    for (size_t i = 0; i < length; i++) {
+        size_t roll = fuzz_below(state, 100);
+        if (roll < 4) {
+            data[i] = '\0';
+        } else if (roll < 4 + noise * 10) {
+            data[i] = (char)fuzz_below(state, 256);
+        } else {
+            data[i] = dense[fuzz_below(state, sizeof(dense) - 1)];
+        }
+    }
+    
+    size_t plants = fuzz_below(state, 4);
+    for (size_t p = 0; p < plants && length > 0; p++) {
+        char id[RJ_PATTERN_LENGTH];
+        size_t offset;
+        size_t place = fuzz_below(state, 3);
+        random_id(state, id);
+        
+        if (place == 0) {
+            size_t edge = 16 * fuzz_below(state, length / 16 + 1);
+            size_t before = fuzz_below(state, id_length);
+            offset = edge >= before ? edge - before : 0;
+        } else if (place == 1) {
+            offset = length - 1 - fuzz_below(state, length < id_length ? length : id_length);
+        } else {
+            offset = fuzz_below(state, length);
+        }
+        if (offset >= length) {
+            offset = length - 1;
+        }
+        
+        if (fuzz_below(state, 4) == 0) {
+            id[fuzz_below(state, id_length)] = dense[fuzz_below(state, sizeof(dense) - 1)];
+        }
+        size_t copy = length - offset < id_length ? length - offset : id_length;
+        memcpy(data + offset, id, copy);
+    }
+}
+
+/**
+ * Reports one disagreement with the reference
+ * @param state The fuzzer state
+ * @param iteration The iteration that produced the buffer
+ * @param what Kernel (and path) that disagreed
+ * @param length Buffer length in bytes
+ * @param expected Offset the reference found, or -1
+ * @param actual Offset the kernel found, or -1
+ */
+static void report_mismatch(FuzzState *state, size_t iteration, const char *what, size_t length,
+                            long expected, long actual) {
+    if (state->mismatches++ < FUZZ_REPORT_LIMIT) {
+        fprintf(stderr, "Error: %s disagrees with the reference at iteration %zu (length %zu): "
+                "expected offset %ld, got %ld\n", what, iteration, length, expected, actual);
+    }
+}
+
+/**
+ * Checks every kernel on one narrow buffer
+ * @param state The fuzzer state
+ * @param iteration Current iteration, for reports
+ * @param data The buffer (ends at the guard page)
+ * @param length Buffer length
+ */
+static void check_narrow(FuzzState *state, size_t iteration, const char *data, size_t length) {
+    long expected = reference_offset(state, data, length);
+    
+    for (size_t k = 0; k < state->kernel_count; k++) {
+        const char *match = state->kernels[k].scan(data, length);
+        long actual = match != NULL ? (long)(match - data) : -1;
+        if (actual != expected) {
+            report_mismatch(state, iteration, state->kernels[k].name, length, expected, actual);
+        }
+    }
+}
+
+/**
+ * Checks the UTF-16 path on one buffer: the narrow buffer is widened with
+ * random non-ASCII code units mixed in (some with an ASCII low byte, which
+ * must not match), then scanned through every narrower and every kernel.
+ * @param state The fuzzer state
+ * @param iteration Current iteration, for reports
+ * @param narrow The narrow buffer to widen
+ * @param units Number of code units
+ */
+static void check_utf16(FuzzState *state, size_t iteration, const char *narrow, size_t units) {
+    static void (*const narrowers[])(const char *, size_t, int, char *) = {
+        narrow_utf16_scalar,
+#ifdef HAVE_X86_SIMD
+        narrow_utf16_sse2,
+#endif
+    };
+    static const char *const narrower_names[] = {
+        "scalar",
+#ifdef HAVE_X86_SIMD
+        "sse2",
+#endif
+    };
+    const size_t narrower_count = sizeof(narrowers) / sizeof(narrowers[0]);
+    int big_endian = (int)fuzz_below(state, 2);
+    char *wide = state->region + state->region_size - units * 2;
+    char *expected_bytes = (char*)malloc(units + 1);
+    
+    if (expected_bytes == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    
+    for (size_t i = 0; i < units; i++) {
+        unsigned value = (unsigned char)narrow[i];
+        if (fuzz_below(state, 16) == 0) {
+            value |= (unsigned)(1 + fuzz_below(state, 255)) << 8;
+        }
+        wide[i * 2 + (big_endian ? 0 : 1)] = (char)(value >> 8);
+        wide[i * 2 + (big_endian ? 1 : 0)] = (char)(value & 0xFF);
+        expected_bytes[i] = value < 0x80 ? (char)value : '\0';
+    }
+    long expected = reference_offset(state, expected_bytes, units);
+    free(expected_bytes);
+    
+    PatternSet dfa_only = state->dfa;
+    dfa_only.builtin = 0;
+    
+    for (size_t n = 0; n < narrower_count; n++) {
+        g_utf16_narrower = narrowers[n];
+        
+        for (size_t k = 0; k <= state->kernel_count; k++) {
+            char what[64];
+            size_t match_length = 0;
+            const char *match;
+            
+            if (k < state->kernel_count && state->kernels[k].scan != find_rj_pattern_dfa) {
+                g_pattern_scanner = state->kernels[k].scan;
+                match = find_pattern_utf16(&state->dfa, wide, units * 2, big_endian, &match_length);
+                snprintf(what, sizeof(what), "utf16 (%s narrower, %s)", narrower_names[n],
+                         state->kernels[k].name);
+            } else if (k == state->kernel_count) {
+                match = find_pattern_utf16(&dfa_only, wide, units * 2, big_endian, &match_length);
+                snprintf(what, sizeof(what), "utf16 (%s narrower, dfa)", narrower_names[n]);
+            } else {
+                continue;
+            }
+            
+            long actual = match != NULL ? (long)(match - wide) / 2 : -1;
+            if (actual != expected) {
+                report_mismatch(state, iteration, what, units * 2, expected, actual);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    FuzzState state;
+    unsigned long long seed = 1;
+    size_t iterations = FUZZ_DEFAULT_ITERATIONS;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = (size_t)strtoull(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [--seed N] [--iterations N]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    memset(&state, 0, sizeof(state));
+    state.rng = seed ? seed : 1;
+    
+    long page = sysconf(_SC_PAGESIZE);
+    state.region_size = ((FUZZ_LONG_LENGTH * 2 + (size_t)page - 1) / (size_t)page) * (size_t)page;
+    state.region = (char*)mmap(NULL, state.region_size + (size_t)page, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    state.reference = (char*)malloc(FUZZ_LONG_LENGTH + 1);
+    if (state.region == MAP_FAILED || state.reference == NULL ||
+        mprotect(state.region + state.region_size, (size_t)page, PROT_NONE) != 0) {
+        fprintf(stderr, "Error: Cannot set up the fuzz buffers\n");
+        return 1;
+    }
+    
+    state.kernels[state.kernel_count++] = (FuzzKernel){ "scalar", find_rj_pattern_scalar };
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        state.kernels[state.kernel_count++] = (FuzzKernel){ "sse2", find_rj_pattern_sse2 };
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        state.kernels[state.kernel_count++] = (FuzzKernel){ "avx2", find_rj_pattern_avx2 };
+    }
+#endif
+    if (pattern_set_add(&state.dfa, DEFAULT_PATTERN_SPEC) != 0 || pattern_set_compile(&state.dfa) != 0) {
+        fprintf(stderr, "Error: Cannot compile the built-in format\n");
+        return 1;
+    }
+    g_fuzz_dfa = &state.dfa;
+    state.kernels[state.kernel_count++] = (FuzzKernel){ "dfa", find_rj_pattern_dfa };
+    
+    for (size_t iteration = 0; iteration < iterations; iteration++) {
+        size_t length = fuzz_below(&state, 64) == 0 ? fuzz_below(&state, FUZZ_LONG_LENGTH + 1) :
+                        fuzz_below(&state, FUZZ_SHORT_LENGTH + 1);
+        char *data = state.region + state.region_size - length;
+        
+        fill_buffer(&state, data, length);
+        check_narrow(&state, iteration, data, length);
+        
+        // Widening reuses the region, so keep a copy of the narrow buffer
+        char *narrow = (char*)malloc(length + 1);
+        if (narrow == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        memcpy(narrow, data, length);
+        check_utf16(&state, iteration, narrow, length);
+        free(narrow);
+    }
+    
+    printf("Kernel fuzz: seed %llu, %zu buffers, %zu kernels, %zu mismatches\n",
+           seed, iterations, state.kernel_count, state.mismatches);
+    pattern_set_free(&state.dfa);
+    free(state.reference);
+    munmap(state.region, state.region_size + (size_t)page);
+    return state.mismatches != 0 ? 1 : 0;
+}
@@ -0,0 +1,465 @@
+/**
+ * Synthetic Corpus Generator for the File Renaming Utility benchmarks
+ *
+ * Builds a directory tree of .txt files with controllable size distribution,
+ * tree shape, pattern placement, false-positive density and duplicate-ID
+ * ratio. Output is fully determined by the options and the seed, so numbers
+ * from different builds are measured on identical input.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Constants
+#define MAX_PATH_LENGTH 4096
+#define PATTERN_LENGTH 13  // "RJ-YYYY-NNNNN"
+#define MAX_FILES 100000000L             // Largest --files
+#define MAX_FILE_SIZE (1L << 30)         // Largest --min-size / --max-size (one buffer of it is allocated)
+#define MAX_DEPTH 64                     // Largest --depth
+#define MAX_DIRECTORIES 1000000L         // Largest tree --depth and --fanout may describe
+#define MAX_FALSE_POSITIVES 1000.0       // Largest --false-positives (per KB)
+
+// Generator settings, filled from the command line
+typedef struct {
+    const char *root;
+    long files;                 // Number of .txt files to create
+    long min_size;              // Smallest file in bytes
+    long max_size;              // Largest file in bytes
+    int log_sizes;              // Log-uniform sizes (many small, few large) instead of uniform
+    int depth;                  // Levels of subdirectories below the root
+    int fanout;                 // Subdirectories per directory
+    double pattern_position;    // Where the pattern sits (0 = start, 1 = end, <0 = random)
+    double no_pattern_ratio;    // Fraction of files without any valid pattern
+    double false_positives;     // Near-miss "RJ-" sequences per KB of content
+    double duplicate_ratio;     // Fraction of files reusing an ID already handed out
+    unsigned long long seed;
+} CorpusOptions;
+
+// Generator state
+typedef struct {
+    unsigned long long rng;
+    char **dirs;                // Every directory in the tree, root first
+    long dir_count;
+    long *ids;                  // IDs handed out so far, for duplicates
+    long id_count;
+    long long total_bytes;
+} Corpus;
+
+/**
+ * Returns the next value of a xorshift64* generator
+ * @param corpus The generator state
+ * @return A pseudo-random 64-bit value
+ */
+static unsigned long long next_random(Corpus *corpus) {
+    corpus->rng ^= corpus->rng >> 12;
+    corpus->rng ^= corpus->rng << 25;
+    corpus->rng ^= corpus->rng >> 27;
+    return corpus->rng * 2685821657736338717ULL;
+}
+
+/**
+ * Returns a pseudo-random double in [0, 1)
+ * @param corpus The generator state
+ * @return The random value
+ */
+static double next_unit(Corpus *corpus) {
+    return (double)(next_random(corpus) >> 11) / 9007199254740992.0;
+}
+
+/**
+ * Creates the directory tree breadth-first and records every directory
+ * @param options Generator settings
+ * @param corpus Generator state
+ * @return 0 on success, -1 on error
+ */
+static int build_tree(const CorpusOptions *options, Corpus *corpus) {
+    long capacity = 1;
+    long level_size = 1;
+    
+    for (int level = 0; level < options->depth; level++) {
+        level_size *= options->fanout;
+        capacity += level_size;
+    }
+    
+    corpus->dirs = (char**)calloc((size_t)capacity, sizeof(char*));
+    if (corpus->dirs == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for %ld directories\n", capacity);
+        return -1;
+    }
+    
+    if (mkdir(options->root, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Cannot create directory '%s': %s\n", options->root, strerror(errno));
+        return -1;
+    }
+    corpus->dirs[corpus->dir_count++] = strdup(options->root);
+    
+    long level_start = 0;
+    for (int level = 0; level < options->depth; level++) {
+        long level_end = corpus->dir_count;
+        
+        for (long parent = level_start; parent < level_end; parent++) {
+            for (int child = 0; child < options->fanout; child++) {
+                char path[MAX_PATH_LENGTH];
+                snprintf(path, sizeof(path), "%s/d%d", corpus->dirs[parent], child);
+                
+                if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                    fprintf(stderr, "Error: Cannot create directory '%s': %s\n", path, strerror(errno));
+                    return -1;
+                }
+                corpus->dirs[corpus->dir_count++] = strdup(path);
+            }
+        }
+        level_start = level_end;
+    }
+    
+    return 0;
+}
+
+/**
+ * Picks a file size from the configured distribution
+ * @param options Generator settings
+ * @param corpus Generator state
+ * @return The size in bytes
+ */
+static long pick_size(const CorpusOptions *options, Corpus *corpus) {
+    if (options->max_size <= options->min_size) {
+        return options->min_size;
+    }
+    
+    if (options->log_sizes) {
+        double low = log((double)(options->min_size > 0 ? options->min_size : 1));
+        double high = log((double)options->max_size);
+        return (long)exp(low + (high - low) * next_unit(corpus));
+    }
+    
+    return options->min_size + (long)(next_unit(corpus) * (double)(options->max_size - options->min_size + 1));
+}
+
+/**
+ * Picks the ID for a file, reusing an earlier one at the duplicate ratio
+ * @param options Generator settings
+ * @param corpus Generator state
+ * @return The ID as year * 100000 + number
+ */
+static long pick_id(const CorpusOptions *options, Corpus *corpus) {
+    if (corpus->id_count > 0 && next_unit(corpus) < options->duplicate_ratio) {
+        return corpus->ids[next_random(corpus) % (unsigned long long)corpus->id_count];
+    }
+    
+    long id = (long)(2000 + next_random(corpus) % 30) * 100000 + (long)(next_random(corpus) % 100000);
+    corpus->ids[corpus->id_count++] = id;
+    return id;
+}
+
+/**
+ * Writes a near-miss "RJ-" sequence that must not match
+ * @param corpus Generator state
+ * @param output Buffer with at least PATTERN_LENGTH bytes free
+ * @return Number of bytes written
+ */
+static int write_false_positive(Corpus *corpus, char *output) {
+    static const char *const near_misses[] = {
+        "RJ-20", "RJ-ABCD-12345", "RJ-2024-1234", "RJ-2024_12345", "RJ-202-12345", "rj-2024-12345"
+    };
+    const char *text = near_misses[next_random(corpus) % (sizeof(near_misses) / sizeof(near_misses[0]))];
+    int length = (int)strlen(text);
+    
+    memcpy(output, text, (size_t)length);
+    return length;
+}
+
+/**
+ * Generates one file's content and writes it
+ * @param options Generator settings
+ * @param corpus Generator state
+ * @param index The file number
+ * @param buffer Scratch buffer of at least max_size + PATTERN_LENGTH bytes
+ * @return 0 on success, -1 on error
+ */
+static int write_file(const CorpusOptions *options, Corpus *corpus, long index, char *buffer) {
+    static const char filler[] = "lorem ipsum dolor sit amet consectetur adipiscing elit sed do\n";
+    long size = pick_size(options, corpus);
+    
+    // Filler text with false positives sprinkled in at the configured density
+    double fp_chance = options->false_positives / 1024.0 * (double)(sizeof(filler) - 1);
+    long pos = 0;
+    while (pos < size) {
+        if (next_unit(corpus) < fp_chance && pos + PATTERN_LENGTH + 1 <= size) {
+            pos += write_false_positive(corpus, buffer + pos);
+            buffer[pos++] = ' ';
+            continue;
+        }
+        
+        long chunk = (long)sizeof(filler) - 1;
+        if (chunk > size - pos) {
+            chunk = size - pos;
+        }
+        memcpy(buffer + pos, filler, (size_t)chunk);
+        pos += chunk;
+    }
+    
+    // The valid pattern overwrites filler at the chosen position
+    if (next_unit(corpus) >= options->no_pattern_ratio && size >= PATTERN_LENGTH) {
+        double where = options->pattern_position < 0 ? next_unit(corpus) : options->pattern_position;
+        long offset = (long)(where * (double)(size - PATTERN_LENGTH));
+        long id = pick_id(options, corpus);
+        char pattern[PATTERN_LENGTH + 1];
+        
+        // IDs are below 10^9; the modulo bounds the year for the compiler's benefit
+        snprintf(pattern, sizeof(pattern), "RJ-%04lu-%05lu", (unsigned long)id / 100000 % 10000,
+                 (unsigned long)id % 100000);
+        memcpy(buffer + offset, pattern, PATTERN_LENGTH);
+    }
+    
+    char path[MAX_PATH_LENGTH];
+    const char *dir = corpus->dirs[next_random(corpus) % (unsigned long long)corpus->dir_count];
+    snprintf(path, sizeof(path), "%s/file%07ld.txt", dir, index);
+    
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Cannot create file '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    if (fwrite(buffer, 1, (size_t)size, fp) != (size_t)size) {
+        fprintf(stderr, "Error: Cannot write file '%s': %s\n", path, strerror(errno));
+        fclose(fp);
+        return -1;
+    }
+    
+    fclose(fp);
+    corpus->total_bytes += size;
+    return 0;
+}
+
+/**
+ * Prints usage information
+ * @param program The program name
+ */
+static void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] <output_directory>\n", program);
+    fprintf(stderr, "\nOptions:\n");
+    fprintf(stderr, "  --files N                 Number of .txt files (default 10000)\n");
+    fprintf(stderr, "  --min-size BYTES          Smallest file size (default 256)\n");
+    fprintf(stderr, "  --max-size BYTES          Largest file size (default 65536)\n");
+    fprintf(stderr, "  --size-dist uniform|log   Size distribution (default log)\n");
+    fprintf(stderr, "  --depth N                 Directory levels below the root (default 3)\n");
+    fprintf(stderr, "  --fanout N                Subdirectories per directory (default 4)\n");
+    fprintf(stderr, "  --pattern-pos F|random    Pattern position as a fraction of the file (default random)\n");
+    fprintf(stderr, "  --no-pattern-ratio F      Fraction of files without a pattern (default 0.2)\n");
+    fprintf(stderr, "  --false-positives F       Near-miss \"RJ-\" sequences per KB (default 0.5)\n");
+    fprintf(stderr, "  --dup-ratio F             Fraction of files reusing an existing ID (default 0.1)\n");
+    fprintf(stderr, "  --seed N                  Random seed (default 1)\n");
+    fprintf(stderr, "  -h, --help                Show this help message\n");
+}
+
+/**
+ * Parses an integer option value
+ * @param arg The option name, for messages
+ * @param value The text to parse
+ * @param min Smallest accepted value
+ * @param max Largest accepted value
+ * @param output Receives the value
+ * @return 0 if valid, -1 otherwise (already reported)
+ */
+static int parse_long_option(const char *arg, const char *value, long min, long max, long *output) {
+    char *end;
+    errno = 0;
+    long parsed = strtol(value, &end, 10);
+    
+    if (end == value || *end != '\0' || errno != 0 || parsed < min || parsed > max) {
+        fprintf(stderr, "Error: %s needs a whole number from %ld to %ld, not '%s'\n", arg, min, max, value);
+        return -1;
+    }
+    
+    *output = parsed;
+    return 0;
+}
+
+/**
+ * Parses a decimal option value
+ * @param arg The option name, for messages
+ * @param value The text to parse
+ * @param min Smallest accepted value
+ * @param max Largest accepted value
+ * @param output Receives the value
+ * @return 0 if valid, -1 otherwise (already reported)
+ */
+static int parse_double_option(const char *arg, const char *value, double min, double max, double *output) {
+    char *end;
+    errno = 0;
+    double parsed = strtod(value, &end);
+    
+    // Written so that NaN fails too
+    if (end == value || *end != '\0' || errno != 0 || !(parsed >= min && parsed <= max)) {
+        fprintf(stderr, "Error: %s needs a number from %g to %g, not '%s'\n", arg, min, max, value);
+        return -1;
+    }
+    
+    *output = parsed;
+    return 0;
+}
+
+/**
+ * Parses command-line arguments
+ * @param argc Argument count
+ * @param argv Argument values
+ * @param options Receives the settings
+ * @return 0 if valid, 1 if help was asked for, -1 otherwise
+ */
+static int parse_arguments(int argc, char *argv[], CorpusOptions *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        long number = 0;
+        int status = 0;
+        
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            return 1;
+        }
+        
+        if (arg[0] != '-') {
+            if (options->root != NULL) {
+                fprintf(stderr, "Error: Invalid number of arguments\n");
+                return -1;
+            }
+            options->root = arg;
+            continue;
+        }
+        
+        if (value == NULL) {
+            fprintf(stderr, "Error: Option %s requires a value\n", arg);
+            return -1;
+        }
+        i++;
+        
+        if (strcmp(arg, "--files") == 0) {
+            status = parse_long_option(arg, value, 0, MAX_FILES, &options->files);
+        } else if (strcmp(arg, "--min-size") == 0) {
+            status = parse_long_option(arg, value, 0, MAX_FILE_SIZE, &options->min_size);
+        } else if (strcmp(arg, "--max-size") == 0) {
+            status = parse_long_option(arg, value, 0, MAX_FILE_SIZE, &options->max_size);
+        } else if (strcmp(arg, "--size-dist") == 0) {
+            options->log_sizes = strcmp(value, "log") == 0;
+            if (!options->log_sizes && strcmp(value, "uniform") != 0) {
+                fprintf(stderr, "Error: Invalid size distribution '%s'\n", value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--depth") == 0) {
+            status = parse_long_option(arg, value, 0, MAX_DEPTH, &number);
+            options->depth = (int)number;
+        } else if (strcmp(arg, "--fanout") == 0) {
+            status = parse_long_option(arg, value, 1, MAX_DIRECTORIES, &number);
+            options->fanout = (int)number;
+        } else if (strcmp(arg, "--pattern-pos") == 0) {
+            if (strcmp(value, "random") == 0) {
+                options->pattern_position = -1.0;
+            } else {
+                status = parse_double_option(arg, value, 0.0, 1.0, &options->pattern_position);
+            }
+        } else if (strcmp(arg, "--no-pattern-ratio") == 0) {
+            status = parse_double_option(arg, value, 0.0, 1.0, &options->no_pattern_ratio);
+        } else if (strcmp(arg, "--false-positives") == 0) {
+            status = parse_double_option(arg, value, 0.0, MAX_FALSE_POSITIVES, &options->false_positives);
+        } else if (strcmp(arg, "--dup-ratio") == 0) {
+            status = parse_double_option(arg, value, 0.0, 1.0, &options->duplicate_ratio);
+        } else if (strcmp(arg, "--seed") == 0) {
+            char *end;
+            errno = 0;
+            options->seed = strtoull(value, &end, 10);
+            if (end == value || *end != '\0' || errno != 0 || value[0] == '-') {
+                fprintf(stderr, "Error: %s needs a non-negative whole number, not '%s'\n", arg, value);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", arg);
+            return -1;
+        }
+        
+        if (status != 0) {
+            return -1;
+        }
+    }
+    
+    if (options->root == NULL) {
+        fprintf(stderr, "Error: No output directory given\n");
+        return -1;
+    }
+    if (options->max_size < options->min_size) {
+        fprintf(stderr, "Error: --max-size (%ld) is smaller than --min-size (%ld)\n",
+                options->max_size, options->min_size);
+        return -1;
+    }
+    
+    // build_tree creates every directory of the tree up front
+    long directories = 1;
+    long level_size = 1;
+    for (int level = 0; level < options->depth; level++) {
+        level_size *= options->fanout;
+        directories += level_size;
+        if (level_size > MAX_DIRECTORIES || directories > MAX_DIRECTORIES) {
+            fprintf(stderr, "Error: --depth %d with --fanout %d makes more than %ld directories\n",
+                    options->depth, options->fanout, MAX_DIRECTORIES);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Main entry point for the corpus generator
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return 0 on success, non-zero on error
+ */
+int main(int argc, char *argv[]) {
+    CorpusOptions options = { NULL, 10000, 256, 65536, 1, 3, 4, -1.0, 0.2, 0.5, 0.1, 1 };
+    Corpus corpus;
+    int result = 1;
+    
+    int parsed = parse_arguments(argc, argv, &options);
+    if (parsed != 0) {
+        print_usage(argv[0]);
+        return parsed > 0 ? 0 : 1;
+    }
+    
+    memset(&corpus, 0, sizeof(corpus));
+    corpus.rng = options.seed ? options.seed : 1;
+    corpus.ids = (long*)malloc((size_t)(options.files + 1) * sizeof(long));
+    char *buffer = (char*)malloc((size_t)options.max_size + PATTERN_LENGTH + 1);
+    
+    if (corpus.ids == NULL || buffer == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        goto cleanup;
+    }
+    
+    if (build_tree(&options, &corpus) != 0) {
+        goto cleanup;
+    }
+    
+    for (long i = 0; i < options.files; i++) {
+        if (write_file(&options, &corpus, i, buffer) != 0) {
+            goto cleanup;
+        }
+    }
+    
+    printf("Corpus: %ld files, %ld directories, %.1f MB in %s\n",
+           options.files, corpus.dir_count, (double)corpus.total_bytes / 1048576.0, options.root);
+    result = 0;
+
+cleanup:
+    for (long i = 0; i < corpus.dir_count; i++) {
+        free(corpus.dirs[i]);
+    }
+    free(corpus.dirs);
+    free(corpus.ids);
+    free(buffer);
+    return result;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Runs the utility over a copy of testing/ once per scanning mode and compares
+# the names left behind with the expected ones (POSIX only, used by make check).
+# Usage: ci/check_testing.sh ./rename_files
+set -u
+
+binary=$1
+testing=$(dirname "$0")/../testing
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT INT TERM
+
+# The lone _N names move to their free base names, whether the ID sits in the
+# first 4 KB (RJ-2024-12345_1.txt) or past it (RJ-2024-55555_1.txt)
+expected='./RJ-2023-98765.txt
+./RJ-2024-11111.txt
+./RJ-2024-12345.txt
+./RJ-2024-55555.txt
+./empty_file.txt
+./invalid_number.txt
+./invalid_pattern.txt
+./invalid_year.txt
+./no_pattern.txt
+./subfolder/RJ-2024-77777.txt
+./subfolder/deep_nested/RJ-2024-99999.txt
+./subfolder/nested_no_pattern.txt
+./test_invalid_rj.txt
+./test_no_rj.txt'
+
+failures=0
+for mode in "" "--jobs 4" "--mmap" "--io-uring" "--trust-names" "--cache $work/cache"; do
+    rm -rf "$work/tree" "$work/cache"
+    cp -R "$testing" "$work/tree"
+
+    # $mode is split into separate options on purpose
+    if ! "$binary" $mode "$work/tree" > "$work/output" 2>&1; then
+        echo "Error: '$binary $mode' failed:"
+        cat "$work/output"
+        failures=$((failures + 1))
+        continue
+    fi
+
+    actual=$(cd "$work/tree" && find . -type f -name '*.txt' | LC_ALL=C sort)
+    if [ "$actual" != "$expected" ]; then
+        echo "Error: unexpected names after '$binary $mode':"
+        echo "$actual"
+        failures=$((failures + 1))
+    fi
+done
+
+echo "Testing tree check: $failures failing modes"
+[ "$failures" -eq 0 ]
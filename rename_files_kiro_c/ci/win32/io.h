@@ -0,0 +1,15 @@
+/*
+ * Stand-in for the CRT's <io.h> (see windows.h in this directory)
+ */
+
+#ifndef WIN32_STUB_IO_H
+#define WIN32_STUB_IO_H
+
+#define _O_RDONLY 0x0000
+#define _O_BINARY 0x8000
+
+int _open(const char *path, int flags, ...);
+int _read(int fd, void *buffer, unsigned int count);
+int _close(int fd);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Stand-in for <windows.h>, declaring only what rename_files.c uses, so that
+ * its Windows code path can be compiled for checking on a POSIX host
+ * (make check-windows). Not for building a working executable.
+ */
+
+#ifndef WIN32_STUB_WINDOWS_H
+#define WIN32_STUB_WINDOWS_H
+
+#include <stdint.h>
+
+typedef void *HANDLE;
+typedef unsigned long DWORD;
+typedef int BOOL;
+
+typedef struct {
+    DWORD dwFileAttributes;
+    char cFileName[260];
+} WIN32_FIND_DATAA;
+
+typedef union {
+    long long QuadPart;
+} LARGE_INTEGER;
+
+#define INVALID_HANDLE_VALUE ((HANDLE)-1)
+#define INVALID_FILE_ATTRIBUTES ((DWORD)-1)
+#define FILE_ATTRIBUTE_DIRECTORY 16
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_NO_MORE_FILES 18
+
+HANDLE FindFirstFileA(const char *path, WIN32_FIND_DATAA *entry);
+BOOL FindNextFileA(HANDLE find, WIN32_FIND_DATAA *entry);
+BOOL FindClose(HANDLE find);
+DWORD GetLastError(void);
+DWORD GetFileAttributesA(const char *path);
+BOOL QueryPerformanceCounter(LARGE_INTEGER *counter);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency);
+
+// Declared by the CRT's <string.h>
+int _stricmp(const char *a, const char *b);
+
+#endif
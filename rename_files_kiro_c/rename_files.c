@@ -3,15 +3,148 @@
  * Automatically renames .txt files based on RJ-YYYY-NNNNN patterns found in their content
  */
 
+#ifndef _WIN32
+#define _GNU_SOURCE  // openat/renameat2/getdents64 and friends
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "renamer.h"
+
+#ifdef _WIN32
 #include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#define HAVE_INOTIFY 1
+#define HAVE_FIEMAP 1
+#endif
+#endif
+
+// io_uring batched I/O through raw system calls (needs the Linux 5.11+ uapi header)
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_EXT_ARG  // Added with IORING_OP_RENAMEAT in Linux 5.11
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+// x86 vector kernels for the pattern scanner, selected at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
 
 // Constants
-#define MAX_PATH_LENGTH 260
+#define MAX_NAME_LENGTH 256  // Longest entry name (NAME_MAX) plus the terminator
 #define RJ_PATTERN_LENGTH 14  // "RJ-YYYY-NNNNN" (13 chars) + null terminator
+#define PATTERN_MAX_LENGTH 32  // Longest ID any pattern format can describe, plus the terminator
+#define PATTERN_SPEC_LENGTH 128  // Longest pattern spec text
+#define DEFAULT_PATTERN_SPEC "RJ-####-#####"  // The built-in format, which has dedicated kernels
+#define MAX_PATTERN_FORMATS 16   // Formats in one pattern set
+#define MAX_MATCHER_STATES 4096  // DFA states before a pattern set is rejected as too complex
+#define MATCHER_HASH_SIZE 8192   // Hash slots for DFA states during construction
+#define SCAN_CHUNK_SIZE 65536  // Bytes read per chunk when scanning file content
+#define ENCODING_SAMPLE_BYTES 512  // Leading bytes inspected to tell UTF-16 from single-byte text
+#define UTF16_WINDOW_UNITS 4096  // UTF-16 code units narrowed per step of a wide scan
+#define MMAP_MIN_SIZE SCAN_CHUNK_SIZE  // With --mmap, files up to one chunk still take the read path
+#define SCAN_USE_READ 2        // scan_mapped_file result: use the chunked read path instead
+#define URING_QUEUE_DEPTH 256  // Submission entries per ring (a batch needs up to two per file)
+#define URING_HEADER_SIZE 16384  // Bytes read through the ring per file before falling back
+#define URING_CLOSE_TAG (1ULL << 63)  // user_data flag marking close completions
+#define URING_OPEN_TAG (1ULL << 62)   // user_data flag marking open completions
+
+// Per-thread storage, for the scan buffer each worker reuses
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+#ifdef _WIN32
+#define PATH_SEPARATOR "\\"
+#else
+#define PATH_SEPARATOR "/"
+#define DIRENT_BUFFER_SIZE 65536  // Bytes requested per getdents64 call
+#define ARENA_BLOCK_SIZE 16384    // Bytes per arena block; larger requests get a block of their own
+#define ARENA_CACHE_BLOCKS 64     // Free arena blocks each thread keeps for reuse
+#define FILE_BATCH_SIZE 64        // Directory entries handed to a worker at a time
+#define CACHE_MAGIC "RFSCACHE"    // First 8 bytes of a scan cache file
+#define CACHE_VERSION 3
+#define CACHE_RACY_WINDOW_NS 2000000000LL  // Files modified this close to a run are rescanned
+#define PLAN_MAGIC "RFS-PLAN"     // First 8 bytes of a rename plan file
+#define PLAN_VERSION 1
+#define JOURNAL_MAGIC "RFS-JRNL"  // First 8 bytes of a rename journal
+#define JOURNAL_VERSION 1
+#define LEASE_MAX_MESSAGE 16777216  // Largest lease protocol payload accepted
+#define THROTTLE_BURST_NS 100000000ULL  // Rate limits allow bursts of this much time's worth of tokens
+#define THROTTLE_ADJUST_NS 100000000ULL // Least time between two changes of the latency back-off
+#define THROTTLE_MAX_PAUSE 64.0   // Longest back-off, as a multiple of the operation's own latency
+#define THROTTLE_MAX_SLEEP_NS 1000000000ULL  // Longest single back-off sleep
+#define HISTOGRAM_BUCKETS 48      // Power-of-two latency buckets per instrumented phase
+#define WATCH_PENDING_LIMIT 4096  // Files waiting out the debounce interval at once
+#define WATCH_QUEUE_SIZE 1024     // Settled files queued for the workers
+#define WATCH_EVENT_BUFFER 65536  // Bytes of inotify events read per call
+#endif
+
+#define MAX_NAME_SUFFIX 10000  // Highest _N suffix tried before giving up on a name
+#define RENAME_ATTEMPTS 8      // Renames tried when target names keep turning up taken
+#define DEDUPE_AWAIT_SPINS 1000  // Yields spent waiting for another worker's rename to land
+#define WATCH_DEBOUNCE_MS 50     // Quiet time before a watched file is processed (default)
+#define READAHEAD_FILES 8         // Files --io-order asks the kernel to read ahead of the scan (default)
+#define READAHEAD_BYTES 131072    // Bytes of each file requested by that readahead
+#define MAX_FILTER_GLOBS 16       // --include or --exclude globs in one run
+#define VERIFY_HEADER_BYTES 4096  // Bytes read to confirm the ID of a file with a canonical name
+#define MAX_JOBS 1024
+#define LOG_MAGIC "RFS-LOG1"      // First 8 bytes of a binary log
+#define LOG_BUFFER_SIZE 262144    // Bytes of log records a thread stages before writing
+#define LOG_MAX_LINE 8192         // Longest text log line
+#define JOURNAL_BATCH_SIZE 256    // Renames per journal commit (default)
+#define MAX_SHARDS 65536
+#define LATENCY_TARGET_MS 10      // Per-operation latency --background backs off above (default)
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+// I/O priority classes of ioprio_set(2), which the C library does not declare
+#ifdef __linux__
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_VALUE(class, level) (((class) << 13) | (level))
+#endif
 
 // Statistics structure for tracking file operations
 typedef struct {
@@ -19,19 +152,926 @@ typedef struct {
     int renamed_files;    // Successfully renamed files
     int skipped_files;    // Files without valid RJ pattern
     int error_files;      // Files that encountered errors
+    int deduplicated_files;  // Identical copies linked or quarantined (--dedupe)
 } Statistics;
 
+#ifndef _WIN32
+// Header of an arena block; the block's memory follows it
+typedef struct ArenaBlock {
+    _Alignas(16) struct ArenaBlock *next;  // Keeps the header, and so the data, 16-byte aligned
+    size_t size;          // Usable bytes after the header
+    size_t used;
+} ArenaBlock;
+
+// Bump allocator whose memory is released all at once. Standard-size blocks
+// go back to a per-thread cache, so steady-state processing reuses them.
+typedef struct {
+    ArenaBlock *head;     // Block currently allocated from; older blocks follow
+} Arena;
+
+// Heap memory held in arena blocks, for the peak memory report
+typedef struct {
+    atomic_size_t bytes;  // Blocks allocated, cached ones included
+    atomic_size_t peak;
+} ArenaUsage;
+
+static ArenaUsage g_arena_usage;
+static THREAD_LOCAL ArenaBlock *t_arena_cache = NULL;
+static THREAD_LOCAL int t_arena_cached = 0;
+
+// Slot of an open-addressing name table
+typedef struct {
+    const char *key;      // NULL marks a never-used slot
+    size_t hash;
+    int value;            // Next suffix to try (stem tables only)
+    unsigned char deleted;
+} NameSlot;
+
+// Hash table of names with linear probing
+typedef struct {
+    NameSlot *slots;
+    size_t capacity;      // Power of two
+    size_t used;          // Live plus deleted slots
+    size_t live;
+    Arena *arena;         // Holds the keys the table copies
+} NameTable;
+
+// In-memory view of a directory's names, kept current as files are renamed
+typedef struct {
+    NameTable names;      // Names present in (or reserved for) the directory
+    NameTable stems;      // Next free suffix per base name ("RJ-2024-12345")
+    pthread_mutex_t lock;
+} NameIndex;
+#endif
+
+#ifdef _WIN32
+// Growable path that components are appended to and truncated from in place
+typedef struct {
+    char *data;           // NUL-terminated path, or NULL before the first append
+    size_t length;
+    size_t capacity;
+} PathBuilder;
+#endif
+
+// Handle to an open directory; entries are addressed relative to it
+typedef struct {
+    const char *path;     // Directory path used in messages (and for lookups on Windows)
+#ifndef _WIN32
+    int fd;               // Directory file descriptor used with the *at() system calls
+    NameIndex *index;     // Name index for collision checks, or NULL to probe the file system
+#endif
+} DirRef;
+
+#ifdef _WIN32
+// Directory on the explicit traversal stack, which replaces recursion
+typedef struct {
+    HANDLE find;              // Enumeration handle from FindFirstFileA
+    WIN32_FIND_DATAA entry;   // Entry returned by the last Find call
+    size_t path_length;       // Length of this directory's path in the traversal's PathBuilder
+    int consumed;             // entry was handled; FindNextFileA comes next
+} DirFrame;
+#endif
+
+#ifndef _WIN32
+// Entry types reported by directory enumeration
+typedef enum {
+    ENTRY_OTHER,
+    ENTRY_FILE,
+    ENTRY_DIRECTORY
+} EntryType;
+
+// Single directory entry; the name lives in the owning listing's string pool
+typedef struct {
+    size_t name_offset;   // Offset of the entry name in DirListing.names
+    EntryType type;
+    uint64_t inode;       // Inode number reported by the directory
+} DirEntry;
+
+// All entries of one directory, read in full before any of them is processed
+typedef struct {
+    Arena *arena;         // Holds entries and names
+    DirEntry *entries;
+    size_t count;
+    size_t capacity;
+    char *names;          // NUL-separated entry names
+    size_t names_used;
+    size_t names_capacity;
+} DirListing;
+
+// Directory shared by the work items that reference it; closed with the last reference
+typedef struct {
+    Arena arena;          // Holds the node itself, its path, listing and copied names
+    DirRef ref;
+    char *path;           // Storage behind ref.path
+    DirListing listing;   // Entry names stay valid for as long as the node lives
+    NameIndex index;      // Backs ref.index once the listing has been read
+    struct JournalTree *tree;  // Progress of this directory's subtree with --journal (NULL otherwise)
+    atomic_int refs;
+} DirNode;
+
+// Kinds of work handed between workers
+typedef enum {
+    WORK_DIRECTORY,       // Open and enumerate a subdirectory (or the root when dir is NULL)
+    WORK_FILES            // Scan and rename a range of a directory's entries
+} WorkType;
+
+// Unit of work; stored by value in the deques
+typedef struct {
+    WorkType type;
+    DirNode *dir;         // Parent directory (WORK_DIRECTORY) or containing directory (WORK_FILES)
+    size_t first;         // Entry index of the subdirectory, or first entry of the range
+    size_t count;         // Number of entries in the range (WORK_FILES only)
+} WorkItem;
+
+// Per-worker double-ended queue: the owner works at the tail, thieves at the head
+typedef struct {
+    WorkItem *items;      // Ring buffer
+    size_t head;
+    size_t count;
+    size_t capacity;
+    pthread_mutex_t lock;
+} WorkDeque;
+
+struct Engine;
+
+// Traversal worker with its own deque and private counters
+typedef struct {
+    struct Engine *engine;
+    pthread_t thread;
+    WorkDeque deque;
+    Statistics stats;     // Merged into the caller's statistics when the run ends
+    unsigned steal_seed;
+} Worker;
+
+// Names collected one after another, each NUL-terminated
+typedef struct {
+    char *data;
+    size_t used;
+    size_t capacity;
+    size_t count;
+} NameList;
+
+// Shared state of one parallel traversal
+typedef struct Engine {
+    const char *root_path;
+    NameList *children;       // With --lease: the root's subdirectories are collected here instead of visited
+    Worker *workers;
+    int worker_count;
+    int root_failed;          // Set if the root directory could not be read
+    atomic_long pending;      // Items queued or running; zero means the tree is done
+    atomic_long queued;       // Items sitting in deques
+    atomic_int sleepers;      // Workers waiting for work
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+} Engine;
+#endif
+
+#ifndef _WIN32
+// One file's scan result in the scan cache. The cache file is a CacheHeader
+// followed by entries sorted by (dev, ino), so it is searched in place.
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    char pattern[PATTERN_MAX_LENGTH]; // First pattern in the file (if found)
+    uint8_t found;                    // 1 if the file contains a pattern
+    uint8_t reserved[7];
+} CacheEntry;
+
+typedef struct {
+    char magic[8];                    // CACHE_MAGIC
+    uint32_t version;
+    uint32_t entry_size;              // sizeof(CacheEntry)
+    uint64_t count;
+    int64_t max_scan_bytes;           // Scan limit the results were produced with
+    uint64_t pattern_hash;            // Pattern set the results were produced with
+    int64_t started_ns;               // When the run that wrote the cache started
+} CacheHeader;
+
+// Entries recorded by one thread during the run
+typedef struct CacheBuffer {
+    CacheEntry *entries;
+    size_t count;
+    size_t capacity;
+    struct CacheBuffer *next;
+} CacheBuffer;
+
+// Previous run's cache (mapped read-only) and this run's results
+typedef struct {
+    int enabled;
+    int64_t started_ns;               // When this run started
+    int64_t written_ns;               // When the run that wrote the loaded cache started
+    void *map;
+    size_t map_size;
+    const CacheEntry *entries;
+    size_t count;
+    CacheBuffer *buffers;             // One per thread that recorded results
+    pthread_mutex_t lock;             // Guards the buffer list
+} ScanCache;
+
+static ScanCache g_cache;
+static THREAD_LOCAL CacheBuffer *t_cache_buffer = NULL;
+#endif
+
+#ifndef _WIN32
+// A file of a batch scheduled by --io-order, opened before the batch is scanned
+typedef struct {
+    const char *name;
+    int fd;                           // Open descriptor, or -1 if the open failed
+    int open_error;                   // errno of a failed open
+    uint64_t key;                     // Disk offset of the first extent, or the inode number
+    int mapped;                       // key is a disk offset
+    int cached;                       // settle_before_scan result (0 = cacheable, -1 = not)
+    CacheEntry entry;                 // Identity to record the scan result under
+} ScheduledFile;
+#endif
+
+#ifndef _WIN32
+// Fixed part of one planned rename in a plan file, followed by the source
+// and target names (no terminators). A plan file is a PlanHeader, the scanned
+// root path, the directory table (uint32_t length + path relative to the
+// root, per directory) and the records, grouped by directory.
+typedef struct {
+    uint64_t dev;                     // Identity of the file when it was planned
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t dir_index;               // Index into the directory table
+    uint32_t suffix;                  // Collision suffix chosen for the target (0 = none)
+    uint16_t source_length;
+    uint16_t target_length;
+    uint32_t reserved;
+} PlanRecord;
+
+typedef struct {
+    char magic[8];                    // PLAN_MAGIC
+    uint32_t version;
+    uint32_t dir_count;
+    uint64_t record_count;
+    uint32_t root_length;             // Bytes of the root path following the header
+    uint32_t reserved;
+} PlanHeader;
+
+// A planned rename held in memory until the plan is written
+typedef struct {
+    uint64_t sequence;                // Planning order, kept within each directory
+    size_t dir_offset;                // Strings in the owning buffer's pool
+    size_t source_offset;
+    size_t target_offset;
+    PlanRecord record;
+} PlanItem;
+
+// Renames planned by one thread
+typedef struct PlanBuffer {
+    PlanItem *items;
+    size_t count;
+    size_t capacity;
+    char *pool;
+    size_t pool_used;
+    size_t pool_capacity;
+    struct PlanBuffer *next;
+} PlanBuffer;
+
+// Plan being built by a --plan run
+typedef struct {
+    int enabled;
+    const char *root;                 // Directory the plan was made for
+    atomic_ullong sequence;
+    PlanBuffer *buffers;              // One per thread that planned renames
+    pthread_mutex_t lock;             // Guards the buffer list
+} RenamePlan;
+
+static RenamePlan g_plan;
+static THREAD_LOCAL PlanBuffer *t_plan_buffer = NULL;
+#endif
+
+#ifndef _WIN32
+// Kinds of journal records
+typedef enum {
+    JOURNAL_INTENT = 1,               // A rename is about to be issued
+    JOURNAL_DONE,                     // The rename with this sequence number succeeded
+    JOURNAL_DIR_DONE,                 // Every file of the directory has been processed
+    JOURNAL_TREE_DONE                 // ... and so has every directory below it
+} JournalRecordType;
+
+// Fixed part of one journal record, followed by the directory path relative
+// to the root and (intents only) the old and new names, without terminators.
+// A journal is a JournalHeader, the root path, then records in append order.
+typedef struct {
+    uint32_t checksum;                // FNV-1a of the rest of the record, strings included
+    uint32_t type;                    // JournalRecordType
+    uint64_t sequence;                // Rename number (intents and completions)
+    uint64_t ino;                     // Inode of the file being renamed (intents)
+    uint32_t dir_length;
+    uint16_t old_length;
+    uint16_t new_length;
+} JournalRecord;
+
+typedef struct {
+    char magic[8];                    // JOURNAL_MAGIC
+    uint32_t version;
+    uint32_t root_length;             // Bytes of the root path following the header
+} JournalHeader;
+
+// A directory whose subtree is in progress. pending counts the directory's
+// own files (until its node is released) plus each unfinished subdirectory.
+typedef struct JournalTree {
+    struct JournalTree *parent;
+    atomic_int pending;
+    atomic_int files_failed;          // A file of this directory was not processed
+    atomic_int failed;                // ... or one somewhere below it
+    char path[];                      // Relative to the root
+} JournalTree;
+
+// A rename held back for the next journal commit
+typedef struct {
+    const DirRef *dir;
+    DirNode *node;                    // Reference keeping dir alive, or NULL if the caller's outlives the commit
+    Statistics *stats;
+    uint64_t sequence;
+    int attempts;
+    int staged;                       // An intent for final_name is in the current commit
+    char old_name[MAX_NAME_LENGTH];
+    char new_name[MAX_NAME_LENGTH];   // Target before any collision suffix
+    char final_name[MAX_NAME_LENGTH];
+} JournalPending;
+
+// Encoded records waiting to be appended
+typedef struct {
+    char *data;
+    size_t used;
+    size_t capacity;
+} JournalBuffer;
+
+// The --journal of this run
+typedef struct {
+    int enabled;
+    int fd;
+    atomic_int failed;                // An append failed: no further renames are issued
+    const char *root;                 // Directory as given; records hold paths relative to it
+    size_t root_length;
+    atomic_ullong sequence;
+    uint64_t written;                 // Bytes appended so far (guarded by lock)
+    uint64_t synced;                  // Bytes known to be on disk (guarded by sync_lock)
+    atomic_int commits;               // fdatasync calls issued
+    pthread_mutex_t lock;             // Serialises appends
+    pthread_mutex_t sync_lock;        // One sync at a time; threads queued behind it share its result
+    NameTable finished;               // With --resume: finished directories (value = 1 << record type)
+    Arena arena;                      // Holds the keys of finished
+} Journal;
+
+static Journal g_journal;
+static THREAD_LOCAL JournalPending *t_journal_pending = NULL;
+static THREAD_LOCAL size_t t_journal_count = 0;
+static THREAD_LOCAL JournalBuffer t_journal_records;
+static THREAD_LOCAL DirNode *t_journal_node = NULL;  // Directory of the file batch this thread is running
+
+// Messages between --lease workers and the --coordinator, each a LeaseHeader and its payload
+typedef enum {
+    LEASE_REQUEST = 1,                // Worker: ready for a directory (no payload)
+    LEASE_GRANT,                      // Coordinator: process this directory (its path relative to the root)
+    LEASE_FINISHED,                   // Coordinator: every directory is done (no payload)
+    LEASE_REPORT                      // Worker: LeaseCounts of the granted directory, then its subdirectory names
+} LeaseMessageType;
+
+typedef struct {
+    uint32_t type;                    // LeaseMessageType
+    uint32_t length;                  // Bytes of payload that follow
+} LeaseHeader;
+
+// Outcome of one leased directory
+typedef struct {
+    int32_t total_files;
+    int32_t renamed_files;
+    int32_t skipped_files;
+    int32_t error_files;
+    int32_t deduplicated_files;
+    int32_t failed;                   // The directory itself could not be read
+} LeaseCounts;
+
+// Directories waiting to be leased (relative paths, taken from the end)
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+} LeaseQueue;
+
+// A connected worker
+typedef struct {
+    int fd;
+    char *lease;                      // Directory it is processing, or NULL
+    int waiting;                      // Asked for a directory while none was free
+    char *input;                      // Bytes received but not yet handled
+    size_t used;
+    size_t capacity;
+} LeaseClient;
+
+// State of the --coordinator
+typedef struct {
+    LeaseQueue queue;
+    LeaseClient *clients;
+    size_t client_count;
+    size_t outstanding;               // Leases granted but not yet reported
+    size_t granted;
+    size_t failed;                    // Leased directories that could not be read
+    Statistics *stats;                // Counts of every worker, added up
+} LeaseCoordinator;
+#endif
+
+#ifndef _WIN32
+// Content hash of one file, remembered by identity so that a file several
+// duplicates collide with is read only once
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t hash;
+    int used;
+} HashEntry;
+
+// State of a --dedupe run
+typedef struct {
+    HashEntry *entries;               // Open-addressing table keyed by (dev, ino)
+    size_t capacity;                  // Power of two
+    size_t count;
+    int quarantine_fd;                // Quarantine directory (--dedupe=quarantine), or -1
+    struct stat quarantine_st;        // Its identity, so the traversal can skip it
+    atomic_uint temp_sequence;        // Makes temporary link names unique
+    pthread_mutex_t lock;             // Guards the table
+} DedupeState;
+
+static DedupeState g_dedupe;
+
+// What a throttled operation is charged to
+typedef enum {
+    THROTTLE_READ,        // Bytes read from files
+    THROTTLE_RENAME,      // Renames issued
+    THROTTLE_KINDS
+} ThrottleKind;
+
+// Token bucket of one kind of operation. An operation is charged once it
+// has finished and its size is known, which may leave the bucket in debt;
+// the next operation then waits until the refill has paid the debt off.
+typedef struct {
+    double rate;          // Tokens added per second (0 = unlimited)
+    double burst;         // Most tokens the bucket holds
+    double tokens;
+    uint64_t refilled_ns; // When tokens were last added
+    double latency_ns;    // Moving average of this kind's operation latency
+} TokenBucket;
+
+// State of --background and the rate limits
+typedef struct {
+    int enabled;                      // A rate limit or a latency target is set
+    TokenBucket buckets[THROTTLE_KINDS];
+    uint64_t target_ns;               // Latency target (0 = no back-off)
+    double pause;                     // Sleep after each operation, as a multiple of its latency
+    uint64_t adjusted_ns;             // When pause last changed
+    atomic_ullong waited_ns;          // Time workers were held back, for the summary
+    pthread_mutex_t lock;             // Guards everything above but waited_ns
+} Throttle;
+
+static Throttle g_throttle;
+#endif
+
+#ifdef HAVE_INOTIFY
+// Directory watched by inotify, by watch descriptor
+typedef struct {
+    int wd;               // 0 marks a never-used slot, -1 a removed one
+    char *path;
+} WatchedDir;
+
+// File inotify reported, waiting for its writes to settle
+typedef struct {
+    int wd;
+    char *name;
+    uint64_t due_ns;      // Processed once no event has touched it until then
+} PendingFile;
+
+// Settled file handed to the workers
+typedef struct {
+    char *dir_path;
+    char *name;
+} WatchItem;
+
+// State of a --watch run
+typedef struct {
+    int fd;                           // inotify instance
+    WatchedDir *dirs;                 // Open-addressing table keyed by watch descriptor
+    size_t dir_capacity;              // Power of two
+    size_t dir_used;                  // Live plus removed slots
+    PendingFile *pending;             // Unordered; WATCH_PENDING_LIMIT entries
+    size_t pending_count;
+    WatchItem *queue;                 // Ring of WATCH_QUEUE_SIZE settled files
+    size_t queue_head;
+    size_t queue_count;
+    int stopping;                     // Workers exit once the queue is empty
+    pthread_mutex_t lock;             // Guards the queue
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} WatchState;
+
+static WatchState g_watch;
+static volatile sig_atomic_t g_watch_signal = 0;
+#endif
+
+// Encodings the scanner reads in place, one code unit at a time
+typedef enum {
+    TEXT_NARROW,                            // ASCII, UTF-8 or any other single-byte encoding
+    TEXT_UTF16LE,
+    TEXT_UTF16BE
+} TextEncoding;
+
+#ifdef HAVE_IO_URING
+// Mapped io_uring instance with its submission and completion rings
+typedef struct {
+    int fd;
+    void *sq_ring;
+    void *cq_ring;
+    struct io_uring_sqe *sqes;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned pending_submit;           // Entries queued but not yet submitted
+    int can_rename;                    // Kernel supports IORING_OP_RENAMEAT
+    char (*headers)[URING_HEADER_SIZE];  // One header buffer per batch slot
+} IoRing;
+
+// Progress of one file through a batch
+typedef enum {
+    URING_FAILED,         // Not handled by the ring yet; finish synchronously
+    URING_RENAME,         // Pattern found; rename pending
+    URING_SKIP,           // Whole file scanned, no pattern
+    URING_NAMED,          // Pattern found, but the file already carries its name
+    URING_SYNC,           // No pattern in the header; scan the rest synchronously, from the open descriptor
+    URING_DONE            // Renamed or failed; already counted
+} UringState;
+
+// Per-file state of a batch
+typedef struct {
+    int fd;
+    UringState state;
+    char pattern[PATTERN_MAX_LENGTH];
+    char final_name[MAX_NAME_LENGTH];
+    CacheEntry cache;     // File identity for the scan cache (cache.size is ~0 if unknown)
+    TextEncoding encoding;  // Told from the header (URING_SYNC)
+    size_t header_bytes;  // Bytes of the file already scanned (URING_SYNC)
+} UringSlot;
+
+// Every stage waits for its own completions, so one batch never has more than two entries per file queued
+_Static_assert(URING_QUEUE_DEPTH >= 2 * FILE_BATCH_SIZE, "URING_QUEUE_DEPTH cannot hold a batch");
+#endif
+
+// One ID format of the pattern set, compiled from a spec such as "RJ-####-#####"
+typedef struct {
+    char spec[PATTERN_SPEC_LENGTH];         // The spec as given
+    size_t length;                          // Length of a matching ID in bytes
+    uint8_t positions[PATTERN_MAX_LENGTH - 1][32];  // Bytes accepted at each position (bitmap)
+} PatternFormat;
+
+// The ID formats searched for, compiled into a single DFA over byte classes.
+// Bytes that no position tells apart share a class, so a set of a few formats
+// needs only a handful of columns per state.
+typedef struct PatternSet {
+    PatternFormat formats[MAX_PATTERN_FORMATS];
+    int count;
+    size_t max_length;                      // Longest ID; scan windows overlap by one less
+    int builtin;                            // Only the built-in RJ format: use its dedicated kernels
+    uint64_t hash;                          // Identifies the set, so cached results from another set are ignored
+    uint8_t byte_class[256];
+    int class_count;
+    int state_count;
+    uint16_t *transitions;                  // [state * class_count + class] -> state; state 0 = no partial match
+    uint16_t *accepts;                      // Per state: formats (bit = index) whose ID ends here
+    uint8_t start_byte[256];                // Bytes that leave state 0
+    uint8_t start_low[16];                  // Nibble tables classifying start bytes 16 at a time:
+    uint8_t start_high[16];                 // b starts an ID iff start_low[b & 15] & start_high[b >> 4]
+    size_t (*skip)(const struct PatternSet *set, const char *data, size_t offset, size_t length);
+} PatternSet;
+
+static PatternSet g_patterns;
+
+// What --dedupe does with a file whose target name is held by an identical copy
+typedef enum {
+    DEDUPE_NONE,          // Give it a suffixed name like any other collision
+    DEDUPE_LINK,          // Replace it with a hard link to the copy
+    DEDUPE_QUARANTINE     // Move it to the quarantine directory
+} DedupeMode;
+
+// Order in which --io-order scans the files of a directory
+typedef enum {
+    IO_ORDER_NONE,        // Directory order
+    IO_ORDER_INODE,       // Ascending inode number
+    IO_ORDER_EXTENT       // Ascending disk offset of each file's first extent (FIEMAP)
+} IoOrder;
+
+// What --shard splits the tree into
+typedef enum {
+    SHARD_BY_DIRECTORY,   // Each directory's files go to the shard its relative path hashes to
+    SHARD_BY_SUBTREE      // Each top-level subtree goes, whole, to the shard its name hashes to
+} ShardBy;
+
+// Command-line options, set once before processing starts
+typedef struct {
+    int jobs;                    // Number of worker threads (POSIX builds)
+    long long max_scan_bytes;    // Bytes scanned per file before giving up (0 = whole file)
+    int use_mmap;                // Scan files larger than one chunk through a memory mapping
+    int use_io_uring;            // Batch opens, header reads and renames through io_uring
+    const char *cache_path;      // Scan cache file for incremental runs (NULL = no cache)
+    const char *plan_path;       // Write a rename plan here instead of renaming (NULL = rename)
+    const char *apply_path;      // Apply this rename plan instead of scanning (NULL = scan)
+    const char *log_path;        // Write file records here instead of standard output
+    int stats_verbose;           // Print per-phase timings and counters (instrumented builds)
+    const char *stats_path;      // Write per-phase timings and counters here as JSON
+    DedupeMode dedupe;           // Handling of identical files that collide on a name
+    const char *quarantine_path; // Where --dedupe=quarantine moves duplicates
+    int watch;                   // Keep running and process files as they arrive
+    int watch_debounce_ms;       // Quiet time before a watched file is processed
+    IoOrder io_order;            // Scan order of each directory's files
+    int readahead;               // Files read ahead of the scan with --io-order
+    int trust_names;             // Skip files with canonical names without opening them
+    long long min_size;          // Smallest file processed (0 = no limit)
+    long long max_size;          // Largest file processed (0 = no limit)
+    int64_t modified_after_ns;   // Only files modified after this time are processed (0 = any)
+    int include_count;
+    int exclude_count;
+    const char *journal_path;    // Record renames in this journal (NULL = no journal)
+    int journal_batch;           // Renames per journal commit
+    int resume;                  // Continue the run recorded in the journal
+    const char *undo_path;       // Revert the renames recorded in this journal instead of scanning
+    int shard_index;             // With --shard: the part of the tree this process renames
+    int shard_count;             // Number of shards (0 = the whole tree)
+    ShardBy shard_by;
+    const char *coordinator_path;  // Hand out directory leases on this socket instead of processing
+    const char *lease_path;      // Process the directories leased by the coordinator on this socket
+    int background;              // Run at idle I/O and CPU priority, backing off when latency rises
+    long long read_rate;         // Bytes read per second (0 = unlimited)
+    long long rename_rate;       // Renames per second (0 = unlimited)
+    int latency_target_ms;       // Back off above this per-operation latency (0 = never, -1 = default)
+    const char *include_globs[MAX_FILTER_GLOBS];  // A file's name must match one of these (none = any)
+    const char *exclude_globs[MAX_FILTER_GLOBS];  // ... and none of these
+} Options;
+
+static Options g_options = { 1, 0, 0, 0, NULL, NULL, NULL, NULL, 0, NULL, DEDUPE_NONE, NULL, 0, WATCH_DEBOUNCE_MS,
+                             IO_ORDER_NONE, READAHEAD_FILES, 0, 0, 0, 0, 0, 0, NULL, JOURNAL_BATCH_SIZE, 0, NULL,
+                             0, 0, SHARD_BY_DIRECTORY, NULL, NULL, 0, 0, 0, -1, { NULL }, { NULL } };
+
+#ifndef _WIN32
+// Settings of a library user (renamer.h), installed over the globals for each path call
+struct RenamerContext {
+    Options options;
+    PatternSet patterns;
+    RenamerEventCallback on_event;
+    void *user_data;
+};
+
+// A batch of paths shared by the threads of one library call
+typedef struct {
+    const char *const *paths;
+    size_t count;
+    atomic_size_t next;               // Next path to claim
+    RenamerMatch *results;            // Scan results, or NULL to process the files
+} LibraryBatch;
+
+// One thread of a library call, with the directory it last opened
+typedef struct {
+    LibraryBatch *batch;
+    pthread_t thread;
+    Statistics stats;
+    size_t found;                     // Files in which an ID was found
+    char *dir_path;                   // Reused for every path the thread handles
+    size_t dir_capacity;
+    int dir_fd;                       // Open descriptor of dir_path, or -1
+} LibraryWorker;
+
+// IDs are copied into RenamerMatch.id unchanged
+_Static_assert(RENAMER_ID_MAX >= PATTERN_MAX_LENGTH, "RENAMER_ID_MAX is smaller than PATTERN_MAX_LENGTH");
+#endif
+
+// Outcome of one file, as reported to the log (and to library callbacks)
+typedef enum {
+    LOG_EVENT_RENAMED = RENAMER_EVENT_RENAMED,
+    LOG_EVENT_PLANNED = RENAMER_EVENT_PLANNED,
+    LOG_EVENT_SKIPPED = RENAMER_EVENT_SKIPPED,
+    LOG_EVENT_ERROR = RENAMER_EVENT_ERROR,
+    LOG_EVENT_DEDUPLICATED = RENAMER_EVENT_DEDUPLICATED
+} LogEvent;
+
+typedef enum {
+    LOG_FORMAT_TEXT,      // "Renamed: a -> b" lines (with -v)
+    LOG_FORMAT_JSONL,     // One JSON object per line, for every file
+    LOG_FORMAT_BINARY     // LOG_MAGIC, then one LogRecord per file
+} LogFormat;
+
+// Fixed part of a binary log record, followed by the path and the final name
+// (no terminators). Little-endian, as written by the host.
+typedef struct {
+    uint32_t length;      // Total record size, names included
+    uint8_t event;        // LogEvent
+    uint8_t reserved;
+    uint16_t path_length;
+    uint16_t name_length; // Final name for renames, skip reason for skips, copy for duplicates
+    int16_t error;        // errno of a failure, 0 otherwise
+    uint32_t reserved2;
+    uint64_t duration_ns; // Time spent on the file (or on its io_uring batch)
+    char pattern[PATTERN_MAX_LENGTH];  // Pattern found, NUL-padded (empty if none)
+} LogRecord;
+
+// Per-thread staging buffer; flushed to the log stream in one write when full
+typedef struct LogBuffer {
+    char *data;
+    size_t used;
+    struct LogBuffer *next;
+} LogBuffer;
+
+// Log destination and settings
+typedef struct {
+    LogFormat format;
+    int verbosity;        // 0 = summary and errors only, 1 = every file (text format)
+    FILE *stream;         // Where file records go (stdout unless --log-file)
+    LogBuffer *buffers;   // Every thread's buffer, for the final flush
+    RenamerEventCallback on_event;  // Library callers get records here instead (NULL = log them)
+    void *user_data;
+#ifndef _WIN32
+    pthread_mutex_t lock; // Guards the buffer list
+#endif
+} Logger;
+
+static Logger g_log;
+static THREAD_LOCAL LogBuffer *t_log_buffer = NULL;
+static THREAD_LOCAL uint64_t t_log_started_ns = 0;
+
+#ifdef RENAME_FILES_INSTRUMENT
+// Timed phases of the hot path
+typedef enum {
+    PHASE_ENUMERATE,      // Listing one directory
+    PHASE_OPEN,           // Opening one file
+    PHASE_READ,           // One chunk read (or mapping set-up with --mmap)
+    PHASE_SCAN,           // One pattern search over a buffer
+    PHASE_RESOLVE,        // Choosing a free target name
+    PHASE_RENAME,         // One rename system call
+    PHASE_URING,          // One io_uring submit-and-wait round trip
+    PHASE_JOURNAL,        // One journal commit's fdatasync
+    PHASE_COUNT
+} Phase;
+
+// Byte and system call counters
+typedef enum {
+    COUNTER_BYTES_READ,
+    COUNTER_READ_CALLS,
+    COUNTER_GETDENTS_CALLS,
+    COUNTER_STAT_CALLS,
+    COUNTER_MMAP_CALLS,
+    COUNTER_URING_ENTERS,
+    COUNTER_RENAME_CONFLICTS,  // Renames refused because the target appeared meanwhile
+    COUNTER_COUNT
+} Counter;
+
+// One thread's measurements. Histogram bucket b counts durations below 2^b ns
+// (and at least 2^(b-1) ns); the last bucket takes everything longer.
+typedef struct Instrument {
+    uint64_t count[PHASE_COUNT];
+    uint64_t total_ns[PHASE_COUNT];
+    uint64_t max_ns[PHASE_COUNT];
+    uint64_t histogram[PHASE_COUNT][HISTOGRAM_BUCKETS];
+    uint64_t counters[COUNTER_COUNT];
+    struct Instrument *next;
+} Instrument;
+
+// Every thread's measurements, merged when the run ends
+typedef struct {
+    Instrument *threads;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+} InstrumentSet;
+
+#ifdef _WIN32
+static InstrumentSet g_instrument = { NULL };
+#else
+static InstrumentSet g_instrument = { NULL, PTHREAD_MUTEX_INITIALIZER };
+#endif
+static THREAD_LOCAL Instrument *t_instrument = NULL;
+
+#define INSTRUMENT_BEGIN(started) uint64_t started = monotonic_ns()
+#define INSTRUMENT_END(phase, started) instrument_phase((phase), monotonic_ns() - (started))
+#define INSTRUMENT_COUNT(counter, amount) instrument_count((counter), (uint64_t)(amount))
+#else
+// Without RENAME_FILES_INSTRUMENT the probes compile to nothing
+#define INSTRUMENT_BEGIN(started)
+#define INSTRUMENT_END(phase, started) ((void)0)
+#define INSTRUMENT_COUNT(counter, amount) ((void)0)
+#endif
+
 // Function declarations
 static int validate_rj_pattern(const char *pattern);
+int extract_rj_pattern_reference(const char *content, char *output, size_t output_size);
 int extract_rj_pattern(const char *content, char *output, size_t output_size);
-static int file_exists(const char *filepath);
-static void generate_unique_name(const char *base_name, char *output, size_t output_size);
-int rename_file(const char *old_path, const char *new_name, Statistics *stats);
-static char* read_file_content(const char *filepath);
-int process_file(const char *filepath, Statistics *stats);
+static void select_pattern_scanner(void);
+static int pattern_set_add(PatternSet *set, const char *spec);
+static int pattern_set_load(PatternSet *set, const char *path);
+static int pattern_set_compile(PatternSet *set);
+static void pattern_set_free(PatternSet *set);
+static const char *find_pattern(const char *data, size_t length, size_t *match_length);
+static TextEncoding detect_text_encoding(const char *data, size_t length);
+static const char *find_encoded_pattern(const char *data, size_t length, TextEncoding encoding,
+                                        size_t *match_length);
+static void copy_encoded_match(const char *match, size_t match_length, TextEncoding encoding, char *output);
+static const char *entry_separator(const char *dir_path);
+static const char *relative_path(const char *root, const char *path);
+static int open_entry(const DirRef *dir, const char *name);
+static long long read_entry(int fd, char *buffer, size_t size);
+static void close_entry(int fd);
+static int move_entry_noreplace(const DirRef *from, const char *old_name, const DirRef *to, const char *new_name);
+static int rename_entry_noreplace(const DirRef *dir, const char *old_name, const char *new_name);
+static int log_open(const char *log_path);
+static int log_owns_stdout(void);
+static void log_file_start(void);
+static void log_file_event(const DirRef *dir, const char *name, LogEvent event, const char *pattern,
+                           const char *detail, int error);
+static void log_flush_thread(void);
+static void log_close(void);
+static uint64_t monotonic_ns(void);
+#ifndef _WIN32
+static long long peak_resident_bytes(void);
+#endif
+#ifdef RENAME_FILES_INSTRUMENT
+static void instrument_phase(Phase phase, uint64_t elapsed_ns);
+static void instrument_count(Counter counter, uint64_t amount);
+static void instrument_report(FILE *out);
+static int instrument_save(const char *path);
+static void instrument_close(void);
+#endif
+static int file_exists(const DirRef *dir, const char *name);
+static int generate_unique_name(const DirRef *dir, const char *base_name, char *output, size_t output_size);
+static int is_already_named(const DirRef *dir, const char *name, const char *base_name);
+static void pattern_from_name(const char *name, int suffixed, char *output);
+int rename_file(const DirRef *dir, const char *old_name, const char *new_name, Statistics *stats);
+#ifndef _WIN32
+static int dedupe_open(const char *quarantine_path, const char *root);
+static int dedupe_file(const DirRef *dir, const char *old_name, const char *new_name, const char *pattern,
+                       Statistics *stats);
+static int dedupe_is_quarantine(int fd);
+static void dedupe_close(void);
+static int is_canonical_name(const char *name, char *pattern);
+static int select_file(const DirRef *dir, const char *name);
+static int verify_canonical_name(const DirRef *dir, const char *name, char *pattern);
+static void cache_open(const char *path);
+static int cache_probe(const DirRef *dir, const char *name, CacheEntry *entry);
+static void cache_store_result(CacheEntry *entry, int scan_result, const char *pattern);
+static int cache_save(const char *path);
+static void cache_close(void);
+static void plan_open(const char *root);
+static int plan_file(const DirRef *dir, const char *old_name, const char *new_name, Statistics *stats);
+static int plan_save(const char *path);
+static void plan_close(void);
+static int apply_plan(const char *plan_path, const char *root_override, Statistics *stats);
+static int journal_open(const char *path, const char *root, int resume);
+static int journal_rename(const DirRef *dir, const char *old_name, const char *new_name, Statistics *stats);
+static void journal_flush_thread(void);
+static void journal_tree_release(JournalTree *tree, int failed);
+static int journal_close(void);
+static void dir_node_release(DirNode *node);
+static int shard_owns(const char *relative);
+static int name_list_add(NameList *list, const char *name);
+static int undo_journal(const char *journal_path, const char *root_override, Statistics *stats);
+static void install_mmap_fault_handler(void);
+static int scan_mapped_file(int fd, const DirRef *dir, const char *name, char *output);
+static uint64_t throttle_begin(ThrottleKind kind);
+static void throttle_end(ThrottleKind kind, uint64_t started, uint64_t used);
+#endif
+static int read_file_content(const DirRef *dir, const char *name, char *output, size_t output_size);
+static int finish_file(const DirRef *dir, const char *name, int scan_result, const char *rj_pattern,
+                       Statistics *stats);
+#ifndef _WIN32
+static int settle_before_scan(const DirRef *dir, const char *name, CacheEntry *entry, Statistics *stats);
+#endif
+int process_file(const DirRef *dir, const char *name, Statistics *stats);
+#ifdef HAVE_IO_URING
+static int io_ring_init(IoRing *ring, unsigned entries);
+static void io_ring_destroy(IoRing *ring);
+static IoRing *thread_io_ring(void);
+static void release_thread_io_ring(void);
+static void process_files_uring(IoRing *ring, const DirRef *dir, const char *const *names,
+                                const CacheEntry *entries, size_t count, Statistics *stats);
+#endif
 static int is_txt_file(const char *filename);
 int process_directory(const char *dir_path, Statistics *stats);
-static int validate_arguments(int argc, char *argv[]);
+#ifdef HAVE_INOTIFY
+static int watch_directory(const char *dir_path, Statistics *stats);
+#endif
+static int validate_arguments(int argc, char *argv[], const char **dir_path);
 
 // Pattern Matching Module Implementation
 
@@ -73,7 +1113,7 @@ static int validate_rj_pattern(const char *pattern) {
     }
     
     // Ensure pattern ends properly (not part of a longer alphanumeric string)
-    if (pattern[13] != '\0' && 
+    if (pattern[13] != '\0' &&
         ((pattern[13] >= '0' && pattern[13] <= '9') ||
          (pattern[13] >= 'A' && pattern[13] <= 'Z') ||
          (pattern[13] >= 'a' && pattern[13] <= 'z'))) {
@@ -84,13 +1124,15 @@ static int validate_rj_pattern(const char *pattern) {
 }
 
 /**
- * Extracts the first valid RJ-YYYY-NNNNN pattern from file content
+ * Extracts the first valid RJ-YYYY-NNNNN pattern from file content.
+ * Original strstr-based scalar implementation, kept as the reference that
+ * the vector kernels behind extract_rj_pattern must agree with.
  * @param content The file content to search
  * @param output Buffer to store the extracted pattern
  * @param output_size Size of the output buffer
  * @return 0 on success, -1 if no valid pattern found
  */
-int extract_rj_pattern(const char *content, char *output, size_t output_size) {
+int extract_rj_pattern_reference(const char *content, char *output, size_t output_size) {
     if (content == NULL || output == NULL || output_size < RJ_PATTERN_LENGTH) {
         return -1;
     }
@@ -123,485 +1165,9507 @@ int extract_rj_pattern(const char *content, char *output, size_t output_size) {
     return -1;
 }
 
-// File Operations Module Implementation
-
 /**
- * Checks if a file exists at the specified path
- * @param filepath The path to check
- * @return 1 if file exists, 0 if not or on error
+ * Extracts the first ID of the configured pattern set (RJ-YYYY-NNNNN unless
+ * --pattern says otherwise) from file content
+ * @param content The file content to search
+ * @param output Buffer to store the extracted pattern
+ * @param output_size Size of the output buffer
+ * @return 0 on success, -1 if no valid pattern found
  */
-static int file_exists(const char *filepath) {
-    if (filepath == NULL) {
-        return 0;
+int extract_rj_pattern(const char *content, char *output, size_t output_size) {
+    if (content == NULL || output == NULL) {
+        return -1;
     }
     
-    DWORD attributes = GetFileAttributesA(filepath);
+    // One strlen for the whole content; candidates are checked in place
+    size_t match_length = 0;
+    const char *match = find_pattern(content, strlen(content), &match_length);
+    if (match == NULL || match_length >= output_size) {
+        return -1;
+    }
     
-    // Check if the path exists and is not a directory
-    if (attributes == INVALID_FILE_ATTRIBUTES) {
+    memcpy(output, match, match_length);
+    output[match_length] = '\0';
+    return 0;
+}
+
+/**
+ * Checks whether an RJ-YYYY-NNNNN pattern starts at the given position
+ * @param p Start of the candidate; at least RJ_PATTERN_LENGTH - 1 bytes must be readable
+ * @return 1 if the bytes form a pattern, 0 otherwise
+ */
+static int is_rj_pattern_at(const char *p) {
+    if (p[0] != 'R' || p[1] != 'J' || p[2] != '-' || p[7] != '-') {
         return 0;
     }
     
-    // Return 0 if it's a directory, 1 if it's a file
-    return (attributes & FILE_ATTRIBUTE_DIRECTORY) ? 0 : 1;
+    // Year digits at 3..6, number digits at 8..12
+    for (int i = 3; i < 13; i++) {
+        if (i != 7 && (p[i] < '0' || p[i] > '9')) {
+            return 0;
+        }
+    }
+    
+    return 1;
 }
 
 /**
- * Generates a unique filename by appending numeric suffix if needed
- * @param base_name The base filename (e.g., "RJ-2024-12345.txt")
- * @param output Buffer to store the unique filename
- * @param output_size Size of the output buffer
+ * Finds the first RJ-YYYY-NNNNN pattern in a buffer that need not be
+ * NUL-terminated, one candidate position at a time. Portable fallback for
+ * the vector kernels and the tail handler for the bytes they leave over.
+ * @param data The bytes to search
+ * @param length Number of bytes in data
+ * @return Pointer to the start of the first match, or NULL if there is none
  */
-static void generate_unique_name(const char *base_name, char *output, size_t output_size) {
-    if (base_name == NULL || output == NULL || output_size == 0) {
-        return;
+static const char *find_rj_pattern_scalar(const char *data, size_t length) {
+    const size_t PATTERN_LEN = RJ_PATTERN_LENGTH - 1;
+    
+    if (data == NULL || length < PATTERN_LEN) {
+        return NULL;
     }
     
-    // First, try the base name without any suffix
-    strncpy(output, base_name, output_size - 1);
-    output[output_size - 1] = '\0';
+    // One past the last position where a complete pattern can start
+    const char *end = data + length - PATTERN_LEN + 1;
+    const char *ptr = data;
     
-    if (!file_exists(output)) {
-        return;  // Base name is available
+    while (ptr < end && (ptr = (const char*)memchr(ptr, 'R', end - ptr)) != NULL) {
+        if (is_rj_pattern_at(ptr)) {
+            return ptr;
+        }
+        ptr++;
     }
     
-    // Extract the name without extension
-    char name_without_ext[MAX_PATH_LENGTH];
-    const char *ext_pos = strrchr(base_name, '.');
+    return NULL;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Vector kernels: every lane of a block is a candidate start position. Each
+ * pattern offset k is checked for all lanes at once by loading the block
+ * shifted by k bytes and comparing it against that offset's byte class
+ * ('R', 'J', '-' or digit). A digit test is (byte - '0') <= 9 as unsigned,
+ * done with a saturating min. Lanes that survive every offset are matches;
+ * the lowest one is the first match. The full layout is only checked for
+ * blocks where the cheap "RJ-" prefix test already found a candidate.
+ */
+
+#define RJ_DIGIT_OFFSETS { 3, 4, 5, 6, 8, 9, 10, 11, 12 }
+
+/**
+ * AVX2 kernel: tests 32 candidate positions per iteration
+ * @param data The bytes to search
+ * @param length Number of bytes in data
+ * @return Pointer to the start of the first match, or NULL if there is none
+ */
+__attribute__((target("avx2")))
+static const char *find_rj_pattern_avx2(const char *data, size_t length) {
+    const size_t PATTERN_LEN = RJ_PATTERN_LENGTH - 1;
+    const int digit_offsets[] = RJ_DIGIT_OFFSETS;
+    size_t i = 0;
     
-    if (ext_pos != NULL) {
-        size_t name_len = ext_pos - base_name;
-        if (name_len >= MAX_PATH_LENGTH) {
-            name_len = MAX_PATH_LENGTH - 1;
-        }
-        strncpy(name_without_ext, base_name, name_len);
-        name_without_ext[name_len] = '\0';
-    } else {
-        strncpy(name_without_ext, base_name, MAX_PATH_LENGTH - 1);
-        name_without_ext[MAX_PATH_LENGTH - 1] = '\0';
-        ext_pos = "";  // No extension
+    if (data == NULL) {
+        return NULL;
     }
     
-    // Try appending numeric suffixes until we find a unique name
-    int suffix = 1;
-    while (suffix < 10000) {  // Reasonable limit to prevent infinite loop
-        snprintf(output, output_size, "%s_%d%s", name_without_ext, suffix, ext_pos);
+    const __m256i r = _mm256_set1_epi8('R');
+    const __m256i j = _mm256_set1_epi8('J');
+    const __m256i hyphen = _mm256_set1_epi8('-');
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+    
+    // Every load of the block, shifted by up to PATTERN_LEN - 1, must stay in bounds
+    for (; i + (PATTERN_LEN - 1) + 32 <= length; i += 32) {
+        const char *p = data + i;
+        __m256i prefix = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), r),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 1)), j)),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 2)), hyphen));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(prefix);
+        if (mask == 0) {
+            continue;
+        }
         
-        if (!file_exists(output)) {
-            return;  // Found a unique name
+        __m256i layout = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 7)), hyphen);
+        for (size_t k = 0; k < sizeof(digit_offsets) / sizeof(digit_offsets[0]); k++) {
+            __m256i d = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(p + digit_offsets[k])), zero);
+            layout = _mm256_and_si256(layout, _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d));
         }
         
-        suffix++;
+        mask &= (unsigned)_mm256_movemask_epi8(layout);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
     }
     
-    // If we couldn't find a unique name, just use the last attempt
-    // This shouldn't happen in practice
+    return find_rj_pattern_scalar(data + i, length - i);
 }
 
 /**
- * Renames a file based on the RJ pattern
- * @param old_path The current file path
- * @param new_name The new filename (RJ-YYYY-NNNNN.txt)
- * @param stats Statistics structure to update
- * @return 0 on success, -1 on failure
+ * SSE2 kernel: tests 16 candidate positions per iteration
+ * @param data The bytes to search
+ * @param length Number of bytes in data
+ * @return Pointer to the start of the first match, or NULL if there is none
  */
-int rename_file(const char *old_path, const char *new_name, Statistics *stats) {
-    if (old_path == NULL || new_name == NULL || stats == NULL) {
-        fprintf(stderr, "Error: Invalid parameters to rename_file\n");
-        if (stats != NULL) {
-            stats->error_files++;
-        }
-        return -1;
-    }
-    
-    // Extract directory path from old_path
-    char new_path[MAX_PATH_LENGTH];
-    const char *last_separator = strrchr(old_path, '\\');
+__attribute__((target("sse2")))
+static const char *find_rj_pattern_sse2(const char *data, size_t length) {
+    const size_t PATTERN_LEN = RJ_PATTERN_LENGTH - 1;
+    const int digit_offsets[] = RJ_DIGIT_OFFSETS;
+    size_t i = 0;
     
-    if (last_separator == NULL) {
-        last_separator = strrchr(old_path, '/');
+    if (data == NULL) {
+        return NULL;
     }
     
-    if (last_separator != NULL) {
-        // File is in a subdirectory
-        size_t dir_len = last_separator - old_path + 1;
-        if (dir_len >= MAX_PATH_LENGTH - strlen(new_name) - 1) {
-            fprintf(stderr, "Error: Path too long for '%s'\n", old_path);
-            stats->error_files++;
-            return -1;
+    const __m128i r = _mm_set1_epi8('R');
+    const __m128i j = _mm_set1_epi8('J');
+    const __m128i hyphen = _mm_set1_epi8('-');
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    
+    for (; i + (PATTERN_LEN - 1) + 16 <= length; i += 16) {
+        const char *p = data + i;
+        __m128i prefix = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), r),
+                          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 1)), j)),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 2)), hyphen));
+        unsigned mask = (unsigned)_mm_movemask_epi8(prefix);
+        if (mask == 0) {
+            continue;
         }
         
-        strncpy(new_path, old_path, dir_len);
-        new_path[dir_len] = '\0';
-        strncat(new_path, new_name, MAX_PATH_LENGTH - dir_len - 1);
-    } else {
-        // File is in current directory
-        strncpy(new_path, new_name, MAX_PATH_LENGTH - 1);
-        new_path[MAX_PATH_LENGTH - 1] = '\0';
+        __m128i layout = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 7)), hyphen);
+        for (size_t k = 0; k < sizeof(digit_offsets) / sizeof(digit_offsets[0]); k++) {
+            __m128i d = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(p + digit_offsets[k])), zero);
+            layout = _mm_and_si128(layout, _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d));
+        }
+        
+        mask &= (unsigned)_mm_movemask_epi8(layout);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
     }
     
-    // Check if target file already exists and generate unique name if needed
-    char final_path[MAX_PATH_LENGTH];
-    generate_unique_name(new_path, final_path, MAX_PATH_LENGTH);
-    
-    // Perform the rename operation
-    if (rename(old_path, final_path) != 0) {
-        fprintf(stderr, "Error: Cannot rename '%s' to '%s': %s\n", 
-                old_path, final_path, strerror(errno));
-        stats->error_files++;
-        return -1;
-    }
+    return find_rj_pattern_scalar(data + i, length - i);
+}
+#endif
+
+// Kernel used by find_rj_pattern; chosen once at startup by select_pattern_scanner
+static const char *(*g_pattern_scanner)(const char *data, size_t length) = find_rj_pattern_scalar;
+
+/**
+ * Reads one UTF-16 code unit as the byte the scanners see: ASCII units stand
+ * for themselves and every other unit for NUL, which no ID contains
+ * @param data The UTF-16 text
+ * @param unit Index of the code unit
+ * @param big_endian Non-zero for UTF-16BE
+ * @return The byte standing for the code unit
+ */
+static inline unsigned char utf16_unit_byte(const char *data, size_t unit, int big_endian) {
+    const unsigned char *bytes = (const unsigned char*)data + unit * 2;
+    unsigned value = big_endian ? ((unsigned)bytes[0] << 8 | bytes[1]) : ((unsigned)bytes[1] << 8 | bytes[0]);
     
-    // Log success
-    const char *old_filename = strrchr(old_path, '\\');
-    if (old_filename == NULL) {
-        old_filename = strrchr(old_path, '/');
+    return value < 0x80 ? (unsigned char)value : 0;
+}
+
+/**
+ * Narrows UTF-16 code units to one byte each (see utf16_unit_byte), one at a time
+ * @param data The UTF-16 text
+ * @param units Number of code units to narrow
+ * @param big_endian Non-zero for UTF-16BE
+ * @param output Receives units bytes
+ */
+static void narrow_utf16_scalar(const char *data, size_t units, int big_endian, char *output) {
+    for (size_t i = 0; i < units; i++) {
+        output[i] = (char)utf16_unit_byte(data, i, big_endian);
     }
-    old_filename = (old_filename != NULL) ? old_filename + 1 : old_path;
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Narrows UTF-16 code units to one byte each, 16 at a time: a saturating pack
+ * keeps units below 0x100 and turns the rest into 0x00 or 0xFF, and every
+ * byte with its top bit set is then cleared, leaving exactly the ASCII units
+ * @param data The UTF-16 text
+ * @param units Number of code units to narrow
+ * @param big_endian Non-zero for UTF-16BE
+ * @param output Receives units bytes
+ */
+__attribute__((target("sse2")))
+static void narrow_utf16_sse2(const char *data, size_t units, int big_endian, char *output) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
     
-    const char *new_filename = strrchr(final_path, '\\');
-    if (new_filename == NULL) {
-        new_filename = strrchr(final_path, '/');
+    for (; i + 16 <= units; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i * 2 + 16));
+        if (big_endian) {
+            a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+            b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+        }
+        __m128i packed = _mm_packus_epi16(a, b);
+        _mm_storeu_si128((__m128i*)(output + i), _mm_andnot_si128(_mm_cmplt_epi8(packed, zero), packed));
     }
-    new_filename = (new_filename != NULL) ? new_filename + 1 : final_path;
-    
-    printf("Renamed: %s -> %s\n", old_filename, new_filename);
-    stats->renamed_files++;
     
-    return 0;
+    narrow_utf16_scalar(data + i * 2, units - i, big_endian, output + i);
 }
+#endif
 
-// File Processing Module Implementation
+// UTF-16 narrowing kernel; chosen once at startup by select_pattern_scanner
+static void (*g_utf16_narrower)(const char *data, size_t units, int big_endian, char *output) = narrow_utf16_scalar;
 
 /**
- * Reads entire file content into memory
- * @param filepath The path to the file to read
- * @return Allocated buffer containing file content, or NULL on error
- *         Caller is responsible for freeing the returned buffer
+ * Selects the fastest pattern scanning kernel the CPU supports (via cpuid).
+ * Must run before worker threads start; until then the scalar kernel is used.
  */
-static char* read_file_content(const char *filepath) {
-    if (filepath == NULL) {
-        fprintf(stderr, "Error: Invalid filepath parameter\n");
-        return NULL;
-    }
+static void select_pattern_scanner(void) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
     
-    // Open file for reading
-    FILE *fp = fopen(filepath, "rb");
-    if (fp == NULL) {
-        fprintf(stderr, "Error: Cannot open file '%s': %s\n", filepath, strerror(errno));
-        return NULL;
+    if (__builtin_cpu_supports("avx2")) {
+        g_pattern_scanner = find_rj_pattern_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        g_pattern_scanner = find_rj_pattern_sse2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        g_utf16_narrower = narrow_utf16_sse2;
     }
+#endif
+}
+
+// Pattern Set Module Implementation
+
+/**
+ * Checks whether a byte may appear in a literal part of an ID. IDs become
+ * file names, so path separators, control characters and the characters
+ * Windows forbids in names are refused.
+ * @param c The byte
+ * @return 1 if allowed, 0 otherwise
+ */
+static int is_valid_id_byte(unsigned char c) {
+    return c >= 0x20 && c != 0x7f && strchr("/\\<>:\"|?*", c) == NULL;
+}
+
+/**
+ * Compiles one ID format spec. A spec is a template: '#' stands for an ASCII
+ * digit, '@' for an uppercase ASCII letter, '\' makes the next character
+ * literal, and "{n}" repeats the preceding element n times. Everything else
+ * matches itself, so the built-in format is "RJ-####-#####" (or "RJ-#{4}-#{5}").
+ * @param spec The spec text
+ * @param format The format to fill
+ * @return 0 on success, -1 if the spec is invalid (already reported)
+ */
+static int pattern_format_parse(const char *spec, PatternFormat *format) {
+    const size_t MAX_LEN = PATTERN_MAX_LENGTH - 1;
+    const char *problem = NULL;
     
-    // Get file size
-    if (fseek(fp, 0, SEEK_END) != 0) {
-        fprintf(stderr, "Error: Cannot seek in file '%s': %s\n", filepath, strerror(errno));
-        fclose(fp);
-        return NULL;
+    memset(format, 0, sizeof(*format));
+    if (strlen(spec) >= sizeof(format->spec)) {
+        fprintf(stderr, "Error: Invalid pattern '%s': spec is too long\n", spec);
+        return -1;
     }
+    strcpy(format->spec, spec);
     
-    long file_size = ftell(fp);
-    if (file_size < 0) {
-        fprintf(stderr, "Error: Cannot determine size of file '%s': %s\n", filepath, strerror(errno));
-        fclose(fp);
-        return NULL;
+    for (const char *p = spec; *p != '\0' && problem == NULL; ) {
+        uint8_t position[32];
+        memset(position, 0, sizeof(position));
+        
+        if (*p == '#' || *p == '@') {
+            char first = *p == '#' ? '0' : 'A';
+            char last = *p == '#' ? '9' : 'Z';
+            for (int c = first; c <= last; c++) {
+                position[c >> 3] |= (uint8_t)(1u << (c & 7));
+            }
+            p++;
+        } else if (*p == '{' || *p == '}') {
+            problem = "'{' must follow an element and hold a count";
+            break;
+        } else {
+            if (*p == '\\') {
+                p++;
+            }
+            if (*p == '\0' || !is_valid_id_byte((unsigned char)*p)) {
+                problem = "character not allowed in a file name";
+                break;
+            }
+            position[(unsigned char)*p >> 3] |= (uint8_t)(1u << (*p & 7));
+            p++;
+        }
+        
+        // Optional repeat count
+        long repeat = 1;
+        if (*p == '{') {
+            char *end = NULL;
+            repeat = strtol(p + 1, &end, 10);
+            if (end == p + 1 || *end != '}' || repeat < 1 || repeat > (long)MAX_LEN) {
+                problem = "invalid repeat count";
+                break;
+            }
+            p = end + 1;
+        }
+        
+        if (format->length + (size_t)repeat > MAX_LEN) {
+            problem = "IDs longer than 31 characters are not supported";
+            break;
+        }
+        while (repeat-- > 0) {
+            memcpy(format->positions[format->length++], position, sizeof(position));
+        }
     }
     
-    if (fseek(fp, 0, SEEK_SET) != 0) {
-        fprintf(stderr, "Error: Cannot seek to beginning of file '%s': %s\n", filepath, strerror(errno));
-        fclose(fp);
-        return NULL;
+    if (problem == NULL && format->length == 0) {
+        problem = "spec is empty";
+    }
+    if (problem != NULL) {
+        fprintf(stderr, "Error: Invalid pattern '%s': %s\n", spec, problem);
+        return -1;
     }
     
-    // Allocate buffer for file content (plus null terminator)
-    char *content = (char*)malloc(file_size + 1);
-    if (content == NULL) {
-        fprintf(stderr, "Error: Cannot allocate memory for file '%s' (%ld bytes)\n", filepath, file_size + 1);
-        fclose(fp);
-        return NULL;
+    return 0;
+}
+
+/**
+ * Checks whether a format matches at the given position
+ * @param format The format
+ * @param p Start of the candidate
+ * @param available Bytes readable from p
+ * @return 1 if an ID of this format starts at p, 0 otherwise
+ */
+static int pattern_format_matches_at(const PatternFormat *format, const char *p, size_t available) {
+    if (available < format->length) {
+        return 0;
     }
     
-    // Read file content
-    size_t bytes_read = fread(content, 1, file_size, fp);
-    if (bytes_read != (size_t)file_size) {
-        if (ferror(fp)) {
-            fprintf(stderr, "Error: Cannot read file '%s': %s\n", filepath, strerror(errno));
-        } else {
-            fprintf(stderr, "Error: Incomplete read of file '%s'\n", filepath);
+    for (size_t i = 0; i < format->length; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (!(format->positions[i][c >> 3] & (1u << (c & 7)))) {
+            return 0;
         }
-        free(content);
-        fclose(fp);
-        return NULL;
     }
     
-    // Null-terminate the content
-    content[file_size] = '\0';
-    
-    fclose(fp);
-    return content;
+    return 1;
 }
 
 /**
- * Processes a single file: reads content, extracts RJ pattern, and renames if found
- * @param filepath The path to the file to process
- * @param stats Statistics structure to update
- * @return 0 on success, -1 on error
+ * Adds a format to a pattern set (before pattern_set_compile)
+ * @param set The pattern set
+ * @param spec The format spec
+ * @return 0 on success, -1 on error (already reported)
  */
-int process_file(const char *filepath, Statistics *stats) {
-    if (filepath == NULL || stats == NULL) {
-        fprintf(stderr, "Error: Invalid parameters to process_file\n");
-        if (stats != NULL) {
-            stats->error_files++;
-        }
+static int pattern_set_add(PatternSet *set, const char *spec) {
+    if (set->count == MAX_PATTERN_FORMATS) {
+        fprintf(stderr, "Error: Too many patterns (at most %d)\n", MAX_PATTERN_FORMATS);
         return -1;
     }
     
-    // Read file content
-    char *content = read_file_content(filepath);
-    if (content == NULL) {
-        // Error already logged by read_file_content
-        stats->error_files++;
+    if (pattern_format_parse(spec, &set->formats[set->count]) != 0) {
+        return -1;
+    }
+    
+    set->count++;
+    return 0;
+}
+
+/**
+ * Adds the formats listed in a file, one spec per line. Blank lines and lines
+ * starting with ';' are ignored, as is whitespace around a spec.
+ * @param set The pattern set
+ * @param path The pattern file
+ * @return 0 on success, -1 on error (already reported)
+ */
+static int pattern_set_load(PatternSet *set, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Cannot open pattern file '%s': %s\n", path, strerror(errno));
         return -1;
     }
     
-    // Extract RJ pattern from content
-    char rj_pattern[RJ_PATTERN_LENGTH];
-    int extract_result = extract_rj_pattern(content, rj_pattern, RJ_PATTERN_LENGTH);
+    char line[PATTERN_SPEC_LENGTH + 2];
+    int result = 0;
     
-    if (extract_result == 0) {
-        // Pattern found - construct new filename
-        char new_filename[MAX_PATH_LENGTH];
-        snprintf(new_filename, MAX_PATH_LENGTH, "%s.txt", rj_pattern);
-        
-        // Attempt to rename the file
-        int rename_result = rename_file(filepath, new_filename, stats);
-        
-        free(content);
-        return rename_result;
-    } else {
-        // No valid RJ pattern found - skip this file
-        const char *filename = strrchr(filepath, '\\');
-        if (filename == NULL) {
-            filename = strrchr(filepath, '/');
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && !feof(file)) {
+            fprintf(stderr, "Error: Line too long in pattern file '%s'\n", path);
+            result = -1;
+            break;
         }
-        filename = (filename != NULL) ? filename + 1 : filepath;
         
-        printf("Skipped: %s (no RJ pattern found)\n", filename);
-        stats->skipped_files++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' ||
+                           line[len - 1] == ' ' || line[len - 1] == '\t')) {
+            line[--len] = '\0';
+        }
+        const char *spec = line;
+        while (*spec == ' ' || *spec == '\t') {
+            spec++;
+        }
         
-        free(content);
-        return 0;
+        if (*spec != '\0' && *spec != ';') {
+            result = pattern_set_add(set, spec);
+        }
+    }
+    
+    if (result == 0 && ferror(file)) {
+        fprintf(stderr, "Error: Cannot read pattern file '%s': %s\n", path, strerror(errno));
+        result = -1;
     }
+    
+    fclose(file);
+    return result;
 }
 
-// Directory Traversal Module Implementation
+/**
+ * Skips bytes that cannot start an ID, one at a time
+ * @param set The compiled pattern set
+ * @param data The bytes to search
+ * @param offset Where to start
+ * @param length Number of bytes in data
+ * @return Offset of the first byte that can start an ID, or length
+ */
+static size_t skip_to_start_scalar(const PatternSet *set, const char *data, size_t offset, size_t length) {
+    while (offset < length && !set->start_byte[(unsigned char)data[offset]]) {
+        offset++;
+    }
+    
+    return offset;
+}
 
+#ifdef HAVE_X86_SIMD
 /**
- * Checks if a filename has a .txt extension (case-insensitive)
- * @param filename The filename to check
- * @return 1 if file ends with .txt, 0 otherwise
+ * Skips bytes that cannot start an ID, 16 at a time: each byte's low and high
+ * nibbles index the two start tables, and a byte can start an ID exactly when
+ * the looked-up bucket masks intersect
+ * @param set The compiled pattern set
+ * @param data The bytes to search
+ * @param offset Where to start
+ * @param length Number of bytes in data
+ * @return Offset of the first byte that can start an ID, or length
  */
-static int is_txt_file(const char *filename) {
-    if (filename == NULL) {
-        return 0;
+__attribute__((target("ssse3")))
+static size_t skip_to_start_ssse3(const PatternSet *set, const char *data, size_t offset, size_t length) {
+    const __m128i low_table = _mm_loadu_si128((const __m128i*)set->start_low);
+    const __m128i high_table = _mm_loadu_si128((const __m128i*)set->start_high);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    
+    for (; offset + 16 <= length; offset += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + offset));
+        __m128i low = _mm_shuffle_epi8(low_table, _mm_and_si128(v, nibble));
+        __m128i high = _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(low, high), zero)) ^ 0xffffu;
+        if (mask != 0) {
+            return offset + (size_t)__builtin_ctz(mask);
+        }
     }
     
-    size_t len = strlen(filename);
+    return skip_to_start_scalar(set, data, offset, length);
+}
+#endif
+
+/**
+ * Builds the nibble tables for the vector start-byte skip. Start bytes are
+ * grouped by high nibble; each distinct set of low nibbles gets one of eight
+ * bucket bits, which keeps the test exact.
+ * @param set The pattern set (start_byte must be filled)
+ * @return 1 if the start bytes fit in eight buckets, 0 otherwise
+ */
+static int build_start_tables(PatternSet *set) {
+    uint16_t low_sets[16];
+    uint16_t buckets[8];
+    int bucket_count = 0;
     
-    // Need at least 5 characters for "a.txt"
-    if (len < 5) {
-        return 0;
+    memset(set->start_low, 0, sizeof(set->start_low));
+    memset(set->start_high, 0, sizeof(set->start_high));
+    
+    for (int high = 0; high < 16; high++) {
+        low_sets[high] = 0;
+        for (int low = 0; low < 16; low++) {
+            if (set->start_byte[high << 4 | low]) {
+                low_sets[high] |= (uint16_t)(1u << low);
+            }
+        }
+        if (low_sets[high] == 0) {
+            continue;
+        }
+        
+        int bucket = 0;
+        while (bucket < bucket_count && buckets[bucket] != low_sets[high]) {
+            bucket++;
+        }
+        if (bucket == bucket_count) {
+            if (bucket_count == 8) {
+                return 0;
+            }
+            buckets[bucket_count++] = low_sets[high];
+        }
+        set->start_high[high] = (uint8_t)(1u << bucket);
     }
     
-    // Get the last 4 characters
-    const char *ext = filename + len - 4;
+    for (int bucket = 0; bucket < bucket_count; bucket++) {
+        for (int low = 0; low < 16; low++) {
+            if (buckets[bucket] & (1u << low)) {
+                set->start_low[low] |= (uint8_t)(1u << bucket);
+            }
+        }
+    }
     
-    // Case-insensitive comparison for Windows
-    if (_stricmp(ext, ".txt") == 0) {
-        return 1;
+    return 1;
+}
+
+// A DFA state during construction: the (format, position) pairs still alive
+typedef struct {
+    uint64_t bits[(MAX_PATTERN_FORMATS * PATTERN_MAX_LENGTH + 63) / 64];
+} MatcherStateSet;
+
+/**
+ * Finds or adds a DFA state during construction
+ * @param states States found so far
+ * @param count Number of states (updated when one is added)
+ * @param table Hash table of state numbers + 1 (0 = empty), MATCHER_HASH_SIZE slots
+ * @param key The state set to look up
+ * @return The state number, or -1 if the state limit is reached
+ */
+static int matcher_state_intern(MatcherStateSet *states, int *count, uint16_t *table, const MatcherStateSet *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof(key->bits) / sizeof(key->bits[0]); i++) {
+        hash = (hash ^ key->bits[i]) * 1099511628211ULL;
     }
     
-    return 0;
+    for (size_t slot = (size_t)(hash % MATCHER_HASH_SIZE); ; slot = (slot + 1) % MATCHER_HASH_SIZE) {
+        if (table[slot] == 0) {
+            if (*count == MAX_MATCHER_STATES) {
+                return -1;
+            }
+            states[*count] = *key;
+            table[slot] = (uint16_t)(++(*count));
+            return *count - 1;
+        }
+        if (memcmp(&states[table[slot] - 1], key, sizeof(*key)) == 0) {
+            return table[slot] - 1;
+        }
+    }
 }
 
 /**
- * Recursively processes a directory and all its subdirectories
- * @param dir_path The directory path to process
- * @param stats Statistics structure to update
- * @return 0 on success, -1 on error
+ * Compiles the formats of a pattern set into one DFA. Each DFA state is the
+ * set of (format, position) pairs a scan can be in; every byte also starts
+ * a fresh attempt at each format, so the automaton finds IDs anywhere. A
+ * state accepts when some format has matched its last position there.
+ * @param set The pattern set (formats added)
+ * @return 0 on success, -1 on error (already reported)
  */
-int process_directory(const char *dir_path, Statistics *stats) {
-    if (dir_path == NULL || stats == NULL) {
-        fprintf(stderr, "Error: Invalid parameters to process_directory\n");
-        return -1;
+static int pattern_set_compile(PatternSet *set) {
+    const int SLOTS = PATTERN_MAX_LENGTH;  // Bit index of (format f, position p) is f * SLOTS + p
+    
+    set->max_length = 0;
+    set->hash = 14695981039346656037ULL;
+    for (int f = 0; f < set->count; f++) {
+        if (set->formats[f].length > set->max_length) {
+            set->max_length = set->formats[f].length;
+        }
+        for (const char *p = set->formats[f].spec; ; p++) {
+            set->hash = (set->hash ^ (unsigned char)*p) * 1099511628211ULL;
+            if (*p == '\0') {
+                break;
+            }
+        }
     }
+    set->builtin = set->count == 1 && strcmp(set->formats[0].spec, DEFAULT_PATTERN_SPEC) == 0;
     
-    // Construct search pattern (directory\*)
-    char search_pattern[MAX_PATH_LENGTH];
-    size_t dir_len = strlen(dir_path);
+    // Byte classes: bytes accepted by exactly the same positions are interchangeable
+    MatcherStateSet signatures[256];
+    int representative[256];
+    set->class_count = 0;
+    for (int c = 0; c < 256; c++) {
+        MatcherStateSet signature;
+        memset(&signature, 0, sizeof(signature));
+        for (int f = 0; f < set->count; f++) {
+            for (size_t p = 0; p < set->formats[f].length; p++) {
+                if (set->formats[f].positions[p][c >> 3] & (1u << (c & 7))) {
+                    size_t bit = (size_t)f * SLOTS + p;
+                    signature.bits[bit / 64] |= 1ULL << (bit % 64);
+                }
+            }
+        }
+        
+        int cls = 0;
+        while (cls < set->class_count && memcmp(&signatures[cls], &signature, sizeof(signature)) != 0) {
+            cls++;
+        }
+        if (cls == set->class_count) {
+            signatures[cls] = signature;
+            representative[cls] = c;
+            set->class_count++;
+        }
+        set->byte_class[c] = (uint8_t)cls;
+        set->start_byte[c] = 0;
+    }
     
-    if (dir_len >= MAX_PATH_LENGTH - 3) {
-        fprintf(stderr, "Error: Directory path too long: %s\n", dir_path);
+    // Subset construction, breadth first from the empty state
+    MatcherStateSet *states = (MatcherStateSet*)calloc(MAX_MATCHER_STATES, sizeof(MatcherStateSet));
+    uint16_t *table = (uint16_t*)calloc(MATCHER_HASH_SIZE, sizeof(uint16_t));
+    set->transitions = (uint16_t*)malloc((size_t)MAX_MATCHER_STATES * set->class_count * sizeof(uint16_t));
+    set->accepts = (uint16_t*)calloc(MAX_MATCHER_STATES, sizeof(uint16_t));
+    if (states == NULL || table == NULL || set->transitions == NULL || set->accepts == NULL) {
+        fprintf(stderr, "Error: Cannot allocate memory for the pattern matcher\n");
+        free(states);
+        free(table);
         return -1;
     }
     
-    // Copy directory path and ensure it ends with backslash
-    strncpy(search_pattern, dir_path, MAX_PATH_LENGTH - 3);
-    search_pattern[MAX_PATH_LENGTH - 3] = '\0';
+    MatcherStateSet empty;
+    memset(&empty, 0, sizeof(empty));
+    set->state_count = 0;
+    matcher_state_intern(states, &set->state_count, table, &empty);
     
-    if (dir_len > 0 && search_pattern[dir_len - 1] != '\\' && search_pattern[dir_len - 1] != '/') {
-        strncat(search_pattern, "\\", MAX_PATH_LENGTH - strlen(search_pattern) - 1);
+    int result = 0;
+    for (int state = 0; state < set->state_count && result == 0; state++) {
+        for (int cls = 0; cls < set->class_count; cls++) {
+            int c = representative[cls];
+            MatcherStateSet next;
+            memset(&next, 0, sizeof(next));
+            
+            for (int f = 0; f < set->count; f++) {
+                const PatternFormat *format = &set->formats[f];
+                for (size_t p = 0; p < format->length; p++) {
+                    size_t bit = (size_t)f * SLOTS + p;
+                    int alive = p == 0 || (states[state].bits[bit / 64] & (1ULL << (bit % 64)));
+                    if (alive && (format->positions[p][c >> 3] & (1u << (c & 7)))) {
+                        next.bits[(bit + 1) / 64] |= 1ULL << ((bit + 1) % 64);
+                    }
+                }
+            }
+            
+            int target = matcher_state_intern(states, &set->state_count, table, &next);
+            if (target < 0) {
+                fprintf(stderr, "Error: Pattern set is too complex (more than %d matcher states)\n",
+                        MAX_MATCHER_STATES);
+                result = -1;
+                break;
+            }
+            set->transitions[(size_t)state * set->class_count + cls] = (uint16_t)target;
+            if (state == 0 && target != 0) {
+                for (int b = 0; b < 256; b++) {
+                    if (set->byte_class[b] == cls) {
+                        set->start_byte[b] = 1;
+                    }
+                }
+            }
+        }
+        
+        for (int f = 0; f < set->count; f++) {
+            size_t bit = (size_t)f * SLOTS + set->formats[f].length;
+            if (states[state].bits[bit / 64] & (1ULL << (bit % 64))) {
+                set->accepts[state] |= (uint16_t)(1u << f);
+            }
+        }
     }
     
-    strncat(search_pattern, "*", MAX_PATH_LENGTH - strlen(search_pattern) - 1);
-    
-    // Start directory enumeration
-    WIN32_FIND_DATAA find_data;
-    HANDLE hFind = FindFirstFileA(search_pattern, &find_data);
+    free(states);
+    free(table);
     
-    if (hFind == INVALID_HANDLE_VALUE) {
-        DWORD error = GetLastError();
-        if (error == ERROR_FILE_NOT_FOUND) {
-            // Empty directory is not an error
-            return 0;
-        }
-        fprintf(stderr, "Error: Cannot open directory '%s': Error code %lu\n", dir_path, error);
-        return -1;
+    set->skip = skip_to_start_scalar;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (build_start_tables(set) && __builtin_cpu_supports("ssse3")) {
+        set->skip = skip_to_start_ssse3;
     }
+#else
+    build_start_tables(set);
+#endif
+
+    return result;
+}
+
+/**
+ * Releases a compiled pattern set
+ * @param set The pattern set
+ */
+static void pattern_set_free(PatternSet *set) {
+    free(set->transitions);
+    free(set->accepts);
+    set->transitions = NULL;
+    set->accepts = NULL;
+    set->count = 0;
+}
+
+/**
+ * Runs a compiled pattern set's DFA over a buffer. The scan stops at the first
+ * byte where some ID ends; if several formats end there, the one listed first
+ * wins. Reporting the earliest end rather than the earliest start keeps the
+ * result independent of how a file is split into scan windows.
+ * @param set The compiled pattern set
+ * @param data The bytes to search
+ * @param length Number of bytes in data
+ * @param match_length Receives the length of the match
+ * @return Pointer to the start of the match, or NULL if there is none
+ */
+static const char *find_pattern_dfa(const PatternSet *set, const char *data, size_t length, size_t *match_length) {
+    const uint16_t *transitions = set->transitions;
+    const uint8_t *byte_class = set->byte_class;
+    const size_t classes = (size_t)set->class_count;
+    unsigned state = 0;
     
-    // Process each entry in the directory
-    do {
-        // Skip "." and ".." entries
-        if (strcmp(find_data.cFileName, ".") == 0 || strcmp(find_data.cFileName, "..") == 0) {
-            continue;
-        }
-        
-        // Construct full path for this entry
-        char full_path[MAX_PATH_LENGTH];
-        size_t base_len = strlen(dir_path);
-        
-        // Check if path will exceed MAX_PATH
-        if (base_len + strlen(find_data.cFileName) + 2 >= MAX_PATH_LENGTH) {
-            fprintf(stderr, "Error: Path too long, skipping: %s\\%s\n", dir_path, find_data.cFileName);
-            stats->error_files++;
-            continue;
+    for (size_t i = 0; i < length; i++) {
+        if (state == 0) {
+            i = set->skip(set, data, i, length);
+            if (i == length) {
+                break;
+            }
         }
         
-        // Build full path
-        strncpy(full_path, dir_path, MAX_PATH_LENGTH - 1);
-        full_path[MAX_PATH_LENGTH - 1] = '\0';
-        
-        if (base_len > 0 && full_path[base_len - 1] != '\\' && full_path[base_len - 1] != '/') {
-            strncat(full_path, "\\", MAX_PATH_LENGTH - strlen(full_path) - 1);
+        state = transitions[state * classes + byte_class[(unsigned char)data[i]]];
+        if (set->accepts[state] != 0) {
+            int f = 0;
+            while (!(set->accepts[state] & (1u << f))) {
+                f++;
+            }
+            size_t len = set->formats[f].length;
+            *match_length = len;
+            return data + i + 1 - len;
         }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Finds the first ID of the configured pattern set in a buffer that need not
+ * be NUL-terminated. The built-in RJ format alone goes through its dedicated
+ * (vectorised) kernels; any other set runs the compiled DFA.
+ * @param data The bytes to search
+ * @param length Number of bytes in data
+ * @param match_length Receives the length of the match
+ * @return Pointer to the start of the match, or NULL if there is none
+ */
+static const char *find_pattern(const char *data, size_t length, size_t *match_length) {
+    INSTRUMENT_BEGIN(started);
+    const char *match;
+    
+    if (g_patterns.builtin) {
+        match = g_pattern_scanner(data, length);
+        *match_length = RJ_PATTERN_LENGTH - 1;
+    } else {
+        match = find_pattern_dfa(&g_patterns, data, length, match_length);
+    }
+    
+    INSTRUMENT_END(PHASE_SCAN, started);
+    return match;
+}
+
+/**
+ * Copies a match into a NUL-terminated output buffer
+ * @param match Start of the match
+ * @param match_length Its length
+ * @param output Buffer of at least PATTERN_MAX_LENGTH bytes
+ */
+static void copy_match(const char *match, size_t match_length, char *output) {
+    memcpy(output, match, match_length);
+    output[match_length] = '\0';
+}
+
+/**
+ * Finds the first ID of a pattern set in UTF-16 text without converting the
+ * text: code units are narrowed a window at a time into a small stack buffer
+ * (see utf16_unit_byte) and handed to the same kernels as single-byte text,
+ * so wide files scan at the speed of narrow ones. Windows overlap by one less
+ * than the longest ID.
+ * @param set The compiled pattern set
+ * @param data The UTF-16 text
+ * @param length Number of bytes in data (a trailing odd byte is ignored)
+ * @param big_endian Non-zero for UTF-16BE
+ * @param match_length Receives the length of the match in code units
+ * @return Pointer to the first byte of the match, or NULL if there is none
+ */
+static const char *find_pattern_utf16(const PatternSet *set, const char *data, size_t length, int big_endian,
+                                      size_t *match_length) {
+    char window[PATTERN_MAX_LENGTH + UTF16_WINDOW_UNITS];
+    const size_t units = length / 2;
+    const size_t carry_units = set->max_length - 1;
+    size_t carry = 0;
+    
+    for (size_t unit = 0; unit < units; ) {
+        size_t count = units - unit < UTF16_WINDOW_UNITS ? units - unit : UTF16_WINDOW_UNITS;
+        g_utf16_narrower(data + unit * 2, count, big_endian, window + carry);
         
-        strncat(full_path, find_data.cFileName, MAX_PATH_LENGTH - strlen(full_path) - 1);
-        
-        // Check if this is a directory
-        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            // Recursively process subdirectory
-            process_directory(full_path, stats);
+        size_t available = carry + count;
+        const char *match;
+        if (set->builtin) {
+            match = g_pattern_scanner(window, available);
+            *match_length = RJ_PATTERN_LENGTH - 1;
         } else {
-            // Check if this is a .txt file
-            if (is_txt_file(find_data.cFileName)) {
-                stats->total_files++;
-                process_file(full_path, stats);
-            }
+            match = find_pattern_dfa(set, window, available, match_length);
+        }
+        if (match != NULL) {
+            return data + (unit - carry + (size_t)(match - window)) * 2;
         }
         
-    } while (FindNextFileA(hFind, &find_data) != 0);
+        unit += count;
+        carry = available < carry_units ? available : carry_units;
+        memmove(window, window + available - carry, carry);
+    }
     
-    // Check if loop ended due to error or normal completion
-    DWORD error = GetLastError();
-    if (error != ERROR_NO_MORE_FILES) {
-        fprintf(stderr, "Error: Error reading directory '%s': Error code %lu\n", dir_path, error);
-        FindClose(hFind);
-        return -1;
+    return NULL;
+}
+
+/**
+ * Tells the encoding of a file from its first bytes. A UTF-16 byte order
+ * mark settles it; without one, text that is mostly ASCII in UTF-16 has a
+ * zero in every other byte, which single-byte text practically never has.
+ * A UTF-8 byte order mark needs no special handling.
+ * @param data The first bytes of the file
+ * @param length Number of bytes available
+ * @return The encoding to scan the file in
+ */
+static TextEncoding detect_text_encoding(const char *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char*)data;
+    
+    if (length >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
+        return TEXT_UTF16LE;
+    }
+    if (length >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) {
+        return TEXT_UTF16BE;
     }
     
-    // Clean up handle
-    FindClose(hFind);
+    size_t pairs = (length < ENCODING_SAMPLE_BYTES ? length : ENCODING_SAMPLE_BYTES) / 2;
+    size_t even_zeros = 0;
+    size_t odd_zeros = 0;
+    for (size_t i = 0; i < pairs; i++) {
+        even_zeros += bytes[i * 2] == 0;
+        odd_zeros += bytes[i * 2 + 1] == 0;
+    }
     
-    return 0;
+    if (pairs >= 4 && odd_zeros * 2 >= pairs && even_zeros * 8 <= pairs) {
+        return TEXT_UTF16LE;
+    }
+    if (pairs >= 4 && even_zeros * 2 >= pairs && odd_zeros * 8 <= pairs) {
+        return TEXT_UTF16BE;
+    }
+    return TEXT_NARROW;
 }
 
-// Main Entry Point Implementation
-
 /**
- * Validates command-line arguments
- * @param argc Argument count
- * @param argv Argument values
- * @return 0 if valid, non-zero error code if invalid
+ * Finds the first ID of the configured pattern set in text of a known encoding
+ * @param data The text
+ * @param length Number of bytes in data
+ * @param encoding Its encoding (see detect_text_encoding)
+ * @param match_length Receives the length of the match in code units
+ * @return Pointer to the first byte of the match, or NULL if there is none
  */
-static int validate_arguments(int argc, char *argv[]) {
-    // Check for exactly 2 arguments (program name + directory path)
-    if (argc != 2) {
-        fprintf(stderr, "Error: Invalid number of arguments\n");
-        fprintf(stderr, "Usage: %s <directory_path>\n", argv[0]);
-        fprintf(stderr, "\nDescription:\n");
-        fprintf(stderr, "  Recursively processes .txt files in the specified directory,\n");
-        fprintf(stderr, "  extracting RJ-YYYY-NNNNN patterns from file contents and renaming\n");
-        fprintf(stderr, "  files accordingly.\n");
-        fprintf(stderr, "\nExample:\n");
-        fprintf(stderr, "  %s C:\\test_files\n", argv[0]);
-        fprintf(stderr, "  %s .\\testing\n", argv[0]);
-        return 1;
+static const char *find_encoded_pattern(const char *data, size_t length, TextEncoding encoding,
+                                        size_t *match_length) {
+    if (encoding == TEXT_NARROW) {
+        return find_pattern(data, length, match_length);
     }
     
-    const char *dir_path = argv[1];
+    INSTRUMENT_BEGIN(started);
+    const char *match = find_pattern_utf16(&g_patterns, data, length, encoding == TEXT_UTF16BE, match_length);
+    INSTRUMENT_END(PHASE_SCAN, started);
+    return match;
+}
+
+/**
+ * Copies a match of any encoding into a NUL-terminated output buffer. IDs are
+ * ASCII, so a UTF-16 match narrows to the low byte of each code unit.
+ * @param match Start of the match
+ * @param match_length Its length in code units
+ * @param encoding The encoding of the text
+ * @param output Buffer of at least PATTERN_MAX_LENGTH bytes
+ */
+static void copy_encoded_match(const char *match, size_t match_length, TextEncoding encoding, char *output) {
+    if (encoding == TEXT_NARROW) {
+        copy_match(match, match_length, output);
+        return;
+    }
     
-    // Validate that the provided path exists
-    DWORD attributes = GetFileAttributesA(dir_path);
+    for (size_t i = 0; i < match_length; i++) {
+        output[i] = (char)utf16_unit_byte(match, i, encoding == TEXT_UTF16BE);
+    }
+    output[match_length] = '\0';
+}
+
+// Platform Module Implementation
+
+/**
+ * Returns the separator to print between a directory path and an entry name
+ * @param dir_path The directory path
+ * @return Empty string if the path already ends with a separator, PATH_SEPARATOR otherwise
+ */
+static const char *entry_separator(const char *dir_path) {
+    size_t len = strlen(dir_path);
     
-    if (attributes == INVALID_FILE_ATTRIBUTES) {
-        fprintf(stderr, "Error: Directory '%s' does not exist or cannot be accessed: %s\n", 
-                dir_path, strerror(errno));
-        return 2;
+    if (len > 0 && (dir_path[len - 1] == '\\' || dir_path[len - 1] == '/')) {
+        return "";
     }
     
-    // Validate that it's a directory, not a file
-    if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
-        fprintf(stderr, "Error: '%s' is not a directory\n", dir_path);
-        return 2;
+    return PATH_SEPARATOR;
+}
+
+/**
+ * Strips a root directory from the path of a directory below it
+ * @param root The root as given on the command line
+ * @param path A directory path starting with the root
+ * @return The path relative to the root ("" for the root itself)
+ */
+static const char *relative_path(const char *root, const char *path) {
+    size_t root_length = strlen(root);
+    if (strncmp(path, root, root_length) != 0) {
+        return path;
     }
     
-    return 0;
+    path += root_length;
+    while (*path == '/' || *path == '\\') {
+        path++;
+    }
+    return path;
 }
 
+#ifdef _WIN32
 /**
- * Main entry point for the File Renaming Utility
- * @param argc Argument count
- * @param argv Argument values
- * @return 0 on success, non-zero on error
+ * Makes room for a path of the given length plus its terminator
+ * @param builder The path builder
+ * @param length Path length needed
+ * @return 0 on success, -1 on allocation failure
  */
-int main(int argc, char *argv[]) {
-    // Validate command-line arguments
-    int validation_result = validate_arguments(argc, argv);
-    if (validation_result != 0) {
-        return validation_result;
+static int path_builder_reserve(PathBuilder *builder, size_t length) {
+    if (length < builder->capacity) {
+        return 0;
     }
     
-    const char *target_directory = argv[1];
+    size_t capacity = builder->capacity ? builder->capacity : 256;
+    while (capacity <= length) {
+        capacity *= 2;
+    }
     
-    // Initialize statistics structure
-    Statistics stats = {0, 0, 0, 0};
+    char *data = (char*)realloc(builder->data, capacity);
+    if (data == NULL) {
+        return -1;
+    }
     
-    // Display starting message
-    printf("File Renaming Utility\n");
-    printf("=====================\n");
-    printf("Processing directory: %s\n\n", target_directory);
+    builder->data = data;
+    builder->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Replaces the builder's contents with a path
+ * @param builder The path builder
+ * @param path The new path
+ * @return 0 on success, -1 on allocation failure
+ */
+static int path_builder_set(PathBuilder *builder, const char *path) {
+    size_t length = strlen(path);
+    
+    if (path_builder_reserve(builder, length) != 0) {
+        return -1;
+    }
+    
+    memcpy(builder->data, path, length + 1);
+    builder->length = length;
+    return 0;
+}
+
+/**
+ * Appends one component, with a separator unless the path already ends in one.
+ * Only the new component is copied; note builder->length beforehand to undo it
+ * with path_builder_truncate.
+ * @param builder The path builder
+ * @param name The component to append
+ * @return 0 on success, -1 on allocation failure
+ */
+static int path_builder_append(PathBuilder *builder, const char *name) {
+    size_t name_len = strlen(name);
+    int needs_separator = builder->length > 0 &&
+                          builder->data[builder->length - 1] != '\\' &&
+                          builder->data[builder->length - 1] != '/';
+    
+    if (path_builder_reserve(builder, builder->length + (size_t)needs_separator + name_len) != 0) {
+        return -1;
+    }
+    
+    if (needs_separator) {
+        builder->data[builder->length++] = PATH_SEPARATOR[0];
+    }
+    memcpy(builder->data + builder->length, name, name_len + 1);
+    builder->length += name_len;
+    return 0;
+}
+
+/**
+ * Cuts the path back to an earlier length, dropping the components after it
+ * @param builder The path builder
+ * @param length Length noted before the components were appended
+ */
+static void path_builder_truncate(PathBuilder *builder, size_t length) {
+    if (builder->data != NULL && length <= builder->length) {
+        builder->data[length] = '\0';
+        builder->length = length;
+    }
+}
+
+/**
+ * Frees a path builder's storage
+ * @param builder The path builder
+ */
+static void path_builder_free(PathBuilder *builder) {
+    free(builder->data);
+    builder->data = NULL;
+    builder->length = 0;
+    builder->capacity = 0;
+}
+
+/**
+ * Builds the full path of a directory entry in one of this thread's reusable
+ * path buffers, for the Windows calls that take paths
+ * @param dir The directory containing the entry
+ * @param name The entry name
+ * @param slot Which buffer to use (0 or 1), so two paths can be live at once
+ * @return The full path, or NULL on allocation failure (errno is set)
+ */
+static const char *entry_path(const DirRef *dir, const char *name, int slot) {
+    static THREAD_LOCAL PathBuilder paths[2];
+    PathBuilder *builder = &paths[slot];
+    
+    if (path_builder_set(builder, dir->path) != 0 || path_builder_append(builder, name) != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    
+    return builder->data;
+}
+#else
+/**
+ * Opens a directory below another one by walking its path one component at
+ * a time, so any depth can be reached
+ * @param dir_fd The directory the path is relative to
+ * @param relative Path relative to dir_fd
+ * @param flags Extra open flags for every component (e.g. O_NOFOLLOW)
+ * @return Directory file descriptor, or -1 on error (errno is set)
+ */
+static int open_directory_components(int dir_fd, const char *relative, int flags) {
+    int fd = -1;
+    int current = dir_fd;
+    const char *component = relative;
+    
+    while (*component != '\0') {
+        const char *end = strchr(component, '/');
+        size_t length = end ? (size_t)(end - component) : strlen(component);
+        
+        if (length > 0) {
+            char name[MAX_NAME_LENGTH];
+            if (length >= sizeof(name)) {
+                fd = -1;
+                errno = ENAMETOOLONG;
+            } else {
+                memcpy(name, component, length);
+                name[length] = '\0';
+                fd = openat(current, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | flags);
+            }
+            
+            int saved_errno = errno;
+            if (current != dir_fd) {
+                close(current);
+            }
+            if (fd < 0) {
+                errno = saved_errno;
+                return -1;
+            }
+            current = fd;
+        }
+        
+        component += length + (end != NULL);
+    }
+    
+    return (current == dir_fd) ? openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) : current;
+}
+
+/**
+ * Opens a directory below another one. Paths too long for a single openat()
+ * are walked one component at a time, so any depth can be reached.
+ * @param dir_fd The directory the path is relative to
+ * @param relative Path relative to dir_fd
+ * @return Directory file descriptor, or -1 on error (errno is set)
+ */
+static int open_directory_at(int dir_fd, const char *relative) {
+    int fd = openat(dir_fd, relative, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0 || errno != ENAMETOOLONG) {
+        return fd;
+    }
+    
+    return open_directory_components(dir_fd, relative, 0);
+}
+
+/**
+ * Raises the soft limit on open descriptors to the hard limit. Every directory
+ * between the root and the one being enumerated can hold a descriptor while
+ * its siblings wait, so deep trees need more than the usual default of 1024.
+ */
+static void raise_descriptor_limit(void) {
+    struct rlimit limit;
+    
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+#endif
+
+/**
+ * Opens a directory entry for binary reading. Files are read through plain
+ * descriptors: a stdio stream would cost a heap allocation per file.
+ * @param dir The directory containing the entry
+ * @param name The entry name
+ * @return File descriptor, or -1 on error (errno is set)
+ */
+static int open_entry(const DirRef *dir, const char *name) {
+#ifdef _WIN32
+    const char *full_path = entry_path(dir, name, 0);
+    
+    if (full_path == NULL) {
+        return -1;
+    }
+    return _open(full_path, _O_RDONLY | _O_BINARY);
+#else
+    return openat(dir->fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+#endif
+}
+
+/**
+ * Reads from an entry opened by open_entry, retrying reads interrupted by signals
+ * @param fd The entry's descriptor
+ * @param buffer Where to store the bytes
+ * @param size Bytes wanted
+ * @return Bytes read (fewer than size near the end of the file, 0 at its end), or -1 on error
+ */
+static long long read_entry(int fd, char *buffer, size_t size) {
+#ifdef _WIN32
+    return _read(fd, buffer, (unsigned int)size);
+#else
+    ssize_t bytes;
+    
+    do {
+        bytes = read(fd, buffer, size);
+    } while (bytes < 0 && errno == EINTR);
+    
+    return bytes;
+#endif
+}
+
+/**
+ * Closes an entry opened by open_entry
+ * @param fd The entry's descriptor
+ */
+static void close_entry(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+/**
+ * Moves an entry to another directory (or another name in the same one)
+ * without ever replacing an existing entry
+ * @param from The directory containing the entry
+ * @param old_name The current entry name
+ * @param to The directory to move the entry to
+ * @param new_name The new entry name
+ * @return 0 on success, -1 on error (errno is EEXIST if the target appeared meanwhile)
+ */
+static int move_entry_noreplace(const DirRef *from, const char *old_name, const DirRef *to, const char *new_name) {
+#ifdef _WIN32
+    const char *old_path = entry_path(from, old_name, 0);
+    const char *new_path = entry_path(to, new_name, 1);
+    
+    if (old_path == NULL || new_path == NULL) {
+        return -1;
+    }
+    
+    // MoveFile semantics: fails instead of replacing an existing file
+    return rename(old_path, new_path);
+#else
+#if defined(__linux__) && defined(SYS_renameat2)
+    if (syscall(SYS_renameat2, from->fd, old_name, to->fd, new_name, RENAME_NOREPLACE) == 0) {
+        return 0;
+    }
+    
+    // Only fall back when the kernel or file system lacks RENAME_NOREPLACE
+    if (errno != ENOSYS && errno != EINVAL) {
+        return -1;
+    }
+#endif
+    // POSIX rename() silently replaces the target; refuse if it is already there
+    struct stat st;
+    if (fstatat(to->fd, new_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    
+    return renameat(from->fd, old_name, to->fd, new_name);
+#endif
+}
+
+/**
+ * Renames an entry within its directory without ever replacing an existing entry
+ * @param dir The directory containing the entry
+ * @param old_name The current entry name
+ * @param new_name The new entry name
+ * @return 0 on success, -1 on error (errno is EEXIST if the target appeared meanwhile)
+ */
+static int rename_entry_noreplace(const DirRef *dir, const char *old_name, const char *new_name) {
+#ifdef _WIN32
+    return move_entry_noreplace(dir, old_name, dir, new_name);
+#else
+    uint64_t started = throttle_begin(THROTTLE_RENAME);
+    int result = move_entry_noreplace(dir, old_name, dir, new_name);
+    throttle_end(THROTTLE_RENAME, started, 1);
+    return result;
+#endif
+}
+
+// Logging Module Implementation
+
+/**
+ * Returns a monotonic timestamp in nanoseconds
+ * @return Nanoseconds since an arbitrary point
+ */
+static uint64_t monotonic_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
+
+#ifndef _WIN32
+/**
+ * Returns the largest resident set size the process has reached so far
+ * @return Peak RSS in bytes, or 0 if unknown
+ */
+static long long peak_resident_bytes(void) {
+    struct rusage usage;
+    
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (long long)usage.ru_maxrss;  // Bytes on macOS
+#else
+    return (long long)usage.ru_maxrss * 1024;  // Kilobytes on Linux and the BSDs
+#endif
+}
+#endif
+
+/**
+ * Sets up logging. Must run before anything is printed and before workers start.
+ * @param log_path File to write file records to, or NULL for standard output
+ * @return 0 on success, -1 if the log file cannot be created
+ */
+static int log_open(const char *log_path) {
+    g_log.stream = stdout;
+#ifndef _WIN32
+    pthread_mutex_init(&g_log.lock, NULL);
+#endif
+
+    if (log_path != NULL) {
+        g_log.stream = fopen(log_path, g_log.format == LOG_FORMAT_BINARY ? "wb" : "w");
+        if (g_log.stream == NULL) {
+            fprintf(stderr, "Error: Cannot create log file '%s': %s\n", log_path, strerror(errno));
+            g_log.stream = stdout;
+            return -1;
+        }
+    }
+    
+    if (g_log.format == LOG_FORMAT_BINARY) {
+        fwrite(LOG_MAGIC, 1, sizeof(LOG_MAGIC) - 1, g_log.stream);
+    }
+    
+    return 0;
+}
+
+/**
+ * Returns whether file records share standard output with the human-readable
+ * banner and summary (which then go to standard error instead)
+ * @return 1 if structured records are written to standard output
+ */
+static int log_owns_stdout(void) {
+    return g_log.format != LOG_FORMAT_TEXT && g_log.stream == stdout;
+}
+
+/**
+ * Writes a buffer's contents to the log stream. stdio locks the stream for
+ * the whole call, so batches from different threads never interleave.
+ * @param buffer The buffer to flush
+ */
+static void log_flush_buffer(LogBuffer *buffer) {
+    if (buffer->used > 0) {
+        fwrite(buffer->data, 1, buffer->used, g_log.stream);
+        buffer->used = 0;
+    }
+}
+
+/**
+ * Writes out the calling thread's buffered records and flushes the stream.
+ * Runs in the log's usual order when a worker finishes; --watch also calls it
+ * whenever it goes idle, so records appear as files are handled.
+ */
+static void log_flush_thread(void) {
+    if (t_log_buffer != NULL && t_log_buffer->used > 0) {
+        log_flush_buffer(t_log_buffer);
+        fflush(g_log.stream);
+    }
+}
+
+/**
+ * Returns room for at least size bytes in the calling thread's log buffer
+ * @param size Bytes needed (at most LOG_BUFFER_SIZE)
+ * @return Pointer to the free space, or NULL if no buffer could be allocated
+ */
+static char *log_reserve(size_t size) {
+    LogBuffer *buffer = t_log_buffer;
+    
+    if (buffer == NULL) {
+        buffer = (LogBuffer*)calloc(1, sizeof(LogBuffer));
+        if (buffer == NULL || (buffer->data = (char*)malloc(LOG_BUFFER_SIZE)) == NULL) {
+            free(buffer);
+            return NULL;
+        }
+#ifndef _WIN32
+        pthread_mutex_lock(&g_log.lock);
+#endif
+        buffer->next = g_log.buffers;
+        g_log.buffers = buffer;
+#ifndef _WIN32
+        pthread_mutex_unlock(&g_log.lock);
+#endif
+        t_log_buffer = buffer;
+    }
+    
+    if (buffer->used + size > LOG_BUFFER_SIZE) {
+        log_flush_buffer(buffer);
+    }
+    
+    return buffer->data + buffer->used;
+}
+
+/**
+ * Appends formatted text to the calling thread's log buffer
+ * @param format printf-style format
+ */
+static void log_printf(const char *format, ...) {
+    char *out = log_reserve(LOG_MAX_LINE);
+    if (out == NULL) {
+        return;
+    }
+    
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(out, LOG_MAX_LINE, format, args);
+    va_end(args);
+    
+    if (length > 0) {
+        t_log_buffer->used += (size_t)length < LOG_MAX_LINE ? (size_t)length : LOG_MAX_LINE - 1;
+    }
+}
+
+/**
+ * Appends JSON-escaped text, without quotes, to a line being built
+ * @param out Output position
+ * @param end End of the output space
+ * @param text The text to encode
+ * @return The new output position
+ */
+static char *json_escape(char *out, char *end, const char *text) {
+    static const char hex[] = "0123456789abcdef";
+    
+    for (const unsigned char *p = (const unsigned char*)text; *p != '\0' && end - out > 8; p++) {
+        if (*p == '"' || *p == '\\') {
+            *out++ = '\\';
+            *out++ = (char)*p;
+        } else if (*p < 0x20) {
+            out += snprintf(out, (size_t)(end - out), "\\u00%c%c", hex[*p >> 4], hex[*p & 15]);
+        } else {
+            *out++ = (char)*p;
+        }
+    }
+    return out;
+}
+
+/**
+ * Appends a JSON string literal (quoted and escaped) to a line being built
+ * @param out Output position
+ * @param end End of the output space
+ * @param text The string to encode (NULL is written as null)
+ * @return The new output position
+ */
+static char *json_append_string(char *out, char *end, const char *text) {
+    if (text == NULL) {
+        return out + snprintf(out, (size_t)(end - out), "null");
+    }
+    
+    *out++ = '"';
+    out = json_escape(out, end, text);
+    *out++ = '"';
+    return out;
+}
+
+/**
+ * Appends an entry's full path as a JSON string literal, straight from its
+ * directory path and name so no intermediate copy limits the length
+ * @param out Output position
+ * @param end End of the output space
+ * @param dir The directory containing the entry
+ * @param name The entry name
+ * @return The new output position
+ */
+static char *json_append_path(char *out, char *end, const DirRef *dir, const char *name) {
+    *out++ = '"';
+    out = json_escape(out, end, dir->path);
+    out = json_escape(out, end, entry_separator(dir->path));
+    out = json_escape(out, end, name);
+    *out++ = '"';
+    return out;
+}
+
+/**
+ * Marks the start of work on a file, for the duration in structured records
+ */
+static void log_file_start(void) {
+    if (g_log.format != LOG_FORMAT_TEXT) {
+        t_log_started_ns = monotonic_ns();
+    }
+}
+
+/**
+ * Logs the outcome of one file. Text lines are only produced with -v (errors
+ * are reported on standard error where they occur); structured formats record
+ * every file.
+ * @param dir The directory containing the file
+ * @param name The file name
+ * @param event What happened to the file
+ * @param pattern The pattern found in the file, or NULL
+ * @param detail The final name (renamed, planned), skip reason (skipped), or the copy or
+ *               quarantine path a duplicate was replaced by (deduplicated), or NULL
+ * @param error errno of a failure, 0 otherwise
+ */
+static void log_file_event(const DirRef *dir, const char *name, LogEvent event, const char *pattern,
+                           const char *detail, int error) {
+    static const char *const event_names[] = { "renamed", "planned", "skipped", "error", "deduplicated" };
+    
+    if (g_log.on_event != NULL) {
+        RenamerEvent record = { (RenamerEventType)event, dir->path, name, pattern, detail, error };
+        g_log.on_event(&record, g_log.user_data);
+        return;
+    }
+    
+    if (g_log.format == LOG_FORMAT_TEXT) {
+        if (g_log.verbosity < 1) {
+            return;
+        }
+        switch (event) {
+            case LOG_EVENT_RENAMED:
+                log_printf("Renamed: %s -> %s\n", name, detail);
+                break;
+            case LOG_EVENT_PLANNED:
+                log_printf("Planned: %s -> %s\n", name, detail);
+                break;
+            case LOG_EVENT_SKIPPED:
+                log_printf("Skipped: %s (%s)\n", name, detail);
+                break;
+            case LOG_EVENT_DEDUPLICATED:
+                log_printf("%s: %s -> %s\n", g_options.dedupe == DEDUPE_LINK ? "Linked" : "Quarantined",
+                           name, detail);
+                break;
+            default:
+                break;
+        }
+        return;
+    }
+    
+    uint64_t duration = t_log_started_ns ? monotonic_ns() - t_log_started_ns : 0;
+    const char *sep = entry_separator(dir->path);
+    
+    if (g_log.format == LOG_FORMAT_BINARY) {
+        size_t path_len = strlen(dir->path) + strlen(sep) + strlen(name);
+        size_t detail_len = detail ? strlen(detail) : 0;
+        if (path_len > UINT16_MAX || detail_len > UINT16_MAX ||
+            sizeof(LogRecord) + path_len + detail_len > LOG_BUFFER_SIZE) {
+            return;
+        }
+        
+        LogRecord record;
+        memset(&record, 0, sizeof(record));
+        record.length = (uint32_t)(sizeof(record) + path_len + detail_len);
+        record.event = (uint8_t)event;
+        record.path_length = (uint16_t)path_len;
+        record.name_length = (uint16_t)detail_len;
+        record.error = (int16_t)error;
+        record.duration_ns = duration;
+        if (pattern != NULL) {
+            strncpy(record.pattern, pattern, sizeof(record.pattern) - 1);
+        }
+        
+        char *out = log_reserve(record.length);
+        if (out == NULL) {
+            return;
+        }
+        memcpy(out, &record, sizeof(record));
+        out += sizeof(record);
+        out += snprintf(out, path_len + 1, "%s%s%s", dir->path, sep, name);
+        if (detail_len > 0) {
+            memcpy(out, detail, detail_len);
+        }
+        t_log_buffer->used += record.length;
+        return;
+    }
+    
+    // JSON lines: escaping can grow a name up to six times
+    size_t worst = 6 * (strlen(dir->path) + strlen(name) + (detail ? strlen(detail) : 0)) + 256;
+    if (worst > LOG_BUFFER_SIZE) {
+        return;
+    }
+    
+    char *start = log_reserve(worst);
+    if (start == NULL) {
+        return;
+    }
+    
+    char *out = start;
+    char *end = start + worst;
+    
+    out += snprintf(out, (size_t)(end - out), "{\"event\":\"%s\",\"path\":", event_names[event]);
+    out = json_append_path(out, end, dir, name);
+    out += snprintf(out, (size_t)(end - out), ",\"pattern\":");
+    out = json_append_string(out, end, pattern);
+    out += snprintf(out, (size_t)(end - out), event == LOG_EVENT_SKIPPED ? ",\"reason\":" : ",\"name\":");
+    out = json_append_string(out, end, detail);
+    out += snprintf(out, (size_t)(end - out), ",\"error\":%d,\"error_text\":", error);
+    out = json_append_string(out, end, error ? strerror(error) : NULL);
+    out += snprintf(out, (size_t)(end - out), ",\"duration_us\":%.3f}\n", (double)duration / 1000.0);
+    
+    t_log_buffer->used += (size_t)(out - start);
+}
+
+/**
+ * Flushes every thread's buffered records and closes the log file. Must run
+ * after all workers have finished.
+ */
+static void log_close(void) {
+    LogBuffer *buffer = g_log.buffers;
+    
+    while (buffer != NULL) {
+        LogBuffer *next = buffer->next;
+        log_flush_buffer(buffer);
+        free(buffer->data);
+        free(buffer);
+        buffer = next;
+    }
+    g_log.buffers = NULL;
+    t_log_buffer = NULL;
+    
+    if (g_log.stream != NULL && g_log.stream != stdout) {
+        int failed = ferror(g_log.stream);
+        if (fclose(g_log.stream) != 0 || failed) {
+            fprintf(stderr, "Warning: Log file '%s' is incomplete\n", g_options.log_path);
+        }
+    }
+    fflush(stdout);
+    g_log.stream = stdout;
+#ifndef _WIN32
+    pthread_mutex_destroy(&g_log.lock);
+#endif
+}
+
+#ifdef RENAME_FILES_INSTRUMENT
+// Instrumentation Module Implementation
+
+static const char *const g_phase_names[PHASE_COUNT] = {
+    "enumerate", "open", "read", "scan", "resolve", "rename", "uring", "journal"
+};
+
+static const char *const g_counter_names[COUNTER_COUNT] = {
+    "bytes_read", "read_calls", "getdents_calls", "stat_calls", "mmap_calls", "uring_enters",
+    "rename_conflicts"
+};
+
+/**
+ * Returns the calling thread's measurements, creating them on first use
+ * @return The thread's Instrument, or NULL if it could not be allocated
+ */
+static Instrument *thread_instrument(void) {
+    if (t_instrument == NULL) {
+        Instrument *instrument = (Instrument*)calloc(1, sizeof(Instrument));
+        if (instrument == NULL) {
+            return NULL;
+        }
+#ifndef _WIN32
+        pthread_mutex_lock(&g_instrument.lock);
+#endif
+        instrument->next = g_instrument.threads;
+        g_instrument.threads = instrument;
+#ifndef _WIN32
+        pthread_mutex_unlock(&g_instrument.lock);
+#endif
+        t_instrument = instrument;
+    }
+    
+    return t_instrument;
+}
+
+/**
+ * Records the duration of one phase
+ * @param phase The phase measured
+ * @param elapsed_ns Its duration in nanoseconds
+ */
+static void instrument_phase(Phase phase, uint64_t elapsed_ns) {
+    Instrument *instrument = thread_instrument();
+    if (instrument == NULL) {
+        return;
+    }
+    
+    // Bucket = number of significant bits, i.e. floor(log2) + 1
+    unsigned bucket = 0;
+#if defined(__GNUC__) || defined(__clang__)
+    bucket = elapsed_ns ? 64 - (unsigned)__builtin_clzll(elapsed_ns) : 0;
+#else
+    for (uint64_t value = elapsed_ns; value != 0; value >>= 1) {
+        bucket++;
+    }
+#endif
+    if (bucket >= HISTOGRAM_BUCKETS) {
+        bucket = HISTOGRAM_BUCKETS - 1;
+    }
+    
+    instrument->count[phase]++;
+    instrument->total_ns[phase] += elapsed_ns;
+    instrument->histogram[phase][bucket]++;
+    if (elapsed_ns > instrument->max_ns[phase]) {
+        instrument->max_ns[phase] = elapsed_ns;
+    }
+}
+
+/**
+ * Adds to a byte or system call counter
+ * @param counter The counter
+ * @param amount The amount to add
+ */
+static void instrument_count(Counter counter, uint64_t amount) {
+    Instrument *instrument = thread_instrument();
+    if (instrument != NULL) {
+        instrument->counters[counter] += amount;
+    }
+}
+
+/**
+ * Sums every thread's measurements. Must run after all workers have finished.
+ * @param total Receives the totals
+ */
+static void instrument_merge(Instrument *total) {
+    memset(total, 0, sizeof(*total));
+    
+    for (const Instrument *thread = g_instrument.threads; thread != NULL; thread = thread->next) {
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            total->count[phase] += thread->count[phase];
+            total->total_ns[phase] += thread->total_ns[phase];
+            if (thread->max_ns[phase] > total->max_ns[phase]) {
+                total->max_ns[phase] = thread->max_ns[phase];
+            }
+            for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+                total->histogram[phase][bucket] += thread->histogram[phase][bucket];
+            }
+        }
+        for (int counter = 0; counter < COUNTER_COUNT; counter++) {
+            total->counters[counter] += thread->counters[counter];
+        }
+    }
+}
+
+/**
+ * Estimates a percentile from a phase's histogram
+ * @param instrument Merged measurements
+ * @param phase The phase
+ * @param percentile The percentile (0-100)
+ * @return Upper bound of the bucket holding the percentile, in nanoseconds
+ */
+static uint64_t instrument_percentile(const Instrument *instrument, Phase phase, double percentile) {
+    uint64_t rank = (uint64_t)((double)instrument->count[phase] * percentile / 100.0);
+    uint64_t seen = 0;
+    
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += instrument->histogram[phase][bucket];
+        if (seen > rank) {
+            uint64_t bound = 1ULL << bucket;
+            return bound < instrument->max_ns[phase] ? bound : instrument->max_ns[phase];
+        }
+    }
+    
+    return instrument->max_ns[phase];
+}
+
+/**
+ * Prints the per-phase timings and counters (--stats=verbose)
+ * @param out Stream to print to
+ */
+static void instrument_report(FILE *out) {
+    Instrument total;
+    instrument_merge(&total);
+    
+    fprintf(out, "\nPhase Timings (p50/p99 are histogram bucket bounds)\n");
+    fprintf(out, "===================================================\n");
+    fprintf(out, "%-10s %10s %12s %10s %10s %10s %10s\n",
+            "phase", "count", "total ms", "mean us", "p50 us", "p99 us", "max us");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        if (total.count[phase] == 0) {
+            continue;
+        }
+        fprintf(out, "%-10s %10llu %12.3f %10.3f %10.3f %10.3f %10.3f\n", g_phase_names[phase],
+                (unsigned long long)total.count[phase],
+                (double)total.total_ns[phase] / 1e6,
+                (double)total.total_ns[phase] / (double)total.count[phase] / 1e3,
+                (double)instrument_percentile(&total, (Phase)phase, 50.0) / 1e3,
+                (double)instrument_percentile(&total, (Phase)phase, 99.0) / 1e3,
+                (double)total.max_ns[phase] / 1e3);
+    }
+    
+    fprintf(out, "\nCounters\n");
+    fprintf(out, "========\n");
+    for (int counter = 0; counter < COUNTER_COUNT; counter++) {
+        fprintf(out, "%-18s %llu\n", g_counter_names[counter], (unsigned long long)total.counters[counter]);
+    }
+}
+
+/**
+ * Writes the per-phase timings, histograms and counters as JSON (--stats-json)
+ * @param path The file to write
+ * @return 0 on success, -1 on error (already reported)
+ */
+static int instrument_save(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Cannot create statistics file '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    Instrument total;
+    instrument_merge(&total);
+    
+    fprintf(file, "{\n  \"phases\": {");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        fprintf(file, "%s\n    \"%s\": {\"count\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, "
+                "\"p50_ns\": %llu, \"p99_ns\": %llu, \"histogram\": [",
+                phase ? "," : "", g_phase_names[phase],
+                (unsigned long long)total.count[phase], (unsigned long long)total.total_ns[phase],
+                (unsigned long long)total.max_ns[phase],
+                (unsigned long long)instrument_percentile(&total, (Phase)phase, 50.0),
+                (unsigned long long)instrument_percentile(&total, (Phase)phase, 99.0));
+        
+        // Non-empty buckets only, as [upper bound in ns, count] pairs
+        int first = 1;
+        for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+            if (total.histogram[phase][bucket] != 0) {
+                fprintf(file, "%s[%llu, %llu]", first ? "" : ", ", 1ULL << bucket,
+                        (unsigned long long)total.histogram[phase][bucket]);
+                first = 0;
+            }
+        }
+        fprintf(file, "]}");
+    }
+    
+    fprintf(file, "\n  },\n  \"memory\": {\"peak_rss_bytes\": %lld, \"peak_arena_bytes\": %llu},",
+            peak_resident_bytes(), (unsigned long long)atomic_load(&g_arena_usage.peak));
+    fprintf(file, "\n  \"counters\": {");
+    for (int counter = 0; counter < COUNTER_COUNT; counter++) {
+        fprintf(file, "%s\n    \"%s\": %llu", counter ? "," : "", g_counter_names[counter],
+                (unsigned long long)total.counters[counter]);
+    }
+    fprintf(file, "\n  }\n}\n");
+    
+    int failed = ferror(file);
+    if (fclose(file) != 0 || failed) {
+        fprintf(stderr, "Error: Cannot write statistics file '%s'\n", path);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Frees every thread's measurements
+ */
+static void instrument_close(void) {
+    Instrument *instrument = g_instrument.threads;
+    
+    while (instrument != NULL) {
+        Instrument *next = instrument->next;
+        free(instrument);
+        instrument = next;
+    }
+    g_instrument.threads = NULL;
+    t_instrument = NULL;
+}
+#endif
+
+#ifndef _WIN32
+// Throttle Module Implementation
+
+/**
+ * Lowers the priority of the process and sets up the rate limits and the
+ * latency back-off. Called before any worker starts, so every thread
+ * inherits the priority.
+ * @param background Move the process to the idle I/O class and the lowest CPU priority
+ * @param read_rate Bytes read per second (0 = unlimited)
+ * @param rename_rate Renames per second (0 = unlimited)
+ * @param target_ms Per-operation latency to back off above (0 = never)
+ */
+static void throttle_open(int background, long long read_rate, long long rename_rate, int target_ms) {
+    if (background) {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+        // Kernels that refuse the idle class still take the lowest best-effort level
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) != 0 &&
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_VALUE(IOPRIO_CLASS_BE, 7)) != 0) {
+            fprintf(stderr, "Warning: Cannot lower the I/O priority: %s\n", strerror(errno));
+        }
+#endif
+        if (setpriority(PRIO_PROCESS, 0, 19) != 0) {
+            fprintf(stderr, "Warning: Cannot lower the CPU priority: %s\n", strerror(errno));
+        }
+    }
+    
+    uint64_t now = monotonic_ns();
+    long long rates[THROTTLE_KINDS] = { read_rate, rename_rate };
+    for (int kind = 0; kind < THROTTLE_KINDS; kind++) {
+        TokenBucket *bucket = &g_throttle.buckets[kind];
+        bucket->rate = (double)rates[kind];
+        bucket->burst = bucket->rate * (double)THROTTLE_BURST_NS / 1e9;
+        if (bucket->burst < 1.0) {
+            bucket->burst = 1.0;
+        }
+        bucket->tokens = bucket->burst;
+        bucket->refilled_ns = now;
+        bucket->latency_ns = 0.0;
+    }
+    
+    g_throttle.target_ns = (uint64_t)target_ms * 1000000ULL;
+    g_throttle.pause = 0.0;
+    g_throttle.adjusted_ns = now;
+    atomic_store(&g_throttle.waited_ns, 0);
+    if (read_rate > 0 || rename_rate > 0 || target_ms > 0) {
+        pthread_mutex_init(&g_throttle.lock, NULL);
+        g_throttle.enabled = 1;
+    }
+}
+
+/**
+ * Sleeps, counting the time as throttled
+ * @param duration_ns How long to sleep
+ */
+static void throttle_sleep(uint64_t duration_ns) {
+    struct timespec delay = { (time_t)(duration_ns / 1000000000ULL), (long)(duration_ns % 1000000000ULL) };
+    
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+    }
+    atomic_fetch_add(&g_throttle.waited_ns, duration_ns);
+}
+
+/**
+ * Waits until an operation may start, i.e. until the refill has paid off
+ * whatever earlier operations of its kind charged beyond the rate limit
+ * @param kind What the operation is charged to
+ * @return When the operation started, for throttle_end (0 if nothing is throttled)
+ */
+static uint64_t throttle_begin(ThrottleKind kind) {
+    if (!g_throttle.enabled) {
+        return 0;
+    }
+    
+    TokenBucket *bucket = &g_throttle.buckets[kind];
+    uint64_t now = monotonic_ns();
+    if (bucket->rate <= 0.0) {
+        return now;
+    }
+    
+    pthread_mutex_lock(&g_throttle.lock);
+    bucket->tokens += bucket->rate * (double)(now - bucket->refilled_ns) / 1e9;
+    if (bucket->tokens > bucket->burst) {
+        bucket->tokens = bucket->burst;
+    }
+    bucket->refilled_ns = now;
+    double debt = -bucket->tokens;
+    pthread_mutex_unlock(&g_throttle.lock);
+    
+    if (debt > 0.0) {
+        throttle_sleep((uint64_t)(debt / bucket->rate * 1e9));
+        now = monotonic_ns();
+    }
+    return now;
+}
+
+/**
+ * Finishes a throttled operation: charges it to its bucket and feeds its
+ * latency to the back-off. While the average latency of an operation kind
+ * stays above the target, the pause taken after each operation doubles (up
+ * to THROTTLE_MAX_PAUSE times the operation's own latency); once it drops
+ * below half the target, the pause shrinks by a quarter per adjustment.
+ * Preserves errno.
+ * @param kind What the operation is charged to
+ * @param started The value throttle_begin returned
+ * @param used Tokens the operation used (bytes read, or renames issued)
+ */
+static void throttle_end(ThrottleKind kind, uint64_t started, uint64_t used) {
+    if (!g_throttle.enabled) {
+        return;
+    }
+    
+    int saved_errno = errno;
+    TokenBucket *bucket = &g_throttle.buckets[kind];
+    uint64_t now = monotonic_ns();
+    uint64_t latency = now - started;
+    double pause = 0.0;
+    
+    pthread_mutex_lock(&g_throttle.lock);
+    if (bucket->rate > 0.0) {
+        bucket->tokens -= (double)used;
+    }
+    if (g_throttle.target_ns != 0) {
+        bucket->latency_ns += ((double)latency - bucket->latency_ns) / 16.0;
+        if (now - g_throttle.adjusted_ns >= THROTTLE_ADJUST_NS) {
+            if (bucket->latency_ns > (double)g_throttle.target_ns) {
+                g_throttle.pause = g_throttle.pause < 1.0 ? 1.0 : g_throttle.pause * 2.0;
+                if (g_throttle.pause > THROTTLE_MAX_PAUSE) {
+                    g_throttle.pause = THROTTLE_MAX_PAUSE;
+                }
+                g_throttle.adjusted_ns = now;
+            } else if (bucket->latency_ns < (double)g_throttle.target_ns / 2.0 && g_throttle.pause > 0.0) {
+                g_throttle.pause = g_throttle.pause < 0.125 ? 0.0 : g_throttle.pause * 0.75;
+                g_throttle.adjusted_ns = now;
+            }
+        }
+        pause = g_throttle.pause;
+    }
+    pthread_mutex_unlock(&g_throttle.lock);
+    
+    if (pause > 0.0) {
+        uint64_t sleep_ns = (uint64_t)((double)latency * pause);
+        throttle_sleep(sleep_ns < THROTTLE_MAX_SLEEP_NS ? sleep_ns : THROTTLE_MAX_SLEEP_NS);
+    }
+    errno = saved_errno;
+}
+
+/**
+ * Releases the throttle's lock
+ */
+static void throttle_close(void) {
+    if (g_throttle.enabled) {
+        pthread_mutex_destroy(&g_throttle.lock);
+        g_throttle.enabled = 0;
+    }
+}
+#endif
+
+#ifndef _WIN32
+// Arena Module Implementation
+
+/**
+ * Records heap memory taken or returned by arena blocks
+ * @param delta Bytes allocated (positive) or freed (negative)
+ */
+static void arena_account(long long delta) {
+    if (delta < 0) {
+        atomic_fetch_sub(&g_arena_usage.bytes, (size_t)-delta);
+        return;
+    }
+    
+    size_t bytes = atomic_fetch_add(&g_arena_usage.bytes, (size_t)delta) + (size_t)delta;
+    size_t peak = atomic_load(&g_arena_usage.peak);
+    while (bytes > peak && !atomic_compare_exchange_weak(&g_arena_usage.peak, &peak, bytes)) {
+        // peak was reloaded by the failed exchange
+    }
+}
+
+/**
+ * Allocates from an arena. Requests up to half a block share standard blocks,
+ * which come from the calling thread's cache when it has one; larger requests
+ * get a block of their own.
+ * @param arena The arena
+ * @param size Bytes needed
+ * @return 16-byte aligned memory, or NULL on allocation failure
+ */
+static void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    
+    ArenaBlock *block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        if (size <= ARENA_BLOCK_SIZE / 2 && t_arena_cache != NULL) {
+            block = t_arena_cache;
+            t_arena_cache = block->next;
+            t_arena_cached--;
+        } else {
+            size_t block_size = size <= ARENA_BLOCK_SIZE / 2 ? ARENA_BLOCK_SIZE : size;
+            block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + block_size);
+            if (block == NULL) {
+                return NULL;
+            }
+            block->size = block_size;
+            arena_account((long long)(sizeof(ArenaBlock) + block_size));
+        }
+        
+        block->used = 0;
+        if (arena->head != NULL && block->size != ARENA_BLOCK_SIZE) {
+            // A dedicated block is filled at once; keep allocating from the current one
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+    
+    // Header size is a multiple of 16, so every allocation stays aligned
+    void *memory = (char*)(block + 1) + block->used;
+    block->used += size;
+    return memory;
+}
+
+/**
+ * Copies a string into an arena
+ * @param arena The arena
+ * @param text The string to copy
+ * @return The copy, or NULL on allocation failure
+ */
+static char *arena_strdup(Arena *arena, const char *text) {
+    size_t length = strlen(text) + 1;
+    char *copy = (char*)arena_alloc(arena, length);
+    
+    if (copy != NULL) {
+        memcpy(copy, text, length);
+    }
+    return copy;
+}
+
+/**
+ * Releases everything allocated from an arena. Standard blocks go to the
+ * calling thread's cache (up to ARENA_CACHE_BLOCKS), the rest to the heap.
+ * The arena may live inside its own memory, so it is not touched afterwards.
+ * @param arena The arena
+ */
+static void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        if (block->size == ARENA_BLOCK_SIZE && t_arena_cached < ARENA_CACHE_BLOCKS) {
+            block->next = t_arena_cache;
+            t_arena_cache = block;
+            t_arena_cached++;
+        } else {
+            arena_account(-(long long)(sizeof(ArenaBlock) + block->size));
+            free(block);
+        }
+        block = next;
+    }
+}
+
+/**
+ * Frees the calling thread's cached arena blocks; threads call this before exiting
+ */
+static void arena_release_cache(void) {
+    while (t_arena_cache != NULL) {
+        ArenaBlock *next = t_arena_cache->next;
+        arena_account(-(long long)(sizeof(ArenaBlock) + t_arena_cache->size));
+        free(t_arena_cache);
+        t_arena_cache = next;
+    }
+    t_arena_cached = 0;
+}
+
+// Name Index Module Implementation
+
+/**
+ * Hashes a NUL-terminated name (FNV-1a)
+ * @param key The name to hash
+ * @return The hash value
+ */
+static size_t hash_name(const char *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    
+    for (const unsigned char *p = (const unsigned char*)key; *p != '\0'; p++) {
+        hash = (hash ^ *p) * 1099511628211ULL;
+    }
+    
+    return (size_t)hash;
+}
+
+/**
+ * Looks up a key in a name table
+ * @param table The table to search
+ * @param key The key to look for
+ * @return The live slot holding the key, or NULL if absent
+ */
+static NameSlot *name_table_find(const NameTable *table, const char *key) {
+    if (table->capacity == 0) {
+        return NULL;
+    }
+    
+    size_t hash = hash_name(key);
+    size_t mask = table->capacity - 1;
+    
+    for (size_t i = hash & mask; table->slots[i].key != NULL; i = (i + 1) & mask) {
+        NameSlot *slot = &table->slots[i];
+        if (!slot->deleted && slot->hash == hash && strcmp(slot->key, key) == 0) {
+            return slot;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Rebuilds a name table with a new capacity, dropping deleted slots
+ * @param table The table to resize
+ * @param capacity The new capacity (a power of two)
+ * @return 0 on success, -1 on allocation failure
+ */
+static int name_table_resize(NameTable *table, size_t capacity) {
+    NameSlot *slots = (NameSlot*)calloc(capacity, sizeof(NameSlot));
+    if (slots == NULL) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < table->capacity; i++) {
+        NameSlot *old = &table->slots[i];
+        if (old->key == NULL) {
+            continue;
+        }
+        if (old->deleted) {
+            continue;
+        }
+        
+        size_t j = old->hash & (capacity - 1);
+        while (slots[j].key != NULL) {
+            j = (j + 1) & (capacity - 1);
+        }
+        slots[j] = *old;
+    }
+    
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    table->used = table->live;
+    return 0;
+}
+
+/**
+ * Inserts a key into a name table (or finds it if already present)
+ * @param table The table to insert into
+ * @param key The key to insert
+ * @param copy Non-zero to store a copy in the table's arena, zero to borrow the caller's string
+ * @return The slot holding the key (value is 0 for new keys), or NULL on allocation failure
+ */
+static NameSlot *name_table_insert(NameTable *table, const char *key, int copy) {
+    NameSlot *existing = name_table_find(table, key);
+    if (existing != NULL) {
+        return existing;
+    }
+    
+    // Keep the load factor, deleted slots included, under 3/4
+    if ((table->used + 1) * 4 > table->capacity * 3) {
+        size_t capacity = table->capacity ? table->capacity : 64;
+        while ((table->live + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+        if (name_table_resize(table, capacity) != 0) {
+            return NULL;
+        }
+    }
+    
+    const char *stored = copy ? arena_strdup(table->arena, key) : key;
+    if (stored == NULL) {
+        return NULL;
+    }
+    
+    size_t hash = hash_name(key);
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+    while (table->slots[i].key != NULL) {
+        i = (i + 1) & mask;
+    }
+    
+    NameSlot *slot = &table->slots[i];
+    slot->key = stored;
+    slot->hash = hash;
+    slot->value = 0;
+    slot->deleted = 0;
+    table->used++;
+    table->live++;
+    return slot;
+}
+
+/**
+ * Removes a key from a name table; absent keys are ignored
+ * @param table The table to remove from
+ * @param key The key to remove
+ */
+static void name_table_remove(NameTable *table, const char *key) {
+    NameSlot *slot = name_table_find(table, key);
+    
+    if (slot != NULL) {
+        // Leave a tombstone so probe chains running through this slot stay intact
+        slot->deleted = 1;
+        table->live--;
+    }
+}
+
+/**
+ * Releases a name table's slots (copied keys go with its arena)
+ * @param table The table to free
+ */
+static void name_table_free(NameTable *table) {
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+/**
+ * Builds a directory's name index from its listing. Names are borrowed from
+ * the listing's string pool, which lives as long as the directory node;
+ * names reserved later are copied into the same arena, so renaming a file
+ * allocates nothing once the slot array has grown to fit the directory.
+ * @param index The index to build (must be zero-initialized)
+ * @param listing The directory listing
+ * @return 0 on success, -1 on allocation failure (the index is left empty)
+ */
+static int name_index_build(NameIndex *index, const DirListing *listing) {
+    index->names.arena = listing->arena;
+    index->stems.arena = listing->arena;
+    
+    for (size_t i = 0; i < listing->count; i++) {
+        if (name_table_insert(&index->names, listing->names + listing->entries[i].name_offset, 0) == NULL) {
+            name_table_free(&index->names);
+            return -1;
+        }
+    }
+    
+    pthread_mutex_init(&index->lock, NULL);
+    return 0;
+}
+
+/**
+ * Releases a directory's name index
+ * @param index The index to free
+ */
+static void name_index_free(NameIndex *index) {
+    name_table_free(&index->names);
+    name_table_free(&index->stems);
+    pthread_mutex_destroy(&index->lock);
+}
+
+/**
+ * Picks the first free name for base_name from the index and reserves it, so
+ * concurrent workers never pick the same one. The next suffix to try is
+ * remembered per base name, making repeated collisions O(1) with no system calls.
+ * @param index The directory's name index
+ * @param base_name The base filename (e.g., "RJ-2024-12345.txt")
+ * @param output Buffer to store the reserved filename
+ * @param output_size Size of the output buffer
+ * @return 0 on success, -1 if no name could be reserved
+ */
+static int name_index_reserve(NameIndex *index, const char *base_name, char *output, size_t output_size) {
+    int result = -1;
+    
+    pthread_mutex_lock(&index->lock);
+    
+    if (name_table_find(&index->names, base_name) == NULL) {
+        if (name_table_insert(&index->names, base_name, 1) != NULL) {
+            snprintf(output, output_size, "%s", base_name);
+            result = 0;
+        }
+        pthread_mutex_unlock(&index->lock);
+        return result;
+    }
+    
+    // Split into stem and extension ("RJ-2024-12345" + ".txt")
+    const char *ext_pos = strrchr(base_name, '.');
+    if (ext_pos == NULL) {
+        ext_pos = base_name + strlen(base_name);
+    }
+    
+    char stem[MAX_NAME_LENGTH];
+    snprintf(stem, sizeof(stem), "%.*s", (int)(ext_pos - base_name), base_name);
+    
+    NameSlot *next = name_table_insert(&index->stems, stem, 1);
+    if (next != NULL) {
+        char candidate[MAX_NAME_LENGTH];
+        
+        for (int suffix = next->value > 0 ? next->value : 1; suffix < MAX_NAME_SUFFIX; suffix++) {
+            int length = snprintf(candidate, sizeof(candidate), "%s_%d%s", stem, suffix, ext_pos);
+            if (length < 0 || (size_t)length >= sizeof(candidate)) {
+                break;  // Suffixed name would not fit
+            }
+            
+            if (name_table_find(&index->names, candidate) == NULL) {
+                if (name_table_insert(&index->names, candidate, 1) != NULL) {
+                    snprintf(output, output_size, "%s", candidate);
+                    next->value = suffix + 1;
+                    result = 0;
+                }
+                break;
+            }
+        }
+    }
+    
+    pthread_mutex_unlock(&index->lock);
+    return result;
+}
+
+/**
+ * Records the outcome of a rename to a name reserved by name_index_reserve
+ * @param index The directory's name index
+ * @param old_name The file's previous name
+ * @param final_name The reserved name
+ * @param error 0 if the rename succeeded, otherwise its errno
+ */
+static void name_index_commit(NameIndex *index, const char *old_name, const char *final_name, int error) {
+    pthread_mutex_lock(&index->lock);
+    
+    if (error == 0) {
+        name_table_remove(&index->names, old_name);
+    } else if (error != EEXIST) {
+        // The reservation was not used; EEXIST means the name really is taken
+        name_table_remove(&index->names, final_name);
+    }
+    
+    pthread_mutex_unlock(&index->lock);
+}
+#endif
+
+// File Operations Module Implementation
+
+/**
+ * Checks if an entry with the given name exists in a directory
+ * @param dir The directory to check
+ * @param name The entry name to look for
+ * @return 1 if an entry exists, 0 if not or on error
+ */
+static int file_exists(const DirRef *dir, const char *name) {
+    if (dir == NULL || name == NULL) {
+        return 0;
+    }
+
+#ifdef _WIN32
+    const char *full_path = entry_path(dir, name, 0);
+    
+    if (full_path == NULL) {
+        return 0;
+    }
+    
+    // Any existing entry, file or directory, blocks the name
+    return GetFileAttributesA(full_path) != INVALID_FILE_ATTRIBUTES;
+#else
+    struct stat st;
+    
+    if (dir->index != NULL) {
+        pthread_mutex_lock(&dir->index->lock);
+        int found = name_table_find(&dir->index->names, name) != NULL;
+        pthread_mutex_unlock(&dir->index->lock);
+        return found;
+    }
+    
+    // Any existing entry, file or directory, blocks the name
+    INSTRUMENT_COUNT(COUNTER_STAT_CALLS, 1);
+    return fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+#endif
+}
+
+/**
+ * Generates a unique filename by appending numeric suffix if needed
+ * @param dir The directory the file will be renamed in
+ * @param base_name The base filename (e.g., "RJ-2024-12345.txt")
+ * @param output Buffer to store the unique filename
+ * @param output_size Size of the output buffer
+ * @return 0 on success, -1 if no unique name could be found
+ */
+static int generate_unique_name(const DirRef *dir, const char *base_name, char *output, size_t output_size) {
+    if (dir == NULL || base_name == NULL || output == NULL || output_size == 0) {
+        return -1;
+    }
+
+#ifndef _WIN32
+    // With a name index the answer comes from memory and is reserved for us
+    if (dir->index != NULL) {
+        return name_index_reserve(dir->index, base_name, output, output_size);
+    }
+#endif
+
+    // First, try the base name without any suffix
+    strncpy(output, base_name, output_size - 1);
+    output[output_size - 1] = '\0';
+    
+    if (!file_exists(dir, output)) {
+        return 0;  // Base name is available
+    }
+    
+    // Extract the name without extension
+    char name_without_ext[MAX_NAME_LENGTH];
+    const char *ext_pos = strrchr(base_name, '.');
+    
+    if (ext_pos != NULL) {
+        size_t name_len = ext_pos - base_name;
+        if (name_len >= MAX_NAME_LENGTH) {
+            name_len = MAX_NAME_LENGTH - 1;
+        }
+        strncpy(name_without_ext, base_name, name_len);
+        name_without_ext[name_len] = '\0';
+    } else {
+        strncpy(name_without_ext, base_name, MAX_NAME_LENGTH - 1);
+        name_without_ext[MAX_NAME_LENGTH - 1] = '\0';
+        ext_pos = "";  // No extension
+    }
+    
+    // Try appending numeric suffixes until we find a unique name
+    int suffix = 1;
+    while (suffix < MAX_NAME_SUFFIX) {  // Reasonable limit to prevent infinite loop
+        int length = snprintf(output, output_size, "%s_%d%s", name_without_ext, suffix, ext_pos);
+        if (length < 0 || (size_t)length >= output_size) {
+            break;  // Suffixed name would not fit
+        }
+        
+        if (!file_exists(dir, output)) {
+            return 0;  // Found a unique name
+        }
+        
+        suffix++;
+    }
+    
+    // Every suffix is taken; this shouldn't happen in practice
+    return -1;
+}
+
+#ifndef _WIN32
+/**
+ * Checks whether a file is a hard link to the holder of its target name or of
+ * one of the suffixed variants, as --dedupe=link leaves duplicates behind
+ * @param dir The directory containing the file
+ * @param name The current filename
+ * @param base_name The base filename (e.g., "RJ-2024-12345.txt")
+ * @return 1 if the file shares its inode with a holder, 0 otherwise
+ */
+static int is_linked_copy(const DirRef *dir, const char *name, const char *base_name) {
+    struct stat st;
+    struct stat holder_st;
+    
+    INSTRUMENT_COUNT(COUNTER_STAT_CALLS, 1);
+    if (fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode) || st.st_nlink < 2) {
+        return 0;
+    }
+    
+    // Walk the names generate_unique_name hands out for this target, in order
+    const char *ext_pos = strrchr(base_name, '.');
+    if (ext_pos == NULL) {
+        ext_pos = base_name + strlen(base_name);
+    }
+    int stem_length = (int)(ext_pos - base_name);
+    char holder[MAX_NAME_LENGTH];
+    
+    for (int suffix = 0; suffix < MAX_NAME_SUFFIX; suffix++) {
+        int length = suffix == 0
+            ? snprintf(holder, sizeof(holder), "%s", base_name)
+            : snprintf(holder, sizeof(holder), "%.*s_%d%s", stem_length, base_name, suffix, ext_pos);
+        if (length < 0 || (size_t)length >= sizeof(holder)) {
+            break;
+        }
+        
+        INSTRUMENT_COUNT(COUNTER_STAT_CALLS, 1);
+        if (fstatat(dir->fd, holder, &holder_st, AT_SYMLINK_NOFOLLOW) != 0) {
+            if (errno == ENOENT) {
+                break;  // First free name: there are no further holders
+            }
+            continue;
+        }
+        if (holder_st.st_dev == st.st_dev && holder_st.st_ino == st.st_ino) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+#endif
+
+/**
+ * Checks whether a file already carries the name it would be renamed to: the
+ * base name itself, or a _N variant of it while the base name is taken.
+ * Renaming such a file would only move it to another suffix. On POSIX systems
+ * a hard link to the file holding one of those names counts as named too, so
+ * duplicates linked by --dedupe=link keep their names in later runs.
+ * @param dir The directory containing the file
+ * @param name The current filename
+ * @param base_name The base filename (e.g., "RJ-2024-12345.txt")
+ * @return 1 if the file is already named for its pattern, 0 otherwise
+ */
+static int is_already_named(const DirRef *dir, const char *name, const char *base_name) {
+    if (strcmp(name, base_name) == 0) {
+        return 1;
+    }
+    
+    const char *ext_pos = strrchr(base_name, '.');
+    if (ext_pos == NULL) {
+        ext_pos = base_name + strlen(base_name);
+    }
+    
+    // Suffix digits as generate_unique_name writes them: no sign, no leading zero
+    size_t stem_len = ext_pos - base_name;
+    int suffixed = 0;
+    if (strncmp(name, base_name, stem_len) == 0 && name[stem_len] == '_') {
+        const char *p = name + stem_len + 1;
+        if (*p >= '1' && *p <= '9') {
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+            suffixed = strcmp(p, ext_pos) == 0;
+        }
+    }
+    
+    // Both need the base name to be taken
+    if (!file_exists(dir, base_name)) {
+        return 0;
+    }
+#ifndef _WIN32
+    return suffixed || is_linked_copy(dir, name, base_name);
+#else
+    return suffixed;
+#endif
+}
+
+
+/**
+ * Recovers the pattern from a target name: "<pattern>.txt", or
+ * "<pattern>_<n>.txt" when the name carries a suffix
+ * @param name The target name
+ * @param suffixed Non-zero if the name carries a _N suffix
+ * @param output Buffer of PATTERN_MAX_LENGTH bytes for the pattern
+ */
+static void pattern_from_name(const char *name, int suffixed, char *output) {
+    const char *end = strrchr(name, '.');
+    if (end == NULL) {
+        end = name + strlen(name);
+    }
+    
+    if (suffixed) {
+        while (end > name && *end != '_') {
+            end--;
+        }
+    }
+    
+    snprintf(output, PATTERN_MAX_LENGTH, "%.*s", (int)(end - name), name);
+}
+
+/**
+ * Renames a file based on the RJ pattern
+ * @param dir The directory containing the file
+ * @param old_name The current filename
+ * @param new_name The new filename (RJ-YYYY-NNNNN.txt)
+ * @param stats Statistics structure to update
+ * @return 0 on success, -1 on failure
+ */
+int rename_file(const DirRef *dir, const char *old_name, const char *new_name, Statistics *stats) {
+    if (dir == NULL || old_name == NULL || new_name == NULL || stats == NULL) {
+        fprintf(stderr, "Error: Invalid parameters to rename_file\n");
+        if (stats != NULL) {
+            stats->error_files++;
+        }
+        return -1;
+    }
+    
+    // The pattern is the new name without its extension
+    char pattern[PATTERN_MAX_LENGTH];
+    pattern_from_name(new_name, 0, pattern);
+
+#ifndef _WIN32
+    // A taken target may be held by an identical copy, which makes this file redundant
+    if (g_options.dedupe != DEDUPE_NONE && file_exists(dir, new_name)) {
+        int deduplicated = dedupe_file(dir, old_name, new_name, pattern, stats);
+        if (deduplicated != 0) {
+            return deduplicated > 0 ? 0 : -1;
+        }
+    }
+#endif
+
+#ifndef _WIN32
+    // With --journal the rename waits for its intent to be committed
+    if (g_journal.enabled) {
+        return journal_rename(dir, old_name, new_name, stats);
+    }
+#endif
+
+    // Pick a free name (reserved in the directory's name index when it has one).
+    // The rename itself never replaces an existing entry, so a name taken
+    // behind our back just sends us back for the next suffix.
+    char final_name[MAX_NAME_LENGTH];
+    int result = -1;
+    
+    for (int attempt = 0; attempt < RENAME_ATTEMPTS && result != 0; attempt++) {
+        INSTRUMENT_BEGIN(resolve_started);
+        int resolved = generate_unique_name(dir, new_name, final_name, MAX_NAME_LENGTH);
+        INSTRUMENT_END(PHASE_RESOLVE, resolve_started);
+        if (resolved != 0) {
+            fprintf(stderr, "Error: Cannot rename '%s%s%s': no free name for '%s'\n",
+                    dir->path, entry_separator(dir->path), old_name, new_name);
+            log_file_event(dir, old_name, LOG_EVENT_ERROR, pattern, NULL, EEXIST);
+            stats->error_files++;
+            return -1;
+        }
+        
+        INSTRUMENT_BEGIN(rename_started);
+        result = rename_entry_noreplace(dir, old_name, final_name);
+        int error = result == 0 ? 0 : errno;
+        INSTRUMENT_END(PHASE_RENAME, rename_started);
+        INSTRUMENT_COUNT(COUNTER_RENAME_CONFLICTS, error == EEXIST);
+
+#ifndef _WIN32
+        if (dir->index != NULL) {
+            name_index_commit(dir->index, old_name, final_name, error);
+        }
+#endif
+
+        errno = error;
+        if (result != 0 && error != EEXIST) {
+            break;
+        }
+    }
+    
+    if (result != 0) {
+        fprintf(stderr, "Error: Cannot rename '%s%s%s' to '%s': %s\n",
+                dir->path, entry_separator(dir->path), old_name, final_name, strerror(errno));
+        log_file_event(dir, old_name, LOG_EVENT_ERROR, pattern, final_name, errno);
+        stats->error_files++;
+        return -1;
+    }
+    
+    // Log success
+    log_file_event(dir, old_name, LOG_EVENT_RENAMED, pattern, final_name, 0);
+    stats->renamed_files++;
+    
+    return 0;
+}
+
+#ifndef _WIN32
+// Deduplication Module Implementation
+
+// XXH64 primes
+static const uint64_t HASH_PRIME1 = 11400714785074694791ULL;
+static const uint64_t HASH_PRIME2 = 14029467366897019727ULL;
+static const uint64_t HASH_PRIME3 = 1609587929392839161ULL;
+static const uint64_t HASH_PRIME4 = 9650029242287828579ULL;
+static const uint64_t HASH_PRIME5 = 2870177450012600261ULL;
+
+// Chunk buffers per thread: hashing reads into the first, comparing into both
+static THREAD_LOCAL char t_dedupe_buffers[2][SCAN_CHUNK_SIZE];
+
+static uint64_t hash_rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t hash_read64(const char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash_read32(const char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * HASH_PRIME2;
+    acc = hash_rotl(acc, 31);
+    return acc * HASH_PRIME1;
+}
+
+/**
+ * Hashes a whole file with XXH64 (seed 0), reading it in chunks from the start
+ * @param fd Open file descriptor
+ * @param hash Receives the hash
+ * @return 0 on success, -1 on read error (errno is set)
+ */
+static int hash_file(int fd, uint64_t *hash) {
+    char *buffer = t_dedupe_buffers[0];
+    uint64_t lanes[4] = { HASH_PRIME1 + HASH_PRIME2, HASH_PRIME2, 0, 0 - HASH_PRIME1 };
+    uint64_t total = 0;
+    size_t carry = 0;
+    
+    for (;;) {
+        size_t want = SCAN_CHUNK_SIZE - carry;
+        uint64_t throttled = throttle_begin(THROTTLE_READ);
+        ssize_t bytes_read = pread(fd, buffer + carry, want, (off_t)total);
+        throttle_end(THROTTLE_READ, throttled, bytes_read > 0 ? (uint64_t)bytes_read : 0);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read < 0) {
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        INSTRUMENT_COUNT(COUNTER_READ_CALLS, 1);
+        INSTRUMENT_COUNT(COUNTER_BYTES_READ, (uint64_t)bytes_read);
+        total += (uint64_t)bytes_read;
+        
+        // Consume whole 32-byte stripes; a partial one waits for the next read
+        size_t available = carry + (size_t)bytes_read;
+        size_t stripes = available & ~(size_t)31;
+        for (size_t i = 0; i < stripes; i += 32) {
+            for (int lane = 0; lane < 4; lane++) {
+                lanes[lane] = hash_round(lanes[lane], hash_read64(buffer + i + lane * 8));
+            }
+        }
+        carry = available - stripes;
+        memmove(buffer, buffer + stripes, carry);
+    }
+    
+    uint64_t h;
+    if (total >= 32) {
+        h = hash_rotl(lanes[0], 1) + hash_rotl(lanes[1], 7) + hash_rotl(lanes[2], 12) + hash_rotl(lanes[3], 18);
+        for (int lane = 0; lane < 4; lane++) {
+            h ^= hash_round(0, lanes[lane]);
+            h = h * HASH_PRIME1 + HASH_PRIME4;
+        }
+    } else {
+        h = HASH_PRIME5;
+    }
+    h += total;
+    
+    // Fold in the tail that did not fill a stripe
+    const char *p = buffer;
+    for (; carry >= 8; p += 8, carry -= 8) {
+        h ^= hash_round(0, hash_read64(p));
+        h = hash_rotl(h, 27) * HASH_PRIME1 + HASH_PRIME4;
+    }
+    if (carry >= 4) {
+        h ^= (uint64_t)hash_read32(p) * HASH_PRIME1;
+        h = hash_rotl(h, 23) * HASH_PRIME2 + HASH_PRIME3;
+        p += 4;
+        carry -= 4;
+    }
+    for (; carry > 0; p++, carry--) {
+        h ^= (uint64_t)(unsigned char)*p * HASH_PRIME5;
+        h = hash_rotl(h, 11) * HASH_PRIME1;
+    }
+    
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+    
+    *hash = h;
+    return 0;
+}
+
+/**
+ * Finds the hash table slot for a file: its own entry, or the empty slot it would take
+ * @param st The file's status
+ * @return The slot (g_dedupe.lock must be held and the table allocated)
+ */
+static HashEntry *dedupe_slot(const struct stat *st) {
+    size_t mask = g_dedupe.capacity - 1;
+    size_t i = (size_t)(((uint64_t)st->st_ino ^ ((uint64_t)st->st_dev << 32)) * HASH_PRIME1 >> 32) & mask;
+    
+    while (g_dedupe.entries[i].used &&
+           (g_dedupe.entries[i].ino != (uint64_t)st->st_ino || g_dedupe.entries[i].dev != (uint64_t)st->st_dev)) {
+        i = (i + 1) & mask;
+    }
+    
+    return &g_dedupe.entries[i];
+}
+
+/**
+ * Doubles the hash table (or allocates it), re-inserting every entry
+ * @return 0 on success, -1 on allocation failure
+ */
+static int dedupe_grow(void) {
+    size_t capacity = g_dedupe.capacity ? g_dedupe.capacity * 2 : 1024;
+    HashEntry *entries = (HashEntry*)calloc(capacity, sizeof(HashEntry));
+    if (entries == NULL) {
+        return -1;
+    }
+    
+    HashEntry *old_entries = g_dedupe.entries;
+    size_t old_capacity = g_dedupe.capacity;
+    g_dedupe.entries = entries;
+    g_dedupe.capacity = capacity;
+    
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_entries[i].used) {
+            struct stat key;
+            key.st_dev = (dev_t)old_entries[i].dev;
+            key.st_ino = (ino_t)old_entries[i].ino;
+            *dedupe_slot(&key) = old_entries[i];
+        }
+    }
+    
+    free(old_entries);
+    return 0;
+}
+
+/**
+ * Returns a file's content hash, computing it only the first time the file
+ * takes part in a collision. Results are keyed by identity, so a file keeps
+ * its hash across renames and is never read twice while it is unchanged.
+ * @param fd Open file descriptor
+ * @param st The file's status
+ * @param hash Receives the hash
+ * @return 0 on success, -1 on read error (errno is set)
+ */
+static int dedupe_hash(int fd, const struct stat *st, uint64_t *hash) {
+    int64_t mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    
+    pthread_mutex_lock(&g_dedupe.lock);
+    if (g_dedupe.capacity > 0) {
+        HashEntry *entry = dedupe_slot(st);
+        if (entry->used && entry->size == (uint64_t)st->st_size && entry->mtime_ns == mtime_ns) {
+            *hash = entry->hash;
+            pthread_mutex_unlock(&g_dedupe.lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&g_dedupe.lock);
+    
+    // Hash outside the lock; two workers racing on one file just store the same value
+    if (hash_file(fd, hash) != 0) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&g_dedupe.lock);
+    if ((g_dedupe.count + 1) * 2 <= g_dedupe.capacity || dedupe_grow() == 0) {
+        HashEntry *entry = dedupe_slot(st);
+        if (!entry->used) {
+            g_dedupe.count++;
+        }
+        entry->dev = (uint64_t)st->st_dev;
+        entry->ino = (uint64_t)st->st_ino;
+        entry->size = (uint64_t)st->st_size;
+        entry->mtime_ns = mtime_ns;
+        entry->hash = *hash;
+        entry->used = 1;
+    }
+    pthread_mutex_unlock(&g_dedupe.lock);
+    
+    return 0;
+}
+
+/**
+ * Compares two open files byte by byte
+ * @param fd_a First file
+ * @param fd_b Second file
+ * @param size Size of both files
+ * @return 1 if identical, 0 if they differ, -1 on read error (errno is set)
+ */
+static int files_identical(int fd_a, int fd_b, off_t size) {
+    char *buffer_a = t_dedupe_buffers[0];
+    char *buffer_b = t_dedupe_buffers[1];
+    
+    for (off_t offset = 0; offset < size; ) {
+        size_t want = (size - offset) < SCAN_CHUNK_SIZE ? (size_t)(size - offset) : SCAN_CHUNK_SIZE;
+        uint64_t throttled = throttle_begin(THROTTLE_READ);
+        ssize_t read_a = pread(fd_a, buffer_a, want, offset);
+        ssize_t read_b = pread(fd_b, buffer_b, want, offset);
+        throttle_end(THROTTLE_READ, throttled,
+                     (uint64_t)(read_a > 0 ? read_a : 0) + (uint64_t)(read_b > 0 ? read_b : 0));
+        if (read_a < 0 || read_b < 0) {
+            return -1;
+        }
+        INSTRUMENT_COUNT(COUNTER_READ_CALLS, 2);
+        INSTRUMENT_COUNT(COUNTER_BYTES_READ, (uint64_t)(read_a + read_b));
+        
+        // A short read means a file changed size under us: not a safe match
+        if (read_a != (ssize_t)want || read_b != (ssize_t)want || memcmp(buffer_a, buffer_b, want) != 0) {
+            return 0;
+        }
+        offset += (off_t)want;
+    }
+    
+    return 1;
+}
+
+/**
+ * Decides whether a file already holding a target name has the same content
+ * as the file being renamed. Sizes are compared first, then hashes, and equal
+ * hashes are confirmed byte by byte, so only real candidates are ever read.
+ * @param fd The file being renamed
+ * @param st Its status
+ * @param hash Its hash, filled in on first use
+ * @param hashed Non-zero once hash is valid
+ * @param copy_fd The file holding the target name
+ * @param copy_st Its status
+ * @return 1 if identical, 0 if not, -1 on read error (errno is set)
+ */
+static int dedupe_compare(int fd, const struct stat *st, uint64_t *hash, int *hashed,
+                          int copy_fd, const struct stat *copy_st) {
+    if (!S_ISREG(copy_st->st_mode) || copy_st->st_size != st->st_size) {
+        return 0;
+    }
+    if (copy_st->st_dev == st->st_dev && copy_st->st_ino == st->st_ino) {
+        return 1;  // Already two names for one file
+    }
+    
+    if (!*hashed) {
+        if (dedupe_hash(fd, st, hash) != 0) {
+            return -1;
+        }
+        *hashed = 1;
+    }
+    
+    uint64_t copy_hash;
+    if (dedupe_hash(copy_fd, copy_st, &copy_hash) != 0) {
+        return -1;
+    }
+    if (copy_hash != *hash) {
+        return 0;
+    }
+    
+    return files_identical(fd, copy_fd, st->st_size);
+}
+
+/**
+ * Replaces a duplicate with a hard link to its copy. The link is made under a
+ * temporary name and renamed over the duplicate, so the duplicate's name never
+ * goes missing.
+ * @param dir The directory containing both files
+ * @param old_name The duplicate
+ * @param copy The copy it is replaced by
+ * @param st The duplicate's status when it was compared
+ * @return 0 on success, -1 on error (errno is set)
+ */
+static int dedupe_link(const DirRef *dir, const char *old_name, const char *copy, const struct stat *st) {
+    char temp_name[MAX_NAME_LENGTH];
+    snprintf(temp_name, sizeof(temp_name), ".rename_files-%ld-%u.tmp",
+             (long)getpid(), atomic_fetch_add(&g_dedupe.temp_sequence, 1));
+    
+    if (linkat(dir->fd, copy, dir->fd, temp_name, 0) != 0) {
+        return -1;
+    }
+    
+    // Only replace the duplicate if it is still the file that was compared
+    struct stat current;
+    int result = fstatat(dir->fd, old_name, &current, AT_SYMLINK_NOFOLLOW);
+    if (result == 0 && (current.st_dev != st->st_dev || current.st_ino != st->st_ino)) {
+        errno = EAGAIN;
+        result = -1;
+    }
+    if (result == 0) {
+        result = renameat(dir->fd, temp_name, dir->fd, old_name);
+    }
+    
+    if (result != 0) {
+        int saved_errno = errno;
+        unlinkat(dir->fd, temp_name, 0);
+        errno = saved_errno;
+    }
+    return result;
+}
+
+/**
+ * Moves a duplicate into the quarantine directory under its own name, with a
+ * numeric suffix if the quarantine already holds that name
+ * @param dir The directory containing the duplicate
+ * @param old_name The duplicate
+ * @param final_name Receives its name in the quarantine directory
+ * @param final_size Size of the final_name buffer
+ * @return 0 on success, -1 on error (errno is set)
+ */
+static int dedupe_quarantine(const DirRef *dir, const char *old_name, char *final_name, size_t final_size) {
+    DirRef quarantine = { g_options.quarantine_path, g_dedupe.quarantine_fd, NULL };
+    int result = -1;
+    
+    for (int attempt = 0; attempt < RENAME_ATTEMPTS && result != 0; attempt++) {
+        if (generate_unique_name(&quarantine, old_name, final_name, final_size) != 0) {
+            errno = EEXIST;
+            return -1;
+        }
+        
+        result = move_entry_noreplace(dir, old_name, &quarantine, final_name);
+        if (result != 0 && errno != EEXIST) {
+            return -1;
+        }
+    }
+    
+    if (result == 0 && dir->index != NULL) {
+        name_index_commit(dir->index, old_name, final_name, 0);
+    }
+    return result;
+}
+
+/**
+ * Waits for a name another worker has reserved to appear on disk. Its rename
+ * is typically one system call away, and comparing against the copy beats
+ * giving an identical file a suffixed name.
+ * @param dir The directory holding the reservation
+ * @param name The reserved name
+ * @return 1 once the name exists, 0 if the reservation was dropped or never landed
+ */
+static int dedupe_await_name(const DirRef *dir, const char *name) {
+    struct stat st;
+    
+    for (int spin = 0; spin < DEDUPE_AWAIT_SPINS && file_exists(dir, name); spin++) {
+        if (fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            return 1;
+        }
+        sched_yield();
+    }
+    
+    return 0;
+}
+
+/**
+ * Handles a file whose target name is taken under --dedupe: if the holder of
+ * the name, or of one of its suffixed variants, has the same content, the file
+ * is linked to it or quarantined instead of getting a suffixed name of its own
+ * @param dir The directory containing the file
+ * @param old_name The current filename
+ * @param new_name The target filename (RJ-YYYY-NNNNN.txt)
+ * @param pattern The pattern found in the file
+ * @param stats Statistics structure to update
+ * @return 1 if the file was handled, 0 if it has no identical copy (rename it
+ *         as usual), -1 on error (already reported)
+ */
+static int dedupe_file(const DirRef *dir, const char *old_name, const char *new_name, const char *pattern,
+                       Statistics *stats) {
+    int fd = openat(dir->fd, old_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;  // The rename reports whatever is wrong with the file
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return 0;
+    }
+    
+    // Walk the names generate_unique_name hands out for this target, in order
+    const char *ext_pos = strrchr(new_name, '.');
+    if (ext_pos == NULL) {
+        ext_pos = new_name + strlen(new_name);
+    }
+    int stem_length = (int)(ext_pos - new_name);
+    
+    char copy[MAX_NAME_LENGTH];
+    uint64_t hash = 0;
+    int hashed = 0;
+    int identical = 0;
+    int error = 0;
+    struct stat copy_st;
+    
+    for (int suffix = 0; suffix < MAX_NAME_SUFFIX && !identical && !error; suffix++) {
+        int length = suffix == 0
+            ? snprintf(copy, sizeof(copy), "%s", new_name)
+            : snprintf(copy, sizeof(copy), "%.*s_%d%s", stem_length, new_name, suffix, ext_pos);
+        if (length < 0 || (size_t)length >= sizeof(copy)) {
+            break;
+        }
+        
+        int copy_fd = openat(dir->fd, copy, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (copy_fd < 0 && errno == ENOENT && dir->index != NULL && dedupe_await_name(dir, copy)) {
+            copy_fd = openat(dir->fd, copy, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        }
+        if (copy_fd < 0) {
+            if (errno == ENOENT) {
+                break;  // First free name: there are no further copies
+            }
+            continue;
+        }
+        
+        if (fstat(copy_fd, &copy_st) != 0) {
+            close(copy_fd);
+            continue;
+        }
+        
+        int compared = dedupe_compare(fd, &st, &hash, &hashed, copy_fd, &copy_st);
+        if (compared < 0) {
+            error = errno;
+        }
+        identical = compared > 0;
+        close(copy_fd);
+    }
+    close(fd);
+    
+    if (error != 0) {
+        fprintf(stderr, "Error: Cannot compare '%s%s%s' with '%s': %s\n",
+                dir->path, entry_separator(dir->path), old_name, copy, strerror(error));
+        log_file_event(dir, old_name, LOG_EVENT_ERROR, pattern, copy, error);
+        stats->error_files++;
+        return -1;
+    }
+    if (!identical) {
+        return 0;
+    }
+    
+    char final_name[MAX_NAME_LENGTH];
+    const char *detail = copy;
+    int result;
+    
+    if (g_options.dedupe == DEDUPE_LINK) {
+        if (copy_st.st_dev == st.st_dev && copy_st.st_ino == st.st_ino) {
+            log_file_event(dir, old_name, LOG_EVENT_SKIPPED, pattern, "already linked", 0);
+            stats->skipped_files++;
+            return 1;
+        }
+        result = dedupe_link(dir, old_name, copy, &st);
+    } else {
+        result = dedupe_quarantine(dir, old_name, final_name, sizeof(final_name));
+        detail = final_name;
+    }
+    
+    if (result != 0) {
+        int saved_errno = errno;
+        fprintf(stderr, "Error: Cannot %s duplicate '%s%s%s' of '%s': %s\n",
+                g_options.dedupe == DEDUPE_LINK ? "link" : "quarantine",
+                dir->path, entry_separator(dir->path), old_name, copy, strerror(saved_errno));
+        log_file_event(dir, old_name, LOG_EVENT_ERROR, pattern, copy, saved_errno);
+        stats->error_files++;
+        return -1;
+    }
+    
+    log_file_event(dir, old_name, LOG_EVENT_DEDUPLICATED, pattern, detail, 0);
+    stats->deduplicated_files++;
+    return 1;
+}
+
+/**
+ * Prepares a --dedupe run: opens the quarantine directory, which must be on
+ * the same file system as the tree so duplicates can be moved with a rename
+ * @param quarantine_path The quarantine directory, or NULL for --dedupe=link
+ * @param root The directory being processed
+ * @return 0 on success, -1 on error (already reported)
+ */
+static int dedupe_open(const char *quarantine_path, const char *root) {
+    memset(&g_dedupe, 0, sizeof(g_dedupe));
+    g_dedupe.quarantine_fd = -1;
+    atomic_init(&g_dedupe.temp_sequence, 0);
+    pthread_mutex_init(&g_dedupe.lock, NULL);
+    
+    if (quarantine_path == NULL) {
+        return 0;
+    }
+    
+    g_dedupe.quarantine_fd = open(quarantine_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (g_dedupe.quarantine_fd < 0) {
+        fprintf(stderr, "Error: Cannot open quarantine directory '%s': %s\n", quarantine_path, strerror(errno));
+        return -1;
+    }
+    
+    struct stat root_st;
+    if (fstat(g_dedupe.quarantine_fd, &g_dedupe.quarantine_st) != 0 || stat(root, &root_st) != 0 ||
+        root_st.st_dev != g_dedupe.quarantine_st.st_dev) {
+        fprintf(stderr, "Error: Quarantine directory '%s' must be on the same file system as '%s'\n",
+                quarantine_path, root);
+        close(g_dedupe.quarantine_fd);
+        g_dedupe.quarantine_fd = -1;
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Checks whether an open directory is the quarantine directory, which the
+ * traversal must not descend into when it lies inside the tree
+ * @param fd The directory's file descriptor
+ * @return 1 if it is the quarantine directory, 0 otherwise
+ */
+static int dedupe_is_quarantine(int fd) {
+    struct stat st;
+    
+    if (g_options.dedupe != DEDUPE_QUARANTINE || fstat(fd, &st) != 0) {
+        return 0;
+    }
+    
+    return st.st_dev == g_dedupe.quarantine_st.st_dev && st.st_ino == g_dedupe.quarantine_st.st_ino;
+}
+
+/**
+ * Releases the hash table and closes the quarantine directory
+ */
+static void dedupe_close(void) {
+    if (g_dedupe.quarantine_fd >= 0) {
+        close(g_dedupe.quarantine_fd);
+    }
+    free(g_dedupe.entries);
+    pthread_mutex_destroy(&g_dedupe.lock);
+    memset(&g_dedupe, 0, sizeof(g_dedupe));
+    g_dedupe.quarantine_fd = -1;
+}
+#endif
+
+#ifndef _WIN32
+// Scan Cache Module Implementation
+
+/**
+ * Checks whether a filename has the form this utility gives renamed files:
+ * an ID of one of the configured formats followed by ".txt" or "_N.txt"
+ * (RJ-YYYY-NNNNN.txt or RJ-YYYY-NNNNN_N.txt by default)
+ * @param name The filename to check
+ * @param pattern Receives the ID in the name (PATTERN_MAX_LENGTH bytes), or NULL
+ * @return 1 if the name is canonical, 0 otherwise
+ */
+static int is_canonical_name(const char *name, char *pattern) {
+    size_t available = strlen(name);
+    
+    for (int f = 0; f < g_patterns.count; f++) {
+        const PatternFormat *format = &g_patterns.formats[f];
+        if (!pattern_format_matches_at(format, name, available)) {
+            continue;
+        }
+        
+        const char *p = name + format->length;
+        if (*p == '_') {
+            p++;
+            if (*p < '1' || *p > '9') {
+                continue;
+            }
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+        
+        if (strcmp(p, ".txt") == 0) {
+            if (pattern != NULL) {
+                snprintf(pattern, PATTERN_MAX_LENGTH, "%.*s", (int)format->length, name);
+            }
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Returns the current wall-clock time in nanoseconds
+ * @return Nanoseconds since the epoch
+ */
+static int64_t current_time_ns(void) {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Orders cache entries by file identity (device, then inode)
+ * @param a First entry
+ * @param b Second entry
+ * @return Negative, zero or positive as for qsort
+ */
+static int compare_cache_entries(const void *a, const void *b) {
+    const CacheEntry *x = (const CacheEntry*)a;
+    const CacheEntry *y = (const CacheEntry*)b;
+    
+    if (x->dev != y->dev) {
+        return x->dev < y->dev ? -1 : 1;
+    }
+    if (x->ino != y->ino) {
+        return x->ino < y->ino ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Maps the cache left by a previous run. A missing file starts an empty
+ * cache; an unreadable or incompatible one is ignored with a warning and
+ * replaced when the run finishes.
+ * @param path Path of the cache file
+ */
+static void cache_open(const char *path) {
+    memset(&g_cache, 0, sizeof(g_cache));
+    pthread_mutex_init(&g_cache.lock, NULL);
+    g_cache.enabled = 1;
+    g_cache.started_ns = current_time_ns();
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "Warning: Cannot open cache file '%s': %s; rescanning all files\n",
+                    path, strerror(errno));
+        }
+        return;
+    }
+    
+    struct stat st;
+    const CacheHeader *header = NULL;
+    void *map = MAP_FAILED;
+    
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader)) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    
+    if (map != MAP_FAILED) {
+        header = (const CacheHeader*)map;
+        if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+            header->version == CACHE_VERSION &&
+            header->entry_size == sizeof(CacheEntry) &&
+            header->count <= ((size_t)st.st_size - sizeof(CacheHeader)) / sizeof(CacheEntry) &&
+            (size_t)st.st_size == sizeof(CacheHeader) + header->count * sizeof(CacheEntry) &&
+            header->max_scan_bytes == g_options.max_scan_bytes &&
+            header->pattern_hash == g_patterns.hash) {
+            madvise(map, (size_t)st.st_size, MADV_RANDOM);
+            g_cache.map = map;
+            g_cache.map_size = (size_t)st.st_size;
+            g_cache.entries = (const CacheEntry*)(header + 1);
+            g_cache.count = (size_t)header->count;
+            g_cache.written_ns = header->started_ns;
+            return;
+        }
+        munmap(map, (size_t)st.st_size);
+    }
+    
+    fprintf(stderr, "Warning: Ignoring invalid or incompatible cache file '%s'; rescanning all files\n", path);
+}
+
+/**
+ * Fills an entry's identity fields from a stat result
+ * @param st The file's status
+ * @param entry The entry to fill (the result fields are cleared)
+ */
+static void cache_entry_from_stat(const struct stat *st, CacheEntry *entry) {
+    memset(entry, 0, sizeof(*entry));
+    entry->dev = (uint64_t)st->st_dev;
+    entry->ino = (uint64_t)st->st_ino;
+    entry->size = (uint64_t)st->st_size;
+    entry->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+/**
+ * Looks up a file in the previous run's cache
+ * @param key Entry holding the file's current identity
+ * @return The cached entry if the file is unchanged since it was scanned, NULL otherwise
+ */
+static const CacheEntry *cache_lookup(const CacheEntry *key) {
+    const CacheEntry *entry = (const CacheEntry*)bsearch(key, g_cache.entries, g_cache.count,
+                                                         sizeof(CacheEntry), compare_cache_entries);
+    
+    if (entry == NULL || entry->size != key->size || entry->mtime_ns != key->mtime_ns) {
+        return NULL;
+    }
+    
+    // A file modified just before that run started may have been changed again
+    // within the same timestamp tick, so its result cannot be trusted
+    if (entry->mtime_ns >= g_cache.written_ns - CACHE_RACY_WINDOW_NS) {
+        return NULL;
+    }
+    
+    return entry;
+}
+
+/**
+ * Records a file's scan result for the cache written at the end of the run.
+ * Entries go to a per-thread buffer, so workers never contend on a lock.
+ * @param entry The entry to record
+ */
+static void cache_record(const CacheEntry *entry) {
+    CacheBuffer *buffer = t_cache_buffer;
+    
+    if (buffer == NULL) {
+        buffer = (CacheBuffer*)calloc(1, sizeof(CacheBuffer));
+        if (buffer == NULL) {
+            return;  // The file is simply rescanned next run
+        }
+        pthread_mutex_lock(&g_cache.lock);
+        buffer->next = g_cache.buffers;
+        g_cache.buffers = buffer;
+        pthread_mutex_unlock(&g_cache.lock);
+        t_cache_buffer = buffer;
+    }
+    
+    if (buffer->count == buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 1024;
+        CacheEntry *entries = (CacheEntry*)realloc(buffer->entries, capacity * sizeof(CacheEntry));
+        if (entries == NULL) {
+            return;
+        }
+        buffer->entries = entries;
+        buffer->capacity = capacity;
+    }
+    
+    buffer->entries[buffer->count++] = *entry;
+}
+
+/**
+ * Looks a file up in the cache by its current identity. On a miss the
+ * caller scans the file and records the result with cache_store_result.
+ * @param dir The directory containing the file
+ * @param name The name of the file
+ * @param entry Receives the file's identity (and cached result on a hit)
+ * @return 1 on a hit, 0 on a miss, -1 if the file cannot be examined
+ */
+static int cache_probe(const DirRef *dir, const char *name, CacheEntry *entry) {
+    struct stat st;
+    
+    INSTRUMENT_COUNT(COUNTER_STAT_CALLS, 1);
+    if (fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return -1;
+    }
+    cache_entry_from_stat(&st, entry);
+    
+    const CacheEntry *cached = cache_lookup(entry);
+    if (cached == NULL) {
+        return 0;
+    }
+    
+    *entry = *cached;
+    cache_record(entry);
+    return 1;
+}
+
+/**
+ * Records the result of scanning a file that missed the cache
+ * @param entry Entry filled by cache_probe
+ * @param scan_result 0 if a pattern was found, 1 if none
+ * @param pattern The pattern found (ignored when scan_result is 1)
+ */
+static void cache_store_result(CacheEntry *entry, int scan_result, const char *pattern) {
+    entry->found = (scan_result == 0);
+    if (entry->found) {
+        memcpy(entry->pattern, pattern, strlen(pattern) + 1);  // At most PATTERN_MAX_LENGTH bytes
+    }
+    cache_record(entry);
+}
+
+/**
+ * Writes this run's results to the cache file, replacing it atomically, and
+ * releases the cache. Files not seen in this run are dropped from the cache.
+ * @param path Path of the cache file
+ * @return 0 on success, -1 on failure
+ */
+static int cache_save(const char *path) {
+    size_t total = 0;
+    int result = -1;
+    
+    for (CacheBuffer *buffer = g_cache.buffers; buffer != NULL; buffer = buffer->next) {
+        total += buffer->count;
+    }
+    
+    CacheEntry *entries = (CacheEntry*)malloc((total ? total : 1) * sizeof(CacheEntry));
+    if (entries == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for cache file '%s'\n", path);
+        return -1;
+    }
+    
+    size_t count = 0;
+    for (CacheBuffer *buffer = g_cache.buffers; buffer != NULL; buffer = buffer->next) {
+        memcpy(entries + count, buffer->entries, buffer->count * sizeof(CacheEntry));
+        count += buffer->count;
+    }
+    
+    // Sort for binary search; hard links show up once per name, keep one entry
+    qsort(entries, count, sizeof(CacheEntry), compare_cache_entries);
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (unique == 0 || compare_cache_entries(&entries[unique - 1], &entries[i]) != 0) {
+            entries[unique++] = entries[i];
+        }
+    }
+    
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.entry_size = sizeof(CacheEntry);
+    header.count = unique;
+    header.max_scan_bytes = g_options.max_scan_bytes;
+    header.pattern_hash = g_patterns.hash;
+    header.started_ns = g_cache.started_ns;
+    
+    // Write a temporary file next to the cache and rename it over the old one
+    size_t path_len = strlen(path);
+    char *temp_path = (char*)malloc(path_len + 5);
+    if (temp_path != NULL) {
+        snprintf(temp_path, path_len + 5, "%s.tmp", path);
+        
+        FILE *file = fopen(temp_path, "wb");
+        if (file == NULL) {
+            fprintf(stderr, "Error: Cannot create cache file '%s': %s\n", temp_path, strerror(errno));
+        } else {
+            int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                     fwrite(entries, sizeof(CacheEntry), unique, file) == unique;
+            ok = (fflush(file) == 0) && ok;
+            ok = (fsync(fileno(file)) == 0) && ok;
+            ok = (fclose(file) == 0) && ok;
+            
+            if (!ok || rename(temp_path, path) != 0) {
+                fprintf(stderr, "Error: Cannot write cache file '%s': %s\n", path, strerror(errno));
+                unlink(temp_path);
+            } else {
+                result = 0;
+            }
+        }
+        free(temp_path);
+    }
+    
+    free(entries);
+    return result;
+}
+
+/**
+ * Unmaps the previous cache and frees this run's buffers
+ */
+static void cache_close(void) {
+    CacheBuffer *buffer = g_cache.buffers;
+    
+    while (buffer != NULL) {
+        CacheBuffer *next = buffer->next;
+        free(buffer->entries);
+        free(buffer);
+        buffer = next;
+    }
+    
+    if (g_cache.map != NULL) {
+        munmap(g_cache.map, g_cache.map_size);
+    }
+    
+    pthread_mutex_destroy(&g_cache.lock);
+    memset(&g_cache, 0, sizeof(g_cache));
+    t_cache_buffer = NULL;
+}
+#endif
+
+#ifndef _WIN32
+// File Selection Module Implementation
+
+/**
+ * Matches a file name against a shell glob: '*' matches any run of
+ * characters, '?' any one character, and "[...]" (or "[!...]") one character
+ * of (or not of) a set that may contain ranges such as "a-z"
+ * @param glob The glob
+ * @param name The file name
+ * @return 1 if the name matches, 0 otherwise
+ */
+static int glob_match(const char *glob, const char *name) {
+    const char *star = NULL;      // Glob position just after the last '*'
+    const char *resume = NULL;    // Name position that '*' will absorb next on a mismatch
+    
+    while (*name != '\0') {
+        if (*glob == '*') {
+            star = ++glob;
+            resume = name;
+            continue;
+        }
+        
+        int matched = 0;
+        const char *next = glob + 1;
+        if (*glob == '?') {
+            matched = 1;
+        } else if (*glob == '[') {
+            const char *p = glob + 1;
+            int negate = (*p == '!' || *p == '^');
+            if (negate) {
+                p++;
+            }
+            // A ']' first in the set is a member, not the end of it
+            int in_set = 0;
+            const char *first = p;
+            while (*p != '\0' && (*p != ']' || p == first)) {
+                unsigned char low = (unsigned char)*p;
+                unsigned char high = low;
+                if (p[1] == '-' && p[2] != '\0' && p[2] != ']') {
+                    high = (unsigned char)p[2];
+                    p += 2;
+                }
+                if ((unsigned char)*name >= low && (unsigned char)*name <= high) {
+                    in_set = 1;
+                }
+                p++;
+            }
+            if (*p == ']') {
+                matched = in_set != negate;
+                next = p + 1;
+            } else {
+                matched = (*name == '[');  // Unterminated: a literal '['
+            }
+        } else {
+            matched = (*glob == *name);
+        }
+        
+        if (matched && *glob != '\0') {
+            glob = next;
+            name++;
+        } else if (star != NULL) {
+            glob = star;
+            name = ++resume;
+        } else {
+            return 0;
+        }
+    }
+    
+    while (*glob == '*') {
+        glob++;
+    }
+    return *glob == '\0';
+}
+
+/**
+ * Applies --include, --exclude, --min-size, --max-size and --newer-than to
+ * a .txt file. Names are checked first; the file is only stat'ed when a size
+ * or age filter is set.
+ * @param dir The directory containing the file
+ * @param name The file name
+ * @return 1 if the file is to be processed, 0 if it is filtered out
+ */
+static int select_file(const DirRef *dir, const char *name) {
+    if (g_options.include_count > 0) {
+        int included = 0;
+        for (int i = 0; i < g_options.include_count && !included; i++) {
+            included = glob_match(g_options.include_globs[i], name);
+        }
+        if (!included) {
+            return 0;
+        }
+    }
+    for (int i = 0; i < g_options.exclude_count; i++) {
+        if (glob_match(g_options.exclude_globs[i], name)) {
+            return 0;
+        }
+    }
+    
+    if (g_options.min_size == 0 && g_options.max_size == 0 && g_options.modified_after_ns == 0) {
+        return 1;
+    }
+    
+    struct stat st;
+    INSTRUMENT_COUNT(COUNTER_STAT_CALLS, 1);
+    if (fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return 1;  // Let the scan report what is wrong with the file
+    }
+    
+    if (st.st_size < g_options.min_size || (g_options.max_size != 0 && st.st_size > g_options.max_size)) {
+        return 0;
+    }
+    int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return mtime_ns > g_options.modified_after_ns;
+}
+
+/**
+ * Confirms that a file with a canonical name holds the ID its name carries:
+ * the first ID among its first VERIFY_HEADER_BYTES must be that one
+ * @param dir The directory containing the file
+ * @param name The canonical file name
+ * @param pattern Receives the ID (PATTERN_MAX_LENGTH bytes) when confirmed
+ * @return 1 if confirmed, 0 if the file needs a full scan
+ */
+static int verify_canonical_name(const DirRef *dir, const char *name, char *pattern) {
+    char buffer[VERIFY_HEADER_BYTES];
+    size_t want = VERIFY_HEADER_BYTES;
+    if (g_options.max_scan_bytes != 0 && (long long)want > g_options.max_scan_bytes) {
+        want = (size_t)g_options.max_scan_bytes;
+    }
+    
+    INSTRUMENT_BEGIN(open_started);
+    int fd = open_entry(dir, name);
+    INSTRUMENT_END(PHASE_OPEN, open_started);
+    if (fd < 0) {
+        return 0;  // The full scan reports the error
+    }
+    
+    uint64_t throttled = throttle_begin(THROTTLE_READ);
+    INSTRUMENT_BEGIN(read_started);
+    long long bytes_read = read_entry(fd, buffer, want);
+    INSTRUMENT_END(PHASE_READ, read_started);
+    throttle_end(THROTTLE_READ, throttled, bytes_read > 0 ? (uint64_t)bytes_read : 0);
+    INSTRUMENT_COUNT(COUNTER_READ_CALLS, 1);
+    INSTRUMENT_COUNT(COUNTER_BYTES_READ, bytes_read > 0 ? bytes_read : 0);
+    close_entry(fd);
+    if (bytes_read <= 0) {
+        return 0;
+    }
+    
+    TextEncoding encoding = detect_text_encoding(buffer, (size_t)bytes_read);
+    size_t match_length = 0;
+    const char *match = find_encoded_pattern(buffer, (size_t)bytes_read, encoding, &match_length);
+    if (match == NULL) {
+        return 0;
+    }
+    
+    char id[PATTERN_MAX_LENGTH];
+    copy_encoded_match(match, match_length, encoding, id);
+    if (strncmp(name, id, match_length) != 0 || (name[match_length] != '.' && name[match_length] != '_')) {
+        return 0;
+    }
+    
+    memcpy(pattern, id, match_length + 1);
+    return 1;
+}
+#endif
+
+#ifndef _WIN32
+// Rename Plan Module Implementation
+
+/**
+ * Starts recording a rename plan for a directory tree
+ * @param root The directory being planned
+ */
+static void plan_open(const char *root) {
+    memset(&g_plan, 0, sizeof(g_plan));
+    pthread_mutex_init(&g_plan.lock, NULL);
+    atomic_init(&g_plan.sequence, 0);
+    g_plan.root = root;
+    g_plan.enabled = 1;
+}
+
+/**
+ * Returns the calling thread's plan buffer, creating it on first use
+ * @return The buffer, or NULL on allocation failure
+ */
+static PlanBuffer *thread_plan_buffer(void) {
+    if (t_plan_buffer == NULL) {
+        PlanBuffer *buffer = (PlanBuffer*)calloc(1, sizeof(PlanBuffer));
+        if (buffer == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&g_plan.lock);
+        buffer->next = g_plan.buffers;
+        g_plan.buffers = buffer;
+        pthread_mutex_unlock(&g_plan.lock);
+        t_plan_buffer = buffer;
+    }
+    
+    return t_plan_buffer;
+}
+
+/**
+ * Copies a string into a plan buffer's pool
+ * @param buffer The buffer
+ * @param text The string to copy
+ * @param offset Receives the string's offset in the pool
+ * @return 0 on success, -1 on allocation failure
+ */
+static int plan_pool_add(PlanBuffer *buffer, const char *text, size_t *offset) {
+    size_t length = strlen(text) + 1;
+    
+    if (buffer->pool_used + length > buffer->pool_capacity) {
+        size_t capacity = buffer->pool_capacity ? buffer->pool_capacity * 2 : 65536;
+        while (capacity < buffer->pool_used + length) {
+            capacity *= 2;
+        }
+        char *pool = (char*)realloc(buffer->pool, capacity);
+        if (pool == NULL) {
+            return -1;
+        }
+        buffer->pool = pool;
+        buffer->pool_capacity = capacity;
+    }
+    
+    memcpy(buffer->pool + buffer->pool_used, text, length);
+    *offset = buffer->pool_used;
+    buffer->pool_used += length;
+    return 0;
+}
+
+/**
+ * Returns a directory's path relative to the planned root ("" for the root itself)
+ * @param dir_path The directory path as built during traversal
+ * @return Pointer into dir_path
+ */
+static const char *plan_relative_dir(const char *dir_path) {
+    const char *relative = dir_path + strlen(g_plan.root);
+    
+    while (*relative == '/') {
+        relative++;
+    }
+    
+    return relative;
+}
+
+/**
+ * Plans the rename of a file instead of performing it. The chosen name is
+ * reserved in the directory's name index and the old name released, so the
+ * rest of the directory is planned as if the rename had already happened.
+ * @param dir The directory containing the file
+ * @param old_name The current filename
+ * @param new_name The new filename (RJ-YYYY-NNNNN.txt)
+ * @param stats Statistics structure to update
+ * @return 0 on success, -1 on failure
+ */
+static int plan_file(const DirRef *dir, const char *old_name, const char *new_name, Statistics *stats) {
+    char final_name[MAX_NAME_LENGTH];
+    char pattern[PATTERN_MAX_LENGTH];
+    struct stat st;
+    
+    pattern_from_name(new_name, 0, pattern);
+    
+    if (fstatat(dir->fd, old_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        fprintf(stderr, "Error: Cannot stat file '%s%s%s': %s\n",
+                dir->path, entry_separator(dir->path), old_name, strerror(errno));
+        log_file_event(dir, old_name, LOG_EVENT_ERROR, pattern, NULL, errno);
+        stats->error_files++;
+        return -1;
+    }
+    
+    INSTRUMENT_BEGIN(resolve_started);
+    int resolved = generate_unique_name(dir, new_name, final_name, MAX_NAME_LENGTH);
+    INSTRUMENT_END(PHASE_RESOLVE, resolve_started);
+    if (resolved != 0) {
+        fprintf(stderr, "Error: Cannot plan '%s%s%s': no free name for '%s'\n",
+                dir->path, entry_separator(dir->path), old_name, new_name);
+        log_file_event(dir, old_name, LOG_EVENT_ERROR, pattern, NULL, EEXIST);
+        stats->error_files++;
+        return -1;
+    }
+    
+    if (dir->index != NULL) {
+        name_index_commit(dir->index, old_name, final_name, 0);
+    }
+    
+    PlanBuffer *buffer = thread_plan_buffer();
+    PlanItem item;
+    CacheEntry identity;
+    
+    cache_entry_from_stat(&st, &identity);
+    memset(&item, 0, sizeof(item));
+    item.sequence = atomic_fetch_add(&g_plan.sequence, 1);
+    item.record.dev = identity.dev;
+    item.record.ino = identity.ino;
+    item.record.size = identity.size;
+    item.record.mtime_ns = identity.mtime_ns;
+    item.record.source_length = (uint16_t)strlen(old_name);
+    item.record.target_length = (uint16_t)strlen(final_name);
+    
+    // A suffixed target is "<stem>_<suffix><ext>" where "<stem><ext>" is new_name
+    if (strcmp(final_name, new_name) != 0) {
+        const char *ext_pos = strrchr(new_name, '.');
+        size_t stem_len = ext_pos ? (size_t)(ext_pos - new_name) : strlen(new_name);
+        item.record.suffix = (uint32_t)strtoul(final_name + stem_len + 1, NULL, 10);
+    }
+    
+    if (buffer == NULL || buffer->count == buffer->capacity) {
+        size_t capacity = (buffer && buffer->capacity) ? buffer->capacity * 2 : 1024;
+        PlanItem *items = buffer ? (PlanItem*)realloc(buffer->items, capacity * sizeof(PlanItem)) : NULL;
+        if (items == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed while planning '%s'\n", old_name);
+            log_file_event(dir, old_name, LOG_EVENT_ERROR, pattern, final_name, ENOMEM);
+            stats->error_files++;
+            return -1;
+        }
+        buffer->items = items;
+        buffer->capacity = capacity;
+    }
+    
+    if (plan_pool_add(buffer, plan_relative_dir(dir->path), &item.dir_offset) != 0 ||
+        plan_pool_add(buffer, old_name, &item.source_offset) != 0 ||
+        plan_pool_add(buffer, final_name, &item.target_offset) != 0) {
+        fprintf(stderr, "Error: Memory allocation failed while planning '%s'\n", old_name);
+        log_file_event(dir, old_name, LOG_EVENT_ERROR, pattern, final_name, ENOMEM);
+        stats->error_files++;
+        return -1;
+    }
+    buffer->items[buffer->count++] = item;
+    
+    log_file_event(dir, old_name, LOG_EVENT_PLANNED, pattern, final_name, 0);
+    stats->renamed_files++;
+    return 0;
+}
+
+// A planned rename together with the pool holding its strings, for sorting
+typedef struct {
+    const PlanItem *item;
+    const char *pool;
+} PlanRef;
+
+/**
+ * Orders planned renames by directory, then by planning order
+ * @param a First PlanRef
+ * @param b Second PlanRef
+ * @return Negative, zero or positive as for qsort
+ */
+static int compare_plan_refs(const void *a, const void *b) {
+    const PlanRef *x = (const PlanRef*)a;
+    const PlanRef *y = (const PlanRef*)b;
+    int order = strcmp(x->pool + x->item->dir_offset, y->pool + y->item->dir_offset);
+    
+    if (order != 0) {
+        return order;
+    }
+    return (x->item->sequence > y->item->sequence) - (x->item->sequence < y->item->sequence);
+}
+
+/**
+ * Writes the recorded plan to a file, replacing it atomically, and releases the plan
+ * @param path Path of the plan file
+ * @return 0 on success, -1 on failure
+ */
+static int plan_save(const char *path) {
+    size_t total = 0;
+    int result = -1;
+    
+    for (PlanBuffer *buffer = g_plan.buffers; buffer != NULL; buffer = buffer->next) {
+        total += buffer->count;
+    }
+    
+    PlanRef *refs = (PlanRef*)malloc((total ? total : 1) * sizeof(PlanRef));
+    size_t temp_len = strlen(path) + 5;
+    char *temp_path = (char*)malloc(temp_len);
+    if (refs == NULL || temp_path == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for plan file '%s'\n", path);
+        free(refs);
+        free(temp_path);
+        return -1;
+    }
+    
+    size_t count = 0;
+    for (PlanBuffer *buffer = g_plan.buffers; buffer != NULL; buffer = buffer->next) {
+        for (size_t i = 0; i < buffer->count; i++) {
+            refs[count].item = &buffer->items[i];
+            refs[count].pool = buffer->pool;
+            count++;
+        }
+    }
+    qsort(refs, count, sizeof(PlanRef), compare_plan_refs);
+    
+    PlanHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PLAN_MAGIC, sizeof(header.magic));
+    header.version = PLAN_VERSION;
+    header.record_count = count;
+    header.root_length = (uint32_t)strlen(g_plan.root);
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || strcmp(refs[i - 1].pool + refs[i - 1].item->dir_offset,
+                             refs[i].pool + refs[i].item->dir_offset) != 0) {
+            header.dir_count++;
+        }
+    }
+    
+    snprintf(temp_path, temp_len, "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Cannot create plan file '%s': %s\n", temp_path, strerror(errno));
+        free(refs);
+        free(temp_path);
+        return -1;
+    }
+    
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(g_plan.root, 1, header.root_length, file) == header.root_length;
+    
+    // Directory table, in the same order as the records
+    for (size_t i = 0; ok && i < count; i++) {
+        const char *dir = refs[i].pool + refs[i].item->dir_offset;
+        if (i > 0 && strcmp(refs[i - 1].pool + refs[i - 1].item->dir_offset, dir) == 0) {
+            continue;
+        }
+        uint32_t length = (uint32_t)strlen(dir);
+        ok = fwrite(&length, sizeof(length), 1, file) == 1 && fwrite(dir, 1, length, file) == length;
+    }
+    
+    uint32_t dir_index = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        const PlanItem *item = refs[i].item;
+        PlanRecord record = item->record;
+        
+        if (i > 0 && strcmp(refs[i - 1].pool + refs[i - 1].item->dir_offset, refs[i].pool + item->dir_offset) != 0) {
+            dir_index++;
+        }
+        record.dir_index = dir_index;
+        
+        ok = fwrite(&record, sizeof(record), 1, file) == 1 &&
+             fwrite(refs[i].pool + item->source_offset, 1, record.source_length, file) == record.source_length &&
+             fwrite(refs[i].pool + item->target_offset, 1, record.target_length, file) == record.target_length;
+    }
+    
+    ok = (fflush(file) == 0) && ok;
+    ok = (fsync(fileno(file)) == 0) && ok;
+    ok = (fclose(file) == 0) && ok;
+    
+    if (!ok || rename(temp_path, path) != 0) {
+        fprintf(stderr, "Error: Cannot write plan file '%s': %s\n", path, strerror(errno));
+        unlink(temp_path);
+    } else {
+        result = 0;
+    }
+    
+    free(refs);
+    free(temp_path);
+    return result;
+}
+
+/**
+ * Releases the plan recorded by this run
+ */
+static void plan_close(void) {
+    PlanBuffer *buffer = g_plan.buffers;
+    
+    while (buffer != NULL) {
+        PlanBuffer *next = buffer->next;
+        free(buffer->items);
+        free(buffer->pool);
+        free(buffer);
+        buffer = next;
+    }
+    
+    pthread_mutex_destroy(&g_plan.lock);
+    memset(&g_plan, 0, sizeof(g_plan));
+    t_plan_buffer = NULL;
+}
+#endif
+
+#ifndef _WIN32
+// One record of a loaded plan, with NUL-terminated names
+typedef struct {
+    PlanRecord record;
+    const char *source;
+    const char *target;
+    int done;
+} PlanStep;
+
+/**
+ * Checks a file name read from a plan: a single entry of its directory,
+ * so not empty, not "." or "..", and without '/' or NUL bytes
+ * @param name The name
+ * @param length Its length in the plan file
+ * @return 1 if the name is acceptable, 0 otherwise
+ */
+static int plan_name_valid(const char *name, size_t length) {
+    return length > 0 && memchr(name, '\0', length) == NULL && memchr(name, '/', length) == NULL &&
+           strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+/**
+ * Checks a directory path read from a plan: relative to the root ("" for the
+ * root itself), without NUL bytes and with every component a plain name, so
+ * it cannot leave the tree the plan is applied to
+ * @param path The path, NUL-terminated
+ * @param length Its length in the plan file
+ * @return 1 if the path is acceptable, 0 otherwise
+ */
+static int plan_directory_valid(const char *path, size_t length) {
+    if (strlen(path) != length || path[0] == '/') {
+        return 0;
+    }
+    
+    for (const char *component = path; *component != '\0'; ) {
+        const char *end = strchr(component, '/');
+        size_t component_length = end ? (size_t)(end - component) : strlen(component);
+        if (component_length == 0 || (component_length == 1 && component[0] == '.') ||
+            (component_length == 2 && component[0] == '.' && component[1] == '.')) {
+            return 0;
+        }
+        component += component_length + (end != NULL);
+    }
+    
+    return 1;
+}
+
+/**
+ * Checks that a planned file is still the file that was planned
+ * @param dir The directory containing the file
+ * @param step The planned rename
+ * @param check_inode Non-zero to compare device and inode as well as size and mtime
+ * @return 1 if the file is unchanged, 0 if it changed or is gone
+ */
+static int plan_identity_matches(const DirRef *dir, const PlanStep *step, int check_inode) {
+    struct stat st;
+    CacheEntry identity;
+    
+    if (fstatat(dir->fd, step->source, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    cache_entry_from_stat(&st, &identity);
+    
+    if (check_inode && (identity.dev != step->record.dev || identity.ino != step->record.ino)) {
+        return 0;
+    }
+    
+    return identity.size == step->record.size && identity.mtime_ns == step->record.mtime_ns;
+}
+
+/**
+ * Applies the planned renames of one directory. Renames whose target is still
+ * taken (typically by a file planned to move away later in the batch) are
+ * retried after the rest of the batch; any still blocked then get the next
+ * free suffix, as in a normal run.
+ * @param root_fd Descriptor of the root directory
+ * @param root Path of the root directory
+ * @param relative Directory path relative to the root ("" for the root)
+ * @param steps The directory's planned renames, in planning order
+ * @param count Number of steps
+ * @param check_inode Non-zero to compare device and inode when verifying files
+ * @param stats Statistics structure to update
+ */
+static void apply_directory(int root_fd, const char *root, const char *relative, PlanStep *steps, size_t count,
+                            int check_inode, Statistics *stats) {
+    size_t path_len = strlen(root) + strlen(relative) + 2;
+    char *path = (char*)malloc(path_len);
+    if (path == NULL) {
+        fprintf(stderr, "Error: Cannot allocate memory for directory '%s'\n", relative);
+        stats->error_files += (int)count;
+        return;
+    }
+    
+    if (*relative == '\0') {
+        snprintf(path, path_len, "%s", root);
+    } else {
+        snprintf(path, path_len, "%s%s%s", root, entry_separator(root), relative);
+    }
+    
+    // Symbolic links on the way are not followed, so the renames stay inside the root
+    DirRef dir = { path, open_directory_components(root_fd, relative, O_NOFOLLOW), NULL };
+    if (dir.fd < 0) {
+        fprintf(stderr, "Error: Cannot open directory '%s': %s\n", path, strerror(errno));
+        stats->error_files += (int)count;
+        free(path);
+        return;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        log_file_start();
+        if (!plan_identity_matches(&dir, &steps[i], check_inode)) {
+            log_file_event(&dir, steps[i].source, LOG_EVENT_SKIPPED, NULL, "changed since planned", 0);
+            stats->skipped_files++;
+            steps[i].done = 1;
+        }
+    }
+    
+    // Keep sweeping while renames make progress; each sweep frees names for the next
+    int progress = 1;
+    while (progress) {
+        progress = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (steps[i].done) {
+                continue;
+            }
+            
+            char pattern[PATTERN_MAX_LENGTH];
+            pattern_from_name(steps[i].target, steps[i].record.suffix != 0, pattern);
+            
+            log_file_start();
+            INSTRUMENT_BEGIN(rename_started);
+            int renamed = rename_entry_noreplace(&dir, steps[i].source, steps[i].target);
+            INSTRUMENT_END(PHASE_RENAME, rename_started);
+            if (renamed == 0) {
+                log_file_event(&dir, steps[i].source, LOG_EVENT_RENAMED, pattern, steps[i].target, 0);
+                stats->renamed_files++;
+                steps[i].done = 1;
+                progress = 1;
+            } else if (errno != EEXIST) {
+                fprintf(stderr, "Error: Cannot rename '%s%s%s' to '%s': %s\n",
+                        path, entry_separator(path), steps[i].source, steps[i].target, strerror(errno));
+                log_file_event(&dir, steps[i].source, LOG_EVENT_ERROR, pattern, steps[i].target, errno);
+                stats->error_files++;
+                steps[i].done = 1;
+            }
+        }
+    }
+    
+    // Targets taken by files the plan did not know about: fall back to the suffix search
+    for (size_t i = 0; i < count; i++) {
+        if (steps[i].done) {
+            continue;
+        }
+        
+        char base_name[MAX_NAME_LENGTH];
+        const char *ext_pos = strrchr(steps[i].target, '.');
+        size_t stem_len = ext_pos ? (size_t)(ext_pos - steps[i].target) : strlen(steps[i].target);
+        if (steps[i].record.suffix != 0) {
+            const char *underscore = steps[i].target + stem_len;
+            while (underscore > steps[i].target && *underscore != '_') {
+                underscore--;
+            }
+            stem_len = (size_t)(underscore - steps[i].target);
+        }
+        snprintf(base_name, sizeof(base_name), "%.*s%s", (int)stem_len, steps[i].target, ext_pos ? ext_pos : "");
+        
+        rename_file(&dir, steps[i].source, base_name, stats);
+    }
+    
+    close(dir.fd);
+    free(path);
+}
+
+/**
+ * Applies a plan written by --plan: renames are run directory by directory,
+ * and only for files whose identity has not changed since planning
+ * @param plan_path Path of the plan file
+ * @param root_override Directory to apply the plan to, or NULL for the planned root.
+ *                      When it differs from the planned root (e.g. the plan was made
+ *                      on a replica), files are verified by size and mtime only.
+ * @param stats Statistics structure to update
+ * @return 0 on success, -1 if the plan could not be read or applied
+ */
+static int apply_plan(const char *plan_path, const char *root_override, Statistics *stats) {
+    FILE *file = fopen(plan_path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Cannot open plan file '%s': %s\n", plan_path, strerror(errno));
+        return -1;
+    }
+    
+    struct stat st;
+    char *data = NULL;
+    size_t size = 0;
+    
+    if (fstat(fileno(file), &st) == 0) {
+        size = (size_t)st.st_size;
+        data = (char*)malloc(size ? size : 1);
+    }
+    if (data == NULL || fread(data, 1, size, file) != size) {
+        fprintf(stderr, "Error: Cannot read plan file '%s': %s\n", plan_path, strerror(errno));
+        free(data);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    
+    // Names are copied out with terminators; they never take more room than the file
+    PlanHeader header;
+    PlanStep *steps = NULL;
+    char **dirs = NULL;
+    char *names = NULL;
+    char *plan_root = NULL;
+    int root_fd = -1;
+    int result = -1;
+    size_t offset = sizeof(header);
+    
+    memset(&header, 0, sizeof(header));
+    if (size >= sizeof(header)) {
+        memcpy(&header, data, sizeof(header));
+    }
+    if (size < sizeof(header) || memcmp(header.magic, PLAN_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != PLAN_VERSION || header.root_length > size - offset ||
+        header.dir_count > size || header.record_count > size / sizeof(PlanRecord)) {
+        goto invalid;
+    }
+    
+    plan_root = strndup(data + offset, header.root_length);
+    offset += header.root_length;
+    dirs = (char**)calloc(header.dir_count + 1, sizeof(char*));
+    steps = (PlanStep*)calloc(header.record_count + 1, sizeof(PlanStep));
+    names = (char*)malloc(size + 2 * header.record_count);
+    if (plan_root == NULL || dirs == NULL || steps == NULL || names == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for plan file '%s'\n", plan_path);
+        goto cleanup;
+    }
+    
+    for (uint32_t i = 0; i < header.dir_count; i++) {
+        uint32_t length;
+        if (size - offset < sizeof(length)) {
+            goto invalid;
+        }
+        memcpy(&length, data + offset, sizeof(length));
+        offset += sizeof(length);
+        if (length > size - offset || (dirs[i] = strndup(data + offset, length)) == NULL ||
+            !plan_directory_valid(dirs[i], length)) {
+            goto invalid;
+        }
+        offset += length;
+    }
+    
+    size_t names_used = 0;
+    for (uint64_t i = 0; i < header.record_count; i++) {
+        PlanStep *step = &steps[i];
+        if (size - offset < sizeof(PlanRecord)) {
+            goto invalid;
+        }
+        memcpy(&step->record, data + offset, sizeof(PlanRecord));
+        offset += sizeof(PlanRecord);
+        
+        size_t source_len = step->record.source_length;
+        size_t target_len = step->record.target_length;
+        if (source_len + target_len > size - offset || source_len == 0 || target_len == 0 ||
+            step->record.dir_index >= header.dir_count ||
+            (i > 0 && step->record.dir_index < steps[i - 1].record.dir_index)) {
+            goto invalid;
+        }
+        
+        step->source = names + names_used;
+        memcpy(names + names_used, data + offset, source_len);
+        names_used += source_len;
+        names[names_used++] = '\0';
+        offset += source_len;
+        
+        step->target = names + names_used;
+        memcpy(names + names_used, data + offset, target_len);
+        names_used += target_len;
+        names[names_used++] = '\0';
+        offset += target_len;
+        
+        // Plans name files in their own directory only
+        if (!plan_name_valid(step->source, source_len) || !plan_name_valid(step->target, target_len)) {
+            goto invalid;
+        }
+    }
+    
+    const char *root = (root_override != NULL) ? root_override : plan_root;
+    root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        fprintf(stderr, "Error: Cannot open directory '%s': %s\n", root, strerror(errno));
+        goto cleanup;
+    }
+    
+    int check_inode = (strcmp(root, plan_root) == 0);
+    stats->total_files = (int)header.record_count;
+    
+    for (size_t first = 0; first < header.record_count; ) {
+        size_t last = first + 1;
+        while (last < header.record_count && steps[last].record.dir_index == steps[first].record.dir_index) {
+            last++;
+        }
+        
+        apply_directory(root_fd, root, dirs[steps[first].record.dir_index], steps + first, last - first,
+                        check_inode, stats);
+        first = last;
+    }
+    
+    result = 0;
+    goto cleanup;
+
+invalid:
+    fprintf(stderr, "Error: Plan file '%s' is invalid or incompatible\n", plan_path);
+
+cleanup:
+    if (root_fd >= 0) {
+        close(root_fd);
+    }
+    if (dirs != NULL) {
+        for (uint32_t i = 0; i < header.dir_count; i++) {
+            free(dirs[i]);
+        }
+    }
+    free(dirs);
+    free(steps);
+    free(names);
+    free(plan_root);
+    free(data);
+    return result;
+}
+#endif
+
+#ifndef _WIN32
+// Rename Journal Module Implementation
+
+/**
+ * Checksums the bytes of a journal record (FNV-1a, 32 bits)
+ * @param data The bytes
+ * @param length Number of bytes
+ * @return The checksum
+ */
+static uint32_t journal_checksum(const char *data, size_t length) {
+    uint32_t hash = 2166136261U;
+    
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 16777619U;
+    }
+    
+    return hash;
+}
+
+/**
+ * Encodes one record at the end of a buffer
+ * @param buffer The buffer to append to
+ * @param type The kind of record
+ * @param sequence Rename number (intents and completions)
+ * @param ino Inode of the file being renamed (intents)
+ * @param dir Directory path relative to the root, or NULL
+ * @param old_name The file's name before the rename, or NULL
+ * @param new_name The file's name after the rename, or NULL
+ * @return 0 on success, -1 on allocation failure
+ */
+static int journal_encode(JournalBuffer *buffer, JournalRecordType type, uint64_t sequence, uint64_t ino,
+                          const char *dir, const char *old_name, const char *new_name) {
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = (uint32_t)type;
+    record.sequence = sequence;
+    record.ino = ino;
+    record.dir_length = dir ? (uint32_t)strlen(dir) : 0;
+    record.old_length = old_name ? (uint16_t)strlen(old_name) : 0;
+    record.new_length = new_name ? (uint16_t)strlen(new_name) : 0;
+    
+    size_t length = sizeof(record) + record.dir_length + record.old_length + record.new_length;
+    if (buffer->used + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 16384;
+        while (capacity < buffer->used + length) {
+            capacity *= 2;
+        }
+        char *data = (char*)realloc(buffer->data, capacity);
+        if (data == NULL) {
+            return -1;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    
+    char *out = buffer->data + buffer->used;
+    char *strings = out + sizeof(record);
+    memcpy(strings, dir ? dir : "", record.dir_length);
+    memcpy(strings + record.dir_length, old_name ? old_name : "", record.old_length);
+    memcpy(strings + record.dir_length + record.old_length, new_name ? new_name : "", record.new_length);
+    memcpy(out, &record, sizeof(record));
+    
+    // The checksum covers everything after itself
+    record.checksum = journal_checksum(out + sizeof(record.checksum), length - sizeof(record.checksum));
+    memcpy(out, &record.checksum, sizeof(record.checksum));
+    
+    buffer->used += length;
+    return 0;
+}
+
+/**
+ * Appends encoded records to the journal. After a failed append the journal
+ * stops accepting records and no further renames are issued.
+ * @param data The records
+ * @param length Their size in bytes
+ * @param end Receives the journal's size after the append, for journal_sync (may be NULL)
+ * @return 0 on success, -1 if the journal could not be written
+ */
+static int journal_append(const char *data, size_t length, uint64_t *end) {
+    int result = 0;
+    
+    pthread_mutex_lock(&g_journal.lock);
+    if (atomic_load(&g_journal.failed)) {
+        result = -1;
+    }
+    for (size_t done = 0; result == 0 && done < length; ) {
+        ssize_t written = write(g_journal.fd, data + done, length - done);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            fprintf(stderr, "Error: Cannot write journal: %s\n", strerror(written < 0 ? errno : ENOSPC));
+            atomic_store(&g_journal.failed, 1);
+            result = -1;
+            break;
+        }
+        done += (size_t)written;
+    }
+    if (result == 0) {
+        g_journal.written += length;
+    }
+    if (end != NULL) {
+        *end = g_journal.written;
+    }
+    pthread_mutex_unlock(&g_journal.lock);
+    
+    return result;
+}
+
+/**
+ * Makes the journal durable up to a given size. A thread that finds another
+ * one syncing waits for it and is usually covered by that sync, so commits
+ * from several workers share one fdatasync.
+ * @param end Journal size that must reach the disk
+ * @return 0 on success, -1 if the journal could not be synced
+ */
+static int journal_sync(uint64_t end) {
+    int result = 0;
+    
+    pthread_mutex_lock(&g_journal.sync_lock);
+    if (g_journal.synced < end) {
+        pthread_mutex_lock(&g_journal.lock);
+        uint64_t target = g_journal.written;
+        pthread_mutex_unlock(&g_journal.lock);
+        
+        INSTRUMENT_BEGIN(sync_started);
+        int synced = atomic_load(&g_journal.failed) ? -1 : fdatasync(g_journal.fd);
+        INSTRUMENT_END(PHASE_JOURNAL, sync_started);
+        if (synced == 0) {
+            g_journal.synced = target;
+            atomic_fetch_add(&g_journal.commits, 1);
+        } else {
+            if (!atomic_exchange(&g_journal.failed, 1)) {
+                fprintf(stderr, "Error: Cannot sync journal: %s\n", strerror(errno));
+            }
+            result = -1;
+        }
+    }
+    pthread_mutex_unlock(&g_journal.sync_lock);
+    
+    return result;
+}
+
+/**
+ * Strips the root from a directory path, as recorded in the journal
+ * @param path A directory path starting with the root
+ * @return The path relative to the root ("" for the root itself)
+ */
+static const char *journal_relative(const char *path) {
+    return relative_path(g_journal.root, path);
+}
+
+/**
+ * Checks whether a run being resumed already finished a directory
+ * @param path Directory path relative to the root
+ * @param type JOURNAL_DIR_DONE (its files) or JOURNAL_TREE_DONE (its whole subtree)
+ * @return 1 if so, 0 otherwise
+ */
+static int journal_finished(const char *path, JournalRecordType type) {
+    if (g_journal.finished.live == 0) {
+        return 0;
+    }
+    
+    const NameSlot *slot = name_table_find(&g_journal.finished, path);
+    return slot != NULL && (slot->value & (1 << type)) != 0;
+}
+
+/**
+ * Records that a directory, or a directory's subtree, is finished
+ * @param type JOURNAL_DIR_DONE or JOURNAL_TREE_DONE
+ * @param path Directory path relative to the root
+ */
+static void journal_mark(JournalRecordType type, const char *path) {
+    if (journal_finished(path, type)) {
+        return;  // Recorded by the run being resumed
+    }
+    
+    JournalBuffer buffer = { NULL, 0, 0 };
+    if (journal_encode(&buffer, type, 0, 0, path, NULL, NULL) == 0) {
+        journal_append(buffer.data, buffer.used, NULL);
+    }
+    free(buffer.data);
+}
+
+/**
+ * Starts tracking the subtree of a directory whose listing has been read
+ * @param node The directory
+ * @param parent The parent's tracker, which already counts this directory (NULL for a root)
+ * @return 0 on success, -1 on allocation failure
+ */
+static int journal_tree_open(DirNode *node, JournalTree *parent) {
+    const char *path = journal_relative(node->path);
+    size_t length = strlen(path);
+    
+    JournalTree *tree = (JournalTree*)malloc(sizeof(JournalTree) + length + 1);
+    if (tree == NULL) {
+        return -1;
+    }
+    
+    tree->parent = parent;
+    atomic_init(&tree->pending, 1);
+    atomic_init(&tree->files_failed, 0);
+    atomic_init(&tree->failed, 0);
+    memcpy(tree->path, path, length + 1);
+    
+    node->tree = tree;
+    return 0;
+}
+
+/**
+ * Drops one count from a subtree tracker: the directory's own files, or one
+ * of its subdirectories. The last count records the subtree as finished
+ * (unless something in it failed) and is passed on to the parent.
+ * @param tree The tracker
+ * @param failed Non-zero if what finished did not finish cleanly
+ */
+static void journal_tree_release(JournalTree *tree, int failed) {
+    while (tree != NULL) {
+        if (failed) {
+            atomic_store(&tree->failed, 1);
+        }
+        if (atomic_fetch_sub(&tree->pending, 1) != 1) {
+            return;
+        }
+        
+        JournalTree *parent = tree->parent;
+        failed = atomic_load(&tree->failed) || atomic_load(&tree->files_failed);
+        if (!failed) {
+            journal_mark(JOURNAL_TREE_DONE, tree->path);
+        }
+        free(tree);
+        tree = parent;
+    }
+}
+
+/**
+ * Reports a queued rename that could not be carried out
+ * @param item The rename
+ * @param error The errno describing why
+ */
+static void journal_fail(JournalPending *item, int error) {
+    char pattern[PATTERN_MAX_LENGTH];
+    pattern_from_name(item->new_name, 0, pattern);
+    
+    if (item->final_name[0] == '\0') {
+        fprintf(stderr, "Error: Cannot rename '%s%s%s': no free name for '%s'\n",
+                item->dir->path, entry_separator(item->dir->path), item->old_name, item->new_name);
+        log_file_event(item->dir, item->old_name, LOG_EVENT_ERROR, pattern, NULL, error);
+    } else {
+        fprintf(stderr, "Error: Cannot rename '%s%s%s' to '%s': %s\n", item->dir->path,
+                entry_separator(item->dir->path), item->old_name, item->final_name, strerror(error));
+        log_file_event(item->dir, item->old_name, LOG_EVENT_ERROR, pattern, item->final_name, error);
+    }
+    item->stats->error_files++;
+    
+    if (item->node != NULL && item->node->tree != NULL) {
+        atomic_store(&item->node->tree->files_failed, 1);
+    }
+    item->attempts = RENAME_ATTEMPTS;
+}
+
+/**
+ * Queues a rename for this thread's next journal commit instead of issuing
+ * it. The queue is committed once it holds --journal-batch renames, when the
+ * worker runs out of work, and at once for callers outside a file batch.
+ * @param dir The directory containing the file
+ * @param old_name The current filename
+ * @param new_name The new filename, before any collision suffix
+ * @param stats Statistics to count the outcome in
+ * @return 0 if queued (the outcome is counted when the rename is issued), -1 on error
+ */
+static int journal_rename(const DirRef *dir, const char *old_name, const char *new_name, Statistics *stats) {
+    if (t_journal_pending == NULL) {
+        t_journal_pending = (JournalPending*)malloc((size_t)g_options.journal_batch * sizeof(JournalPending));
+    }
+    if (t_journal_pending == NULL || atomic_load(&g_journal.failed)) {
+        fprintf(stderr, "Error: Cannot rename '%s%s%s': %s\n", dir->path, entry_separator(dir->path), old_name,
+                t_journal_pending == NULL ? "out of memory" : "the journal cannot be written");
+        log_file_event(dir, old_name, LOG_EVENT_ERROR, NULL, new_name, t_journal_pending == NULL ? ENOMEM : EIO);
+        stats->error_files++;
+        return -1;
+    }
+    
+    JournalPending *item = &t_journal_pending[t_journal_count++];
+    item->dir = dir;
+    item->node = NULL;
+    item->stats = stats;
+    item->attempts = 0;
+    item->staged = 0;
+    snprintf(item->old_name, sizeof(item->old_name), "%s", old_name);
+    snprintf(item->new_name, sizeof(item->new_name), "%s", new_name);
+    item->final_name[0] = '\0';
+    
+    // Within a file batch the directory is kept open by a reference until the commit
+    if (t_journal_node != NULL && dir == &t_journal_node->ref) {
+        item->node = t_journal_node;
+        atomic_fetch_add(&item->node->refs, 1);
+    }
+    
+    if (item->node == NULL || t_journal_count == (size_t)g_options.journal_batch) {
+        journal_flush_thread();
+    }
+    return 0;
+}
+
+/**
+ * Commits the renames this thread has queued: reserves their target names,
+ * appends one intent per rename and syncs the journal once, issues the
+ * renames, then appends their completions. A rename that loses a race for
+ * its target goes round again with the next free name.
+ */
+static void journal_flush_thread(void) {
+    JournalBuffer *records = &t_journal_records;
+    
+    while (t_journal_count > 0) {
+        records->used = 0;
+        
+        for (size_t i = 0; i < t_journal_count; i++) {
+            JournalPending *item = &t_journal_pending[i];
+            
+            INSTRUMENT_BEGIN(resolve_started);
+            int resolved = generate_unique_name(item->dir, item->new_name, item->final_name, MAX_NAME_LENGTH);
+            INSTRUMENT_END(PHASE_RESOLVE, resolve_started);
+            if (resolved != 0) {
+                item->final_name[0] = '\0';
+                journal_fail(item, EEXIST);
+                continue;
+            }
+            
+            // The inode lets --undo tell this file from whatever holds the name later
+            struct stat st;
+            INSTRUMENT_COUNT(COUNTER_STAT_CALLS, 1);
+            int error = fstatat(item->dir->fd, item->old_name, &st, AT_SYMLINK_NOFOLLOW) == 0 ? 0 : errno;
+            item->sequence = atomic_fetch_add(&g_journal.sequence, 1);
+            if (error == 0 && journal_encode(records, JOURNAL_INTENT, item->sequence, (uint64_t)st.st_ino,
+                                             journal_relative(item->dir->path), item->old_name,
+                                             item->final_name) != 0) {
+                error = ENOMEM;
+            }
+            if (error != 0) {
+                if (item->dir->index != NULL) {
+                    name_index_commit(item->dir->index, item->old_name, item->final_name, ECANCELED);
+                }
+                journal_fail(item, error);
+                continue;
+            }
+            item->staged = 1;
+        }
+        
+        // One append and one sync cover every intent of the commit
+        uint64_t end = 0;
+        int committed = records->used > 0 && journal_append(records->data, records->used, &end) == 0 &&
+                        journal_sync(end) == 0;
+        
+        records->used = 0;
+        for (size_t i = 0; i < t_journal_count; i++) {
+            JournalPending *item = &t_journal_pending[i];
+            if (!item->staged) {
+                continue;
+            }
+            item->staged = 0;
+            
+            if (!committed) {
+                if (item->dir->index != NULL) {
+                    name_index_commit(item->dir->index, item->old_name, item->final_name, ECANCELED);
+                }
+                journal_fail(item, EIO);
+                continue;
+            }
+            
+            INSTRUMENT_BEGIN(rename_started);
+            int result = rename_entry_noreplace(item->dir, item->old_name, item->final_name);
+            int error = result == 0 ? 0 : errno;
+            INSTRUMENT_END(PHASE_RENAME, rename_started);
+            INSTRUMENT_COUNT(COUNTER_RENAME_CONFLICTS, error == EEXIST);
+            
+            if (item->dir->index != NULL) {
+                name_index_commit(item->dir->index, item->old_name, item->final_name, error);
+            }
+            
+            if (result == 0) {
+                char pattern[PATTERN_MAX_LENGTH];
+                pattern_from_name(item->new_name, 0, pattern);
+                
+                // A completion lost in a crash only costs --undo an inode check
+                journal_encode(records, JOURNAL_DONE, item->sequence, 0, NULL, NULL, NULL);
+                log_file_event(item->dir, item->old_name, LOG_EVENT_RENAMED, pattern, item->final_name, 0);
+                item->stats->renamed_files++;
+                item->attempts = RENAME_ATTEMPTS;
+            } else if (error != EEXIST || ++item->attempts >= RENAME_ATTEMPTS) {
+                journal_fail(item, error);
+            }
+        }
+        if (records->used > 0) {
+            journal_append(records->data, records->used, NULL);
+        }
+        
+        // Keep only the renames that go round again
+        size_t kept = 0;
+        for (size_t i = 0; i < t_journal_count; i++) {
+            if (t_journal_pending[i].attempts < RENAME_ATTEMPTS) {
+                t_journal_pending[kept++] = t_journal_pending[i];
+            } else {
+                dir_node_release(t_journal_pending[i].node);
+            }
+        }
+        t_journal_count = kept;
+    }
+}
+
+/**
+ * Frees this thread's rename queue and record buffer (the queue must be empty)
+ */
+static void journal_release_thread(void) {
+    free(t_journal_pending);
+    free(t_journal_records.data);
+    t_journal_pending = NULL;
+    t_journal_count = 0;
+    memset(&t_journal_records, 0, sizeof(t_journal_records));
+}
+
+/**
+ * Reads a journal into memory and checks its header
+ * @param path The journal file
+ * @param data Receives the contents (free with free)
+ * @param size Receives the number of bytes read
+ * @param root Receives the recorded root directory (free with free)
+ * @return Offset of the first record, or 0 if the journal could not be read (already reported)
+ */
+static size_t journal_read(const char *path, char **data, size_t *size, char **root) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Cannot open journal '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    
+    struct stat st;
+    *data = NULL;
+    *size = 0;
+    if (fstat(fileno(file), &st) == 0) {
+        *size = (size_t)st.st_size;
+        *data = (char*)malloc(*size ? *size : 1);
+    }
+    if (*data == NULL || fread(*data, 1, *size, file) != *size) {
+        fprintf(stderr, "Error: Cannot read journal '%s': %s\n", path, strerror(errno));
+        free(*data);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    
+    JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    if (*size >= sizeof(header)) {
+        memcpy(&header, *data, sizeof(header));
+    }
+    if (*size < sizeof(header) || memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != JOURNAL_VERSION || header.root_length == 0 ||
+        header.root_length > *size - sizeof(header)) {
+        fprintf(stderr, "Error: Journal '%s' is invalid or incompatible\n", path);
+        free(*data);
+        return 0;
+    }
+    
+    *root = strndup(*data + sizeof(header), header.root_length);
+    if (*root == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for journal '%s'\n", path);
+        free(*data);
+        return 0;
+    }
+    
+    return sizeof(header) + header.root_length;
+}
+
+/**
+ * Steps to the next record of a journal read by journal_read. A torn or
+ * corrupt record, as left by an interrupted append, ends the journal.
+ * @param data The journal contents
+ * @param size Their size
+ * @param offset Offset of the record; advanced past it
+ * @param record Receives the fixed part of the record
+ * @param strings Receives the record's directory path, followed by its old and new names
+ * @return 1 if a record was read, 0 at the end of the intact records
+ */
+static int journal_next(const char *data, size_t size, size_t *offset, JournalRecord *record,
+                        const char **strings) {
+    if (size - *offset < sizeof(JournalRecord)) {
+        return 0;
+    }
+    memcpy(record, data + *offset, sizeof(JournalRecord));
+    
+    size_t length = sizeof(JournalRecord) + (size_t)record->dir_length + record->old_length + record->new_length;
+    if (length > size - *offset || record->type < JOURNAL_INTENT || record->type > JOURNAL_TREE_DONE ||
+        record->old_length >= MAX_NAME_LENGTH || record->new_length >= MAX_NAME_LENGTH ||
+        journal_checksum(data + *offset + sizeof(record->checksum), length - sizeof(record->checksum)) !=
+            record->checksum) {
+        return 0;
+    }
+    
+    *strings = data + *offset + sizeof(JournalRecord);
+    *offset += length;
+    return 1;
+}
+
+/**
+ * Loads the journal of an interrupted run for --resume: finished directories
+ * and subtrees go into g_journal.finished, and numbering continues after the
+ * last rename
+ * @param path The journal file
+ * @param root The directory being processed, which must be the journal's
+ * @param end Receives the size of the intact part of the journal
+ * @return 0 on success, -1 on error (already reported)
+ */
+static int journal_load(const char *path, const char *root, uint64_t *end) {
+    char *data = NULL;
+    char *journal_root = NULL;
+    size_t size = 0;
+    size_t offset = journal_read(path, &data, &size, &journal_root);
+    if (offset == 0) {
+        return -1;
+    }
+    
+    // Compare resolved paths so "dir" and "./dir/" are the same tree
+    char *resolved_root = realpath(root, NULL);
+    char *resolved_journal = realpath(journal_root, NULL);
+    int same = resolved_root != NULL && resolved_journal != NULL && strcmp(resolved_root, resolved_journal) == 0;
+    free(resolved_root);
+    free(resolved_journal);
+    if (!same) {
+        fprintf(stderr, "Error: Journal '%s' was written for '%s', not '%s'\n", path, journal_root, root);
+        free(journal_root);
+        free(data);
+        return -1;
+    }
+    free(journal_root);
+    
+    JournalRecord record;
+    const char *strings;
+    char *dir = NULL;
+    size_t dir_capacity = 0;
+    uint64_t next_sequence = 0;
+    int result = 0;
+    
+    while (result == 0 && journal_next(data, size, &offset, &record, &strings)) {
+        if (record.type == JOURNAL_INTENT || record.type == JOURNAL_DONE) {
+            if (record.sequence >= next_sequence) {
+                next_sequence = record.sequence + 1;
+            }
+            continue;
+        }
+        
+        if (record.dir_length + 1 > dir_capacity) {
+            dir_capacity = record.dir_length + 256;
+            char *grown = (char*)realloc(dir, dir_capacity);
+            if (grown == NULL) {
+                result = -1;
+                break;
+            }
+            dir = grown;
+        }
+        memcpy(dir, strings, record.dir_length);
+        dir[record.dir_length] = '\0';
+        
+        NameSlot *slot = name_table_insert(&g_journal.finished, dir, 1);
+        if (slot == NULL) {
+            result = -1;
+        } else {
+            slot->value |= 1 << record.type;
+        }
+    }
+    
+    if (result != 0) {
+        fprintf(stderr, "Error: Memory allocation failed for journal '%s'\n", path);
+    }
+    atomic_store(&g_journal.sequence, next_sequence);
+    *end = offset;
+    free(dir);
+    free(data);
+    return result;
+}
+
+/**
+ * Opens the journal for a run: a new journal replaces any file at path,
+ * and with --resume the run it records is continued and appended to
+ * @param path The journal file
+ * @param root The directory being processed
+ * @param resume Non-zero to continue the journal's run
+ * @return 0 on success, -1 on error (already reported)
+ */
+static int journal_open(const char *path, const char *root, int resume) {
+    memset(&g_journal, 0, sizeof(g_journal));
+    g_journal.fd = -1;
+    g_journal.root = root;
+    g_journal.root_length = strlen(root);
+    g_journal.finished.arena = &g_journal.arena;
+    pthread_mutex_init(&g_journal.lock, NULL);
+    pthread_mutex_init(&g_journal.sync_lock, NULL);
+    
+    if (resume) {
+        uint64_t end = 0;
+        if (journal_load(path, root, &end) != 0) {
+            journal_close();
+            return -1;
+        }
+        
+        // Drop a torn tail so new records follow the last intact one
+        g_journal.fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (g_journal.fd < 0 || ftruncate(g_journal.fd, (off_t)end) != 0) {
+            fprintf(stderr, "Error: Cannot open journal '%s': %s\n", path, strerror(errno));
+            journal_close();
+            return -1;
+        }
+        g_journal.written = end;
+        g_journal.synced = end;
+    } else {
+        g_journal.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (g_journal.fd < 0) {
+            fprintf(stderr, "Error: Cannot create journal '%s': %s\n", path, strerror(errno));
+            journal_close();
+            return -1;
+        }
+        
+        JournalHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+        header.version = JOURNAL_VERSION;
+        header.root_length = (uint32_t)g_journal.root_length;
+        
+        uint64_t end = 0;
+        if (journal_append((const char*)&header, sizeof(header), NULL) != 0 ||
+            journal_append(root, g_journal.root_length, &end) != 0 || journal_sync(end) != 0) {
+            journal_close();
+            return -1;
+        }
+    }
+    
+    g_journal.enabled = 1;
+    return 0;
+}
+
+/**
+ * Syncs and closes the journal
+ * @return 0 on success, -1 if any part of the journal could not be written
+ */
+static int journal_close(void) {
+    int result = atomic_load(&g_journal.failed) ? -1 : 0;
+    
+    if (g_journal.fd >= 0) {
+        if (result == 0 && fdatasync(g_journal.fd) != 0) {
+            fprintf(stderr, "Error: Cannot sync journal: %s\n", strerror(errno));
+            result = -1;
+        }
+        close(g_journal.fd);
+    }
+    
+    name_table_free(&g_journal.finished);
+    arena_free(&g_journal.arena);
+    pthread_mutex_destroy(&g_journal.lock);
+    pthread_mutex_destroy(&g_journal.sync_lock);
+    memset(&g_journal, 0, sizeof(g_journal));
+    g_journal.fd = -1;
+    return result;
+}
+
+/**
+ * Reverts the renames recorded in a journal, newest first. A file is renamed
+ * back only while the entry under its new name is still the same file (same
+ * inode) and its old name is free; intents whose rename never happened are
+ * passed over.
+ * @param journal_path The journal file
+ * @param root_override Directory to undo the renames in, or NULL for the recorded one
+ * @param stats Statistics structure to update (renamed_files counts reverted renames)
+ * @return 0 on success, -1 if the journal or the directory could not be read
+ */
+static int undo_journal(const char *journal_path, const char *root_override, Statistics *stats) {
+    char *data = NULL;
+    char *journal_root = NULL;
+    size_t size = 0;
+    size_t offset = journal_read(journal_path, &data, &size, &journal_root);
+    if (offset == 0) {
+        return -1;
+    }
+    
+    // Intents in journal order, and which of them completed
+    size_t *intents = (size_t*)malloc((size / sizeof(JournalRecord) + 1) * sizeof(size_t));
+    size_t intent_count = 0;
+    uint64_t max_sequence = 0;
+    JournalRecord record;
+    const char *strings;
+    
+    for (size_t next = offset; intents != NULL && journal_next(data, size, &next, &record, &strings); ) {
+        if (record.type == JOURNAL_INTENT) {
+            intents[intent_count++] = (size_t)(strings - data) - sizeof(JournalRecord);
+        }
+        if ((record.type == JOURNAL_INTENT || record.type == JOURNAL_DONE) && record.sequence > max_sequence) {
+            max_sequence = record.sequence;
+        }
+    }
+    
+    unsigned char *done = intents ? (unsigned char*)calloc(max_sequence + 1, 1) : NULL;
+    const char *root = (root_override != NULL) ? root_override : journal_root;
+    int root_fd = -1;
+    int result = -1;
+    
+    if (done == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for journal '%s'\n", journal_path);
+        goto cleanup;
+    }
+    for (size_t next = offset; journal_next(data, size, &next, &record, &strings); ) {
+        if (record.type == JOURNAL_DONE) {
+            done[record.sequence] = 1;
+        }
+    }
+    
+    root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        fprintf(stderr, "Error: Cannot open directory '%s': %s\n", root, strerror(errno));
+        goto cleanup;
+    }
+    
+    DirRef dir = { NULL, -1, NULL };
+    char *dir_path = NULL;
+    const char *dir_key = NULL;       // Relative path of the open directory, in the journal
+    uint32_t dir_key_length = 0;
+    
+    for (size_t i = intent_count; i-- > 0; ) {
+        size_t at = intents[i];
+        journal_next(data, size, &at, &record, &strings);
+        
+        // Consecutive intents usually share a directory
+        if (dir_key == NULL || record.dir_length != dir_key_length ||
+            memcmp(strings, dir_key, dir_key_length) != 0) {
+            if (dir.fd >= 0) {
+                close(dir.fd);
+            }
+            free(dir_path);
+            dir_key = strings;
+            dir_key_length = record.dir_length;
+            
+            char *relative = strndup(strings, record.dir_length);
+            size_t path_len = strlen(root) + record.dir_length + 2;
+            dir_path = (char*)malloc(path_len);
+            if (relative == NULL || dir_path == NULL) {
+                fprintf(stderr, "Error: Memory allocation failed for journal '%s'\n", journal_path);
+                free(relative);
+                dir.fd = -1;
+                break;
+            }
+            if (record.dir_length == 0) {
+                snprintf(dir_path, path_len, "%s", root);
+            } else {
+                snprintf(dir_path, path_len, "%s%s%s", root, entry_separator(root), relative);
+            }
+            dir.path = dir_path;
+            dir.fd = open_directory_at(root_fd, record.dir_length ? relative : ".");
+            if (dir.fd < 0) {
+                fprintf(stderr, "Error: Cannot open directory '%s': %s\n", dir_path, strerror(errno));
+            }
+            free(relative);
+        }
+        
+        char old_name[MAX_NAME_LENGTH];
+        char new_name[MAX_NAME_LENGTH];
+        snprintf(old_name, sizeof(old_name), "%.*s", (int)record.old_length, strings + record.dir_length);
+        snprintf(new_name, sizeof(new_name), "%.*s", (int)record.new_length,
+                 strings + record.dir_length + record.old_length);
+        
+        struct stat st;
+        int present = dir.fd >= 0 && fstatat(dir.fd, new_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                      S_ISREG(st.st_mode) && (uint64_t)st.st_ino == record.ino;
+        if (!present && !done[record.sequence]) {
+            continue;  // The rename was never issued, or never took effect
+        }
+        
+        stats->total_files++;
+        log_file_start();
+        if (dir.fd < 0) {
+            stats->error_files++;
+        } else if (!present) {
+            log_file_event(&dir, new_name, LOG_EVENT_SKIPPED, NULL, "changed since the run", 0);
+            stats->skipped_files++;
+        } else if (rename_entry_noreplace(&dir, new_name, old_name) == 0) {
+            log_file_event(&dir, new_name, LOG_EVENT_RENAMED, NULL, old_name, 0);
+            stats->renamed_files++;
+        } else {
+            fprintf(stderr, "Error: Cannot rename '%s%s%s' back to '%s': %s\n",
+                    dir.path, entry_separator(dir.path), new_name, old_name, strerror(errno));
+            log_file_event(&dir, new_name, LOG_EVENT_ERROR, NULL, old_name, errno);
+            stats->error_files++;
+        }
+    }
+    
+    if (dir.fd >= 0) {
+        close(dir.fd);
+    }
+    free(dir_path);
+    result = 0;
+
+cleanup:
+    if (root_fd >= 0) {
+        close(root_fd);
+    }
+    free(done);
+    free(intents);
+    free(journal_root);
+    free(data);
+    return result;
+}
+#endif
+
+// File Processing Module Implementation
+
+#ifndef _WIN32
+// Recovery point for a SIGBUS raised while this thread scans a mapping
+static THREAD_LOCAL sigjmp_buf *t_mmap_recovery = NULL;
+
+/**
+ * SIGBUS handler: a mapped file was truncated under us. Jumps back to the
+ * scan that touched the missing page; any other SIGBUS keeps its default action.
+ * @param sig The signal number
+ */
+static void mmap_fault_handler(int sig) {
+    if (t_mmap_recovery != NULL) {
+        siglongjmp(*t_mmap_recovery, 1);
+    }
+    
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/**
+ * Installs the SIGBUS handler that lets --mmap survive files shrinking mid-scan
+ */
+static void install_mmap_fault_handler(void) {
+    struct sigaction action;
+    
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = mmap_fault_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, NULL);
+}
+
+/**
+ * Scans a file through a read-only memory mapping, handing the mapped bytes
+ * straight to the scanner with no copy and no NUL terminator. The mapping is
+ * released as soon as the scan returns, i.e. right after the first match.
+ * @param fd Open descriptor of the file
+ * @param dir The directory containing the file (for messages)
+ * @param name The name of the file (for messages)
+ * @param output Buffer of at least PATTERN_MAX_LENGTH bytes for the pattern
+ * @return 0 if a pattern was found, 1 if none, -1 on error,
+ *         SCAN_USE_READ if the file is better served by the chunked read path
+ */
+static int scan_mapped_file(int fd, const DirRef *dir, const char *name, char *output) {
+    struct stat st;
+    
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot determine size of file '%s%s%s': %s\n",
+                dir->path, entry_separator(dir->path), name, strerror(errno));
+        return -1;
+    }
+    
+    // A single read() is cheaper than setting up and tearing down a mapping, and
+    // a throttled scan needs reads of one chunk at a time to be paced
+    if (st.st_size <= MMAP_MIN_SIZE || g_throttle.enabled) {
+        return SCAN_USE_READ;
+    }
+    
+    size_t length = (size_t)st.st_size;
+    if (g_options.max_scan_bytes != 0 && (long long)length > g_options.max_scan_bytes) {
+        length = (size_t)g_options.max_scan_bytes;
+    }
+    
+    INSTRUMENT_BEGIN(map_started);
+    void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    INSTRUMENT_COUNT(COUNTER_MMAP_CALLS, 1);
+    if (map == MAP_FAILED) {
+        // Some file systems cannot be mapped; reading still works
+        return SCAN_USE_READ;
+    }
+    madvise(map, length, MADV_SEQUENTIAL);
+    INSTRUMENT_END(PHASE_READ, map_started);
+    
+    sigjmp_buf recovery;
+    volatile int result = 1;
+    
+    t_mmap_recovery = &recovery;
+    if (sigsetjmp(recovery, 1) == 0) {
+        TextEncoding encoding = detect_text_encoding((const char*)map, length);
+        size_t match_length = 0;
+        const char *match = find_encoded_pattern((const char*)map, length, encoding, &match_length);
+        INSTRUMENT_COUNT(COUNTER_BYTES_READ, match ? (size_t)(match - (const char*)map) +
+                                                 match_length * (encoding == TEXT_NARROW ? 1 : 2) : length);
+        if (match != NULL) {
+            copy_encoded_match(match, match_length, encoding, output);
+            result = 0;
+        }
+    } else {
+        fprintf(stderr, "Error: File '%s%s%s' was truncated while being scanned\n",
+                dir->path, entry_separator(dir->path), name);
+        result = -1;
+    }
+    t_mmap_recovery = NULL;
+    
+    munmap(map, length);
+    return result;
+}
+#endif
+
+/**
+ * Scans an open file in fixed-size chunks for the first pattern, from the
+ * descriptor's current position. The last code units of every chunk (one
+ * less than the longest ID) are carried over into the next one so IDs split
+ * across a chunk boundary still match, and reading stops at the first match
+ * or after g_options.max_scan_bytes. Unless the caller already knows it, the
+ * encoding is told from the first chunk, and UTF-16 files are scanned a code
+ * unit at a time. The chunk buffer is reused for every file this thread reads.
+ * @param fd Descriptor from open_entry (left open)
+ * @param dir The directory containing the file
+ * @param name The name of the file, for error messages
+ * @param output Buffer of PATTERN_MAX_LENGTH bytes to store the extracted pattern
+ * @param offset Bytes of the file before the descriptor's position, counted against --max-scan-bytes
+ * @param known The file's encoding, or NULL to detect it (then offset must be 0)
+ * @return 0 if a pattern was found, 1 if the scanned content has none, -1 on error
+ */
+static int scan_file_chunks(int fd, const DirRef *dir, const char *name, char *output, long long offset,
+                            const TextEncoding *known) {
+    static THREAD_LOCAL char buffer[2 * PATTERN_MAX_LENGTH + SCAN_CHUNK_SIZE];
+    const size_t carry_units = g_patterns.max_length - 1;
+    long long remaining = g_options.max_scan_bytes - offset;
+    TextEncoding encoding = known != NULL ? *known : TEXT_NARROW;
+    size_t unit = encoding == TEXT_NARROW ? 1 : 2;
+    size_t carry = 0;
+    int first = known == NULL;
+    int result = 1;
+    
+    while (g_options.max_scan_bytes == 0 || remaining > 0) {
+        size_t want = SCAN_CHUNK_SIZE;
+        if (g_options.max_scan_bytes != 0 && (long long)want > remaining) {
+            want = (size_t)remaining;
+        }
+
+#ifndef _WIN32
+        uint64_t throttled = throttle_begin(THROTTLE_READ);
+#endif
+        INSTRUMENT_BEGIN(read_started);
+        long long bytes_read = read_entry(fd, buffer + carry, want);
+        INSTRUMENT_END(PHASE_READ, read_started);
+#ifndef _WIN32
+        throttle_end(THROTTLE_READ, throttled, bytes_read > 0 ? (uint64_t)bytes_read : 0);
+#endif
+        INSTRUMENT_COUNT(COUNTER_READ_CALLS, 1);
+        INSTRUMENT_COUNT(COUNTER_BYTES_READ, bytes_read > 0 ? bytes_read : 0);
+        if (bytes_read <= 0) {
+            if (bytes_read < 0) {
+                fprintf(stderr, "Error: Cannot read file '%s%s%s': %s\n",
+                        dir->path, entry_separator(dir->path), name, strerror(errno));
+                result = -1;
+            }
+            break;
+        }
+        remaining -= bytes_read;
+        
+        size_t available = carry + (size_t)bytes_read;
+        if (first) {
+            encoding = detect_text_encoding(buffer, available);
+            unit = encoding == TEXT_NARROW ? 1 : 2;
+            first = 0;
+        }
+        
+        // Only whole code units are scanned; a split one waits for the next chunk
+        size_t whole = available - available % unit;
+        size_t match_length = 0;
+        const char *match = find_encoded_pattern(buffer, whole, encoding, &match_length);
+        if (match != NULL) {
+            copy_encoded_match(match, match_length, encoding, output);
+            result = 0;
+            break;
+        }
+        
+        // Keep the tail that could still be the start of a pattern
+        size_t keep = whole < carry_units * unit ? whole : carry_units * unit;
+        carry = keep + (available - whole);
+        memmove(buffer, buffer + available - carry, carry);
+    }
+    
+    return result;
+}
+
+/**
+ * Scans an open file for the first pattern (see scan_file_chunks). With
+ * --mmap, files larger than one chunk are scanned in place by
+ * scan_mapped_file instead.
+ * @param fd Descriptor from open_entry, positioned at the start (left open)
+ * @param dir The directory containing the file
+ * @param name The name of the file, for error messages
+ * @param output Buffer of PATTERN_MAX_LENGTH bytes to store the extracted pattern
+ * @return 0 if a pattern was found, 1 if the scanned content has none, -1 on error
+ */
+static int scan_open_file(int fd, const DirRef *dir, const char *name, char *output) {
+#ifndef _WIN32
+    if (g_options.use_mmap) {
+        int mapped_result = scan_mapped_file(fd, dir, name, output);
+        if (mapped_result != SCAN_USE_READ) {
+            return mapped_result;
+        }
+    }
+#endif
+
+    return scan_file_chunks(fd, dir, name, output, 0, NULL);
+}
+
+/**
+ * Opens a file and scans its content for the first pattern (see scan_open_file)
+ * @param dir The directory containing the file
+ * @param name The name of the file to read
+ * @param output Buffer to store the extracted pattern
+ * @param output_size Size of the output buffer
+ * @return 0 if a pattern was found, 1 if the scanned content has none, -1 on error
+ */
+static int read_file_content(const DirRef *dir, const char *name, char *output, size_t output_size) {
+    if (dir == NULL || name == NULL || output == NULL || output_size < PATTERN_MAX_LENGTH) {
+        fprintf(stderr, "Error: Invalid filepath parameter\n");
+        return -1;
+    }
+    
+    // Open file for reading
+    INSTRUMENT_BEGIN(open_started);
+    int fd = open_entry(dir, name);
+    INSTRUMENT_END(PHASE_OPEN, open_started);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file '%s%s%s': %s\n",
+                dir->path, entry_separator(dir->path), name, strerror(errno));
+        return -1;
+    }
+    
+    int result = scan_open_file(fd, dir, name, output);
+    
+    int saved_errno = errno;
+    close_entry(fd);
+    errno = saved_errno;
+    return result;
+}
+
+/**
+ * Renames or skips a file according to the result of scanning it
+ * @param dir The directory containing the file
+ * @param name The name of the file
+ * @param scan_result 0 if a pattern was found, 1 if none, -1 if the scan failed
+ * @param rj_pattern The pattern found (ignored unless scan_result is 0)
+ * @param stats Statistics structure to update
+ * @return 0 on success, -1 on error
+ */
+static int finish_file(const DirRef *dir, const char *name, int scan_result, const char *rj_pattern,
+                       Statistics *stats) {
+    if (scan_result < 0) {
+        // Error already reported by the scan, which left errno set
+        log_file_event(dir, name, LOG_EVENT_ERROR, NULL, NULL, errno);
+        stats->error_files++;
+        return -1;
+    }
+    
+    if (scan_result == 0) {
+        // Pattern found - construct new filename
+        char new_filename[MAX_NAME_LENGTH];
+        snprintf(new_filename, MAX_NAME_LENGTH, "%s.txt", rj_pattern);
+        
+        // A file that already carries its pattern's name stays put
+        if (is_already_named(dir, name, new_filename)) {
+            log_file_event(dir, name, LOG_EVENT_SKIPPED, rj_pattern, "already named", 0);
+            stats->skipped_files++;
+            return 0;
+        }
+
+#ifndef _WIN32
+        // With --plan the rename is only recorded
+        if (g_plan.enabled) {
+            return plan_file(dir, name, new_filename, stats);
+        }
+#endif
+
+        // Attempt to rename the file
+        return rename_file(dir, name, new_filename, stats);
+    } else {
+        // No valid RJ pattern found - skip this file
+        log_file_event(dir, name, LOG_EVENT_SKIPPED, NULL, "no RJ pattern found", 0);
+        stats->skipped_files++;
+        return 0;
+    }
+}
+
+#ifndef _WIN32
+/**
+ * Handles a file without a full scan when its name or the scan cache allows:
+ * files with canonical names take their ID from the name (unopened with
+ * --trust-names or --cache, after a header check otherwise) and go through
+ * finish_file, which skips them if is_already_named agrees; unchanged files
+ * reuse the cached result
+ * @param dir The directory containing the file
+ * @param name The name of the file
+ * @param entry Receives the file's identity for cache_store_result on a miss
+ * @param stats Statistics structure to update
+ * @return 1 if the file was handled, 0 if it must be scanned,
+ *         -1 if it must be scanned but cannot be cached
+ */
+static int settle_before_scan(const DirRef *dir, const char *name, CacheEntry *entry, Statistics *stats) {
+    // Files this utility already renamed are recognised by name. A _N name whose
+    // base name is free still moves to it, as after a full scan.
+    char pattern[PATTERN_MAX_LENGTH];
+    if (is_canonical_name(name, pattern) &&
+        (g_options.trust_names || g_cache.enabled || verify_canonical_name(dir, name, pattern))) {
+        finish_file(dir, name, 0, pattern, stats);
+        return 1;
+    }
+    
+    if (!g_cache.enabled) {
+        return -1;
+    }
+    
+    int cached = cache_probe(dir, name, entry);
+    if (cached > 0) {
+        finish_file(dir, name, entry->found ? 0 : 1, entry->pattern, stats);
+    }
+    
+    return cached;
+}
+#endif
+
+/**
+ * Processes a single file: scans its content for an RJ pattern and renames it if found
+ * @param dir The directory containing the file
+ * @param name The name of the file to process
+ * @param stats Statistics structure to update
+ * @return 0 on success, -1 on error
+ */
+int process_file(const DirRef *dir, const char *name, Statistics *stats) {
+    if (dir == NULL || name == NULL || stats == NULL) {
+        fprintf(stderr, "Error: Invalid parameters to process_file\n");
+        if (stats != NULL) {
+            stats->error_files++;
+        }
+        return -1;
+    }
+    
+    char rj_pattern[PATTERN_MAX_LENGTH];
+    
+    log_file_start();
+
+#ifndef _WIN32
+    CacheEntry entry;
+    int cached = settle_before_scan(dir, name, &entry, stats);
+    if (cached > 0) {
+        return 0;
+    }
+    
+    int scan_result = read_file_content(dir, name, rj_pattern, PATTERN_MAX_LENGTH);
+    if (cached == 0 && scan_result >= 0) {
+        cache_store_result(&entry, scan_result, rj_pattern);
+    }
+    return finish_file(dir, name, scan_result, rj_pattern, stats);
+#else
+    // Scan file content for the first RJ pattern
+    int scan_result = read_file_content(dir, name, rj_pattern, PATTERN_MAX_LENGTH);
+    return finish_file(dir, name, scan_result, rj_pattern, stats);
+#endif
+}
+
+#ifdef HAVE_IO_URING
+// Asynchronous I/O Module Implementation (io_uring)
+
+/**
+ * Creates an io_uring instance and maps its submission and completion rings
+ * @param ring The ring to initialize
+ * @param entries Number of submission queue entries
+ * @return 0 on success, -1 if io_uring is unavailable (errno is set)
+ */
+static int io_ring_init(IoRing *ring, unsigned entries) {
+    struct io_uring_params params;
+    
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        goto fail;
+    }
+    
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            goto fail;
+        }
+    }
+    
+    ring->headers = (char (*)[URING_HEADER_SIZE])malloc(FILE_BATCH_SIZE * sizeof(*ring->headers));
+    if (ring->headers == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        goto fail;
+    }
+    
+    char *sq = (char*)ring->sq_ring;
+    char *cq = (char*)ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    
+    // Renames through the ring need Linux 5.11; older kernels rename synchronously
+    struct io_uring_probe *probe = (struct io_uring_probe*)calloc(1,
+        sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (probe != NULL) {
+        if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+            int has_core = 1;
+            const int core_ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+            for (size_t i = 0; i < sizeof(core_ops) / sizeof(core_ops[0]); i++) {
+                if (core_ops[i] > probe->last_op || !(probe->ops[core_ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                    has_core = 0;
+                }
+            }
+            ring->can_rename = IORING_OP_RENAMEAT <= probe->last_op &&
+                               (probe->ops[IORING_OP_RENAMEAT].flags & IO_URING_OP_SUPPORTED);
+            if (!has_core) {
+                free(probe);
+                errno = ENOSYS;
+                goto fail;
+            }
+        }
+        free(probe);
+    }
+    
+    return 0;
+
+fail:
+    {
+        int saved_errno = errno;
+        io_ring_destroy(ring);
+        errno = saved_errno;
+    }
+    return -1;
+}
+
+/**
+ * Unmaps and closes an io_uring instance (safe on a partially initialized ring)
+ * @param ring The ring to destroy
+ */
+static void io_ring_destroy(IoRing *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring->headers);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/**
+ * Claims the next free submission queue entry
+ * @param ring The ring
+ * @param user_data Value returned with the completion
+ * @return Zeroed entry to fill in, or NULL if the queue is full
+ */
+static struct io_uring_sqe *io_ring_get_sqe(IoRing *ring, unsigned long long user_data) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    
+    if (tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    ring->pending_submit++;
+    
+    // Publish the entry; the kernel reads it once the tail moves past it
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+/**
+ * Submits all queued entries and waits until the given number of completions arrived
+ * @param ring The ring
+ * @param wait_count Completions to wait for (all earlier completions must have been taken)
+ * @return 0 on success, -1 on error (errno is set)
+ */
+static int io_ring_submit_and_wait(IoRing *ring, unsigned wait_count) {
+    INSTRUMENT_BEGIN(started);
+    
+    for (;;) {
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending_submit, wait_count,
+                                 IORING_ENTER_GETEVENTS, NULL, 0);
+        INSTRUMENT_COUNT(COUNTER_URING_ENTERS, 1);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            return -1;
+        }
+        
+        ring->pending_submit -= (unsigned)submitted;
+        unsigned ready = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) - *ring->cq_head;
+        if (ring->pending_submit == 0 && ready >= wait_count) {
+            INSTRUMENT_END(PHASE_URING, started);
+            return 0;
+        }
+    }
+}
+
+/**
+ * Takes the next completion off the completion queue
+ * @param ring The ring
+ * @param user_data Receives the entry's user data
+ * @param res Receives the operation result (negative errno on failure)
+ * @return 1 if a completion was taken, 0 if the queue is empty
+ */
+static int io_ring_next_completion(IoRing *ring, unsigned long long *user_data, int *res) {
+    unsigned head = *ring->cq_head;
+    
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    
+    const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// This thread's ring; created on first use and destroyed when the worker exits
+static THREAD_LOCAL IoRing t_io_ring;
+static THREAD_LOCAL int t_io_ring_state = 0;  // 0 = untried, 1 = ready, -1 = unavailable
+
+/**
+ * Returns this thread's ring, creating it on first use
+ * @return The ring, or NULL if io_uring is unavailable (warned about once)
+ */
+static IoRing *thread_io_ring(void) {
+    static atomic_int warned = 0;
+    
+    if (t_io_ring_state == 0) {
+        t_io_ring_state = (io_ring_init(&t_io_ring, URING_QUEUE_DEPTH) == 0) ? 1 : -1;
+        if (t_io_ring_state < 0 && atomic_exchange(&warned, 1) == 0) {
+            fprintf(stderr, "Warning: io_uring is unavailable (%s); using synchronous I/O\n", strerror(errno));
+        }
+    }
+    
+    return (t_io_ring_state > 0) ? &t_io_ring : NULL;
+}
+
+/**
+ * Destroys this thread's ring, if it created one
+ */
+static void release_thread_io_ring(void) {
+    if (t_io_ring_state > 0) {
+        io_ring_destroy(&t_io_ring);
+    }
+    t_io_ring_state = 0;
+}
+
+/**
+ * Finishes scanning a file whose io_uring header read found no pattern,
+ * carrying on from the end of the header instead of reading it again. The
+ * header's last code units (one less than the longest ID) are read again,
+ * so an ID that straddles its end still matches. Closes the descriptor.
+ * @param dir The directory containing the file
+ * @param name The name of the file
+ * @param slot The file's batch slot (URING_SYNC, descriptor open)
+ * @param output Buffer of PATTERN_MAX_LENGTH bytes to store the extracted pattern
+ * @return 0 if a pattern was found, 1 if the scanned content has none, -1 on error
+ */
+static int scan_after_header(const DirRef *dir, const char *name, UringSlot *slot, char *output) {
+    size_t unit = slot->encoding == TEXT_NARROW ? 1 : 2;
+    long long offset = (long long)(slot->header_bytes - (g_patterns.max_length - 1) * unit);
+    int result = SCAN_USE_READ;
+    
+    if (g_options.use_mmap) {
+        result = scan_mapped_file(slot->fd, dir, name, output);
+    }
+    if (result == SCAN_USE_READ) {
+        if (lseek(slot->fd, (off_t)offset, SEEK_SET) < 0) {
+            fprintf(stderr, "Error: Cannot read file '%s%s%s': %s\n",
+                    dir->path, entry_separator(dir->path), name, strerror(errno));
+            result = -1;
+        } else {
+            result = scan_file_chunks(slot->fd, dir, name, output, offset, &slot->encoding);
+        }
+    }
+    
+    int saved_errno = errno;
+    close(slot->fd);
+    slot->fd = -1;
+    errno = saved_errno;
+    return result;
+}
+
+/**
+ * Processes a batch of files with io_uring: all opens are submitted together,
+ * then all header reads, then the closes and renames. Each stage costs one
+ * submit-and-wait round trip instead of one blocking call chain per file.
+ * Files whose pattern is not within the header are finished by the
+ * synchronous read path, which carries on from the end of the header, and a
+ * lost race for a target name falls back to rename_file, which picks the
+ * next free suffix. The files must already have been through
+ * settle_before_scan.
+ * @param ring This thread's ring
+ * @param dir The directory containing the files
+ * @param names Names of the .txt files to process
+ * @param entries Each file's identity from settle_before_scan (size ~0 if it cannot be cached)
+ * @param count Number of names (at most FILE_BATCH_SIZE)
+ * @param stats Statistics structure to update
+ */
+static void process_files_uring(IoRing *ring, const DirRef *dir, const char *const *names,
+                                const CacheEntry *entries, size_t count, Statistics *stats) {
+    char (*headers)[URING_HEADER_SIZE] = ring->headers;
+    UringSlot slots[FILE_BATCH_SIZE];
+    const char *sep = entry_separator(dir->path);
+    unsigned long long user_data;
+    int res;
+    
+    size_t header_size = URING_HEADER_SIZE;
+    if (g_options.max_scan_bytes != 0 && g_options.max_scan_bytes < (long long)header_size) {
+        header_size = (size_t)g_options.max_scan_bytes;
+    }
+    
+    // Files finished by the ring are timed as a batch
+    log_file_start();
+    
+    for (size_t i = 0; i < count; i++) {
+        slots[i].fd = -1;
+        slots[i].state = URING_FAILED;
+        slots[i].final_name[0] = '\0';
+        slots[i].cache = entries[i];
+    }
+    
+    // Stage 1: open every file relative to the directory descriptor. A file that
+    // finds no free submission entry at any stage is finished synchronously.
+    unsigned submitted = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = io_ring_get_sqe(ring, i | URING_OPEN_TAG);
+        if (sqe == NULL) {
+            break;
+        }
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = dir->fd;
+        sqe->addr = (unsigned long long)(uintptr_t)names[i];
+        sqe->open_flags = O_RDONLY | O_NOFOLLOW | O_CLOEXEC;
+        submitted++;
+    }
+    if (io_ring_submit_and_wait(ring, submitted) != 0) {
+        goto sync_fallback;
+    }
+    while (io_ring_next_completion(ring, &user_data, &res)) {
+        size_t index = (size_t)(user_data & ~URING_OPEN_TAG);
+        if (res < 0) {
+            fprintf(stderr, "Error: Cannot open file '%s%s%s': %s\n", dir->path, sep, names[index], strerror(-res));
+            log_file_event(dir, names[index], LOG_EVENT_ERROR, NULL, NULL, -res);
+            stats->error_files++;
+            slots[index].state = URING_DONE;
+        } else {
+            slots[index].fd = res;
+        }
+    }
+    
+    // Stage 2: read the first header_size bytes of each opened file
+    submitted = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (slots[i].fd < 0) {
+            continue;
+        }
+        struct io_uring_sqe *sqe = io_ring_get_sqe(ring, i);
+        if (sqe == NULL) {
+            break;
+        }
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = slots[i].fd;
+        sqe->addr = (unsigned long long)(uintptr_t)headers[i];
+        sqe->len = (unsigned)header_size;
+        sqe->off = 0;
+        submitted++;
+    }
+    
+    // The batch of reads is charged, and timed, as one operation
+    uint64_t bytes = 0;
+    uint64_t throttled = throttle_begin(THROTTLE_READ);
+    if (io_ring_submit_and_wait(ring, submitted) != 0) {
+        goto sync_fallback;
+    }
+    while (io_ring_next_completion(ring, &user_data, &res)) {
+        UringSlot *slot = &slots[user_data];
+        bytes += res > 0 ? (uint64_t)res : 0;
+        if (res < 0) {
+            fprintf(stderr, "Error: Cannot read file '%s%s%s': %s\n", dir->path, sep, names[user_data], strerror(-res));
+            log_file_event(dir, names[user_data], LOG_EVENT_ERROR, NULL, NULL, -res);
+            stats->error_files++;
+            slot->state = URING_DONE;
+            continue;
+        }
+        
+        INSTRUMENT_COUNT(COUNTER_BYTES_READ, res);
+        TextEncoding encoding = detect_text_encoding(headers[user_data], (size_t)res);
+        size_t match_length = 0;
+        const char *match = find_encoded_pattern(headers[user_data], (size_t)res, encoding, &match_length);
+        if (match != NULL) {
+            copy_encoded_match(match, match_length, encoding, slot->pattern);
+            slot->state = URING_RENAME;
+        } else if ((size_t)res == header_size && header_size == URING_HEADER_SIZE) {
+            // There is more file than header; let the streaming reader finish it
+            slot->state = URING_SYNC;
+            slot->encoding = encoding;
+            slot->header_bytes = (size_t)res;
+        } else {
+            slot->state = URING_SKIP;
+        }
+        
+        if (slot->state != URING_SYNC && slot->cache.size != UINT64_MAX) {
+            cache_store_result(&slot->cache, slot->state == URING_RENAME ? 0 : 1, slot->pattern);
+        }
+    }
+    throttle_end(THROTTLE_READ, throttled, bytes);
+    
+    // Stage 3: close everything and issue the renames in the same round trip
+    submitted = 0;
+    uint64_t renames = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Files still to be scanned stay open for the synchronous reader
+        if (slots[i].fd >= 0 && slots[i].state != URING_SYNC) {
+            struct io_uring_sqe *sqe = io_ring_get_sqe(ring, i | URING_CLOSE_TAG);
+            if (sqe != NULL) {
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = slots[i].fd;
+                slots[i].fd = -1;
+                submitted++;
+            }
+        }
+        
+        // With --dedupe, renames go through rename_file below: a name reserved for a
+        // rename still in flight cannot be compared against, so it would get a suffix.
+        // With --journal they go there too, to wait for their intents to be committed.
+        if (slots[i].state == URING_RENAME && ring->can_rename && !g_plan.enabled &&
+            g_options.dedupe == DEDUPE_NONE && !g_journal.enabled) {
+            char new_name[MAX_NAME_LENGTH];
+            snprintf(new_name, MAX_NAME_LENGTH, "%s.txt", slots[i].pattern);
+            if (is_already_named(dir, names[i], new_name)) {
+                slots[i].state = URING_NAMED;
+                continue;
+            }
+            INSTRUMENT_BEGIN(resolve_started);
+            int resolved = generate_unique_name(dir, new_name, slots[i].final_name, MAX_NAME_LENGTH);
+            INSTRUMENT_END(PHASE_RESOLVE, resolve_started);
+            if (resolved != 0) {
+                slots[i].final_name[0] = '\0';
+                continue;  // rename_file below reports it
+            }
+            
+            struct io_uring_sqe *sqe = io_ring_get_sqe(ring, i);
+            if (sqe == NULL) {
+                continue;  // The reserved name is released, and the file renamed, below
+            }
+            sqe->opcode = IORING_OP_RENAMEAT;
+            sqe->fd = dir->fd;
+            sqe->addr = (unsigned long long)(uintptr_t)names[i];
+            sqe->len = (unsigned)dir->fd;
+            sqe->addr2 = (unsigned long long)(uintptr_t)slots[i].final_name;
+            sqe->rename_flags = RENAME_NOREPLACE;
+            submitted++;
+            renames++;
+        }
+    }
+    throttled = renames > 0 ? throttle_begin(THROTTLE_RENAME) : 0;
+    if (io_ring_submit_and_wait(ring, submitted) != 0) {
+        goto sync_fallback;
+    }
+    if (renames > 0) {
+        throttle_end(THROTTLE_RENAME, throttled, renames);
+    }
+    while (io_ring_next_completion(ring, &user_data, &res)) {
+        if (user_data & URING_CLOSE_TAG) {
+            continue;
+        }
+        
+        UringSlot *slot = &slots[user_data];
+        if (dir->index != NULL) {
+            name_index_commit(dir->index, names[user_data], slot->final_name, -res);
+        }
+        
+        if (res == 0) {
+            log_file_event(dir, names[user_data], LOG_EVENT_RENAMED, slot->pattern, slot->final_name, 0);
+            stats->renamed_files++;
+            slot->state = URING_DONE;
+        } else if (res != -EEXIST) {
+            fprintf(stderr, "Error: Cannot rename '%s%s%s' to '%s': %s\n",
+                    dir->path, sep, names[user_data], slot->final_name, strerror(-res));
+            log_file_event(dir, names[user_data], LOG_EVENT_ERROR, slot->pattern, slot->final_name, -res);
+            stats->error_files++;
+            slot->state = URING_DONE;
+        }
+        // -EEXIST: another file took the name first; rename_file below retries
+        slot->final_name[0] = '\0';
+    }
+
+sync_fallback:
+    // Anything the ring did not finish goes through the synchronous path
+    for (size_t i = 0; i < count; i++) {
+        if (slots[i].fd >= 0 && slots[i].state != URING_SYNC) {
+            close(slots[i].fd);
+            slots[i].fd = -1;
+        }
+        
+        // Release a name reserved for a rename that was never submitted
+        if (slots[i].final_name[0] != '\0' && dir->index != NULL) {
+            name_index_commit(dir->index, names[i], slots[i].final_name, ECANCELED);
+        }
+        
+        switch (slots[i].state) {
+            case URING_RENAME:
+                finish_file(dir, names[i], 0, slots[i].pattern, stats);
+                break;
+            case URING_SKIP:
+                log_file_event(dir, names[i], LOG_EVENT_SKIPPED, NULL, "no RJ pattern found", 0);
+                stats->skipped_files++;
+                break;
+            case URING_NAMED:
+                log_file_event(dir, names[i], LOG_EVENT_SKIPPED, slots[i].pattern, "already named", 0);
+                stats->skipped_files++;
+                break;
+            case URING_SYNC:
+            case URING_FAILED: {
+                char pattern[PATTERN_MAX_LENGTH];
+                int scan_result;
+                
+                log_file_start();
+                if (slots[i].state == URING_SYNC) {
+                    scan_result = scan_after_header(dir, names[i], &slots[i], pattern);
+                } else {
+                    scan_result = read_file_content(dir, names[i], pattern, PATTERN_MAX_LENGTH);
+                }
+                if (scan_result >= 0 && slots[i].cache.size != UINT64_MAX) {
+                    cache_store_result(&slots[i].cache, scan_result, pattern);
+                }
+                finish_file(dir, names[i], scan_result, pattern, stats);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    
+    // Drain completions left behind by a failed submit so the next batch starts
+    // clean, closing the files the kernel opened for it
+    while (io_ring_next_completion(ring, &user_data, &res)) {
+        if ((user_data & URING_OPEN_TAG) && res >= 0) {
+            close(res);
+        }
+    }
+}
+#endif
+
+// Directory Traversal Module Implementation
+
+/**
+ * Checks if a filename has a .txt extension (case-insensitive)
+ * @param filename The filename to check
+ * @return 1 if file ends with .txt, 0 otherwise
+ */
+static int is_txt_file(const char *filename) {
+    if (filename == NULL) {
+        return 0;
+    }
+    
+    size_t len = strlen(filename);
+    
+    // Need at least 5 characters for "a.txt"
+    if (len < 5) {
+        return 0;
+    }
+    
+    // Get the last 4 characters
+    const char *ext = filename + len - 4;
+    
+    // Case-insensitive comparison, matching Windows file name semantics
+#ifdef _WIN32
+    if (_stricmp(ext, ".txt") == 0) {
+#else
+    if (strcasecmp(ext, ".txt") == 0) {
+#endif
+        return 1;
+    }
+    
+    return 0;
+}
+
+#ifdef _WIN32
+/**
+ * Starts enumerating the directory whose path is in the builder and pushes it
+ * onto the traversal stack
+ * @param path Path of the directory; restored before returning
+ * @param stack The traversal stack, grown as needed
+ * @param depth Number of frames on the stack
+ * @param capacity Allocated frames
+ * @return 1 if pushed, 0 if the directory is empty, -1 on error (already logged)
+ */
+static int dir_frame_push(PathBuilder *path, DirFrame **stack, size_t *depth, size_t *capacity) {
+    if (*depth == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        DirFrame *frames = (DirFrame*)realloc(*stack, new_capacity * sizeof(DirFrame));
+        if (frames == NULL) {
+            fprintf(stderr, "Error: Cannot allocate memory for directory '%s'\n", path->data);
+            return -1;
+        }
+        *stack = frames;
+        *capacity = new_capacity;
+    }
+    
+    DirFrame *frame = &(*stack)[*depth];
+    frame->path_length = path->length;
+    frame->consumed = 0;
+    
+    // Search pattern is the directory followed by "*"
+    if (path_builder_append(path, "*") != 0) {
+        fprintf(stderr, "Error: Cannot allocate memory for directory '%s'\n", path->data);
+        return -1;
+    }
+    frame->find = FindFirstFileA(path->data, &frame->entry);
+    path_builder_truncate(path, frame->path_length);
+    
+    if (frame->find == INVALID_HANDLE_VALUE) {
+        DWORD error = GetLastError();
+        if (error == ERROR_FILE_NOT_FOUND) {
+            // Empty directory is not an error
+            return 0;
+        }
+        fprintf(stderr, "Error: Cannot open directory '%s': Error code %lu\n", path->data, error);
+        return -1;
+    }
+    
+    (*depth)++;
+    return 1;
+}
+
+/**
+ * Processes a directory and all its subdirectories. Directories being
+ * enumerated live on a heap stack and share one path that each level appends
+ * its name to and truncates back, so neither depth nor path length is limited
+ * by fixed buffers or the call stack.
+ * @param dir_path The directory path to process
+ * @param stats Statistics structure to update
+ * @return 0 on success, -1 on error
+ */
+int process_directory(const char *dir_path, Statistics *stats) {
+    if (dir_path == NULL || stats == NULL) {
+        fprintf(stderr, "Error: Invalid parameters to process_directory\n");
+        return -1;
+    }
+    
+    PathBuilder path = { NULL, 0, 0 };
+    DirFrame *stack = NULL;
+    size_t depth = 0;
+    size_t capacity = 0;
+    
+    if (path_builder_set(&path, dir_path) != 0) {
+        fprintf(stderr, "Error: Cannot allocate memory for directory '%s'\n", dir_path);
+        return -1;
+    }
+    
+    int result = dir_frame_push(&path, &stack, &depth, &capacity) < 0 ? -1 : 0;
+    
+    while (depth > 0) {
+        DirFrame *frame = &stack[depth - 1];
+        path_builder_truncate(&path, frame->path_length);
+        
+        if (frame->consumed && FindNextFileA(frame->find, &frame->entry) == 0) {
+            // Check if enumeration ended due to error or normal completion
+            DWORD error = GetLastError();
+            if (error != ERROR_NO_MORE_FILES) {
+                fprintf(stderr, "Error: Error reading directory '%s': Error code %lu\n", path.data, error);
+                if (depth == 1) {
+                    result = -1;
+                }
+            }
+            FindClose(frame->find);
+            depth--;
+            continue;
+        }
+        frame->consumed = 1;
+        
+        const char *name = frame->entry.cFileName;
+        
+        // Skip "." and ".." entries
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        
+        if (frame->entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            // Descend: the subdirectory's entries come before this one's remaining entries
+            if (path_builder_append(&path, name) != 0) {
+                fprintf(stderr, "Error: Cannot allocate memory for directory '%s\\%s'\n", path.data, name);
+                stats->error_files++;
+                continue;
+            }
+            dir_frame_push(&path, &stack, &depth, &capacity);
+        } else if (is_txt_file(name)) {
+            DirRef dir = { path.data };
+            stats->total_files++;
+            process_file(&dir, name, stats);
+        }
+    }
+    
+    free(stack);
+    path_builder_free(&path);
+    
+    return result;
+}
+#else
+/**
+ * Appends an entry to a directory listing
+ * @param listing The listing to append to
+ * @param name The entry name
+ * @param name_len Length of the entry name
+ * @param type The entry type
+ * @param inode The entry's inode number
+ * @return 0 on success, -1 on allocation failure
+ */
+static int listing_append(DirListing *listing, const char *name, size_t name_len, EntryType type,
+                          uint64_t inode) {
+    // Growing copies into fresh arena memory; the old arrays go with the arena
+    if (listing->count == listing->capacity) {
+        size_t new_capacity = listing->capacity ? listing->capacity * 2 : 64;
+        DirEntry *entries = (DirEntry*)arena_alloc(listing->arena, new_capacity * sizeof(DirEntry));
+        if (entries == NULL) {
+            return -1;
+        }
+        if (listing->count > 0) {
+            memcpy(entries, listing->entries, listing->count * sizeof(DirEntry));
+        }
+        listing->entries = entries;
+        listing->capacity = new_capacity;
+    }
+    
+    if (listing->names_used + name_len + 1 > listing->names_capacity) {
+        size_t new_capacity = listing->names_capacity ? listing->names_capacity * 2 : 2048;
+        while (new_capacity < listing->names_used + name_len + 1) {
+            new_capacity *= 2;
+        }
+        char *names = (char*)arena_alloc(listing->arena, new_capacity);
+        if (names == NULL) {
+            return -1;
+        }
+        if (listing->names_used > 0) {
+            memcpy(names, listing->names, listing->names_used);
+        }
+        listing->names = names;
+        listing->names_capacity = new_capacity;
+    }
+    
+    memcpy(listing->names + listing->names_used, name, name_len + 1);
+    listing->entries[listing->count].name_offset = listing->names_used;
+    listing->entries[listing->count].type = type;
+    listing->entries[listing->count].inode = inode;
+    listing->names_used += name_len + 1;
+    listing->count++;
+    
+    return 0;
+}
+
+/**
+ * Classifies a directory entry from its d_type, falling back to fstatat
+ * only for file systems that do not report entry types
+ * @param dir_fd Descriptor of the directory containing the entry
+ * @param name The entry name
+ * @param d_type The type reported by the kernel
+ * @return The entry type; symbolic links are reported as ENTRY_OTHER
+ */
+static EntryType classify_entry(int dir_fd, const char *name, unsigned char d_type) {
+    switch (d_type) {
+        case DT_REG:
+            return ENTRY_FILE;
+        case DT_DIR:
+            return ENTRY_DIRECTORY;
+        case DT_UNKNOWN: {
+            struct stat st;
+            INSTRUMENT_COUNT(COUNTER_STAT_CALLS, 1);
+            if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                return ENTRY_OTHER;
+            }
+            if (S_ISREG(st.st_mode)) {
+                return ENTRY_FILE;
+            }
+            return S_ISDIR(st.st_mode) ? ENTRY_DIRECTORY : ENTRY_OTHER;
+        }
+        default:
+            return ENTRY_OTHER;
+    }
+}
+
+#ifdef __linux__
+// Record layout returned by the getdents64 system call
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+/**
+ * Reads every entry of an open directory into a listing
+ * @param dir The directory to enumerate
+ * @param listing The listing to fill (zero-initialized apart from its arena)
+ * @return 0 on success, -1 on error (errno is set)
+ */
+static int read_directory(const DirRef *dir, DirListing *listing) {
+#ifdef __linux__
+    // Raw getdents64 fills a large buffer per system call and hands us d_type;
+    // each thread reuses its own
+    static THREAD_LOCAL _Alignas(8) char buffer[DIRENT_BUFFER_SIZE];
+    
+    for (;;) {
+        long bytes = syscall(SYS_getdents64, dir->fd, buffer, DIRENT_BUFFER_SIZE);
+        INSTRUMENT_COUNT(COUNTER_GETDENTS_CALLS, 1);
+        if (bytes < 0) {
+            return -1;
+        }
+        if (bytes == 0) {
+            break;
+        }
+        
+        for (long offset = 0; offset < bytes; ) {
+            struct linux_dirent64 *entry = (struct linux_dirent64*)(buffer + offset);
+            offset += entry->d_reclen;
+            
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                continue;
+            }
+            
+            EntryType type = classify_entry(dir->fd, name, entry->d_type);
+            if (listing_append(listing, name, strlen(name), type, entry->d_ino) != 0) {
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+    }
+    
+    return 0;
+#else
+    // Portable path: readdir on a duplicate so closedir leaves dir->fd open
+    int fd = dup(dir->fd);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    DIR *stream = fdopendir(fd);
+    if (stream == NULL) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    
+    struct dirent *entry;
+    errno = 0;
+    while ((entry = readdir(stream)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        
+        EntryType type = classify_entry(dir->fd, name, entry->d_type);
+        if (listing_append(listing, name, strlen(name), type, entry->d_ino) != 0) {
+            closedir(stream);
+            errno = ENOMEM;
+            return -1;
+        }
+        errno = 0;
+    }
+    
+    int result = (errno == 0) ? 0 : -1;
+    int saved_errno = errno;
+    closedir(stream);
+    errno = saved_errno;
+    return result;
+#endif
+}
+
+/**
+ * Creates a directory node by opening a directory relative to its parent
+ * @param parent The parent directory node, or NULL to open root_path
+ * @param name The directory name inside the parent, or the root path
+ * @return New node holding one reference, or NULL on error (already logged)
+ */
+static DirNode *dir_node_open(DirNode *parent, const char *name) {
+    // The node lives in its own arena, together with everything else it holds
+    Arena arena = { NULL };
+    DirNode *node = (DirNode*)arena_alloc(&arena, sizeof(DirNode));
+    if (node == NULL) {
+        fprintf(stderr, "Error: Cannot allocate memory for directory '%s'\n", name);
+        return NULL;
+    }
+    memset(node, 0, sizeof(*node));
+    node->arena = arena;
+    node->listing.arena = &node->arena;
+    
+    if (parent == NULL) {
+        node->path = arena_strdup(&node->arena, name);
+    } else {
+        // Build the child path once per directory, for messages only
+        const char *parent_path = parent->ref.path;
+        size_t path_len = strlen(parent_path) + strlen(name) + 2;
+        node->path = (char*)arena_alloc(&node->arena, path_len);
+        if (node->path != NULL) {
+            snprintf(node->path, path_len, "%s%s%s", parent_path, entry_separator(parent_path), name);
+        }
+    }
+    
+    if (node->path == NULL) {
+        fprintf(stderr, "Error: Cannot allocate memory for directory '%s'\n", name);
+        arena_free(&node->arena);
+        return NULL;
+    }
+    
+    node->ref.path = node->path;
+    if (parent == NULL) {
+        node->ref.fd = open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } else {
+        node->ref.fd = openat(parent->ref.fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    
+    if (node->ref.fd < 0) {
+        fprintf(stderr, "Error: Cannot open directory '%s': %s\n", node->path, strerror(errno));
+        arena_free(&node->arena);
+        return NULL;
+    }
+    
+    atomic_init(&node->refs, 1);
+    return node;
+}
+
+/**
+ * Drops one reference to a directory node, closing and freeing it with the last one
+ * @param node The node to release (NULL is ignored)
+ */
+static void dir_node_release(DirNode *node) {
+    if (node == NULL || atomic_fetch_sub(&node->refs, 1) != 1) {
+        return;
+    }
+    
+    // With --journal, the last reference means every file of the directory is done
+    if (node->tree != NULL) {
+        if (!atomic_load(&node->tree->files_failed)) {
+            journal_mark(JOURNAL_DIR_DONE, node->tree->path);
+        }
+        journal_tree_release(node->tree, 0);
+    }
+    
+    close(node->ref.fd);
+    if (node->ref.index != NULL) {
+        name_index_free(node->ref.index);
+    }
+    arena_free(&node->arena);
+}
+
+/**
+ * Pushes a work item onto the owner's end of a deque
+ * @param deque The deque to push to
+ * @param item The item to push
+ * @return 0 on success, -1 on allocation failure
+ */
+static int deque_push(WorkDeque *deque, const WorkItem *item) {
+    pthread_mutex_lock(&deque->lock);
+    
+    if (deque->count == deque->capacity) {
+        size_t new_capacity = deque->capacity ? deque->capacity * 2 : 256;
+        WorkItem *items = (WorkItem*)malloc(new_capacity * sizeof(WorkItem));
+        if (items == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        
+        // Unwrap the ring into the new buffer
+        for (size_t i = 0; i < deque->count; i++) {
+            items[i] = deque->items[(deque->head + i) % deque->capacity];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->capacity = new_capacity;
+        deque->head = 0;
+    }
+    
+    deque->items[(deque->head + deque->count) % deque->capacity] = *item;
+    deque->count++;
+    
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+/**
+ * Takes a work item from a deque. The owner pops its newest item, which keeps
+ * its traversal depth-first; thieves take the oldest one, which tends to be
+ * the largest unexplored subtree.
+ * @param deque The deque to take from
+ * @param item Receives the item
+ * @param steal Non-zero to take from the thief's end
+ * @return 1 if an item was taken, 0 if the deque was empty
+ */
+static int deque_take(WorkDeque *deque, WorkItem *item, int steal) {
+    pthread_mutex_lock(&deque->lock);
+    
+    if (deque->count == 0) {
+        pthread_mutex_unlock(&deque->lock);
+        return 0;
+    }
+    
+    if (steal) {
+        *item = deque->items[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+    } else {
+        *item = deque->items[(deque->head + deque->count - 1) % deque->capacity];
+    }
+    deque->count--;
+    
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+/**
+ * Queues a work item on a worker's own deque and wakes an idle worker if any
+ * @param worker The worker queueing the item
+ * @param item The item to queue
+ * @return 0 on success, -1 on allocation failure
+ */
+static int schedule_work(Worker *worker, const WorkItem *item) {
+    Engine *engine = worker->engine;
+    
+    atomic_fetch_add(&engine->pending, 1);
+    if (deque_push(&worker->deque, item) != 0) {
+        atomic_fetch_sub(&engine->pending, 1);
+        return -1;
+    }
+    atomic_fetch_add(&engine->queued, 1);
+    
+    if (atomic_load(&engine->sleepers) > 0) {
+        pthread_mutex_lock(&engine->idle_lock);
+        pthread_cond_signal(&engine->idle_cond);
+        pthread_mutex_unlock(&engine->idle_lock);
+    }
+    
+    return 0;
+}
+
+/**
+ * Finds the next work item: the worker's own deque first, then the others
+ * @param worker The worker looking for work
+ * @param item Receives the item
+ * @return 1 if an item was found, 0 if every deque was empty
+ */
+static int find_work(Worker *worker, WorkItem *item) {
+    Engine *engine = worker->engine;
+    
+    if (deque_take(&worker->deque, item, 0)) {
+        atomic_fetch_sub(&engine->queued, 1);
+        return 1;
+    }
+    
+    // Start stealing at a different victim each time to spread contention
+    worker->steal_seed = worker->steal_seed * 1103515245u + 12345u;
+    int start = (int)((worker->steal_seed >> 16) % (unsigned)engine->worker_count);
+    
+    for (int i = 0; i < engine->worker_count; i++) {
+        Worker *victim = &engine->workers[(start + i) % engine->worker_count];
+        if (victim != worker && deque_take(&victim->deque, item, 1)) {
+            atomic_fetch_sub(&engine->queued, 1);
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Orders directory entries by inode number
+ * @param a First DirEntry
+ * @param b Second DirEntry
+ * @return Negative, zero or positive as for qsort
+ */
+static int compare_entry_inodes(const void *a, const void *b) {
+    uint64_t left = ((const DirEntry*)a)->inode;
+    uint64_t right = ((const DirEntry*)b)->inode;
+    return (left > right) - (left < right);
+}
+
+/**
+ * Orders scheduled files by disk offset of their first extent; files whose
+ * extents are unknown follow, by inode number
+ * @param a First ScheduledFile
+ * @param b Second ScheduledFile
+ * @return Negative, zero or positive as for qsort
+ */
+static int compare_scheduled_files(const void *a, const void *b) {
+    const ScheduledFile *left = (const ScheduledFile*)a;
+    const ScheduledFile *right = (const ScheduledFile*)b;
+    
+    if (left->mapped != right->mapped) {
+        return right->mapped - left->mapped;
+    }
+    return (left->key > right->key) - (left->key < right->key);
+}
+
+/**
+ * Looks up where a file's data starts on disk
+ * @param fd The open file
+ * @param offset Receives the physical byte offset of the first extent
+ * @return 0 on success, -1 if the file system cannot tell or the file has no data
+ */
+static int first_extent_offset(int fd, uint64_t *offset) {
+#ifdef HAVE_FIEMAP
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extents[1];
+    } request;
+    
+    memset(&request, 0, sizeof(request));
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, &request.map) != 0 || request.map.fm_mapped_extents == 0 ||
+        (request.extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE))) {
+        return -1;
+    }
+    
+    *offset = request.extents[0].fe_physical;
+    return 0;
+#else
+    (void)fd;
+    (void)offset;
+    return -1;
+#endif
+}
+
+/**
+ * Asks the kernel to start reading the head of a file into the page cache
+ * @param fd The open file
+ */
+static void advise_readahead(int fd) {
+#ifdef POSIX_FADV_WILLNEED
+    off_t length = READAHEAD_BYTES;
+    if (g_options.max_scan_bytes != 0 && g_options.max_scan_bytes < length) {
+        length = (off_t)g_options.max_scan_bytes;
+    }
+    posix_fadvise(fd, 0, length, POSIX_FADV_WILLNEED);
+#else
+    (void)fd;
+#endif
+}
+
+/**
+ * Processes the .txt files in a range of a directory listing with --io-order:
+ * opens them all, sorts them by disk position (--io-order=extent; the listing
+ * itself is already in inode order) and scans them in that order while the
+ * kernel reads the next g_options.readahead files in the background
+ * @param worker The worker executing the item
+ * @param item The WORK_FILES item
+ */
+static void run_files_ordered(Worker *worker, const WorkItem *item) {
+    const DirNode *node = item->dir;
+    const DirListing *listing = &node->listing;
+    ScheduledFile files[FILE_BATCH_SIZE];
+    size_t count = 0;
+    
+    for (size_t i = item->first; i < item->first + item->count; i++) {
+        const char *name = listing->names + listing->entries[i].name_offset;
+        if (listing->entries[i].type != ENTRY_FILE || !is_txt_file(name) || !select_file(&node->ref, name)) {
+            continue;
+        }
+        
+        worker->stats.total_files++;
+        ScheduledFile *file = &files[count];
+        file->cached = settle_before_scan(&node->ref, name, &file->entry, &worker->stats);
+        if (file->cached > 0) {
+            continue;
+        }
+        file->name = name;
+        file->key = listing->entries[i].inode;
+        file->mapped = 0;
+        count++;
+    }
+    
+    // Opening in inode order walks the inode table once
+    for (size_t i = 0; i < count; i++) {
+        ScheduledFile *file = &files[i];
+        INSTRUMENT_BEGIN(open_started);
+        file->fd = open_entry(&node->ref, file->name);
+        INSTRUMENT_END(PHASE_OPEN, open_started);
+        file->open_error = (file->fd < 0) ? errno : 0;
+        
+        uint64_t offset;
+        if (file->fd >= 0 && g_options.io_order == IO_ORDER_EXTENT && first_extent_offset(file->fd, &offset) == 0) {
+            file->key = offset;
+            file->mapped = 1;
+        }
+    }
+    
+    if (g_options.io_order == IO_ORDER_EXTENT) {
+        qsort(files, count, sizeof(ScheduledFile), compare_scheduled_files);
+    }
+    
+    size_t advised = 0;
+    for (size_t i = 0; i < count; i++) {
+        ScheduledFile *file = &files[i];
+        char rj_pattern[PATTERN_MAX_LENGTH];
+        int scan_result;
+        
+        // Keep the files up to readahead places ahead of this one in flight
+        while (g_options.readahead > 0 && advised < count && advised <= i + (size_t)g_options.readahead) {
+            if (files[advised].fd >= 0) {
+                advise_readahead(files[advised].fd);
+            }
+            advised++;
+        }
+        
+        log_file_start();
+        if (file->fd >= 0) {
+            scan_result = scan_open_file(file->fd, &node->ref, file->name, rj_pattern);
+            int saved_errno = errno;
+            close_entry(file->fd);
+            errno = saved_errno;
+        } else if (file->open_error == EMFILE || file->open_error == ENFILE) {
+            // Out of descriptors with the whole batch open; this file opens now the others are closing
+            scan_result = read_file_content(&node->ref, file->name, rj_pattern, PATTERN_MAX_LENGTH);
+        } else {
+            fprintf(stderr, "Error: Cannot open file '%s%s%s': %s\n",
+                    node->path, entry_separator(node->path), file->name, strerror(file->open_error));
+            errno = file->open_error;
+            scan_result = -1;
+        }
+        
+        if (file->cached == 0 && scan_result >= 0) {
+            cache_store_result(&file->entry, scan_result, rj_pattern);
+        }
+        finish_file(&node->ref, file->name, scan_result, rj_pattern, &worker->stats);
+    }
+}
+
+/**
+ * Processes the .txt files in a range of a directory listing
+ * @param worker The worker executing the item
+ * @param item The WORK_FILES item
+ */
+static void run_files_batch(Worker *worker, const WorkItem *item) {
+    const DirNode *node = item->dir;
+    const DirListing *listing = &node->listing;
+
+#ifdef HAVE_IO_URING
+    IoRing *ring = g_options.use_io_uring ? thread_io_ring() : NULL;
+    if (ring != NULL) {
+        const char *names[FILE_BATCH_SIZE];
+        CacheEntry entries[FILE_BATCH_SIZE];
+        size_t count = 0;
+        
+        for (size_t i = item->first; i < item->first + item->count; i++) {
+            const char *name = listing->names + listing->entries[i].name_offset;
+            if (listing->entries[i].type != ENTRY_FILE || !is_txt_file(name) || !select_file(&node->ref, name)) {
+                continue;
+            }
+            
+            // Files settled by name or by the scan cache never enter the ring
+            worker->stats.total_files++;
+            int cached = settle_before_scan(&node->ref, name, &entries[count], &worker->stats);
+            if (cached <= 0) {
+                if (cached < 0) {
+                    entries[count].size = UINT64_MAX;
+                }
+                names[count++] = name;
+            }
+        }
+        
+        if (count > 0) {
+            process_files_uring(ring, &node->ref, names, entries, count, &worker->stats);
+        }
+        return;
+    }
+#endif
+
+    if (g_options.io_order != IO_ORDER_NONE) {
+        run_files_ordered(worker, item);
+        return;
+    }
+    
+    for (size_t i = item->first; i < item->first + item->count; i++) {
+        const char *name = listing->names + listing->entries[i].name_offset;
+        
+        if (listing->entries[i].type == ENTRY_FILE && is_txt_file(name) && select_file(&node->ref, name)) {
+            worker->stats.total_files++;
+            process_file(&node->ref, name, &worker->stats);
+        }
+    }
+}
+
+/**
+ * Runs a WORK_FILES item. With --journal, renames it queues keep the
+ * directory alive until they are committed, and an error keeps the
+ * directory from being recorded as done.
+ * @param worker The worker executing the item
+ * @param item The WORK_FILES item
+ */
+static void run_files_item(Worker *worker, const WorkItem *item) {
+    int errors = worker->stats.error_files;
+    
+    t_journal_node = item->dir;
+    run_files_batch(worker, item);
+    t_journal_node = NULL;
+    
+    if (item->dir->tree != NULL && worker->stats.error_files != errors) {
+        atomic_store(&item->dir->tree->files_failed, 1);
+    }
+}
+
+/**
+ * Enumerates a directory and queues its subdirectories and file batches
+ * @param worker The worker executing the item
+ * @param item The WORK_DIRECTORY item (parent node and entry index, or the root)
+ */
+static void run_directory_item(Worker *worker, const WorkItem *item) {
+    Engine *engine = worker->engine;
+    DirNode *parent = item->dir;
+    const char *name = (parent == NULL)
+        ? engine->root_path
+        : parent->listing.names + parent->listing.entries[item->first].name_offset;
+    
+    JournalTree *parent_tree = (parent != NULL) ? parent->tree : NULL;
+    
+    DirNode *node = dir_node_open(parent, name);
+    if (node == NULL) {
+        if (parent == NULL) {
+            engine->root_failed = 1;
+        }
+        journal_tree_release(parent_tree, 1);
+        return;
+    }
+    
+    // Duplicates moved to a quarantine inside the tree must not be processed again,
+    // and a resumed run skips subtrees its journal records as finished
+    if (dedupe_is_quarantine(node->ref.fd) ||
+        (g_journal.enabled && journal_finished(journal_relative(node->path), JOURNAL_TREE_DONE))) {
+        journal_tree_release(parent_tree, 0);
+        dir_node_release(node);
+        return;
+    }
+    
+    // Read the whole listing first so our own renames never show up as new entries
+    INSTRUMENT_BEGIN(enumerate_started);
+    int listed = read_directory(&node->ref, &node->listing);
+    INSTRUMENT_END(PHASE_ENUMERATE, enumerate_started);
+    if (listed != 0) {
+        fprintf(stderr, "Error: Error reading directory '%s': %s\n", node->path, strerror(errno));
+        if (parent == NULL) {
+            engine->root_failed = 1;
+        }
+        journal_tree_release(parent_tree, 1);
+        dir_node_release(node);
+        return;
+    }
+    
+    // The subtree is recorded as finished once this node and every child tree are done
+    if (g_journal.enabled && journal_tree_open(node, parent_tree) != 0) {
+        fprintf(stderr, "Error: Memory allocation failed for directory '%s'\n", node->path);
+        journal_tree_release(parent_tree, 1);
+        dir_node_release(node);
+        return;
+    }
+    
+    // With --io-order, files are handed out (and subdirectories visited) in inode order
+    if (g_options.io_order != IO_ORDER_NONE) {
+        qsort(node->listing.entries, node->listing.count, sizeof(DirEntry), compare_entry_inodes);
+    }
+    
+    const DirListing *listing = &node->listing;
+    
+    // Collision checks come from the index from now on; without it they probe the disk
+    if (name_index_build(&node->index, listing) == 0) {
+        node->ref.index = &node->index;
+    }
+    
+    for (size_t i = 0; i < listing->count; i++) {
+        if (listing->entries[i].type != ENTRY_DIRECTORY) {
+            continue;
+        }
+        
+        const char *child_name = listing->names + listing->entries[i].name_offset;
+        
+        // With --lease, the coordinator hands the subdirectories out instead
+        if (parent == NULL && engine->children != NULL) {
+            if (name_list_add(engine->children, child_name) != 0) {
+                fprintf(stderr, "Error: Memory allocation failed for directory '%s%s%s'\n",
+                        node->path, entry_separator(node->path), child_name);
+                engine->root_failed = 1;
+            }
+            continue;
+        }
+        
+        // With --shard-by=subtree, other shards own the other top-level subtrees outright
+        if (parent == NULL && g_options.shard_count > 0 && g_options.shard_by == SHARD_BY_SUBTREE &&
+            !shard_owns(child_name)) {
+            continue;
+        }
+        
+        WorkItem child = { WORK_DIRECTORY, node, i, 0 };
+        atomic_fetch_add(&node->refs, 1);
+        if (node->tree != NULL) {
+            atomic_fetch_add(&node->tree->pending, 1);
+        }
+        if (schedule_work(worker, &child) != 0) {
+            fprintf(stderr, "Error: Cannot queue directory '%s%s%s'\n",
+                    node->path, entry_separator(node->path), child_name);
+            journal_tree_release(node->tree, 1);
+            dir_node_release(node);
+        }
+    }
+    
+    // A resumed run has nothing left to do among files its journal records as done,
+    // and with --shard the files of directories owned by another shard are left to it
+    size_t file_count = listing->count;
+    if (node->tree != NULL && journal_finished(node->tree->path, JOURNAL_DIR_DONE)) {
+        file_count = 0;
+    }
+    if (g_options.shard_count > 0 && !shard_owns(relative_path(engine->root_path, node->path))) {
+        file_count = 0;
+    }
+    
+    // File batches go on top so this directory's files are handled before descending
+    for (size_t first = 0; first < file_count; first += FILE_BATCH_SIZE) {
+        size_t count = listing->count - first;
+        if (count > FILE_BATCH_SIZE) {
+            count = FILE_BATCH_SIZE;
+        }
+        
+        WorkItem batch = { WORK_FILES, node, first, count };
+        atomic_fetch_add(&node->refs, 1);
+        if (schedule_work(worker, &batch) != 0) {
+            // Could not hand the batch off; process it inline instead
+            dir_node_release(node);
+            run_files_item(worker, &batch);
+        }
+    }
+    
+    dir_node_release(node);
+}
+
+/**
+ * Worker loop: runs items until the whole tree has been processed
+ * @param arg The Worker this thread runs as
+ * @return NULL
+ */
+static void *worker_main(void *arg) {
+    Worker *worker = (Worker*)arg;
+    Engine *engine = worker->engine;
+    WorkItem item;
+    
+    for (;;) {
+        if (find_work(worker, &item)) {
+            if (item.type == WORK_DIRECTORY) {
+                run_directory_item(worker, &item);
+            } else {
+                run_files_item(worker, &item);
+            }
+            dir_node_release(item.dir);
+            
+            // The item's children were queued before this, so zero means done
+            if (atomic_fetch_sub(&engine->pending, 1) == 1) {
+                pthread_mutex_lock(&engine->idle_lock);
+                pthread_cond_broadcast(&engine->idle_cond);
+                pthread_mutex_unlock(&engine->idle_lock);
+            }
+            continue;
+        }
+        
+        // Commit queued renames before going idle; they may be all that is left
+        if (t_journal_count > 0) {
+            journal_flush_thread();
+            continue;
+        }
+        
+        // Nothing to steal: sleep until new work is queued or everything is done
+        pthread_mutex_lock(&engine->idle_lock);
+        atomic_fetch_add(&engine->sleepers, 1);
+        while (atomic_load(&engine->queued) == 0 && atomic_load(&engine->pending) > 0) {
+            pthread_cond_wait(&engine->idle_cond, &engine->idle_lock);
+        }
+        atomic_fetch_sub(&engine->sleepers, 1);
+        pthread_mutex_unlock(&engine->idle_lock);
+        
+        if (atomic_load(&engine->pending) == 0) {
+#ifdef HAVE_IO_URING
+            release_thread_io_ring();
+#endif
+            arena_release_cache();
+            journal_release_thread();
+            log_flush_thread();
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Runs the worker engine over a directory: with children NULL over its whole
+ * subtree, otherwise over its own files only, collecting the names of its
+ * subdirectories in children
+ * @param dir_path The directory path to process
+ * @param children Receives the subdirectory names instead of their being visited, or NULL
+ * @param stats Statistics structure to update
+ * @return 0 on success, -1 on error
+ */
+static int run_engine(const char *dir_path, NameList *children, Statistics *stats) {
+    raise_descriptor_limit();
+    
+    Engine engine;
+    memset(&engine, 0, sizeof(engine));
+    engine.root_path = dir_path;
+    engine.children = children;
+    engine.worker_count = g_options.jobs > 0 ? g_options.jobs : 1;
+    atomic_init(&engine.pending, 0);
+    atomic_init(&engine.queued, 0);
+    atomic_init(&engine.sleepers, 0);
+    pthread_mutex_init(&engine.idle_lock, NULL);
+    pthread_cond_init(&engine.idle_cond, NULL);
+    
+    engine.workers = (Worker*)calloc(engine.worker_count, sizeof(Worker));
+    if (engine.workers == NULL) {
+        fprintf(stderr, "Error: Cannot allocate %d workers\n", engine.worker_count);
+        return -1;
+    }
+    
+    for (int i = 0; i < engine.worker_count; i++) {
+        engine.workers[i].engine = &engine;
+        engine.workers[i].steal_seed = (unsigned)i + 1;
+        pthread_mutex_init(&engine.workers[i].deque.lock, NULL);
+    }
+    
+    // Seed the first worker with the root directory
+    WorkItem root = { WORK_DIRECTORY, NULL, 0, 0 };
+    int result = schedule_work(&engine.workers[0], &root);
+    
+    if (result == 0) {
+        // Worker 0 runs on the calling thread; the rest get their own
+        int started = 1;
+        for (; started < engine.worker_count; started++) {
+            if (pthread_create(&engine.workers[started].thread, NULL, worker_main, &engine.workers[started]) != 0) {
+                fprintf(stderr, "Warning: Could only start %d of %d workers\n", started, engine.worker_count);
+                break;
+            }
+        }
+        
+        worker_main(&engine.workers[0]);
+        
+        for (int i = 1; i < started; i++) {
+            pthread_join(engine.workers[i].thread, NULL);
+        }
+    }
+    
+    // Merge the per-worker counters
+    for (int i = 0; i < engine.worker_count; i++) {
+        stats->total_files += engine.workers[i].stats.total_files;
+        stats->renamed_files += engine.workers[i].stats.renamed_files;
+        stats->skipped_files += engine.workers[i].stats.skipped_files;
+        stats->error_files += engine.workers[i].stats.error_files;
+        stats->deduplicated_files += engine.workers[i].stats.deduplicated_files;
+        
+        free(engine.workers[i].deque.items);
+        pthread_mutex_destroy(&engine.workers[i].deque.lock);
+    }
+    
+    free(engine.workers);
+    pthread_cond_destroy(&engine.idle_cond);
+    pthread_mutex_destroy(&engine.idle_lock);
+    
+    return (result != 0 || engine.root_failed) ? -1 : 0;
+}
+
+/**
+ * Recursively processes a directory and all its subdirectories.
+ * Directories are enumerated into per-worker deques and the resulting file
+ * batches are scanned and renamed by g_options.jobs workers, which steal
+ * from each other when their own deque runs dry. With a single job the
+ * calling thread does all the work. Files are opened and renamed relative
+ * to their directory's descriptor, so no per-entry path is ever built.
+ * @param dir_path The directory path to process
+ * @param stats Statistics structure to update
+ * @return 0 on success, -1 on error
+ */
+int process_directory(const char *dir_path, Statistics *stats) {
+    if (dir_path == NULL || stats == NULL) {
+        fprintf(stderr, "Error: Invalid parameters to process_directory\n");
+        return -1;
+    }
+    
+    return run_engine(dir_path, NULL, stats);
+}
+
+// Sharding Module Implementation
+
+/**
+ * Appends a name to a name list
+ * @param list The list
+ * @param name The name to append
+ * @return 0 on success, -1 on allocation failure
+ */
+static int name_list_add(NameList *list, const char *name) {
+    size_t length = strlen(name) + 1;
+    
+    if (list->used + length > list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 4096;
+        while (capacity < list->used + length) {
+            capacity *= 2;
+        }
+        char *data = (char*)realloc(list->data, capacity);
+        if (data == NULL) {
+            return -1;
+        }
+        list->data = data;
+        list->capacity = capacity;
+    }
+    
+    memcpy(list->data + list->used, name, length);
+    list->used += length;
+    list->count++;
+    return 0;
+}
+
+/**
+ * Decides whether this process owns a directory under --shard. The owner is
+ * picked by a hash of the directory's path relative to the root (with
+ * --shard-by=subtree, of its top-level component), which every process and
+ * every host computes alike, so each directory, and with it the choice of
+ * collision suffixes among its files, belongs to exactly one shard.
+ * @param relative Directory path relative to the root ("" for the root)
+ * @return 1 if this shard renames the directory's files, 0 otherwise
+ */
+static int shard_owns(const char *relative) {
+    size_t length = strlen(relative);
+    if (g_options.shard_by == SHARD_BY_SUBTREE) {
+        length = strcspn(relative, "/");
+    }
+    
+    // FNV-1a over the bytes, fixed at 64 bits so every platform agrees
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)relative[i]) * 1099511628211ULL;
+    }
+    
+    return hash % (uint64_t)g_options.shard_count == (uint64_t)g_options.shard_index;
+}
+
+/**
+ * Sends one lease protocol message
+ * @param fd The connected socket
+ * @param type The message type
+ * @param first First part of the payload (may be NULL if first_length is 0)
+ * @param first_length Its size in bytes
+ * @param second Second part of the payload (may be NULL if second_length is 0)
+ * @param second_length Its size in bytes
+ * @return 0 on success, -1 if the peer is gone
+ */
+static int lease_send(int fd, LeaseMessageType type, const void *first, size_t first_length,
+                      const void *second, size_t second_length) {
+    LeaseHeader header = { (uint32_t)type, (uint32_t)(first_length + second_length) };
+    struct iovec parts[3] = {
+        { &header, sizeof(header) },
+        { (void*)first, first_length },
+        { (void*)second, second_length }
+    };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = 3;
+    
+    size_t remaining = sizeof(header) + first_length + second_length;
+    while (remaining > 0) {
+        ssize_t sent = sendmsg(fd, &message, 0);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        
+        // Skip what went out, part by part
+        remaining -= (size_t)sent;
+        while (message.msg_iovlen > 0 && (size_t)sent >= message.msg_iov[0].iov_len) {
+            sent -= (ssize_t)message.msg_iov[0].iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov[0].iov_base = (char*)message.msg_iov[0].iov_base + sent;
+            message.msg_iov[0].iov_len -= (size_t)sent;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Reads exactly the requested number of bytes from a socket
+ * @param fd The connected socket
+ * @param buffer Receives the bytes
+ * @param length Number of bytes to read
+ * @return 0 on success, -1 if the peer is gone
+ */
+static int lease_read(int fd, void *buffer, size_t length) {
+    for (size_t done = 0; done < length; ) {
+        ssize_t got = read(fd, (char*)buffer + done, length - done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return -1;
+        }
+        done += (size_t)got;
+    }
+    
+    return 0;
+}
+
+/**
+ * Appends a directory to the coordinator's queue of directories to lease
+ * @param queue The queue
+ * @param parent Relative path of the parent, or NULL for a path given whole
+ * @param name The directory's name (or whole relative path)
+ * @return 0 on success, -1 on allocation failure
+ */
+static int lease_queue_push(LeaseQueue *queue, const char *parent, const char *name) {
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 256;
+        char **paths = (char**)realloc(queue->paths, capacity * sizeof(char*));
+        if (paths == NULL) {
+            return -1;
+        }
+        queue->paths = paths;
+        queue->capacity = capacity;
+    }
+    
+    size_t length = (parent && *parent ? strlen(parent) + 1 : 0) + strlen(name) + 1;
+    char *path = (char*)malloc(length);
+    if (path == NULL) {
+        return -1;
+    }
+    if (parent != NULL && *parent != '\0') {
+        snprintf(path, length, "%s/%s", parent, name);
+    } else {
+        snprintf(path, length, "%s", name);
+    }
+    
+    queue->paths[queue->count++] = path;
+    return 0;
+}
+
+/**
+ * Hands a client its next lease if one is free, or tells it that the run is
+ * over once nothing is queued and no lease is outstanding
+ * @param state The coordinator
+ * @param client The waiting client
+ * @return 0 if the client was served or must keep waiting, -1 if it is gone
+ */
+static int lease_serve(LeaseCoordinator *state, LeaseClient *client) {
+    if (state->queue.count > 0) {
+        client->lease = state->queue.paths[--state->queue.count];
+        client->waiting = 0;
+        state->outstanding++;
+        state->granted++;
+        return lease_send(client->fd, LEASE_GRANT, client->lease, strlen(client->lease), NULL, 0);
+    }
+    
+    if (state->outstanding == 0) {
+        client->waiting = 0;
+        return lease_send(client->fd, LEASE_FINISHED, NULL, 0, NULL, 0);
+    }
+    
+    client->waiting = 1;
+    return 0;
+}
+
+/**
+ * Handles one complete message from a client
+ * @param state The coordinator
+ * @param client The client that sent it
+ * @param type The message type
+ * @param payload The payload
+ * @param length Its size in bytes
+ * @return 0 on success, -1 if the client broke the protocol or is gone
+ */
+static int lease_handle(LeaseCoordinator *state, LeaseClient *client, uint32_t type, const char *payload,
+                        size_t length) {
+    if (type == LEASE_REQUEST && client->lease == NULL && !client->waiting) {
+        return lease_serve(state, client);
+    }
+    if (type != LEASE_REPORT || client->lease == NULL || length < sizeof(LeaseCounts) ||
+        (length > sizeof(LeaseCounts) && payload[length - 1] != '\0')) {
+        return -1;
+    }
+    
+    LeaseCounts counts;
+    memcpy(&counts, payload, sizeof(counts));
+    state->stats->total_files += counts.total_files;
+    state->stats->renamed_files += counts.renamed_files;
+    state->stats->skipped_files += counts.skipped_files;
+    state->stats->error_files += counts.error_files;
+    state->stats->deduplicated_files += counts.deduplicated_files;
+    if (counts.failed) {
+        state->failed++;
+    }
+    
+    // The leased directory's subdirectories become leases of their own
+    for (const char *name = payload + sizeof(counts); name < payload + length; name += strlen(name) + 1) {
+        if (*name == '\0' || strchr(name, '/') != NULL || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        if (lease_queue_push(&state->queue, client->lease, name) != 0) {
+            fprintf(stderr, "Error: Memory allocation failed for directory '%s/%s'\n", client->lease, name);
+            state->stats->error_files++;
+        }
+    }
+    
+    free(client->lease);
+    client->lease = NULL;
+    state->outstanding--;
+    return 0;
+}
+
+/**
+ * Reads what a client has sent and handles every complete message in it
+ * @param state The coordinator
+ * @param client The client whose socket is readable
+ * @return 0 on success, -1 if the client disconnected or broke the protocol
+ */
+static int lease_receive(LeaseCoordinator *state, LeaseClient *client) {
+    if (client->capacity - client->used < 65536) {
+        size_t capacity = client->capacity ? client->capacity * 2 : 65536;
+        char *input = (char*)realloc(client->input, capacity);
+        if (input == NULL) {
+            return -1;
+        }
+        client->input = input;
+        client->capacity = capacity;
+    }
+    
+    ssize_t got = read(client->fd, client->input + client->used, client->capacity - client->used);
+    if (got < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return 0;
+    }
+    if (got <= 0) {
+        return -1;
+    }
+    client->used += (size_t)got;
+    
+    size_t offset = 0;
+    while (client->used - offset >= sizeof(LeaseHeader)) {
+        LeaseHeader header;
+        memcpy(&header, client->input + offset, sizeof(header));
+        if (header.length > LEASE_MAX_MESSAGE) {
+            return -1;
+        }
+        if (client->used - offset - sizeof(header) < header.length) {
+            break;
+        }
+        
+        if (lease_handle(state, client, header.type, client->input + offset + sizeof(header), header.length) != 0) {
+            return -1;
+        }
+        offset += sizeof(header) + header.length;
+    }
+    
+    memmove(client->input, client->input + offset, client->used - offset);
+    client->used -= offset;
+    return 0;
+}
+
+/**
+ * Drops a client. A lease it still held goes back to the queue for the next
+ * worker; processing a directory again is harmless, since files already
+ * renamed are recognised from their names.
+ * @param state The coordinator
+ * @param index Index of the client
+ */
+static void lease_drop(LeaseCoordinator *state, size_t index) {
+    LeaseClient *client = &state->clients[index];
+    
+    if (client->lease != NULL) {
+        fprintf(stderr, "Warning: A worker left before finishing '%s'; leasing it again\n",
+                *client->lease ? client->lease : ".");
+        state->outstanding--;
+        if (lease_queue_push(&state->queue, NULL, client->lease) != 0) {
+            fprintf(stderr, "Error: Memory allocation failed for directory '%s'\n", client->lease);
+            state->stats->error_files++;
+        }
+        free(client->lease);
+    }
+    
+    close(client->fd);
+    free(client->input);
+    state->clients[index] = state->clients[--state->client_count];
+}
+
+/**
+ * Runs the coordinator of a leased run: hands out one directory at a time to
+ * the --lease workers that connect to the socket, queues the subdirectories
+ * each worker reports, and adds up their counts. The run is over once every
+ * directory has been reported and the workers have disconnected.
+ * @param socket_path Path of the Unix domain socket to listen on
+ * @param stats Receives the counts of all workers
+ * @param leases Receives the number of directories leased
+ * @return 0 on success, -1 on error
+ */
+static int coordinate_leases(const char *socket_path, Statistics *stats, int *leases) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long\n", socket_path);
+        return -1;
+    }
+    memcpy(address.sun_path, socket_path, strlen(socket_path) + 1);
+    
+    // A socket left behind by an earlier coordinator is replaced; anything else is not
+    struct stat st;
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socket_path);
+    }
+    
+    // A worker that goes away mid-reply must not take the coordinator with it
+    signal(SIGPIPE, SIG_IGN);
+    
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Error: Cannot listen on '%s': %s\n", socket_path, strerror(errno));
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+        return -1;
+    }
+    
+    LeaseCoordinator state;
+    memset(&state, 0, sizeof(state));
+    state.stats = stats;
+    int result = lease_queue_push(&state.queue, NULL, "");
+    struct pollfd *polls = NULL;
+    size_t poll_capacity = 0;
+    
+    while (result == 0 && (state.queue.count > 0 || state.outstanding > 0 || state.client_count > 0 ||
+                           state.granted == 0)) {
+        if (poll_capacity < state.client_count + 1) {
+            poll_capacity = (state.client_count + 1) * 2;
+            struct pollfd *grown = (struct pollfd*)realloc(polls, poll_capacity * sizeof(struct pollfd));
+            if (grown == NULL) {
+                fprintf(stderr, "Error: Memory allocation failed for %zu workers\n", state.client_count);
+                result = -1;
+                break;
+            }
+            polls = grown;
+        }
+        
+        polls[0].fd = listen_fd;
+        polls[0].events = POLLIN;
+        for (size_t i = 0; i < state.client_count; i++) {
+            polls[i + 1].fd = state.clients[i].fd;
+            polls[i + 1].events = POLLIN;
+        }
+        
+        size_t polled = state.client_count;
+        if (poll(polls, polled + 1, -1) < 0) {
+            if (errno != EINTR) {
+                fprintf(stderr, "Error: Cannot wait for workers: %s\n", strerror(errno));
+                result = -1;
+            }
+            continue;
+        }
+        
+        // Clients are dropped from the back so the indexes of those not yet looked at stay put
+        for (size_t i = polled; i-- > 0; ) {
+            if (polls[i + 1].revents != 0 && lease_receive(&state, &state.clients[i]) != 0) {
+                lease_drop(&state, i);
+            }
+        }
+        
+        if (polls[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                LeaseClient *clients = (LeaseClient*)realloc(state.clients,
+                                                             (state.client_count + 1) * sizeof(LeaseClient));
+                if (clients == NULL) {
+                    close(fd);
+                } else {
+                    state.clients = clients;
+                    memset(&state.clients[state.client_count], 0, sizeof(LeaseClient));
+                    state.clients[state.client_count++].fd = fd;
+                }
+            }
+        }
+        
+        // Newly queued directories, or the end of the run, release waiting workers
+        for (size_t i = state.client_count; i-- > 0; ) {
+            if (state.clients[i].waiting && lease_serve(&state, &state.clients[i]) != 0) {
+                lease_drop(&state, i);
+            }
+        }
+    }
+    
+    for (size_t i = state.client_count; i-- > 0; ) {
+        lease_drop(&state, i);
+    }
+    for (size_t i = 0; i < state.queue.count; i++) {
+        free(state.queue.paths[i]);
+    }
+    free(state.queue.paths);
+    free(state.clients);
+    free(polls);
+    close(listen_fd);
+    unlink(socket_path);
+    
+    *leases = (int)state.granted;
+    return (result != 0 || state.failed > 0) ? -1 : 0;
+}
+
+/**
+ * Runs a --lease worker: asks the coordinator for a directory, processes that
+ * directory's files with the usual engine, reports its counts and its
+ * subdirectories, and repeats until the coordinator says the run is over
+ * @param socket_path Path of the coordinator's Unix domain socket
+ * @param root This host's path of the tree being processed
+ * @param stats Statistics structure to update with this worker's share
+ * @return 0 on success, -1 if the coordinator could not be reached or a directory failed
+ */
+static int lease_worker(const char *socket_path, const char *root, Statistics *stats) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long\n", socket_path);
+        return -1;
+    }
+    memcpy(address.sun_path, socket_path, strlen(socket_path) + 1);
+    
+    signal(SIGPIPE, SIG_IGN);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Error: Cannot connect to coordinator '%s': %s\n", socket_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    
+    int result = 0;
+    char *relative = NULL;
+    char *path = NULL;
+    
+    for (;;) {
+        LeaseHeader header;
+        if (lease_send(fd, LEASE_REQUEST, NULL, 0, NULL, 0) != 0 || lease_read(fd, &header, sizeof(header)) != 0 ||
+            header.length > LEASE_MAX_MESSAGE) {
+            fprintf(stderr, "Error: Lost the connection to coordinator '%s'\n", socket_path);
+            result = -1;
+            break;
+        }
+        if (header.type == LEASE_FINISHED) {
+            break;
+        }
+        
+        free(relative);
+        relative = (char*)malloc(header.length + 1);
+        if (relative == NULL || lease_read(fd, relative, header.length) != 0) {
+            fprintf(stderr, "Error: Lost the connection to coordinator '%s'\n", socket_path);
+            result = -1;
+            break;
+        }
+        relative[header.length] = '\0';
+        
+        size_t path_len = strlen(root) + header.length + 2;
+        free(path);
+        path = (char*)malloc(path_len);
+        if (path == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for directory '%s'\n", relative);
+            result = -1;
+            break;
+        }
+        if (*relative == '\0') {
+            snprintf(path, path_len, "%s", root);
+        } else {
+            snprintf(path, path_len, "%s%s%s", root, entry_separator(root), relative);
+        }
+        
+        // The directory's own files only; its subdirectories go back to the coordinator
+        Statistics counts = {0, 0, 0, 0, 0};
+        NameList children = { NULL, 0, 0, 0 };
+        int failed = run_engine(path, &children, &counts) != 0;
+        if (failed) {
+            result = -1;
+        }
+        stats->total_files += counts.total_files;
+        stats->renamed_files += counts.renamed_files;
+        stats->skipped_files += counts.skipped_files;
+        stats->error_files += counts.error_files;
+        stats->deduplicated_files += counts.deduplicated_files;
+        
+        LeaseCounts report = { counts.total_files, counts.renamed_files, counts.skipped_files,
+                               counts.error_files, counts.deduplicated_files, failed };
+        int sent = lease_send(fd, LEASE_REPORT, &report, sizeof(report), children.data, children.used);
+        free(children.data);
+        if (sent != 0) {
+            fprintf(stderr, "Error: Lost the connection to coordinator '%s'\n", socket_path);
+            result = -1;
+            break;
+        }
+    }
+    
+    free(relative);
+    free(path);
+    close(fd);
+    return result;
+}
+#endif
+
+#ifdef HAVE_INOTIFY
+// Watch Module Implementation (inotify)
+
+// Events that announce a finished file, and directories to start watching
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DONT_FOLLOW | IN_EXCL_UNLINK | IN_ONLYDIR)
+
+/**
+ * SIGINT/SIGTERM handler for --watch: asks the event loop to finish
+ * @param sig The signal number
+ */
+static void watch_signal_handler(int sig) {
+    g_watch_signal = sig;
+}
+
+/**
+ * Finds the table slot of a watch descriptor
+ * @param wd The watch descriptor
+ * @param insert Non-zero to return the first reusable slot when wd is absent
+ * @return The slot, or NULL if wd is absent and insert is zero
+ */
+static WatchedDir *watch_slot(int wd, int insert) {
+    if (g_watch.dir_capacity == 0) {
+        return NULL;
+    }
+    
+    size_t mask = g_watch.dir_capacity - 1;
+    WatchedDir *reusable = NULL;
+    
+    for (size_t i = ((size_t)wd * 2654435761u) & mask; ; i = (i + 1) & mask) {
+        WatchedDir *slot = &g_watch.dirs[i];
+        if (slot->wd == wd) {
+            return slot;
+        }
+        if (slot->wd == -1 && reusable == NULL) {
+            reusable = slot;
+        }
+        if (slot->wd == 0) {
+            return insert ? (reusable ? reusable : slot) : NULL;
+        }
+    }
+}
+
+/**
+ * Records the path of a watch descriptor. inotify hands out the same
+ * descriptor when a directory is watched again, so a directory moved within
+ * the tree just has its path replaced.
+ * @param wd The watch descriptor
+ * @param path The directory path
+ * @return 0 on success, -1 on allocation failure
+ */
+static int watch_remember(int wd, const char *path) {
+    // Keep at least a quarter of the slots never used, so probes always end
+    if ((g_watch.dir_used + 1) * 4 > g_watch.dir_capacity * 3) {
+        size_t capacity = g_watch.dir_capacity ? g_watch.dir_capacity * 2 : 256;
+        WatchedDir *old_dirs = g_watch.dirs;
+        size_t old_capacity = g_watch.dir_capacity;
+        
+        g_watch.dirs = (WatchedDir*)calloc(capacity, sizeof(WatchedDir));
+        if (g_watch.dirs == NULL) {
+            g_watch.dirs = old_dirs;
+            return -1;
+        }
+        g_watch.dir_capacity = capacity;
+        g_watch.dir_used = 0;
+        
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_dirs[i].wd > 0) {
+                *watch_slot(old_dirs[i].wd, 1) = old_dirs[i];
+                g_watch.dir_used++;
+            }
+        }
+        free(old_dirs);
+    }
+    
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return -1;
+    }
+    
+    WatchedDir *slot = watch_slot(wd, 1);
+    if (slot->wd == wd) {
+        free(slot->path);
+    } else {
+        if (slot->wd == 0) {
+            g_watch.dir_used++;
+        }
+        slot->wd = wd;
+    }
+    slot->path = copy;
+    return 0;
+}
+
+/**
+ * Forgets a watch descriptor the kernel has dropped (its directory is gone)
+ * @param wd The watch descriptor
+ */
+static void watch_forget(int wd) {
+    WatchedDir *slot = watch_slot(wd, 0);
+    
+    if (slot != NULL) {
+        free(slot->path);
+        slot->path = NULL;
+        slot->wd = -1;  // Removed; probe chains through this slot stay intact
+    }
+}
+
+/**
+ * Watches a directory and every directory below it. The tree is walked with
+ * an explicit stack of paths, and each directory is watched before it is
+ * listed, so subdirectories created meanwhile are reported by inotify.
+ * @param root The top directory to watch
+ * @return 0 on success, -1 if root itself could not be watched
+ */
+static int watch_add_tree(const char *root) {
+    size_t depth = 0;
+    size_t capacity = 64;
+    char **stack = (char**)malloc(capacity * sizeof(char*));
+    int result = 0;
+    
+    if (stack == NULL || (stack[depth] = strdup(root)) == NULL) {
+        fprintf(stderr, "Error: Cannot allocate memory to watch '%s'\n", root);
+        free(stack);
+        return -1;
+    }
+    depth++;
+    
+    while (depth > 0) {
+        char *path = stack[--depth];
+        DirRef dir = { path, open_directory_at(AT_FDCWD, path), NULL };
+        
+        if (dir.fd < 0 || dedupe_is_quarantine(dir.fd)) {
+            if (dir.fd < 0 && errno != ENOENT) {
+                fprintf(stderr, "Error: Cannot open directory '%s': %s\n", path, strerror(errno));
+            }
+            if (dir.fd < 0 && strcmp(path, root) == 0) {
+                result = -1;
+            }
+            if (dir.fd >= 0) {
+                close(dir.fd);
+            }
+            free(path);
+            continue;
+        }
+        
+        // Watch through the descriptor, so paths longer than PATH_MAX work too
+        char fd_path[64];
+        snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", dir.fd);
+        int wd = inotify_add_watch(g_watch.fd, fd_path, WATCH_MASK);
+        if (wd < 0) {
+            wd = inotify_add_watch(g_watch.fd, path, WATCH_MASK);
+        }
+        if (wd < 0 || watch_remember(wd, path) != 0) {
+            fprintf(stderr, "Error: Cannot watch directory '%s': %s\n", path,
+                    wd < 0 ? strerror(errno) : "out of memory");
+            if (strcmp(path, root) == 0) {
+                result = -1;
+            }
+            close(dir.fd);
+            free(path);
+            continue;
+        }
+        
+        Arena arena = { NULL };
+        DirListing listing;
+        memset(&listing, 0, sizeof(listing));
+        listing.arena = &arena;
+        if (read_directory(&dir, &listing) != 0) {
+            fprintf(stderr, "Error: Error reading directory '%s': %s\n", path, strerror(errno));
+        }
+        close(dir.fd);
+        
+        for (size_t i = 0; i < listing.count; i++) {
+            if (listing.entries[i].type != ENTRY_DIRECTORY) {
+                continue;
+            }
+            
+            const char *name = listing.names + listing.entries[i].name_offset;
+            size_t path_len = strlen(path) + strlen(name) + 2;
+            char *child = (char*)malloc(path_len);
+            
+            if (depth == capacity) {
+                char **grown = (char**)realloc(stack, capacity * 2 * sizeof(char*));
+                if (grown != NULL) {
+                    stack = grown;
+                    capacity *= 2;
+                }
+            }
+            if (child == NULL || depth == capacity) {
+                fprintf(stderr, "Error: Cannot allocate memory to watch '%s%s%s'\n",
+                        path, entry_separator(path), name);
+                free(child);
+                continue;
+            }
+            
+            snprintf(child, path_len, "%s%s%s", path, entry_separator(path), name);
+            stack[depth++] = child;
+        }
+        
+        arena_free(&arena);
+        free(path);
+    }
+    
+    free(stack);
+    return result;
+}
+
+/**
+ * Queues a settled file for the workers, waiting while the queue is full
+ * @param dir_path Directory of the file (copied)
+ * @param name The file name (ownership passes to the queue)
+ */
+static void watch_enqueue(const char *dir_path, char *name) {
+    char *path_copy = strdup(dir_path);
+    if (path_copy == NULL) {
+        fprintf(stderr, "Error: Cannot allocate memory for '%s%s%s'\n", dir_path, entry_separator(dir_path), name);
+        free(name);
+        return;
+    }
+    
+    pthread_mutex_lock(&g_watch.lock);
+    while (g_watch.queue_count == WATCH_QUEUE_SIZE) {
+        pthread_cond_wait(&g_watch.not_full, &g_watch.lock);
+    }
+    
+    WatchItem *item = &g_watch.queue[(g_watch.queue_head + g_watch.queue_count) % WATCH_QUEUE_SIZE];
+    item->dir_path = path_copy;
+    item->name = name;
+    g_watch.queue_count++;
+    
+    pthread_cond_signal(&g_watch.not_empty);
+    pthread_mutex_unlock(&g_watch.lock);
+}
+
+/**
+ * Hands a pending file to the workers and removes it from the pending set
+ * @param index Index of the file in g_watch.pending
+ */
+static void watch_dispatch(size_t index) {
+    PendingFile file = g_watch.pending[index];
+    g_watch.pending[index] = g_watch.pending[--g_watch.pending_count];
+    
+    WatchedDir *dir = watch_slot(file.wd, 0);
+    if (dir == NULL) {
+        free(file.name);  // Directory was removed while the file settled
+        return;
+    }
+    
+    watch_enqueue(dir->path, file.name);
+}
+
+/**
+ * Notes an event for a file, (re)starting its debounce interval. When the
+ * pending set is full the file that has waited longest goes out early.
+ * @param wd Watch descriptor of the file's directory
+ * @param name The file name
+ */
+static void watch_touch(int wd, const char *name) {
+    uint64_t due = monotonic_ns() + (uint64_t)g_options.watch_debounce_ms * 1000000ULL;
+    
+    for (size_t i = 0; i < g_watch.pending_count; i++) {
+        if (g_watch.pending[i].wd == wd && strcmp(g_watch.pending[i].name, name) == 0) {
+            g_watch.pending[i].due_ns = due;
+            return;
+        }
+    }
+    
+    if (g_watch.pending_count == WATCH_PENDING_LIMIT) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < g_watch.pending_count; i++) {
+            if (g_watch.pending[i].due_ns < g_watch.pending[oldest].due_ns) {
+                oldest = i;
+            }
+        }
+        watch_dispatch(oldest);
+    }
+    
+    char *copy = strdup(name);
+    if (copy == NULL) {
+        fprintf(stderr, "Error: Cannot allocate memory for '%s'\n", name);
+        return;
+    }
+    
+    PendingFile *file = &g_watch.pending[g_watch.pending_count++];
+    file->wd = wd;
+    file->name = copy;
+    file->due_ns = due;
+}
+
+/**
+ * Hands every file whose debounce interval has passed to the workers
+ * @param now Current monotonic time
+ * @return Nanoseconds until the next file is due, or UINT64_MAX if none is pending
+ */
+static uint64_t watch_dispatch_due(uint64_t now) {
+    uint64_t next = UINT64_MAX;
+    
+    for (size_t i = 0; i < g_watch.pending_count; ) {
+        if (g_watch.pending[i].due_ns <= now) {
+            watch_dispatch(i);  // Moves the last entry into slot i
+            continue;
+        }
+        if (g_watch.pending[i].due_ns - now < next) {
+            next = g_watch.pending[i].due_ns - now;
+        }
+        i++;
+    }
+    
+    return next;
+}
+
+/**
+ * Watches a new subdirectory and sweeps it for files that landed before its
+ * watch existed
+ * @param path The subdirectory
+ * @param stats Statistics structure to update
+ */
+static void watch_new_directory(const char *path, Statistics *stats) {
+    if (watch_add_tree(path) == 0) {
+        process_directory(path, stats);
+    }
+}
+
+/**
+ * Handles one batch of inotify events
+ * @param buffer The events as read from the inotify descriptor
+ * @param length Bytes in the buffer
+ * @param root The watched tree, for rescans after an overflow
+ * @param stats Statistics structure to update
+ */
+static void watch_handle_events(const char *buffer, size_t length, const char *root, Statistics *stats) {
+    for (size_t offset = 0; offset < length; ) {
+        const struct inotify_event *event = (const struct inotify_event*)(buffer + offset);
+        offset += sizeof(struct inotify_event) + event->len;
+        
+        if (event->mask & IN_Q_OVERFLOW) {
+            // The kernel dropped events: catch up with one sweep of the whole tree
+            fprintf(stderr, "Warning: inotify queue overflowed; rescanning '%s'\n", root);
+            watch_new_directory(root, stats);
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            watch_forget(event->wd);
+            continue;
+        }
+        if (event->len == 0) {
+            continue;
+        }
+        
+        const char *name = event->name;
+        if (event->mask & IN_ISDIR) {
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                WatchedDir *parent = watch_slot(event->wd, 0);
+                if (parent != NULL) {
+                    size_t path_len = strlen(parent->path) + strlen(name) + 2;
+                    char *path = (char*)malloc(path_len);
+                    if (path != NULL) {
+                        snprintf(path, path_len, "%s%s%s", parent->path, entry_separator(parent->path), name);
+                        watch_new_directory(path, stats);
+                        free(path);
+                    }
+                }
+            }
+            continue;
+        }
+        
+        // Canonical names, our own renames included, are checked by the workers
+        if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && is_txt_file(name)) {
+            watch_touch(event->wd, name);
+        }
+    }
+}
+
+/**
+ * Checks whether a file that arrived under a canonical name (our own renames
+ * among them) is already named for the ID it holds. The ID is confirmed as
+ * settle_before_scan does it: from the header, or from the name alone with
+ * --trust-names or --cache.
+ * @param dir The directory containing the file
+ * @param name The file name
+ * @return 1 if the file needs no processing, 0 otherwise
+ */
+static int watch_already_named(const DirRef *dir, const char *name) {
+    char pattern[PATTERN_MAX_LENGTH];
+    char base_name[MAX_NAME_LENGTH];
+    
+    if (!is_canonical_name(name, pattern) ||
+        !(g_options.trust_names || g_cache.enabled || verify_canonical_name(dir, name, pattern))) {
+        return 0;
+    }
+    
+    snprintf(base_name, sizeof(base_name), "%s.txt", pattern);
+    return is_already_named(dir, name, base_name);
+}
+
+/**
+ * Worker loop for --watch: processes settled files until told to stop
+ * @param arg The worker's Statistics
+ * @return NULL
+ */
+static void *watch_worker_main(void *arg) {
+    Statistics *stats = (Statistics*)arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&g_watch.lock);
+        while (g_watch.queue_count == 0 && !g_watch.stopping) {
+            pthread_cond_wait(&g_watch.not_empty, &g_watch.lock);
+        }
+        if (g_watch.queue_count == 0) {
+            pthread_mutex_unlock(&g_watch.lock);
+            break;
+        }
+        
+        WatchItem item = g_watch.queue[g_watch.queue_head];
+        g_watch.queue_head = (g_watch.queue_head + 1) % WATCH_QUEUE_SIZE;
+        g_watch.queue_count--;
+        int idle = g_watch.queue_count == 0;
+        pthread_cond_signal(&g_watch.not_full);
+        pthread_mutex_unlock(&g_watch.lock);
+        
+        // The file may have been renamed or removed since it settled
+        DirRef dir = { item.dir_path, open_directory_at(AT_FDCWD, item.dir_path), NULL };
+        struct stat st;
+        if (dir.fd >= 0) {
+            if (fstatat(dir.fd, item.name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode) &&
+                select_file(&dir, item.name) && !watch_already_named(&dir, item.name)) {
+                stats->total_files++;
+                process_file(&dir, item.name, stats);
+            }
+            close(dir.fd);
+        }
+        free(item.dir_path);
+        free(item.name);
+        
+        if (idle) {
+            log_flush_thread();
+        }
+    }
+
+#ifdef HAVE_IO_URING
+    release_thread_io_ring();
+#endif
+    journal_release_thread();
+    log_flush_thread();
+    return NULL;
+}
+
+/**
+ * Processes a directory tree and then keeps watching it: files that are
+ * written or moved into the tree are processed once no event has touched them
+ * for the debounce interval. Between events the process sleeps in ppoll();
+ * the tree is only swept again if inotify reports lost events. Runs until
+ * SIGINT or SIGTERM.
+ * @param dir_path The directory to watch
+ * @param stats Statistics structure to update
+ * @return 0 on a clean shutdown, -1 if the tree could not be watched
+ */
+static int watch_directory(const char *dir_path, Statistics *stats) {
+    memset(&g_watch, 0, sizeof(g_watch));
+    g_watch.pending = (PendingFile*)calloc(WATCH_PENDING_LIMIT, sizeof(PendingFile));
+    g_watch.queue = (WatchItem*)calloc(WATCH_QUEUE_SIZE, sizeof(WatchItem));
+    g_watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_watch.fd < 0 || g_watch.pending == NULL || g_watch.queue == NULL) {
+        fprintf(stderr, "Error: Cannot start watching '%s': %s\n", dir_path,
+                g_watch.fd < 0 ? strerror(errno) : "out of memory");
+        if (g_watch.fd >= 0) {
+            close(g_watch.fd);
+        }
+        free(g_watch.pending);
+        free(g_watch.queue);
+        return -1;
+    }
+    pthread_mutex_init(&g_watch.lock, NULL);
+    pthread_cond_init(&g_watch.not_empty, NULL);
+    pthread_cond_init(&g_watch.not_full, NULL);
+    
+    // Signals stay blocked, in every thread, except while the loop waits in ppoll
+    sigset_t stop_signals;
+    sigset_t wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+    
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = watch_signal_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    
+    // Watch first, then sweep, so nothing that lands in between is missed
+    int result = watch_add_tree(dir_path);
+    if (result == 0) {
+        result = process_directory(dir_path, stats);
+    }
+    
+    int worker_count = g_options.jobs > 0 ? g_options.jobs : 1;
+    pthread_t *threads = (pthread_t*)calloc((size_t)worker_count, sizeof(pthread_t));
+    Statistics *worker_stats = (Statistics*)calloc((size_t)worker_count, sizeof(Statistics));
+    int started = 0;
+    
+    if (result == 0 && threads != NULL && worker_stats != NULL) {
+        for (; started < worker_count; started++) {
+            if (pthread_create(&threads[started], NULL, watch_worker_main, &worker_stats[started]) != 0) {
+                break;
+            }
+        }
+    }
+    if (result == 0 && started == 0) {
+        fprintf(stderr, "Error: Cannot start watch workers\n");
+        result = -1;
+    }
+    
+    if (result == 0) {
+        if (g_log.verbosity > 0) {
+            fprintf(log_owns_stdout() ? stderr : stdout, "Watching '%s' for new files (Ctrl+C to stop)\n", dir_path);
+        }
+        log_flush_thread();
+    }
+    
+    // Event loop: sleep until inotify has something or the next file is due
+    char *events = (char*)malloc(WATCH_EVENT_BUFFER);
+    while (result == 0 && events != NULL && !g_watch_signal) {
+        uint64_t wait_ns = watch_dispatch_due(monotonic_ns());
+        struct timespec timeout = { (time_t)(wait_ns / 1000000000ULL), (long)(wait_ns % 1000000000ULL) };
+        struct pollfd poll_fd = { g_watch.fd, POLLIN, 0 };
+        
+        int ready = ppoll(&poll_fd, 1, wait_ns == UINT64_MAX ? NULL : &timeout, &wait_mask);
+        if (ready < 0 && errno != EINTR) {
+            fprintf(stderr, "Error: Cannot wait for file events: %s\n", strerror(errno));
+            result = -1;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        
+        ssize_t length;
+        while ((length = read(g_watch.fd, events, WATCH_EVENT_BUFFER)) > 0) {
+            watch_handle_events(events, (size_t)length, dir_path, stats);
+        }
+        log_flush_thread();
+    }
+    free(events);
+    
+    // Files still settling are processed before the workers stop
+    while (g_watch.pending_count > 0) {
+        watch_dispatch(0);
+    }
+    pthread_mutex_lock(&g_watch.lock);
+    g_watch.stopping = 1;
+    pthread_cond_broadcast(&g_watch.not_empty);
+    pthread_mutex_unlock(&g_watch.lock);
+    
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        stats->total_files += worker_stats[i].total_files;
+        stats->renamed_files += worker_stats[i].renamed_files;
+        stats->skipped_files += worker_stats[i].skipped_files;
+        stats->error_files += worker_stats[i].error_files;
+        stats->deduplicated_files += worker_stats[i].deduplicated_files;
+    }
+    free(threads);
+    free(worker_stats);
+    
+    for (size_t i = 0; i < g_watch.dir_capacity; i++) {
+        free(g_watch.dirs[i].path);
+    }
+    free(g_watch.dirs);
+    arena_release_cache();
+    free(g_watch.pending);
+    free(g_watch.queue);
+    close(g_watch.fd);
+    pthread_cond_destroy(&g_watch.not_full);
+    pthread_cond_destroy(&g_watch.not_empty);
+    pthread_mutex_destroy(&g_watch.lock);
+    
+    pthread_sigmask(SIG_UNBLOCK, &stop_signals, NULL);
+    return result;
+}
+#endif
+
+#ifndef _WIN32
+// Library API Implementation (renamer.h)
+
+static pthread_once_t g_library_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_library_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Fills a configuration with the utility's defaults
+ * @param config The configuration to initialize
+ */
+void renamer_config_init(RenamerConfig *config) {
+    memset(config, 0, sizeof(*config));
+    config->jobs = 1;
+}
+
+/**
+ * Creates a context from a configuration, compiling its pattern set
+ * @param config The settings
+ * @return The context, or NULL if a setting is invalid or memory is short
+ */
+RenamerContext *renamer_create(const RenamerConfig *config) {
+    if (config == NULL || config->jobs < 0 || config->jobs > MAX_JOBS || config->max_scan_bytes < 0) {
+        fprintf(stderr, "Error: Invalid renamer configuration\n");
+        return NULL;
+    }
+    
+    pthread_once(&g_library_once, select_pattern_scanner);
+    
+    RenamerContext *ctx = (RenamerContext*)calloc(1, sizeof(RenamerContext));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    
+    ctx->options.jobs = config->jobs;
+    if (ctx->options.jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        ctx->options.jobs = (cpus > 0 && cpus <= MAX_JOBS) ? (int)cpus : 1;
+    }
+    ctx->options.max_scan_bytes = config->max_scan_bytes;
+    ctx->options.use_mmap = config->use_mmap;
+    ctx->options.use_io_uring = config->use_io_uring;
+    ctx->options.cache_path = config->cache_path;
+    ctx->options.dedupe = DEDUPE_NONE;
+    ctx->options.watch_debounce_ms = WATCH_DEBOUNCE_MS;
+    ctx->options.readahead = READAHEAD_FILES;
+    ctx->on_event = config->on_event;
+    ctx->user_data = config->user_data;
+    
+    for (size_t i = 0; i < config->pattern_count; i++) {
+        if (pattern_set_add(&ctx->patterns, config->patterns[i]) != 0) {
+            renamer_destroy(ctx);
+            return NULL;
+        }
+    }
+    if ((ctx->patterns.count == 0 && pattern_set_add(&ctx->patterns, DEFAULT_PATTERN_SPEC) != 0) ||
+        pattern_set_compile(&ctx->patterns) != 0) {
+        renamer_destroy(ctx);
+        return NULL;
+    }
+    
+    if (ctx->options.use_mmap) {
+        install_mmap_fault_handler();
+    }
+    
+    return ctx;
+}
+
+/**
+ * Releases a context
+ * @param ctx The context (may be NULL)
+ */
+void renamer_destroy(RenamerContext *ctx) {
+    if (ctx != NULL) {
+        pattern_set_free(&ctx->patterns);
+        free(ctx);
+    }
+}
+
+/**
+ * Finds the first ID in each of a batch of buffers. Only the context is read,
+ * so any number of threads may scan at once.
+ * @param ctx The context
+ * @param buffers The buffers to scan
+ * @param count Number of buffers
+ * @param results Receives one result per buffer
+ * @return Number of buffers in which an ID was found
+ */
+size_t renamer_scan_buffers(RenamerContext *ctx, const RenamerBuffer *buffers, size_t count,
+                            RenamerMatch *results) {
+    size_t found = 0;
+    
+    for (size_t i = 0; i < count; i++) {
+        RenamerMatch *result = &results[i];
+        const char *data = (const char*)buffers[i].data;
+        size_t length = buffers[i].length;
+        size_t match_length = RJ_PATTERN_LENGTH - 1;
+        const char *match = NULL;
+        
+        result->offset = 0;
+        result->id[0] = '\0';
+        if (data == NULL && length > 0) {
+            result->status = -1;
+            result->error = EINVAL;
+            continue;
+        }
+        
+        if (ctx->options.max_scan_bytes != 0 && (long long)length > ctx->options.max_scan_bytes) {
+            length = (size_t)ctx->options.max_scan_bytes;
+        }
+        TextEncoding encoding = detect_text_encoding(data, length);
+        if (encoding != TEXT_NARROW) {
+            match = find_pattern_utf16(&ctx->patterns, data, length, encoding == TEXT_UTF16BE, &match_length);
+        } else if (ctx->patterns.builtin) {
+            match = g_pattern_scanner(data, length);
+        } else {
+            match = find_pattern_dfa(&ctx->patterns, data, length, &match_length);
+        }
+        
+        result->error = 0;
+        if (match == NULL) {
+            result->status = 1;
+            continue;
+        }
+        result->status = 0;
+        result->offset = (size_t)(match - data);
+        copy_encoded_match(match, match_length, encoding, result->id);
+        found++;
+    }
+    
+    return found;
+}
+
+/**
+ * Installs a context's settings over the globals the engine reads. Path calls
+ * run one at a time; the lock is held until library_leave.
+ * @param ctx The context
+ */
+static void library_enter(RenamerContext *ctx) {
+    pthread_mutex_lock(&g_library_lock);
+    g_options = ctx->options;
+    g_patterns = ctx->patterns;
+    g_log.on_event = ctx->on_event;
+    g_log.user_data = ctx->user_data;
+}
+
+/**
+ * Detaches the globals from the context installed by library_enter
+ */
+static void library_leave(void) {
+    g_log.on_event = NULL;
+    g_log.user_data = NULL;
+    memset(&g_patterns, 0, sizeof(g_patterns));
+    pthread_mutex_unlock(&g_library_lock);
+}
+
+/**
+ * Adds the counts of a run to a caller's statistics
+ * @param stats The caller's statistics
+ * @param run The counts of the run
+ */
+static void library_add_stats(RenamerStats *stats, const Statistics *run) {
+    stats->total_files += run->total_files;
+    stats->renamed_files += run->renamed_files;
+    stats->skipped_files += run->skipped_files;
+    stats->error_files += run->error_files;
+    stats->deduplicated_files += run->deduplicated_files;
+}
+
+/**
+ * Opens the directory part of a path, reusing the worker's descriptor when
+ * consecutive paths share a directory
+ * @param worker The worker
+ * @param path The file path
+ * @param name Receives the file name part of the path
+ * @return 0 on success, -1 on error (errno is set)
+ */
+static int library_open_parent(LibraryWorker *worker, const char *path, const char **name) {
+    const char *slash = strrchr(path, '/');
+    const char *dir = slash == NULL ? "." : path;
+    size_t dir_len = slash == NULL ? 1 : (slash == path ? 1 : (size_t)(slash - path));
+    
+    *name = slash == NULL ? path : slash + 1;
+    if (worker->dir_fd >= 0 && strlen(worker->dir_path) == dir_len && memcmp(worker->dir_path, dir, dir_len) == 0) {
+        return 0;
+    }
+    
+    if (dir_len + 1 > worker->dir_capacity) {
+        size_t capacity = worker->dir_capacity ? worker->dir_capacity : 256;
+        while (capacity < dir_len + 1) {
+            capacity *= 2;
+        }
+        char *grown = (char*)realloc(worker->dir_path, capacity);
+        if (grown == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        worker->dir_path = grown;
+        worker->dir_capacity = capacity;
+    }
+    memcpy(worker->dir_path, dir, dir_len);
+    worker->dir_path[dir_len] = '\0';
+    
+    if (worker->dir_fd >= 0) {
+        close(worker->dir_fd);
+    }
+    worker->dir_fd = open_directory_at(AT_FDCWD, worker->dir_path);
+    return worker->dir_fd >= 0 ? 0 : -1;
+}
+
+/**
+ * Thread body of a library path call: claims paths until the batch is done,
+ * scanning or processing each
+ * @param arg The LibraryWorker
+ * @return NULL
+ */
+static void *library_worker_main(void *arg) {
+    LibraryWorker *worker = (LibraryWorker*)arg;
+    LibraryBatch *batch = worker->batch;
+    size_t index;
+    
+    while ((index = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+        const char *path = batch->paths[index];
+        const char *name = NULL;
+        int opened = library_open_parent(worker, path, &name);
+        DirRef dir = { worker->dir_path != NULL ? worker->dir_path : ".", worker->dir_fd, NULL };
+        
+        if (batch->results != NULL) {
+            RenamerMatch *result = &batch->results[index];
+            result->offset = 0;
+            result->status = opened == 0 ? read_file_content(&dir, name, result->id, RENAMER_ID_MAX) : -1;
+            result->error = result->status < 0 ? errno : 0;
+            if (result->status != 0) {
+                result->id[0] = '\0';
+            } else {
+                worker->found++;
+            }
+            continue;
+        }
+        
+        worker->stats.total_files++;
+        if (opened != 0) {
+            fprintf(stderr, "Error: Cannot open directory of '%s': %s\n", path, strerror(errno));
+            log_file_event(&dir, name, LOG_EVENT_ERROR, NULL, NULL, errno);
+            worker->stats.error_files++;
+            continue;
+        }
+        process_file(&dir, name, &worker->stats);
+    }
+    
+    return NULL;
+}
+
+/**
+ * Runs a batch of paths on up to g_options.jobs threads, the calling thread
+ * included. Must run between library_enter and library_leave.
+ * @param paths The paths
+ * @param count Number of paths
+ * @param results Scan results, or NULL to process the files
+ * @param stats Receives the counts of processed files
+ * @return Number of files in which an ID was found (scans)
+ */
+static size_t library_run_batch(const char *const *paths, size_t count, RenamerMatch *results, Statistics *stats) {
+    LibraryBatch batch;
+    LibraryWorker local[1];
+    size_t worker_count = (size_t)g_options.jobs < count ? (size_t)g_options.jobs : count;
+    LibraryWorker *workers = worker_count > 1 ? (LibraryWorker*)calloc(worker_count, sizeof(LibraryWorker)) : NULL;
+    size_t started = 1;
+    size_t found = 0;
+    
+    batch.paths = paths;
+    batch.count = count;
+    batch.results = results;
+    atomic_init(&batch.next, 0);
+    
+    if (workers == NULL) {
+        memset(local, 0, sizeof(local));
+        workers = local;
+        worker_count = 1;
+    }
+    for (size_t i = 0; i < worker_count; i++) {
+        workers[i].batch = &batch;
+        workers[i].dir_fd = -1;
+    }
+    
+    // Helpers that fail to start just leave more paths for the others
+    for (; started < worker_count; started++) {
+        if (pthread_create(&workers[started].thread, NULL, library_worker_main, &workers[started]) != 0) {
+            break;
+        }
+    }
+    library_worker_main(&workers[0]);
+    
+    for (size_t i = 0; i < started; i++) {
+        if (i > 0) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        found += workers[i].found;
+        stats->total_files += workers[i].stats.total_files;
+        stats->renamed_files += workers[i].stats.renamed_files;
+        stats->skipped_files += workers[i].stats.skipped_files;
+        stats->error_files += workers[i].stats.error_files;
+        stats->deduplicated_files += workers[i].stats.deduplicated_files;
+        if (workers[i].dir_fd >= 0) {
+            close(workers[i].dir_fd);
+        }
+        free(workers[i].dir_path);
+    }
+    
+    if (workers != local) {
+        free(workers);
+    }
+    return found;
+}
+
+/**
+ * Finds the first ID in each of a batch of files, without renaming them
+ * @param ctx The context
+ * @param paths The files to scan
+ * @param count Number of files
+ * @param results Receives one result per file
+ * @return Number of files in which an ID was found
+ */
+size_t renamer_scan_paths(RenamerContext *ctx, const char *const *paths, size_t count, RenamerMatch *results) {
+    Statistics run = {0, 0, 0, 0, 0};
+    
+    library_enter(ctx);
+    size_t found = library_run_batch(paths, count, results, &run);
+    library_leave();
+    
+    return found;
+}
+
+/**
+ * Scans and renames a batch of files
+ * @param ctx The context
+ * @param paths The files to process
+ * @param count Number of files
+ * @param stats Counts to add this batch's outcomes to
+ * @return 0 if every file was processed without error, -1 otherwise
+ */
+int renamer_process_paths(RenamerContext *ctx, const char *const *paths, size_t count, RenamerStats *stats) {
+    Statistics run = {0, 0, 0, 0, 0};
+    
+    library_enter(ctx);
+    library_run_batch(paths, count, NULL, &run);
+    library_leave();
+    
+    library_add_stats(stats, &run);
+    return run.error_files == 0 ? 0 : -1;
+}
+
+/**
+ * Processes every .txt file of a directory tree, loading and saving the
+ * context's scan cache around the run as the utility does
+ * @param ctx The context
+ * @param path The directory
+ * @param stats Counts to add this run's outcomes to
+ * @return 0 on success, -1 if the tree (or the cache) could not be processed
+ */
+int renamer_process_directory(RenamerContext *ctx, const char *path, RenamerStats *stats) {
+    Statistics run = {0, 0, 0, 0, 0};
+    
+    library_enter(ctx);
+    if (g_options.cache_path != NULL) {
+        cache_open(g_options.cache_path);
+    }
+    
+    int result = process_directory(path, &run);
+    
+    if (g_options.cache_path != NULL) {
+        if (result == 0 && cache_save(g_options.cache_path) != 0) {
+            result = -1;
+        }
+        cache_close();
+    }
+    library_leave();
+    
+    library_add_stats(stats, &run);
+    return result;
+}
+#endif
+
+// Main Entry Point Implementation
+
+/**
+ * Prints command-line usage information
+ * @param program The program name (argv[0])
+ */
+static void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] <directory_path>\n", program);
+    fprintf(stderr, "       %s --apply FILE [directory_path]\n", program);
+    fprintf(stderr, "       %s --undo FILE [directory_path]\n", program);
+    fprintf(stderr, "       %s --coordinator SOCKET\n", program);
+    fprintf(stderr, "\nDescription:\n");
+    fprintf(stderr, "  Recursively processes .txt files in the specified directory,\n");
+    fprintf(stderr, "  extracting RJ-YYYY-NNNNN patterns from file contents and renaming\n");
+    fprintf(stderr, "  files accordingly.\n");
+    fprintf(stderr, "\nOptions:\n");
+    fprintf(stderr, "  -j, --jobs N              Process with N worker threads (0 = one per CPU, default 1)\n");
+    fprintf(stderr, "  --max-scan-bytes SIZE     Scan at most SIZE bytes of each file (K/M/G suffixes, 0 = all)\n");
+    fprintf(stderr, "  --pattern SPEC            Look for IDs of format SPEC instead of RJ-####-##### (repeatable;\n");
+    fprintf(stderr, "                            '#' = digit, '@' = uppercase letter, '{n}' = repeat, '\\' = literal)\n");
+    fprintf(stderr, "  --pattern-file FILE       Read ID formats from FILE, one per line (';' starts a comment)\n");
+    fprintf(stderr, "  --mmap                    Scan files larger than 64 KB through a read-only memory mapping\n");
+    fprintf(stderr, "  --io-uring                Batch opens, header reads and renames through io_uring (Linux)\n");
+    fprintf(stderr, "  --io-order ORDER          Scan each directory's files in inode order (inode) or in order of\n");
+    fprintf(stderr, "                            their position on disk (extent), reading ahead of the scan\n");
+    fprintf(stderr, "  --readahead N             Files read ahead with --io-order (0 = none, default %d)\n", READAHEAD_FILES);
+    fprintf(stderr, "  --cache FILE              Reuse scan results for unchanged files from FILE and update it\n");
+    fprintf(stderr, "  --trust-names             Skip files named after an ID without opening them\n");
+    fprintf(stderr, "  --include GLOB            Only process files whose name matches GLOB (repeatable)\n");
+    fprintf(stderr, "  --exclude GLOB            Leave out files whose name matches GLOB (repeatable)\n");
+    fprintf(stderr, "  --min-size SIZE           Leave out files smaller than SIZE (K/M/G suffixes)\n");
+    fprintf(stderr, "  --max-size SIZE           Leave out files larger than SIZE (K/M/G suffixes, 0 = no limit)\n");
+    fprintf(stderr, "  --newer-than AGE          Only process files modified in the last AGE (s/m/h/d suffixes)\n");
+    fprintf(stderr, "  --dedupe MODE             Identical copies colliding on a name are hard-linked to the\n");
+    fprintf(stderr, "                            copy (link) or moved to --quarantine-dir (quarantine)\n");
+    fprintf(stderr, "  --quarantine-dir DIR      Where --dedupe=quarantine moves duplicates (same file system)\n");
+    fprintf(stderr, "  --watch                   After processing, keep watching the tree and process new files\n");
+    fprintf(stderr, "                            as they are written (Linux; stop with Ctrl+C)\n");
+    fprintf(stderr, "  --watch-debounce MS       Wait until a file has been quiet for MS milliseconds (default %d)\n",
+            WATCH_DEBOUNCE_MS);
+    fprintf(stderr, "  --plan FILE               Write the renames to FILE instead of performing them\n");
+    fprintf(stderr, "  --apply FILE              Perform the renames planned in FILE (directory optional)\n");
+    fprintf(stderr, "  --journal FILE            Record each rename in FILE, synced to disk before it is issued\n");
+    fprintf(stderr, "  --journal-batch N         Renames per thread committed with one sync (default %d)\n",
+            JOURNAL_BATCH_SIZE);
+    fprintf(stderr, "  --resume                  Continue the interrupted run recorded in --journal\n");
+    fprintf(stderr, "  --undo FILE               Revert the renames recorded in journal FILE (directory optional)\n");
+    fprintf(stderr, "  --shard I/N               Rename only the files of shard I of N (0-based) of the tree\n");
+    fprintf(stderr, "  --shard-by MODE           Shards made of directories (directory, default) or of whole\n");
+    fprintf(stderr, "                            top-level subtrees (subtree)\n");
+    fprintf(stderr, "  --coordinator SOCKET      Hand out directories to --lease workers on Unix socket SOCKET\n");
+    fprintf(stderr, "                            and print their combined summary (no directory argument)\n");
+    fprintf(stderr, "  --lease SOCKET            Process the directories the coordinator on SOCKET hands out\n");
+    fprintf(stderr, "  --background              Run at idle I/O and CPU priority and back off when disk latency\n");
+    fprintf(stderr, "                            rises above --latency-target\n");
+    fprintf(stderr, "  --max-read-rate SIZE      Read at most SIZE bytes per second from files (K, M, G suffixes)\n");
+    fprintf(stderr, "  --max-rename-rate N       Issue at most N renames per second\n");
+    fprintf(stderr, "  --latency-target MS       Per-operation latency to back off above (0 = never; default %d\n",
+            LATENCY_TARGET_MS);
+    fprintf(stderr, "                            with --background)\n");
+    fprintf(stderr, "  -v, --verbose             Print a line for every renamed, planned or skipped file\n");
+    fprintf(stderr, "  --log-format FORMAT       Per-file records as text (default), jsonl or binary\n");
+    fprintf(stderr, "  --log-file FILE           Write per-file records to FILE instead of standard output\n");
+    fprintf(stderr, "  --stats MODE              Summary only (summary, default) or per-phase timings too (verbose)\n");
+    fprintf(stderr, "  --stats-json FILE         Write per-phase timings and counters to FILE as JSON\n");
+    fprintf(stderr, "\nExample:\n");
+    fprintf(stderr, "  %s C:\\test_files\n", program);
+    fprintf(stderr, "  %s --jobs 8 .\\testing\n", program);
+}
+
+/**
+ * Matches argv[*index] against an option that takes a value, accepting both
+ * "--name value" and "--name=value" forms
+ * @param argc Argument count
+ * @param argv Argument values
+ * @param index Index of the current argument; advanced past a separate value
+ * @param long_name The long option name (e.g. "--jobs")
+ * @param short_name The short option name (e.g. "-j"), or NULL
+ * @param value Receives the option value (NULL if the value is missing)
+ * @return 1 if the argument is this option, 0 otherwise
+ */
+static int match_option(int argc, char *argv[], int *index, const char *long_name,
+                        const char *short_name, const char **value) {
+    const char *arg = argv[*index];
+    size_t name_len = strlen(long_name);
+    
+    if (strncmp(arg, long_name, name_len) == 0 && arg[name_len] == '=') {
+        *value = arg + name_len + 1;
+        return 1;
+    }
+    
+    if (strcmp(arg, long_name) != 0 && (short_name == NULL || strcmp(arg, short_name) != 0)) {
+        return 0;
+    }
+    
+    *value = (*index + 1 < argc) ? argv[++(*index)] : NULL;
+    return 1;
+}
+
+/**
+ * Parses a non-negative decimal option value
+ * @param option The option name, for error messages
+ * @param text The value text
+ * @param max Largest accepted value
+ * @param value Receives the parsed value
+ * @return 0 on success, -1 if the value is missing or out of range
+ */
+static int parse_number(const char *option, const char *text, long long max, long long *value) {
+    if (text == NULL || *text == '\0') {
+        fprintf(stderr, "Error: Option %s requires a value\n", option);
+        return -1;
+    }
+    
+    char *end = NULL;
+    errno = 0;
+    long long parsed = strtoll(text, &end, 10);
+    
+    if (errno != 0 || *end != '\0' || parsed < 0 || parsed > max) {
+        fprintf(stderr, "Error: Invalid value '%s' for %s (expected 0..%lld)\n", text, option, max);
+        return -1;
+    }
+    
+    *value = parsed;
+    return 0;
+}
+
+/**
+ * Parses a byte count option value with an optional K, M or G suffix (powers of 1024)
+ * @param option The option name, for error messages
+ * @param text The value text
+ * @param value Receives the parsed byte count
+ * @return 0 on success, -1 if the value is missing or malformed
+ */
+static int parse_size(const char *option, const char *text, long long *value) {
+    if (text == NULL || *text == '\0') {
+        fprintf(stderr, "Error: Option %s requires a value\n", option);
+        return -1;
+    }
+    
+    char *end = NULL;
+    errno = 0;
+    long long parsed = strtoll(text, &end, 10);
+    int shift = 0;
+    
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    
+    if (errno != 0 || end == text || *end != '\0' || parsed < 0 || parsed > (LLONG_MAX >> shift)) {
+        fprintf(stderr, "Error: Invalid size '%s' for %s (expected bytes with optional K, M or G suffix)\n",
+                text, option);
+        return -1;
+    }
+    
+    *value = parsed << shift;
+    return 0;
+}
+
+/**
+ * Parses an age option value: seconds, or a count with an s, m, h or d suffix
+ * @param option The option name, for error messages
+ * @param text The value text
+ * @param seconds Receives the age in seconds
+ * @return 0 on success, -1 if the value is missing or malformed
+ */
+static int parse_age(const char *option, const char *text, long long *seconds) {
+    if (text == NULL || *text == '\0') {
+        fprintf(stderr, "Error: Option %s requires a value\n", option);
+        return -1;
+    }
+    
+    char *end = NULL;
+    errno = 0;
+    long long parsed = strtoll(text, &end, 10);
+    long long unit = 1;
+    
+    switch (*end) {
+        case 's': unit = 1; end++; break;
+        case 'm': unit = 60; end++; break;
+        case 'h': unit = 3600; end++; break;
+        case 'd': unit = 86400; end++; break;
+        default: break;
+    }
+    
+    // Ages beyond a century would overflow the nanosecond cutoff
+    if (errno != 0 || end == text || *end != '\0' || parsed <= 0 || parsed > 3155760000LL / unit) {
+        fprintf(stderr, "Error: Invalid age '%s' for %s (expected a count with optional s, m, h or d suffix)\n",
+                text, option);
+        return -1;
+    }
+    
+    *seconds = parsed * unit;
+    return 0;
+}
+
+/**
+ * Adds a glob to an --include or --exclude list
+ * @param option The option name, for error messages
+ * @param glob The glob
+ * @param globs The list
+ * @param count Number of globs in the list; incremented
+ * @return 0 on success, -1 if the value is missing or the list is full
+ */
+static int add_filter_glob(const char *option, const char *glob, const char **globs, int *count) {
+    if (glob == NULL || *glob == '\0') {
+        fprintf(stderr, "Error: Option %s requires a value\n", option);
+        return -1;
+    }
+    if (*count == MAX_FILTER_GLOBS) {
+        fprintf(stderr, "Error: Too many %s globs (at most %d)\n", option, MAX_FILTER_GLOBS);
+        return -1;
+    }
+    
+    globs[(*count)++] = glob;
+    return 0;
+}
+
+/**
+ * Parses and validates command-line arguments, filling g_options
+ * @param argc Argument count
+ * @param argv Argument values
+ * @param dir_path Receives the directory to process
+ * @return 0 if valid, non-zero error code if invalid
+ */
+static int validate_arguments(int argc, char *argv[], const char **dir_path) {
+    *dir_path = NULL;
+    
+    int readahead_given = 0;
+    int shard_by_given = 0;
+    long long newer_than = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        const char *value = NULL;
+        long long number = 0;
+        
+        if (match_option(argc, argv, &i, "--jobs", "-j", &value)) {
+            if (parse_number("--jobs", value, MAX_JOBS, &number) != 0) {
+                return 1;
+            }
+            g_options.jobs = (int)number;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            g_options.use_mmap = 1;
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            g_options.use_io_uring = 1;
+        } else if (match_option(argc, argv, &i, "--io-order", NULL, &value)) {
+            if (value != NULL && strcmp(value, "inode") == 0) {
+                g_options.io_order = IO_ORDER_INODE;
+            } else if (value != NULL && strcmp(value, "extent") == 0) {
+                g_options.io_order = IO_ORDER_EXTENT;
+            } else {
+                fprintf(stderr, "Error: Invalid value '%s' for --io-order (expected inode or extent)\n",
+                        value ? value : "");
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--readahead", NULL, &value)) {
+            if (parse_number("--readahead", value, 1024, &number) != 0) {
+                return 1;
+            }
+            g_options.readahead = (int)number;
+            readahead_given = 1;
+        } else if (match_option(argc, argv, &i, "--cache", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --cache requires a value\n");
+                return 1;
+            }
+            g_options.cache_path = value;
+        } else if (match_option(argc, argv, &i, "--plan", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --plan requires a value\n");
+                return 1;
+            }
+            g_options.plan_path = value;
+        } else if (match_option(argc, argv, &i, "--apply", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --apply requires a value\n");
+                return 1;
+            }
+            g_options.apply_path = value;
+        } else if (match_option(argc, argv, &i, "--journal", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --journal requires a value\n");
+                return 1;
+            }
+            g_options.journal_path = value;
+        } else if (match_option(argc, argv, &i, "--journal-batch", NULL, &value)) {
+            long long number = 0;
+            if (parse_number("--journal-batch", value, 65536, &number) != 0) {
+                return 1;
+            }
+            if (number == 0) {
+                fprintf(stderr, "Error: Invalid value '%s' for --journal-batch (expected 1..65536)\n", value);
+                return 1;
+            }
+            g_options.journal_batch = (int)number;
+        } else if (strcmp(argv[i], "--background") == 0) {
+            g_options.background = 1;
+        } else if (match_option(argc, argv, &i, "--max-read-rate", NULL, &value)) {
+            if (parse_size("--max-read-rate", value, &g_options.read_rate) != 0) {
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--max-rename-rate", NULL, &value)) {
+            if (parse_number("--max-rename-rate", value, 1000000000LL, &g_options.rename_rate) != 0) {
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--latency-target", NULL, &value)) {
+            long long number = 0;
+            if (parse_number("--latency-target", value, 60000, &number) != 0) {
+                return 1;
+            }
+            g_options.latency_target_ms = (int)number;
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            g_options.resume = 1;
+        } else if (match_option(argc, argv, &i, "--undo", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --undo requires a value\n");
+                return 1;
+            }
+            g_options.undo_path = value;
+        } else if (match_option(argc, argv, &i, "--shard", NULL, &value)) {
+            char *end = NULL;
+            long index = value ? strtol(value, &end, 10) : -1;
+            long count = (end != NULL && end != value && *end == '/') ? strtol(end + 1, &end, 10) : 0;
+            if (value == NULL || *end != '\0' || count < 1 || count > MAX_SHARDS || index < 0 || index >= count) {
+                fprintf(stderr, "Error: Invalid value '%s' for --shard (expected I/N with 0 <= I < N <= %d)\n",
+                        value ? value : "", MAX_SHARDS);
+                return 1;
+            }
+            g_options.shard_index = (int)index;
+            g_options.shard_count = (int)count;
+        } else if (match_option(argc, argv, &i, "--shard-by", NULL, &value)) {
+            if (value != NULL && strcmp(value, "directory") == 0) {
+                g_options.shard_by = SHARD_BY_DIRECTORY;
+            } else if (value != NULL && strcmp(value, "subtree") == 0) {
+                g_options.shard_by = SHARD_BY_SUBTREE;
+            } else {
+                fprintf(stderr, "Error: Invalid value '%s' for --shard-by (expected directory or subtree)\n",
+                        value ? value : "");
+                return 1;
+            }
+            shard_by_given = 1;
+        } else if (match_option(argc, argv, &i, "--coordinator", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --coordinator requires a value\n");
+                return 1;
+            }
+            g_options.coordinator_path = value;
+        } else if (match_option(argc, argv, &i, "--lease", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --lease requires a value\n");
+                return 1;
+            }
+            g_options.lease_path = value;
+        } else if (strcmp(argv[i], "--verbose") == 0 || strcmp(argv[i], "-v") == 0) {
+            g_log.verbosity++;
+        } else if (match_option(argc, argv, &i, "--log-format", NULL, &value)) {
+            if (value != NULL && strcmp(value, "text") == 0) {
+                g_log.format = LOG_FORMAT_TEXT;
+            } else if (value != NULL && strcmp(value, "jsonl") == 0) {
+                g_log.format = LOG_FORMAT_JSONL;
+            } else if (value != NULL && strcmp(value, "binary") == 0) {
+                g_log.format = LOG_FORMAT_BINARY;
+            } else {
+                fprintf(stderr, "Error: Invalid value '%s' for --log-format (expected text, jsonl or binary)\n",
+                        value ? value : "");
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--log-file", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --log-file requires a value\n");
+                return 1;
+            }
+            g_options.log_path = value;
+        } else if (match_option(argc, argv, &i, "--stats", NULL, &value)) {
+            if (value != NULL && strcmp(value, "summary") == 0) {
+                g_options.stats_verbose = 0;
+            } else if (value != NULL && strcmp(value, "verbose") == 0) {
+                g_options.stats_verbose = 1;
+            } else {
+                fprintf(stderr, "Error: Invalid value '%s' for --stats (expected summary or verbose)\n",
+                        value ? value : "");
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--stats-json", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --stats-json requires a value\n");
+                return 1;
+            }
+            g_options.stats_path = value;
+        } else if (match_option(argc, argv, &i, "--pattern", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --pattern requires a value\n");
+                return 1;
+            }
+            if (pattern_set_add(&g_patterns, value) != 0) {
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--pattern-file", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --pattern-file requires a value\n");
+                return 1;
+            }
+            if (pattern_set_load(&g_patterns, value) != 0) {
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--dedupe", NULL, &value)) {
+            if (value != NULL && strcmp(value, "link") == 0) {
+                g_options.dedupe = DEDUPE_LINK;
+            } else if (value != NULL && strcmp(value, "quarantine") == 0) {
+                g_options.dedupe = DEDUPE_QUARANTINE;
+            } else {
+                fprintf(stderr, "Error: Invalid value '%s' for --dedupe (expected link or quarantine)\n",
+                        value ? value : "");
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--quarantine-dir", NULL, &value)) {
+            if (value == NULL || *value == '\0') {
+                fprintf(stderr, "Error: Option --quarantine-dir requires a value\n");
+                return 1;
+            }
+            g_options.quarantine_path = value;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            g_options.watch = 1;
+        } else if (match_option(argc, argv, &i, "--watch-debounce", NULL, &value)) {
+            if (parse_number("--watch-debounce", value, 60000, &number) != 0) {
+                return 1;
+            }
+            g_options.watch_debounce_ms = (int)number;
+        } else if (strcmp(argv[i], "--trust-names") == 0) {
+            g_options.trust_names = 1;
+        } else if (match_option(argc, argv, &i, "--include", NULL, &value)) {
+            if (add_filter_glob("--include", value, g_options.include_globs, &g_options.include_count) != 0) {
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--exclude", NULL, &value)) {
+            if (add_filter_glob("--exclude", value, g_options.exclude_globs, &g_options.exclude_count) != 0) {
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--min-size", NULL, &value)) {
+            if (parse_size("--min-size", value, &g_options.min_size) != 0) {
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--max-size", NULL, &value)) {
+            if (parse_size("--max-size", value, &g_options.max_size) != 0) {
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--newer-than", NULL, &value)) {
+            if (parse_age("--newer-than", value, &newer_than) != 0) {
+                return 1;
+            }
+        } else if (match_option(argc, argv, &i, "--max-scan-bytes", NULL, &value)) {
+            if (parse_size("--max-scan-bytes", value, &g_options.max_scan_bytes) != 0) {
+                return 1;
+            }
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else if (*dir_path == NULL) {
+            *dir_path = argv[i];
+        } else {
+            fprintf(stderr, "Error: Invalid number of arguments\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (g_options.plan_path != NULL && g_options.apply_path != NULL) {
+        fprintf(stderr, "Error: --plan and --apply cannot be combined\n");
+        return 1;
+    }
+    
+    // A plan records renames only; duplicates are decided when files are renamed
+    if (g_options.dedupe != DEDUPE_NONE && (g_options.plan_path != NULL || g_options.apply_path != NULL)) {
+        fprintf(stderr, "Error: --dedupe cannot be combined with --plan or --apply\n");
+        return 1;
+    }
+    if (g_options.dedupe == DEDUPE_QUARANTINE && g_options.quarantine_path == NULL) {
+        fprintf(stderr, "Error: --dedupe=quarantine requires --quarantine-dir\n");
+        return 1;
+    }
+    if (g_options.dedupe != DEDUPE_QUARANTINE && g_options.quarantine_path != NULL) {
+        fprintf(stderr, "Warning: --quarantine-dir has no effect without --dedupe=quarantine\n");
+        g_options.quarantine_path = NULL;
+    }
+    
+    // A watch never finishes, so there would be no point at which to save a plan
+    if (g_options.watch && (g_options.plan_path != NULL || g_options.apply_path != NULL)) {
+        fprintf(stderr, "Error: --watch cannot be combined with --plan or --apply\n");
+        return 1;
+    }
+#ifndef HAVE_INOTIFY
+    if (g_options.watch) {
+        fprintf(stderr, "Error: --watch needs inotify and is only supported on Linux\n");
+        return 1;
+    }
+#endif
+
+    // Only renames made in place are journaled; an undo replays a journal instead of scanning
+    if (g_options.resume && g_options.journal_path == NULL) {
+        fprintf(stderr, "Error: --resume requires --journal\n");
+        return 1;
+    }
+    if (g_options.journal_path != NULL && (g_options.plan_path != NULL || g_options.apply_path != NULL ||
+                                           g_options.dedupe != DEDUPE_NONE || g_options.undo_path != NULL)) {
+        fprintf(stderr, "Error: --journal cannot be combined with --plan, --apply, --dedupe or --undo\n");
+        return 1;
+    }
+    if (g_options.undo_path != NULL && (g_options.plan_path != NULL || g_options.apply_path != NULL ||
+                                        g_options.dedupe != DEDUPE_NONE || g_options.watch)) {
+        fprintf(stderr, "Error: --undo cannot be combined with --plan, --apply, --dedupe or --watch\n");
+        return 1;
+    }
+    
+    // A shard, a leased worker and the coordinator each take part in one scan-and-rename run
+    int split_modes = (g_options.shard_count > 0) + (g_options.lease_path != NULL) +
+                      (g_options.coordinator_path != NULL);
+    if (split_modes > 1) {
+        fprintf(stderr, "Error: --shard, --lease and --coordinator cannot be combined\n");
+        return 1;
+    }
+    if (split_modes > 0 && (g_options.apply_path != NULL || g_options.undo_path != NULL || g_options.watch)) {
+        fprintf(stderr, "Error: --shard, --lease and --coordinator cannot be combined with --apply, --undo "
+                "or --watch\n");
+        return 1;
+    }
+    if ((g_options.lease_path != NULL || g_options.coordinator_path != NULL) &&
+        (g_options.plan_path != NULL || g_options.journal_path != NULL)) {
+        fprintf(stderr, "Error: --lease and --coordinator cannot be combined with --plan or --journal\n");
+        return 1;
+    }
+    if (g_options.coordinator_path != NULL && g_options.dedupe != DEDUPE_NONE) {
+        fprintf(stderr, "Error: --dedupe belongs on the --lease workers, not the coordinator\n");
+        return 1;
+    }
+    if (shard_by_given && g_options.shard_count == 0) {
+        fprintf(stderr, "Warning: --shard-by has no effect without --shard\n");
+    }
+    
+    // --background backs off at the default latency target unless told otherwise
+    if (g_options.latency_target_ms < 0) {
+        g_options.latency_target_ms = g_options.background ? LATENCY_TARGET_MS : 0;
+    }
+    
+    // Without --pattern or --pattern-file, look for the built-in RJ format only
+    if (g_patterns.count == 0 && pattern_set_add(&g_patterns, DEFAULT_PATTERN_SPEC) != 0) {
+        return 1;
+    }
+    if (pattern_set_compile(&g_patterns) != 0) {
+        return 1;
+    }
+    
+    // Binary records on a terminal are of no use to anyone
+    if (g_log.format == LOG_FORMAT_BINARY && g_options.log_path == NULL) {
+        fprintf(stderr, "Error: --log-format=binary requires --log-file\n");
+        return 1;
+    }
+    
+    // The coordinator never touches the tree; the workers name it on their own hosts
+    if (g_options.coordinator_path != NULL && *dir_path != NULL) {
+        fprintf(stderr, "Error: --coordinator does not take a directory; give it to the --lease workers\n");
+        return 1;
+    }
+    
+    // Exactly one directory path is required (--apply and --undo default to the recorded one)
+    if (*dir_path == NULL && g_options.apply_path == NULL && g_options.undo_path == NULL &&
+        g_options.coordinator_path == NULL) {
+        fprintf(stderr, "Error: Invalid number of arguments\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+#ifdef _WIN32
+    if (g_options.jobs != 1) {
+        fprintf(stderr, "Warning: --jobs is not supported on Windows; processing single-threaded\n");
+        g_options.jobs = 1;
+    }
+    if (g_options.use_mmap) {
+        fprintf(stderr, "Warning: --mmap is not supported on Windows; reading files in chunks\n");
+        g_options.use_mmap = 0;
+    }
+    if (g_options.cache_path != NULL) {
+        fprintf(stderr, "Warning: --cache is not supported on Windows; scanning all files\n");
+        g_options.cache_path = NULL;
+    }
+    // Falling back to renaming would defeat the point of a dry run
+    if (g_options.plan_path != NULL || g_options.apply_path != NULL) {
+        fprintf(stderr, "Error: --plan and --apply are not supported on Windows\n");
+        return 1;
+    }
+    if (g_options.dedupe != DEDUPE_NONE) {
+        fprintf(stderr, "Error: --dedupe is not supported on Windows\n");
+        return 1;
+    }
+    if (g_options.journal_path != NULL || g_options.undo_path != NULL) {
+        fprintf(stderr, "Error: --journal and --undo are not supported on Windows\n");
+        return 1;
+    }
+    if (g_options.shard_count > 0 || g_options.lease_path != NULL || g_options.coordinator_path != NULL) {
+        fprintf(stderr, "Error: --shard, --lease and --coordinator are not supported on Windows\n");
+        return 1;
+    }
+    if (g_options.background || g_options.read_rate != 0 || g_options.rename_rate != 0 ||
+        g_options.latency_target_ms > 0) {
+        fprintf(stderr, "Warning: --background and rate limits are not supported on Windows; running unthrottled\n");
+        g_options.background = 0;
+        g_options.read_rate = 0;
+        g_options.rename_rate = 0;
+        g_options.latency_target_ms = 0;
+    }
+    if (g_options.io_order != IO_ORDER_NONE) {
+        fprintf(stderr, "Warning: --io-order is not supported on Windows; scanning in directory order\n");
+        g_options.io_order = IO_ORDER_NONE;
+    }
+    if (g_options.trust_names || g_options.include_count > 0 || g_options.exclude_count > 0 ||
+        g_options.min_size != 0 || g_options.max_size != 0 || newer_than != 0) {
+        fprintf(stderr, "Warning: --trust-names and file filters are not supported on Windows; "
+                "processing all .txt files\n");
+        g_options.trust_names = 0;
+        g_options.include_count = 0;
+        g_options.exclude_count = 0;
+        g_options.min_size = 0;
+        g_options.max_size = 0;
+        newer_than = 0;
+    }
+#endif
+#ifndef RENAME_FILES_INSTRUMENT
+    if (g_options.stats_verbose || g_options.stats_path != NULL) {
+        fprintf(stderr, "Warning: Phase timings need an instrumented build (make instrument); "
+                "printing the summary only\n");
+        g_options.stats_verbose = 0;
+        g_options.stats_path = NULL;
+    }
+#endif
+#ifndef HAVE_IO_URING
+    if (g_options.use_io_uring) {
+        fprintf(stderr, "Warning: --io-uring is not supported by this build; using synchronous I/O\n");
+        g_options.use_io_uring = 0;
+    }
+#endif
+    if (g_options.apply_path != NULL && g_options.cache_path != NULL) {
+        fprintf(stderr, "Warning: --cache has no effect with --apply; the cache is left unchanged\n");
+        g_options.cache_path = NULL;
+    }
+    if (g_options.undo_path != NULL && g_options.cache_path != NULL) {
+        fprintf(stderr, "Warning: --cache has no effect with --undo; the cache is left unchanged\n");
+        g_options.cache_path = NULL;
+    }
+    if (g_options.coordinator_path != NULL && g_options.cache_path != NULL) {
+        fprintf(stderr, "Warning: --cache has no effect on the coordinator; give it to the --lease workers\n");
+        g_options.cache_path = NULL;
+    }
+    if (g_options.max_size != 0 && g_options.max_size < g_options.min_size) {
+        fprintf(stderr, "Error: --max-size is smaller than --min-size\n");
+        return 1;
+    }
+#ifndef _WIN32
+    if (newer_than != 0) {
+        g_options.modified_after_ns = current_time_ns() - newer_than * 1000000000LL;
+    }
+#endif
+    if (readahead_given && g_options.io_order == IO_ORDER_NONE) {
+        fprintf(stderr, "Warning: --readahead has no effect without --io-order\n");
+    }
+    // io_uring batches keep their own submission order; they still see files in inode order
+    if (g_options.io_order != IO_ORDER_NONE && g_options.use_io_uring) {
+        fprintf(stderr, "Warning: --io-uring batches are scanned in inode order, without --io-order readahead\n");
+    }
+#ifndef _WIN32
+    if (g_options.jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        g_options.jobs = (cpus > 0 && cpus <= MAX_JOBS) ? (int)cpus : 1;
+    }
+#endif
+
+    const char *path = *dir_path;
+    if (path == NULL) {
+        return 0;  // --apply or --undo without a directory (the recorded root is used), or --coordinator
+    }
+
+#ifdef _WIN32
+    // Validate that the provided path exists
+    DWORD attributes = GetFileAttributesA(path);
+    
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        fprintf(stderr, "Error: Directory '%s' does not exist or cannot be accessed: %s\n",
+                path, strerror(errno));
+        return 2;
+    }
+    
+    // Validate that it's a directory, not a file
+    if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        fprintf(stderr, "Error: '%s' is not a directory\n", path);
+        return 2;
+    }
+#else
+    // Validate that the provided path exists
+    struct stat st;
+    
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Error: Directory '%s' does not exist or cannot be accessed: %s\n",
+                path, strerror(errno));
+        return 2;
+    }
+    
+    // Validate that it's a directory, not a file
+    if (!S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: '%s' is not a directory\n", path);
+        return 2;
+    }
+#endif
+
+    return 0;
+}
+
+// The benchmark harness (bench/bench.c) includes this file with main() left out
+#ifndef RENAME_FILES_NO_MAIN
+/**
+ * Main entry point for the File Renaming Utility
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return 0 on success, non-zero on error
+ */
+int main(int argc, char *argv[]) {
+    select_pattern_scanner();
+    
+    // Validate command-line arguments
+    const char *target_directory = NULL;
+    int validation_result = validate_arguments(argc, argv, &target_directory);
+    if (validation_result != 0) {
+        return validation_result;
+    }
+    
+    if (log_open(g_options.log_path) != 0) {
+        return 1;
+    }
+    
+    // Human-readable output makes way for structured records on standard output
+    FILE *out = log_owns_stdout() ? stderr : stdout;
+
+#ifndef _WIN32
+    if (g_options.use_mmap) {
+        install_mmap_fault_handler();
+    }
+    if (g_options.cache_path != NULL) {
+        cache_open(g_options.cache_path);
+    }
+    if (g_options.dedupe != DEDUPE_NONE && dedupe_open(g_options.quarantine_path, target_directory) != 0) {
+        log_close();
+        return 2;
+    }
+    if (g_options.journal_path != NULL &&
+        journal_open(g_options.journal_path, target_directory, g_options.resume) != 0) {
+        log_close();
+        return 2;
+    }
+    throttle_open(g_options.background, g_options.read_rate, g_options.rename_rate, g_options.latency_target_ms);
+#endif
+
+    // Initialize statistics structure
+    Statistics stats = {0, 0, 0, 0, 0};
+    
+    // Display starting message
+    if (g_log.verbosity > 0) {
+        fprintf(out, "File Renaming Utility\n");
+        fprintf(out, "=====================\n");
+    }
+    
+    int process_result = 0;
+    int cache_result = 0;
+    int plan_result = 0;
+    int journal_result = 0;
+    int journal_commits = 0;
+    int leases = 0;
+
+#ifndef _WIN32
+    if (g_options.apply_path != NULL) {
+        if (g_log.verbosity > 0) {
+            fprintf(out, "Applying plan: %s\n\n", g_options.apply_path);
+        }
+        process_result = apply_plan(g_options.apply_path, target_directory, &stats);
+    } else if (g_options.undo_path != NULL) {
+        if (g_log.verbosity > 0) {
+            fprintf(out, "Undoing journal: %s\n\n", g_options.undo_path);
+        }
+        process_result = undo_journal(g_options.undo_path, target_directory, &stats);
+    } else if (g_options.coordinator_path != NULL) {
+        if (g_log.verbosity > 0) {
+            fprintf(out, "Coordinating workers on: %s\n\n", g_options.coordinator_path);
+        }
+        process_result = coordinate_leases(g_options.coordinator_path, &stats, &leases);
+    } else {
+        if (g_log.verbosity > 0) {
+            fprintf(out, "Processing directory: %s\n\n", target_directory);
+        }
+        if (g_options.plan_path != NULL) {
+            plan_open(target_directory);
+        }
+        
+        // Process the directory recursively (or as leased), then keep watching it if asked to
+        if (g_options.lease_path != NULL) {
+            process_result = lease_worker(g_options.lease_path, target_directory, &stats);
+#ifdef HAVE_INOTIFY
+        } else if (g_options.watch) {
+            process_result = watch_directory(target_directory, &stats);
+#endif
+        } else {
+            process_result = process_directory(target_directory, &stats);
+        }
+        
+        // Keep the old cache and plan if the tree could not be walked at all
+        if (g_options.cache_path != NULL) {
+            if (process_result == 0) {
+                cache_result = cache_save(g_options.cache_path);
+            }
+            cache_close();
+        }
+        if (g_options.plan_path != NULL) {
+            if (process_result == 0) {
+                plan_result = plan_save(g_options.plan_path);
+            }
+            plan_close();
+        }
+        if (g_options.dedupe != DEDUPE_NONE) {
+            dedupe_close();
+        }
+        if (g_options.journal_path != NULL) {
+            journal_commits = atomic_load(&g_journal.commits);
+            journal_result = journal_close();
+        }
+    }
+#else
+    if (g_log.verbosity > 0) {
+        fprintf(out, "Processing directory: %s\n\n", target_directory);
+    }
     
     // Process the directory recursively
-    int process_result = process_directory(target_directory, &stats);
+    process_result = process_directory(target_directory, &stats);
+#endif
+
+    // Per-file records are complete once every worker has finished
+    log_close();
+    pattern_set_free(&g_patterns);
     
     // Print final summary
-    printf("\n");
-    printf("Processing Complete\n");
-    printf("===================\n");
-    printf("Total .txt files found: %d\n", stats.total_files);
-    printf("Files renamed:          %d\n", stats.renamed_files);
-    printf("Files skipped:          %d\n", stats.skipped_files);
-    printf("Errors encountered:     %d\n", stats.error_files);
-    
+    if (g_log.verbosity > 0) {
+        fprintf(out, "\n");
+    }
+    fprintf(out, "Processing Complete\n");
+    fprintf(out, "===================\n");
+    fprintf(out, "Total .txt files found: %d\n", stats.total_files);
+    if (g_options.plan_path != NULL) {
+        fprintf(out, "Files to rename:        %d\n", stats.renamed_files);
+    } else if (g_options.undo_path != NULL) {
+        fprintf(out, "Renames undone:         %d\n", stats.renamed_files);
+    } else {
+        fprintf(out, "Files renamed:          %d\n", stats.renamed_files);
+    }
+    if (g_options.dedupe == DEDUPE_LINK) {
+        fprintf(out, "Duplicates linked:      %d\n", stats.deduplicated_files);
+    } else if (g_options.dedupe == DEDUPE_QUARANTINE) {
+        fprintf(out, "Duplicates quarantined: %d\n", stats.deduplicated_files);
+    }
+    fprintf(out, "Files skipped:          %d\n", stats.skipped_files);
+    fprintf(out, "Errors encountered:     %d\n", stats.error_files);
+    if (g_options.journal_path != NULL) {
+        fprintf(out, "Journal commits:        %d\n", journal_commits);
+    }
+    if (g_options.coordinator_path != NULL) {
+        fprintf(out, "Directories leased:     %d\n", leases);
+    }
+#ifndef _WIN32
+    if (g_throttle.enabled) {
+        fprintf(out, "Time throttled:         %.1f s (across all workers)\n",
+                (double)atomic_load(&g_throttle.waited_ns) / 1e9);
+    }
+    throttle_close();
+    fprintf(out, "Peak memory:            %.1f MB (directory arenas %.1f MB)\n",
+            (double)peak_resident_bytes() / 1048576.0, (double)atomic_load(&g_arena_usage.peak) / 1048576.0);
+#endif
+
+    int stats_result = 0;
+#ifdef RENAME_FILES_INSTRUMENT
+    if (g_options.stats_verbose) {
+        instrument_report(out);
+    }
+    if (g_options.stats_path != NULL) {
+        stats_result = instrument_save(g_options.stats_path);
+    }
+    instrument_close();
+#endif
+
     // Return appropriate exit code
     if (process_result != 0) {
         fprintf(stderr, "\nWarning: Directory processing encountered errors\n");
@@ -613,5 +10677,26 @@ int main(int argc, char *argv[]) {
         return 3;
     }
     
+    if (cache_result != 0) {
+        fprintf(stderr, "\nWarning: Scan cache could not be saved\n");
+        return 3;
+    }
+    
+    if (plan_result != 0) {
+        fprintf(stderr, "\nWarning: Rename plan could not be saved\n");
+        return 3;
+    }
+    
+    if (journal_result != 0) {
+        fprintf(stderr, "\nWarning: Rename journal could not be written\n");
+        return 3;
+    }
+    
+    if (stats_result != 0) {
+        fprintf(stderr, "\nWarning: Statistics could not be saved\n");
+        return 3;
+    }
+    
     return 0;
 }
+#endif
@@ -0,0 +1,164 @@
+/*
+ * librenamer - the scanning and renaming engine of the File Renaming Utility
+ *
+ * Built from rename_files.c without its command-line front end (make lib
+ * produces librenamer.a and librenamer.so). A context holds the settings the
+ * utility takes from its command line; per-file outcomes are delivered to a
+ * callback instead of being printed.
+ *
+ * Buffer scans are reentrant and may run on any number of threads at once.
+ * Path scans and renames share process-wide state (the worker engine, the
+ * scan cache), so the library runs one of those calls at a time and other
+ * callers wait; each call can still use several worker threads of its own.
+ * Diagnostics are written to standard error as by the utility, and every
+ * failed file is also reported as a RENAMER_EVENT_ERROR.
+ */
+
+#ifndef RENAMER_H
+#define RENAMER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) && !defined(_WIN32)
+#define RENAMER_API __attribute__((visibility("default")))
+#else
+#define RENAMER_API
+#endif
+
+#define RENAMER_ID_MAX 32  // Room for the longest ID any pattern format can describe, plus the terminator
+
+// Opaque settings and state of one user of the library
+typedef struct RenamerContext RenamerContext;
+
+// What happened to a file (the "event" field of --log-format=jsonl, in the same order)
+typedef enum {
+    RENAMER_EVENT_RENAMED,
+    RENAMER_EVENT_PLANNED,
+    RENAMER_EVENT_SKIPPED,
+    RENAMER_EVENT_ERROR,
+    RENAMER_EVENT_DEDUPLICATED
+} RenamerEventType;
+
+// One per-file outcome. The strings are only valid during the callback.
+typedef struct {
+    RenamerEventType type;
+    const char *directory;   // Directory of the file, as given to the library
+    const char *name;        // File name within the directory
+    const char *id;          // ID found in the file, or NULL
+    const char *detail;      // New name (renamed), skip reason (skipped), or NULL
+    int error;               // errno of a failure, 0 otherwise
+} RenamerEvent;
+
+// Receives per-file outcomes; called from the library's worker threads, possibly concurrently
+typedef void (*RenamerEventCallback)(const RenamerEvent *event, void *user_data);
+
+// Settings of a context; start from renamer_config_init()
+typedef struct {
+    int jobs;                      // Worker threads for path calls (0 = one per CPU, default 1)
+    long long max_scan_bytes;      // Bytes scanned per file or buffer (0 = all, the default)
+    int use_mmap;                  // Scan large files through a memory mapping (installs a SIGBUS handler)
+    int use_io_uring;              // Batch directory runs through io_uring where available
+    const char *const *patterns;   // ID formats as for --pattern (NULL = RJ-####-#####)
+    size_t pattern_count;
+    const char *cache_path;        // Scan cache used and updated by directory runs (NULL = none)
+    RenamerEventCallback on_event; // Per-file outcomes of path calls (NULL = discard)
+    void *user_data;               // Passed to on_event
+} RenamerConfig;
+
+// Result of scanning one buffer or file
+typedef struct {
+    int status;                    // 0 = ID found, 1 = no ID, -1 = error
+    int error;                     // errno when status is -1
+    size_t offset;                 // Byte offset of the ID within a buffer (buffer scans only)
+    char id[RENAMER_ID_MAX];       // The ID found, NUL-terminated (empty unless status is 0)
+} RenamerMatch;
+
+// A caller-owned buffer to scan; it need not be NUL-terminated
+typedef struct {
+    const void *data;
+    size_t length;
+} RenamerBuffer;
+
+// Counts of a rename call, added to by each call
+typedef struct {
+    int total_files;
+    int renamed_files;
+    int skipped_files;
+    int error_files;
+    int deduplicated_files;
+} RenamerStats;
+
+/**
+ * Fills a configuration with the utility's defaults
+ * @param config The configuration to initialize
+ */
+RENAMER_API void renamer_config_init(RenamerConfig *config);
+
+/**
+ * Creates a context. The configuration is copied, except for the strings it
+ * points to, which must outlive the context.
+ * @param config The settings
+ * @return The context, or NULL if a pattern is invalid or memory is short
+ */
+RENAMER_API RenamerContext *renamer_create(const RenamerConfig *config);
+
+/**
+ * Releases a context
+ * @param ctx The context (may be NULL)
+ */
+RENAMER_API void renamer_destroy(RenamerContext *ctx);
+
+/**
+ * Finds the first ID in each of a batch of buffers. Allocates nothing and
+ * runs on the calling thread.
+ * @param ctx The context
+ * @param buffers The buffers to scan
+ * @param count Number of buffers
+ * @param results Receives one result per buffer
+ * @return Number of buffers in which an ID was found
+ */
+RENAMER_API size_t renamer_scan_buffers(RenamerContext *ctx, const RenamerBuffer *buffers, size_t count,
+                                        RenamerMatch *results);
+
+/**
+ * Finds the first ID in each of a batch of files, without renaming them
+ * @param ctx The context
+ * @param paths The files to scan
+ * @param count Number of files
+ * @param results Receives one result per file
+ * @return Number of files in which an ID was found
+ */
+RENAMER_API size_t renamer_scan_paths(RenamerContext *ctx, const char *const *paths, size_t count,
+                                      RenamerMatch *results);
+
+/**
+ * Scans a batch of files and renames each after the ID it contains, exactly
+ * as the utility would. Outcomes go to the context's callback.
+ * @param ctx The context
+ * @param paths The files to process
+ * @param count Number of files
+ * @param stats Counts to add this batch's outcomes to
+ * @return 0 if every file was processed without error, -1 otherwise
+ */
+RENAMER_API int renamer_process_paths(RenamerContext *ctx, const char *const *paths, size_t count,
+                                      RenamerStats *stats);
+
+/**
+ * Processes every .txt file of a directory tree, exactly as the utility
+ * would. Outcomes go to the context's callback.
+ * @param ctx The context
+ * @param path The directory
+ * @param stats Counts to add this run's outcomes to
+ * @return 0 on success, -1 if the tree (or the cache) could not be processed
+ */
+RENAMER_API int renamer_process_directory(RenamerContext *ctx, const char *path, RenamerStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif